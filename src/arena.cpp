@@ -0,0 +1,184 @@
+#include "arena.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <mutex>
+
+void LinearArena_t::AddBlock(size_t size)
+{
+	// Not value-initialized, nothing reads arena memory before writing it
+	Blocks.push_back({ .Data = std::unique_ptr<std::byte[]>(new std::byte[size]), .Size = size });
+	BlockAllocationCount++;
+}
+
+void* LinearArena_t::Allocate(size_t size, size_t alignment)
+{
+	assert(alignment != 0 && (alignment & (alignment - 1)) == 0);
+
+	for (;;)
+	{
+		if (CurrentBlock < Blocks.size())
+		{
+			Block_t& block = Blocks[CurrentBlock];
+
+			uintptr_t base = (uintptr_t)block.Data.get();
+			size_t alignedOffset = ((base + Offset + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base;
+
+			if (alignedOffset + size <= block.Size)
+			{
+				Used += alignedOffset + size - Offset;
+				PeakUsed = std::max(PeakUsed, Used);
+				Offset = alignedOffset + size;
+
+				return block.Data.get() + alignedOffset;
+			}
+
+			// The rest of the block stays unused until the next reset
+			CurrentBlock++;
+			Offset = 0;
+			continue;
+		}
+
+		// Grow geometrically, so a round that outgrows the arena only takes a few more blocks
+		size_t blockSize = std::max(MinBlockSize, size + alignment);
+
+		if (!Blocks.empty())
+			blockSize = std::max(blockSize, Blocks.back().Size * 2);
+
+		AddBlock(blockSize);
+	}
+}
+
+void LinearArena_t::Rewind(const Marker_t& marker)
+{
+	assert(marker.Block < CurrentBlock || (marker.Block == CurrentBlock && marker.Offset <= Offset));
+
+	CurrentBlock = marker.Block;
+	Offset = marker.Offset;
+	Used = marker.Used;
+}
+
+void LinearArena_t::Reset()
+{
+	//
+	// Resize to what the round needed: every block it spilled into merged into one,
+	// or less if most of it went unused
+	//
+	size_t capacity = GetCapacity();
+	size_t targetSize = Blocks.size() > 1 ? capacity : 0;
+
+	if (capacity > ShrinkRatio * std::max(PeakUsed, MinBlockSize))
+		targetSize = std::max(PeakUsed * 2, MinBlockSize);
+
+	if (targetSize != 0)
+	{
+		Blocks.clear();
+		AddBlock(targetSize);
+	}
+
+	CurrentBlock = 0;
+	Offset = 0;
+	Used = 0;
+	PeakUsed = 0;
+}
+
+size_t LinearArena_t::GetCapacity()
+{
+	size_t capacity = 0;
+
+	for (const Block_t& block : Blocks)
+		capacity += block.Size;
+
+	return capacity;
+}
+
+void LinearArena_t::Destroy()
+{
+	Blocks.clear();
+
+	CurrentBlock = 0;
+	Offset = 0;
+	Used = 0;
+	PeakUsed = 0;
+}
+
+/*
+ * Arenas of every thread that asked for one
+ */
+struct FrameArenas_t
+{
+	// Workers register their arena the first time they use it, possibly during a reset
+	std::mutex Mutex											= {};
+
+	// Owned here rather than by the threads, so they stay valid for the reset
+	std::vector<std::unique_ptr<LinearArena_t>> Arenas			= {};
+};
+
+static FrameArenas_t FrameArenas;
+
+static thread_local LinearArena_t* ThreadArena					= nullptr;
+
+LinearArena_t& FrameArena::Get()
+{
+	if (!ThreadArena)
+	{
+		std::lock_guard<std::mutex> lock(FrameArenas.Mutex);
+
+		FrameArenas.Arenas.push_back(std::make_unique<LinearArena_t>());
+		ThreadArena = FrameArenas.Arenas.back().get();
+	}
+
+	return *ThreadArena;
+}
+
+void FrameArena::Reset()
+{
+	std::lock_guard<std::mutex> lock(FrameArenas.Mutex);
+
+	for (auto& arena : FrameArenas.Arenas)
+		arena->Reset();
+}
+
+size_t FrameArena::GetUsed()
+{
+	std::lock_guard<std::mutex> lock(FrameArenas.Mutex);
+
+	size_t used = 0;
+
+	for (auto& arena : FrameArenas.Arenas)
+		used += arena->GetUsed();
+
+	return used;
+}
+
+size_t FrameArena::GetCapacity()
+{
+	std::lock_guard<std::mutex> lock(FrameArenas.Mutex);
+
+	size_t capacity = 0;
+
+	for (auto& arena : FrameArenas.Arenas)
+		capacity += arena->GetCapacity();
+
+	return capacity;
+}
+
+uint64_t FrameArena::GetBlockAllocationCount()
+{
+	std::lock_guard<std::mutex> lock(FrameArenas.Mutex);
+
+	uint64_t count = 0;
+
+	for (auto& arena : FrameArenas.Arenas)
+		count += arena->GetBlockAllocationCount();
+
+	return count;
+}
+
+void FrameArena::Shutdown()
+{
+	std::lock_guard<std::mutex> lock(FrameArenas.Mutex);
+
+	for (auto& arena : FrameArenas.Arenas)
+		arena->Destroy();
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+/*
+ * Bump allocator for data that only has to live until the next reset.
+ *
+ * Allocating moves an offset forward within the current block, and nothing is freed on its own.
+ * Reset drops everything at once but keeps the memory. If the last round spilled over into more
+ * blocks, they get merged into one that covers all of it. Once a workload has run for a round or
+ * two, the arena fits it in a single block and stops going to the heap. A block that ends up much
+ * bigger than what a round uses (a loading spike) gets shrunk again.
+ */
+struct LinearArena_t
+{
+public:
+	static constexpr size_t MinBlockSize						= 64 * 1024;
+
+	// Reset shrinks the block once it's this many times what the last round used
+	static constexpr size_t ShrinkRatio							= 4;
+
+	/*
+	 * Position in the arena, for giving back everything allocated after it
+	 */
+	struct Marker_t
+	{
+		size_t Block											= 0;
+		size_t Offset											= 0;
+		size_t Used												= 0;
+	};
+
+private:
+	struct Block_t
+	{
+		std::unique_ptr<std::byte[]> Data						= {};
+		size_t Size												= 0;
+	};
+
+	std::vector<Block_t> Blocks									= {};
+
+	// Allocations go into Blocks[CurrentBlock] at Offset
+	size_t CurrentBlock											= 0;
+	size_t Offset												= 0;
+
+	// Bytes handed out since the last reset, alignment padding included, and the most there was at once
+	size_t Used													= 0;
+	size_t PeakUsed												= 0;
+
+	// Blocks taken from the heap over the arena's lifetime
+	uint64_t BlockAllocationCount								= 0;
+
+	void AddBlock(size_t size);
+
+public:
+	// Never null; alignment has to be a power of two
+	void* Allocate(size_t size, size_t alignment);
+
+	template <typename T>
+	T* Allocate(size_t count)
+	{
+		return (T*)Allocate(count * sizeof(T), alignof(T));
+	}
+
+	Marker_t GetMarker()										{ return { .Block = CurrentBlock, .Offset = Offset, .Used = Used }; }
+
+	// Give back everything allocated since the marker was taken
+	void Rewind(const Marker_t& marker);
+
+	// Everything allocated so far becomes invalid
+	void Reset();
+
+	size_t GetUsed()											{ return Used; }
+	size_t GetCapacity();
+	uint64_t GetBlockAllocationCount()							{ return BlockAllocationCount; }
+
+	void Destroy();
+};
+
+/*
+ * Rewinds an arena to where it was when the scope began, for temporaries in code that
+ * also runs outside the frame (loading)
+ */
+struct ArenaScope_t
+{
+private:
+	LinearArena_t& Arena;
+	LinearArena_t::Marker_t Marker;
+
+public:
+	explicit ArenaScope_t(LinearArena_t& arena) : Arena(arena), Marker(arena.GetMarker()) {}
+	~ArenaScope_t()												{ Arena.Rewind(Marker); }
+
+	ArenaScope_t(const ArenaScope_t&) = delete;
+	ArenaScope_t& operator=(const ArenaScope_t&) = delete;
+};
+
+/*
+ * Per-thread frame arenas.
+ *
+ * Each thread gets its own arena the first time it asks for one, so the job system's workers never
+ * contend for it. The device thread resets all of them at the start of every frame. Only work
+ * that finishes within the frame (draw gathering, frame graph compilation, parallel recording)
+ * may allocate from them. Background jobs that span frames keep using the heap.
+ */
+namespace FrameArena
+{
+	// The calling thread's arena
+	LinearArena_t& Get();
+
+	// Start of the frame, while no job holds frame memory
+	void Reset();
+
+	// Summed over every thread; a steady frame rate should leave the allocation count flat
+	size_t GetUsed();
+	size_t GetCapacity();
+	uint64_t GetBlockAllocationCount();
+
+	// Frees the memory of every thread's arena; an arena used again afterwards starts over
+	void Shutdown();
+}
+
+/*
+ * STL allocator on top of a linear arena. Deallocation does nothing; the memory comes back
+ * with the arena's reset.
+ *
+ * Default constructed, it uses the calling thread's frame arena. A container that outlives a frame
+ * has to be replaced with a fresh one before it gets used again (see ArenaVector_t); moving a new
+ * one in doesn't touch the old memory, as long as the elements are trivially destructible.
+ */
+template <typename T>
+struct ArenaAllocator_t
+{
+	using value_type = T;
+
+	// A container that gets a fresh vector moved in takes its arena along
+	using propagate_on_container_move_assignment = std::true_type;
+
+	LinearArena_t* Arena										= nullptr;
+
+	ArenaAllocator_t() : Arena(&FrameArena::Get()) {}
+	ArenaAllocator_t(LinearArena_t& arena) : Arena(&arena) {}
+
+	template <typename U>
+	ArenaAllocator_t(const ArenaAllocator_t<U>& other) : Arena(other.Arena) {}
+
+	T* allocate(size_t count)									{ return Arena->Allocate<T>(count); }
+	void deallocate(T* pointer, size_t count)					{}
+
+	template <typename U>
+	bool operator==(const ArenaAllocator_t<U>& other) const		{ return Arena == other.Arena; }
+};
+
+/*
+ * Transient vector; growing it leaves the old storage behind in the arena, so reserve
+ * up front where the size is known. Only valid until the arena is reset
+ */
+template <typename T>
+using ArenaVector_t = std::vector<T, ArenaAllocator_t<T>>;
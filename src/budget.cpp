@@ -0,0 +1,82 @@
+#include "budget.hpp"
+#include "frames.hpp"
+#include "resources.hpp"
+
+#include <algorithm>
+
+void MemoryBudget_t::MakeResident(Mesh_t& mesh)
+{
+	uint64_t frameIndex = Gpu->Frames->GetFrameIndex();
+
+	mesh.LastUsedFrame = frameIndex;
+
+	if (!mesh.IsResident)
+	{
+		mesh.CreateGeometry(Gpu);
+		ReloadCount++;
+	}
+
+	// Several meshes share a material, only the first one this frame has anything to do
+	Material_t& material = *Gpu->MaterialPool.Get(mesh.Material);
+
+	if (material.LastUsedFrame == frameIndex)
+		return;
+
+	material.LastUsedFrame = frameIndex;
+
+	if (material.Restore(Gpu))
+		ReloadCount++;
+}
+
+void MemoryBudget_t::Update()
+{
+	if (Budget == 0 || Resources::GetTotalMemoryUsage() <= Budget)
+		return;
+
+	uint64_t frameIndex = Gpu->Frames->GetFrameIndex();
+
+	auto isIdle = [frameIndex](uint64_t lastUsedFrame) { return frameIndex - lastUsedFrame > MinIdleFrames; };
+
+	//
+	// Least recently used first
+	//
+	Candidates.clear();
+
+	for (Mesh_t& mesh : Gpu->MeshPool)
+	{
+		if (mesh.IsResident && isIdle(mesh.LastUsedFrame))
+			Candidates.push_back({ .LastUsedFrame = mesh.LastUsedFrame, .Mesh = &mesh, .Material = nullptr });
+	}
+
+	for (Material_t& material : Gpu->MaterialPool)
+	{
+		if (isIdle(material.LastUsedFrame))
+			Candidates.push_back({ .LastUsedFrame = material.LastUsedFrame, .Mesh = nullptr, .Material = &material });
+	}
+
+	std::sort(Candidates.begin(), Candidates.end(), [](const Candidate_t& a, const Candidate_t& b) { return a.LastUsedFrame < b.LastUsedFrame; });
+
+	//
+	// Evict; released memory leaves the registry's count right away, the GPU frees it a few frames later
+	//
+	for (const Candidate_t& candidate : Candidates)
+	{
+		if (Resources::GetTotalMemoryUsage() <= Budget)
+			break;
+
+		if (candidate.Mesh)
+		{
+			candidate.Mesh->DestroyGeometry();
+			EvictionCount++;
+			continue;
+		}
+
+		while (Resources::GetTotalMemoryUsage() > Budget && candidate.Material->DropTopMip(Gpu, MinTextureSize))
+			EvictionCount++;
+	}
+}
+
+void MemoryBudget_t::Destroy()
+{
+	Candidates.clear();
+}
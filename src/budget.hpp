@@ -0,0 +1,68 @@
+#pragma once
+
+#include "gpu.hpp"
+
+#include <vector>
+
+/*
+ * GPU memory budget.
+ *
+ * Memory usage comes from the resource registry. Whenever it's over budget, Update goes over the
+ * device's mesh and material pools and evicts whatever was drawn least recently: meshes lose their
+ * geometry, materials drop the top mip of their textures one level at a time, until usage is back
+ * under the budget. Anything drawn within the last MinIdleFrames frames stays, so the working set of
+ * the current view is never evicted; when that alone doesn't fit, usage stays over budget rather
+ * than thrashing.
+ *
+ * Eviction is transparent: MakeResident loads geometry and mips back from their CPU copies as soon
+ * as a mesh gets drawn again.
+ */
+struct MemoryBudget_t
+{
+public:
+	// Frames a mesh or material has to go undrawn before it can be evicted
+	static constexpr uint64_t MinIdleFrames						= 60;
+
+	// Textures keep at least this many texels on their larger side
+	static constexpr uint32_t MinTextureSize					= 64;
+
+private:
+	/*
+	 * Something that can be evicted; either a mesh or a material
+	 */
+	struct Candidate_t
+	{
+		uint64_t LastUsedFrame									= 0;
+		Mesh_t* Mesh											= nullptr;
+		Material_t* Material									= nullptr;
+	};
+
+	GraphicsDevice_t* Gpu										= nullptr;
+
+	// Bytes; 0 for no limit
+	uint64_t Budget												= 0;
+
+	// Pool pointers, only used within Update
+	std::vector<Candidate_t> Candidates							= {};
+
+	uint64_t EvictionCount										= 0;
+	uint64_t ReloadCount										= 0;
+
+public:
+	void Init(GraphicsDevice_t* gpu)							{ Gpu = gpu; }
+
+	void SetBudget(uint64_t bytes)								{ Budget = bytes; }
+	uint64_t GetBudget()										{ return Budget; }
+
+	// Mark a mesh and its material as drawn this frame, loading back whatever was evicted
+	void MakeResident(Mesh_t& mesh);
+
+	// Evict until usage fits the budget; once a frame, before anything gets drawn
+	void Update();
+
+	// Meshes unloaded and mips dropped, and how often evicted data had to be loaded again
+	uint64_t GetEvictionCount()									{ return EvictionCount; }
+	uint64_t GetReloadCount()									{ return ReloadCount; }
+
+	void Destroy();
+};
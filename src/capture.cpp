@@ -0,0 +1,239 @@
+#include "capture.hpp"
+#include "frames.hpp"
+#include "jobs.hpp"
+#include "resources.hpp"
+
+#include <stb_image_write.h>
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+void FrameCapture_t::Init(GraphicsDevice_t* gpu)
+{
+	Gpu = gpu;
+
+	for (Readback_t& readback : Readbacks)
+		readback.Owner = this;
+}
+
+void FrameCapture_t::RequestScreenshot(const std::string& path)
+{
+	ScreenshotPaths.push_back(path);
+}
+
+void FrameCapture_t::StartCapture(const std::string& directory, CaptureFormat_t format)
+{
+	std::error_code error;
+	std::filesystem::create_directories(directory, error);
+
+	CaptureDirectory = directory;
+	CaptureFormat = format;
+	CaptureIndex = 0;
+	DroppedFrames = 0;
+	IsCapturing = true;
+}
+
+FrameCapture_t::Readback_t* FrameCapture_t::AcquireReadback(uint32_t width, uint32_t height)
+{
+	for (Readback_t& readback : Readbacks)
+	{
+		if (readback.IsBusy)
+			continue;
+
+		uint32_t rowPitch = (width * 4 + RowPitchAlignment - 1) / RowPitchAlignment * RowPitchAlignment;
+		uint64_t size = (uint64_t)rowPitch * height;
+
+		// Sized for the last capture; the window may have changed since
+		if (readback.Size != size)
+		{
+			Resources::Release(readback.Buffer);
+
+			WGPUBufferDescriptor readbackBufferDesc = {
+				.nextInChain = nullptr,
+				.label = "Capture readback buffer",
+				.usage = WGPUBufferUsage_MapRead | WGPUBufferUsage_CopyDst,
+				.size = size,
+				.mappedAtCreation = false
+			};
+
+			readback.Buffer = Resources::Track(wgpuDeviceCreateBuffer(Gpu->Device, &readbackBufferDesc), readbackBufferDesc.label, MemoryCategory_t::Staging, size);
+			readback.Size = size;
+		}
+
+		readback.Width = width;
+		readback.Height = height;
+		readback.RowPitch = rowPitch;
+
+		return &readback;
+	}
+
+	return nullptr;
+}
+
+void FrameCapture_t::AddPasses(FrameGraph_t& graph, FrameGraphResource_t output)
+{
+	bool hasScreenshot = !ScreenshotPaths.empty();
+
+	if (!hasScreenshot && !IsCapturing)
+		return;
+
+	const FrameGraphTextureDesc_t& desc = graph.GetTextureDesc(output);
+	assert(desc.Format == WGPUTextureFormat_BGRA8Unorm || desc.Format == WGPUTextureFormat_RGBA8Unorm);
+
+	Readback_t* readback = AcquireReadback(desc.Width, desc.Height);
+
+	// Screenshots wait for a free readback, capture frames don't
+	if (!readback)
+	{
+		if (IsCapturing && !hasScreenshot)
+			DroppedFrames++;
+
+		return;
+	}
+
+	if (hasScreenshot)
+	{
+		readback->Path = ScreenshotPaths.front();
+		readback->Format = std::filesystem::path(readback->Path).extension() == ".png" ? CaptureFormat_t::Png : CaptureFormat_t::Raw;
+
+		ScreenshotPaths.erase(ScreenshotPaths.begin());
+	}
+	else
+	{
+		char fileName[64];
+		snprintf(fileName, sizeof(fileName), "frame_%06llu.%s", (unsigned long long)CaptureIndex++, CaptureFormat == CaptureFormat_t::Png ? "png" : "raw");
+
+		readback->Path = (std::filesystem::path(CaptureDirectory) / fileName).string();
+		readback->Format = CaptureFormat;
+	}
+
+	readback->IsBgra = desc.Format == WGPUTextureFormat_BGRA8Unorm;
+	readback->IsBusy = true;
+
+	graph.AddPass("Capture", FrameGraphPassType_t::Transfer, [readback, output](FrameGraphContext_t& context)
+		{
+			WGPUImageCopyTexture source = {
+				.nextInChain = nullptr,
+				.texture = context.GetTexture(output),
+				.mipLevel = 0,
+				.origin = { 0, 0, 0 },
+				.aspect = WGPUTextureAspect_All
+			};
+
+			WGPUImageCopyBuffer destination = {
+				.nextInChain = nullptr,
+				.layout = {
+					.nextInChain = nullptr,
+					.offset = 0,
+					.bytesPerRow = readback->RowPitch,
+					.rowsPerImage = readback->Height
+				},
+				.buffer = readback->Buffer
+			};
+
+			WGPUExtent3D copySize = { readback->Width, readback->Height, 1 };
+
+			wgpuCommandEncoderCopyTextureToBuffer(context.Encoder, &source, &destination, &copySize);
+		})
+		.Read(output)
+		.SetSideEffects();
+
+	PendingReadback = readback;
+}
+
+void FrameCapture_t::OnSubmitted()
+{
+	if (!PendingReadback)
+		return;
+
+	wgpuBufferMapAsync(PendingReadback->Buffer, WGPUMapMode_Read, 0, PendingReadback->Size, OnReadbackMapped, PendingReadback);
+	PendingReadback = nullptr;
+}
+
+void FrameCapture_t::OnReadbackMapped(WGPUBufferMapAsyncStatus status, void* userData)
+{
+	Readback_t* readback = (Readback_t*)userData;
+
+	if (status != WGPUBufferMapAsyncStatus_Success)
+	{
+		std::cout << "Capture readback failed, " << readback->Path << " not written" << std::endl;
+		readback->IsBusy = false;
+		return;
+	}
+
+	const uint8_t* data = (const uint8_t*)wgpuBufferGetConstMappedRange(readback->Buffer, 0, readback->Size);
+
+	// Encoding takes far longer than a frame; the buffer stays mapped until the worker is done with it
+	Jobs::Run([readback, data]()
+		{
+			WriteFile(readback, data);
+
+			Jobs::RunOnMainThread([readback]()
+				{
+					wgpuBufferUnmap(readback->Buffer);
+					readback->IsBusy = false;
+				});
+		});
+}
+
+void FrameCapture_t::WriteFile(Readback_t* readback, const uint8_t* data)
+{
+	//
+	// Drop the row padding and put the channels in RGBA order
+	//
+	uint32_t rowSize = readback->Width * 4;
+	std::vector<uint8_t> pixels((size_t)rowSize * readback->Height);
+
+	for (uint32_t y = 0; y < readback->Height; ++y)
+	{
+		const uint8_t* source = data + (size_t)y * readback->RowPitch;
+		uint8_t* destination = pixels.data() + (size_t)y * rowSize;
+
+		memcpy(destination, source, rowSize);
+
+		if (readback->IsBgra)
+		{
+			for (uint32_t x = 0; x < rowSize; x += 4)
+				std::swap(destination[x], destination[x + 2]);
+		}
+	}
+
+	bool isWritten = false;
+
+	if (readback->Format == CaptureFormat_t::Png)
+	{
+		isWritten = stbi_write_png(readback->Path.c_str(), (int)readback->Width, (int)readback->Height, 4, pixels.data(), (int)rowSize) != 0;
+	}
+	else
+	{
+		std::ofstream file(readback->Path, std::ios::binary);
+		file.write((const char*)pixels.data(), (std::streamsize)pixels.size());
+		isWritten = file.good();
+	}
+
+	if (!isWritten)
+		std::cout << "Couldn't write capture " << readback->Path << std::endl;
+}
+
+void FrameCapture_t::Destroy()
+{
+	ScreenshotPaths.clear();
+	IsCapturing = false;
+
+	// Let outstanding captures finish; the workers hand the buffers back through main thread jobs
+	for (Readback_t& readback : Readbacks)
+	{
+		Gpu->Frames->WaitUntil([&readback]()
+			{
+				Jobs::ExecuteMainThreadJobs();
+				return !readback.IsBusy;
+			});
+
+		Resources::Release(readback.Buffer);
+		readback.Size = 0;
+	}
+}
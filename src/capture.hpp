@@ -0,0 +1,99 @@
+#pragma once
+
+#include "gpu.hpp"
+#include "framegraph.hpp"
+
+#include <webgpu/webgpu.h>
+
+#include <string>
+#include <vector>
+
+enum class CaptureFormat_t
+{
+	Png,
+	Raw		// Tightly packed RGBA8 rows, top to bottom, no header
+};
+
+/*
+ * Screenshots and continuous frame capture.
+ *
+ * The frame's output gets copied into one of a ring of MapRead buffers, which is mapped once the
+ * frame is submitted and resolves a few frames later; nothing waits for it. The mapped buffer is
+ * handed to a worker as it is, which converts and writes the file and then has the device thread
+ * unmap it again. When every buffer is still busy a capture frame is dropped rather than stalling.
+ */
+struct FrameCapture_t
+{
+public:
+	// Frames of readback that can be in flight at once
+	static constexpr uint32_t ReadbackCount					= 3;
+
+	static constexpr uint32_t RowPitchAlignment					= 256;
+
+private:
+	/*
+	 * One frame's pixels on their way back to the CPU
+	 */
+	struct Readback_t
+	{
+		FrameCapture_t* Owner									= nullptr;
+		WGPUBuffer Buffer										= nullptr;
+		uint64_t Size											= 0;
+
+		uint32_t Width											= 0;
+		uint32_t Height											= 0;
+		uint32_t RowPitch										= 0;
+		bool IsBgra												= false;
+
+		std::string Path										= {};
+		CaptureFormat_t Format									= CaptureFormat_t::Png;
+
+		// From the copy until the worker is done with the mapped data
+		bool IsBusy												= false;
+	};
+
+	GraphicsDevice_t* Gpu										= nullptr;
+
+	Readback_t Readbacks[ReadbackCount]							= {};
+
+	// Readback copied into this frame, mapped once the frame is submitted
+	Readback_t* PendingReadback									= nullptr;
+
+	// One-shot screenshots, taken one per frame
+	std::vector<std::string> ScreenshotPaths					= {};
+
+	bool IsCapturing											= false;
+	std::string CaptureDirectory								= {};
+	CaptureFormat_t CaptureFormat								= CaptureFormat_t::Png;
+	uint64_t CaptureIndex										= 0;
+	uint64_t DroppedFrames										= 0;
+
+	Readback_t* AcquireReadback(uint32_t width, uint32_t height);
+
+	static void OnReadbackMapped(WGPUBufferMapAsyncStatus status, void* userData);
+
+	// Runs on a worker
+	static void WriteFile(Readback_t* readback, const uint8_t* data);
+
+public:
+	void Init(GraphicsDevice_t* gpu);
+
+	// .png files are written as PNG, anything else as raw RGBA8
+	void RequestScreenshot(const std::string& path);
+
+	// Writes every frame to directory as frame_<index>, until stopped
+	void StartCapture(const std::string& directory, CaptureFormat_t format);
+	void StopCapture()											{ IsCapturing = false; }
+
+	// Capture frames skipped because every readback was still busy
+	uint64_t GetDroppedFrameCount()								{ return DroppedFrames; }
+
+	// Copy output into a readback, when anything wants this frame
+	void AddPasses(FrameGraph_t& graph, FrameGraphResource_t output);
+
+	// Buffers can only be mapped once the copy into them has been submitted
+	void OnSubmitted();
+
+	// Waits for outstanding captures to be written
+	void Destroy();
+};
@@ -0,0 +1,317 @@
+#include "deferred.hpp"
+#include "frames.hpp"
+#include "lighting.hpp"
+#include "renderqueue.hpp"
+#include "resources.hpp"
+
+#include <string>
+
+static const char* DeferredShaderSource = R"(
+	struct DeferredUniforms {
+		invViewProjMatrix: mat4x4f,
+		cameraPosition: vec3f
+	};
+
+	@group(0) @binding(0) var gBufferBaseColorAo: texture_2d<f32>;
+	@group(0) @binding(1) var gBufferNormalMetalRoughness: texture_2d<f32>;
+	@group(0) @binding(2) var gBufferEmissive: texture_2d<f32>;
+	@group(0) @binding(3) var gBufferDepth: texture_depth_2d;
+
+	@group(1) @binding(0) var<uniform> uDeferred: DeferredUniforms;
+
+	fn DecodeOctahedral(e: vec2f) -> vec3f
+	{
+		var n: vec3f = vec3f(e, 1.0 - abs(e.x) - abs(e.y));
+		let t: f32 = saturate(-n.z);
+
+		n.x += select(t, -t, n.x >= 0.0);
+		n.y += select(t, -t, n.y >= 0.0);
+
+		return normalize(n);
+	}
+
+	@vertex
+	fn vs_fullscreen(@builtin(vertex_index) vertexIndex: u32) -> @builtin(position) vec4f
+	{
+		let uv = vec2f(f32((vertexIndex << 1u) & 2u), f32(vertexIndex & 2u));
+		return vec4f(uv * 2.0 - 1.0, 0.0, 1.0);
+	}
+
+	@fragment
+	fn fs_lighting(@builtin(position) fragCoord: vec4f) -> @location(0) vec4f
+	{
+		let texel: vec2i = vec2i(fragCoord.xy);
+		let depth: f32 = textureLoad(gBufferDepth, texel, 0);
+
+		// Nothing was drawn here, match the forward path's clear color
+		if (depth >= 1.0)
+		{
+			return vec4f(0.0, 0.0, 0.0, 1.0);
+		}
+
+		let baseColorAo: vec4f = textureLoad(gBufferBaseColorAo, texel, 0);
+		let normalMetalRoughness: vec4f = textureLoad(gBufferNormalMetalRoughness, texel, 0);
+		let emissive: vec4f = textureLoad(gBufferEmissive, texel, 0);
+
+		// Framebuffer y points down, NDC y points up
+		let screenSize: vec2f = vec2f(textureDimensions(gBufferDepth));
+		let ndc: vec2f = (fragCoord.xy / screenSize) * vec2f(2.0, -2.0) + vec2f(-1.0, 1.0);
+		let worldPosition: vec4f = uDeferred.invViewProjMatrix * vec4f(ndc, depth, 1.0);
+
+		var surface: Surface;
+		surface.position = worldPosition.xyz / worldPosition.w;
+		surface.normal = DecodeOctahedral(normalMetalRoughness.xy);
+		surface.baseColor = baseColorAo.rgb;
+		surface.emissive = emissive.rgb;
+		surface.ao = baseColorAo.a;
+		surface.metalness = normalMetalRoughness.z;
+		surface.roughness = normalMetalRoughness.w;
+
+		return vec4f(ShadeSurface(surface, fragCoord.xy, uDeferred.cameraPosition), 1.0);
+	}
+)";
+
+void DeferredRenderer_t::Init(GraphicsDevice_t* gpu, WGPUTextureFormat outputFormat)
+{
+	Gpu = gpu;
+
+	//
+	// G-buffer layout: everything is read with textureLoad, no sampler
+	//
+	WGPUBindGroupLayoutEntry gBufferBindingLayouts[GBufferCount + 1] = {};
+
+	for (uint32_t i = 0; i < GBufferCount + 1; ++i)
+	{
+		WGPUBindGroupLayoutEntry& bindingLayout = gBufferBindingLayouts[i];
+		SetDefaultBindGroupLayoutEntry(bindingLayout);
+		bindingLayout.binding = i;
+		bindingLayout.visibility = WGPUShaderStage_Fragment;
+		bindingLayout.texture.sampleType = i < GBufferCount ? WGPUTextureSampleType_UnfilterableFloat : WGPUTextureSampleType_Depth;
+		bindingLayout.texture.viewDimension = WGPUTextureViewDimension_2D;
+	}
+
+	WGPUBindGroupLayoutDescriptor gBufferBindGroupLayoutDesc = {
+		.nextInChain = nullptr,
+		.label = "G-buffer bind group layout",
+		.entryCount = GBufferCount + 1,
+		.entries = gBufferBindingLayouts
+	};
+
+	GBufferBindGroupLayout = Resources::Track(wgpuDeviceCreateBindGroupLayout(gpu->Device, &gBufferBindGroupLayoutDesc), gBufferBindGroupLayoutDesc.label);
+
+	//
+	// View layout
+	//
+	WGPUBindGroupLayoutEntry viewBindingLayout = {};
+	SetDefaultBindGroupLayoutEntry(viewBindingLayout);
+	viewBindingLayout.binding = 0;
+	viewBindingLayout.visibility = WGPUShaderStage_Fragment;
+	viewBindingLayout.buffer.type = WGPUBufferBindingType_Uniform;
+	viewBindingLayout.buffer.minBindingSize = sizeof(DeferredUniforms_t);
+
+	WGPUBindGroupLayoutDescriptor viewBindGroupLayoutDesc = {
+		.nextInChain = nullptr,
+		.label = "Deferred view bind group layout",
+		.entryCount = 1,
+		.entries = &viewBindingLayout
+	};
+
+	ViewBindGroupLayout = Resources::Track(wgpuDeviceCreateBindGroupLayout(gpu->Device, &viewBindGroupLayoutDesc), viewBindGroupLayoutDesc.label);
+
+	WGPUBufferDescriptor uniformBufferDesc = {
+		.nextInChain = nullptr,
+		.label = "Deferred uniform buffer",
+		.usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Uniform,
+		.size = sizeof(DeferredUniforms_t),
+		.mappedAtCreation = false
+	};
+
+	UniformBuffer.DataBuffer = Resources::Track(wgpuDeviceCreateBuffer(gpu->Device, &uniformBufferDesc), uniformBufferDesc.label, MemoryCategory_t::Uniform, uniformBufferDesc.size);
+	UniformBuffer.DataSize = sizeof(DeferredUniforms_t);
+	UniformBuffer.Count = 1;
+
+	WGPUBindGroupEntry viewBinding = {
+		.nextInChain = nullptr,
+		.binding = 0,
+		.buffer = UniformBuffer.DataBuffer,
+		.offset = 0,
+		.size = sizeof(DeferredUniforms_t)
+	};
+
+	WGPUBindGroupDescriptor viewBindGroupDesc = {
+		.nextInChain = nullptr,
+		.label = "Deferred view bind group",
+		.layout = ViewBindGroupLayout,
+		.entryCount = 1,
+		.entries = &viewBinding
+	};
+
+	ViewBindGroup = Resources::Track(wgpuDeviceCreateBindGroup(gpu->Device, &viewBindGroupDesc), viewBindGroupDesc.label);
+
+	CreateLightingPipeline(outputFormat);
+}
+
+void DeferredRenderer_t::CreateLightingPipeline(WGPUTextureFormat outputFormat)
+{
+	std::string source = std::string(Lighting_t::GetShaderSource()) + DeferredShaderSource;
+
+	WGPUShaderModule shaderModule = Graphics::MakeShaderModule(Gpu, source.c_str());
+
+	// Lighting stays at group 2 so the shared shading code binds the same way in both paths
+	WGPUBindGroupLayout bindGroupLayouts[] = { GBufferBindGroupLayout, ViewBindGroupLayout, Gpu->LightingBindGroupLayout };
+
+	WGPUPipelineLayoutDescriptor layoutDesc = {
+		.nextInChain = nullptr,
+		.bindGroupLayoutCount = 3,
+		.bindGroupLayouts = bindGroupLayouts
+	};
+
+	WGPUPipelineLayout layout = wgpuDeviceCreatePipelineLayout(Gpu->Device, &layoutDesc);
+
+	WGPUColorTargetState colorTarget = {
+		.format = outputFormat,
+		.blend = nullptr,
+		.writeMask = WGPUColorWriteMask_All
+	};
+
+	WGPUFragmentState fragmentState = {
+		.module = shaderModule,
+		.entryPoint = "fs_lighting",
+		.constantCount = 0,
+		.constants = nullptr,
+		.targetCount = 1,
+		.targets = &colorTarget
+	};
+
+	WGPURenderPipelineDescriptor pipelineDesc = {
+		.nextInChain = nullptr,
+		.label = "Deferred lighting pipeline",
+		.layout = layout,
+		.vertex = {
+			.module = shaderModule,
+			.entryPoint = "vs_fullscreen",
+			.constantCount = 0,
+			.constants = nullptr,
+			.bufferCount = 0,
+			.buffers = nullptr
+		},
+
+		.primitive = {
+			.topology = WGPUPrimitiveTopology_TriangleList,
+			.stripIndexFormat = WGPUIndexFormat_Undefined,
+			.frontFace = WGPUFrontFace_CCW,
+			.cullMode = WGPUCullMode_None
+		},
+
+		.depthStencil = nullptr,
+		.multisample = {
+			.count = 1,
+			.mask = ~0u,
+			.alphaToCoverageEnabled = false
+		},
+		.fragment = &fragmentState
+	};
+
+	LightingPipeline = Resources::Track(wgpuDeviceCreateRenderPipeline(Gpu->Device, &pipelineDesc), pipelineDesc.label);
+
+	wgpuPipelineLayoutRelease(layout);
+	wgpuShaderModuleRelease(shaderModule);
+}
+
+void DeferredRenderer_t::AddPasses(FrameGraph_t& graph, RenderQueue_t& queue, Camera_t& camera, Lighting_t& lighting, const LightingResources_t& lightingResources,
+	FrameGraphResource_t output, FrameGraphResource_t depth, bool hasDepthPrepass)
+{
+	DeferredUniforms_t uniforms = {};
+	uniforms.InvViewProjMatrix = glm::inverse(camera.GetViewProjMatrix());
+	uniforms.CameraPosition = camera.Transform.GetPosition();
+
+	Gpu->Frames->WriteBuffer(UniformBuffer.DataBuffer, 0, &uniforms, sizeof(DeferredUniforms_t));
+
+	//
+	// G-buffer
+	//
+	const FrameGraphTextureDesc_t& depthDesc = graph.GetTextureDesc(depth);
+
+	FrameGraphResource_t gBuffer[GBufferCount];
+	const char* gBufferNames[GBufferCount] = { "G-buffer base color", "G-buffer normal", "G-buffer emissive" };
+
+	for (uint32_t i = 0; i < GBufferCount; ++i)
+	{
+		gBuffer[i] = graph.CreateTexture(gBufferNames[i], {
+			.Width = depthDesc.Width,
+			.Height = depthDesc.Height,
+			.Format = GBufferFormats[i],
+			.Usage = WGPUTextureUsage_RenderAttachment | WGPUTextureUsage_TextureBinding
+		});
+	}
+
+	FrameGraphPassBuilder_t gBufferPass = graph.AddPass("G-buffer pass", FrameGraphPassType_t::Render, [&queue](FrameGraphContext_t& context)
+		{
+			queue.Execute(context.Gpu, context.RenderPass, DrawPass_t::GBuffer);
+		});
+
+	for (uint32_t i = 0; i < GBufferCount; ++i)
+	{
+		gBufferPass.WriteColor(gBuffer[i], WGPULoadOp_Clear, { 0.0, 0.0, 0.0, 0.0 });
+	}
+
+	gBufferPass.WriteDepth(depth, hasDepthPrepass ? WGPULoadOp_Load : WGPULoadOp_Clear, 1.0f);
+
+	//
+	// Lighting
+	//
+	FrameGraphPassBuilder_t lightingPass = graph.AddPass("Deferred lighting", FrameGraphPassType_t::Render, [this, &lighting, gBuffer, depth](FrameGraphContext_t& context)
+		{
+			// Transient textures can move between pooled objects from frame to frame, so bind them fresh
+			WGPUBindGroupEntry gBufferBindings[GBufferCount + 1] = {};
+
+			for (uint32_t i = 0; i < GBufferCount; ++i)
+			{
+				gBufferBindings[i].binding = i;
+				gBufferBindings[i].textureView = context.GetTextureView(gBuffer[i]);
+			}
+
+			gBufferBindings[GBufferCount].binding = GBufferCount;
+			gBufferBindings[GBufferCount].textureView = context.GetTextureView(depth);
+
+			WGPUBindGroupDescriptor gBufferBindGroupDesc = {
+				.nextInChain = nullptr,
+				.label = "G-buffer bind group",
+				.layout = GBufferBindGroupLayout,
+				.entryCount = GBufferCount + 1,
+				.entries = gBufferBindings
+			};
+
+			WGPUBindGroup gBufferBindGroup = wgpuDeviceCreateBindGroup(context.Gpu->Device, &gBufferBindGroupDesc);
+
+			wgpuRenderPassEncoderSetPipeline(context.RenderPass, LightingPipeline);
+			wgpuRenderPassEncoderSetBindGroup(context.RenderPass, 0, gBufferBindGroup, 0, nullptr);
+			wgpuRenderPassEncoderSetBindGroup(context.RenderPass, 1, ViewBindGroup, 0, nullptr);
+			wgpuRenderPassEncoderSetBindGroup(context.RenderPass, 2, lighting.GetBindGroup(), 0, nullptr);
+			wgpuRenderPassEncoderDraw(context.RenderPass, 3, 1, 0, 0);
+
+			wgpuBindGroupRelease(gBufferBindGroup);
+		});
+
+	for (uint32_t i = 0; i < GBufferCount; ++i)
+	{
+		lightingPass.Read(gBuffer[i]);
+	}
+
+	lightingPass
+		.Read(depth)
+		.Read(lightingResources.ClusterLightCounts)
+		.Read(lightingResources.ClusterLightIndices)
+		.Read(lightingResources.ShadowAtlas)
+		.WriteColor(output, WGPULoadOp_Clear, { 0.0, 0.0, 0.0, 1.0 });
+}
+
+void DeferredRenderer_t::Destroy()
+{
+	Resources::Release(LightingPipeline);
+	Resources::Release(ViewBindGroup);
+	Resources::Release(ViewBindGroupLayout);
+	Resources::Release(GBufferBindGroupLayout);
+
+	UniformBuffer.Destroy();
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "gpu.hpp"
+#include "framegraph.hpp"
+
+#include <webgpu/webgpu.h>
+
+struct Lighting_t;
+struct LightingResources_t;
+
+/*
+ * Must match `DeferredUniforms` in the WGSL source
+ */
+struct DeferredUniforms_t
+{
+	glm::mat4 InvViewProjMatrix									= {};
+	glm::vec3 CameraPosition									= {};
+	float Padding												= 0.0f;
+};
+
+/*
+ * Deferred shading: opaque meshes write their surface into a G-buffer, then a single full-screen pass
+ * shades every pixel once with the same clustered lights and shading code as the forward path.
+ *
+ * G-buffer layout:
+ *   RT0 RGBA8Unorm   base color, AO
+ *   RT1 RGBA16Float  octahedral normal (xy), metalness, roughness
+ *   RT2 RGBA8Unorm   emissive
+ *   Depth            world position is reconstructed from it
+ */
+struct DeferredRenderer_t
+{
+public:
+	static constexpr uint32_t GBufferCount						= 3;
+
+	static constexpr WGPUTextureFormat GBufferFormats[GBufferCount] = {
+		WGPUTextureFormat_RGBA8Unorm,
+		WGPUTextureFormat_RGBA16Float,
+		WGPUTextureFormat_RGBA8Unorm
+	};
+
+private:
+	GraphicsDevice_t* Gpu										= nullptr;
+
+	GraphicsBuffer_t UniformBuffer								= {};
+
+	WGPUBindGroupLayout GBufferBindGroupLayout					= nullptr;
+	WGPUBindGroupLayout ViewBindGroupLayout						= nullptr;
+	WGPUBindGroup ViewBindGroup									= nullptr;
+	WGPURenderPipeline LightingPipeline							= nullptr;
+
+	void CreateLightingPipeline(WGPUTextureFormat outputFormat);
+
+public:
+	void Init(GraphicsDevice_t* gpu, WGPUTextureFormat outputFormat);
+
+	// G-buffer pass for the queue's GBuffer draws, then the lighting pass into output
+	void AddPasses(FrameGraph_t& graph, RenderQueue_t& queue, Camera_t& camera, Lighting_t& lighting, const LightingResources_t& lightingResources,
+		FrameGraphResource_t output, FrameGraphResource_t depth, bool hasDepthPrepass);
+
+	void Destroy();
+};
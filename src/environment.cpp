@@ -0,0 +1,1112 @@
+#include "environment.hpp"
+#include "frames.hpp"
+#include "upload.hpp"
+#include "resources.hpp"
+
+#include <stb_image.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+
+//
+// Bake shaders, each entry point gets its own module since their bindings overlap
+//
+static const char* BakeCommonSource = R"(
+	const PI: f32 = 3.14159265359;
+
+	// Direction through a texel centre of a cube face, faces in +X, -X, +Y, -Y, +Z, -Z order
+	fn CubeTexelDirection(face: u32, texel: vec2u, size: u32) -> vec3f
+	{
+		let uv: vec2f = (vec2f(texel) + 0.5) / f32(size) * 2.0 - 1.0;
+
+		switch face
+		{
+			case 0u: { return normalize(vec3f(1.0, -uv.y, -uv.x)); }
+			case 1u: { return normalize(vec3f(-1.0, -uv.y, uv.x)); }
+			case 2u: { return normalize(vec3f(uv.x, 1.0, uv.y)); }
+			case 3u: { return normalize(vec3f(uv.x, -1.0, -uv.y)); }
+			case 4u: { return normalize(vec3f(uv.x, -uv.y, 1.0)); }
+			default: { return normalize(vec3f(-uv.x, -uv.y, -1.0)); }
+		}
+	}
+
+	fn Hammersley(i: u32, count: u32) -> vec2f
+	{
+		return vec2f(f32(i) / f32(count), f32(reverseBits(i)) * 2.3283064365386963e-10);
+	}
+
+	// Half vector around N, distributed like the GGX lobe
+	fn ImportanceSampleGGX(xi: vec2f, N: vec3f, roughness: f32) -> vec3f
+	{
+		let a: f32 = roughness * roughness;
+
+		let phi: f32 = 2.0 * PI * xi.x;
+		let cosTheta: f32 = sqrt((1.0 - xi.y) / (1.0 + (a * a - 1.0) * xi.y));
+		let sinTheta: f32 = sqrt(1.0 - cosTheta * cosTheta);
+
+		let up: vec3f = select(vec3f(1.0, 0.0, 0.0), vec3f(0.0, 0.0, 1.0), abs(N.z) < 0.999);
+		let tangentX: vec3f = normalize(cross(up, N));
+		let tangentY: vec3f = cross(N, tangentX);
+
+		return normalize(tangentX * cos(phi) * sinTheta + tangentY * sin(phi) * sinTheta + N * cosTheta);
+	}
+)";
+
+static const char* EquirectSource = R"(
+	@group(0) @binding(0) var equirect: texture_2d<f32>;
+	@group(0) @binding(1) var cubeOut: texture_storage_2d_array<rgba16float, write>;
+
+	// Wraps around horizontally, clamps at the poles
+	fn LoadEquirect(texel: vec2i, size: vec2i) -> vec3f
+	{
+		let wrapped: vec2i = vec2i((texel.x % size.x + size.x) % size.x, clamp(texel.y, 0, size.y - 1));
+		return textureLoad(equirect, wrapped, 0).rgb;
+	}
+
+	@compute @workgroup_size(8, 8, 1)
+	fn cs_equirect(@builtin(global_invocation_id) id: vec3u)
+	{
+		let size: u32 = textureDimensions(cubeOut).x;
+
+		if (id.x >= size || id.y >= size)
+		{
+			return;
+		}
+
+		let dir: vec3f = CubeTexelDirection(id.z, id.xy, size);
+
+		// Longitude around +Y, latitude from the top
+		let sourceSize: vec2i = vec2i(textureDimensions(equirect));
+		let uv: vec2f = vec2f(atan2(dir.z, dir.x) / (2.0 * PI) + 0.5, acos(clamp(dir.y, -1.0, 1.0)) / PI);
+
+		let position: vec2f = uv * vec2f(sourceSize) - 0.5;
+		let base: vec2i = vec2i(floor(position));
+		let f: vec2f = position - floor(position);
+
+		let top: vec3f = mix(LoadEquirect(base, sourceSize), LoadEquirect(base + vec2i(1, 0), sourceSize), f.x);
+		let bottom: vec3f = mix(LoadEquirect(base + vec2i(0, 1), sourceSize), LoadEquirect(base + vec2i(1, 1), sourceSize), f.x);
+
+		// Keep the sun finite in half floats
+		let color: vec3f = min(mix(top, bottom, f.y), vec3f(65000.0));
+
+		textureStore(cubeOut, id.xy, id.z, vec4f(color, 1.0));
+	}
+)";
+
+static const char* DownsampleSource = R"(
+	@group(0) @binding(0) var source: texture_2d_array<f32>;
+	@group(0) @binding(1) var destination: texture_storage_2d_array<rgba16float, write>;
+
+	@compute @workgroup_size(8, 8, 1)
+	fn cs_downsample(@builtin(global_invocation_id) id: vec3u)
+	{
+		let size: u32 = textureDimensions(destination).x;
+
+		if (id.x >= size || id.y >= size)
+		{
+			return;
+		}
+
+		let texel: vec2u = id.xy * 2u;
+
+		let color: vec4f = textureLoad(source, texel, id.z, 0)
+			+ textureLoad(source, texel + vec2u(1u, 0u), id.z, 0)
+			+ textureLoad(source, texel + vec2u(0u, 1u), id.z, 0)
+			+ textureLoad(source, texel + vec2u(1u, 1u), id.z, 0);
+
+		textureStore(destination, id.xy, id.z, color * 0.25);
+	}
+)";
+
+static const char* PrefilterSource = R"(
+	struct PrefilterUniforms {
+		roughness: f32,
+		sourceSize: f32,
+		sampleCount: u32,
+		padding: f32
+	};
+
+	@group(0) @binding(0) var environment: texture_cube<f32>;
+	@group(0) @binding(1) var environmentSampler: sampler;
+	@group(0) @binding(2) var prefiltered: texture_storage_2d_array<rgba16float, write>;
+	@group(0) @binding(3) var<uniform> uPrefilter: PrefilterUniforms;
+
+	fn DistributionGGX(NdotH: f32, roughness: f32) -> f32
+	{
+		let a: f32 = roughness * roughness;
+		let a2: f32 = a * a;
+		let d: f32 = NdotH * NdotH * (a2 - 1.0) + 1.0;
+
+		return a2 / (PI * d * d);
+	}
+
+	@compute @workgroup_size(8, 8, 1)
+	fn cs_prefilter(@builtin(global_invocation_id) id: vec3u)
+	{
+		let size: u32 = textureDimensions(prefiltered).x;
+
+		if (id.x >= size || id.y >= size)
+		{
+			return;
+		}
+
+		// The usual view == normal assumption, the lobe loses its stretch at grazing angles
+		let N: vec3f = CubeTexelDirection(id.z, id.xy, size);
+		let V: vec3f = N;
+
+		if (uPrefilter.roughness == 0.0)
+		{
+			textureStore(prefiltered, id.xy, id.z, textureSampleLevel(environment, environmentSampler, N, 0.0));
+			return;
+		}
+
+		// Solid angle of one source texel, to pick a source mip per sample (filtered importance sampling)
+		let texelSolidAngle: f32 = 4.0 * PI / (6.0 * uPrefilter.sourceSize * uPrefilter.sourceSize);
+
+		var color: vec3f = vec3f(0.0);
+		var weight: f32 = 0.0;
+
+		for (var i = 0u; i < uPrefilter.sampleCount; i++)
+		{
+			let H: vec3f = ImportanceSampleGGX(Hammersley(i, uPrefilter.sampleCount), N, uPrefilter.roughness);
+			let L: vec3f = normalize(2.0 * dot(V, H) * H - V);
+			let NdotL: f32 = dot(N, L);
+
+			if (NdotL > 0.0)
+			{
+				let NdotH: f32 = max(dot(N, H), 0.0);
+				let HdotV: f32 = max(dot(H, V), 0.0);
+				let pdf: f32 = DistributionGGX(NdotH, uPrefilter.roughness) * NdotH / (4.0 * HdotV) + 0.0001;
+
+				let sampleSolidAngle: f32 = 1.0 / (f32(uPrefilter.sampleCount) * pdf + 0.0001);
+				let mip: f32 = max(0.5 * log2(sampleSolidAngle / texelSolidAngle), 0.0);
+
+				color += textureSampleLevel(environment, environmentSampler, L, mip).rgb * NdotL;
+				weight += NdotL;
+			}
+		}
+
+		textureStore(prefiltered, id.xy, id.z, vec4f(color / max(weight, 0.0001), 1.0));
+	}
+)";
+
+static const char* IrradianceSource = R"(
+	@group(0) @binding(0) var source: texture_2d_array<f32>;
+	@group(0) @binding(1) var<storage, read_write> shCoefficients: array<vec4f, 9>;
+
+	const SH_GROUP_SIZE: u32 = 64u;
+
+	var<workgroup> sharedSh: array<array<vec3f, 9>, SH_GROUP_SIZE>;
+	var<workgroup> sharedWeight: array<f32, SH_GROUP_SIZE>;
+
+	fn ShBasis(d: vec3f) -> array<f32, 9>
+	{
+		return array<f32, 9>(
+			0.282095,
+			0.488603 * d.y,
+			0.488603 * d.z,
+			0.488603 * d.x,
+			1.092548 * d.x * d.y,
+			1.092548 * d.y * d.z,
+			0.315392 * (3.0 * d.z * d.z - 1.0),
+			1.092548 * d.x * d.z,
+			0.546274 * (d.x * d.x - d.y * d.y));
+	}
+
+	// A single workgroup walks the whole (small) cube, then reduces through shared memory
+	@compute @workgroup_size(SH_GROUP_SIZE)
+	fn cs_irradiance(@builtin(local_invocation_index) localIndex: u32)
+	{
+		let size: u32 = textureDimensions(source).x;
+		let texelCount: u32 = size * size * 6u;
+
+		var sh: array<vec3f, 9>;
+		var weight: f32 = 0.0;
+
+		for (var i = localIndex; i < texelCount; i += SH_GROUP_SIZE)
+		{
+			let face: u32 = i / (size * size);
+			let texel: vec2u = vec2u(i % size, (i / size) % size);
+
+			// Texel solid angle, relative to a face spanning [-1, 1]
+			let uv: vec2f = (vec2f(texel) + 0.5) / f32(size) * 2.0 - 1.0;
+			let solidAngle: f32 = 4.0 / (pow(1.0 + dot(uv, uv), 1.5) * f32(size * size));
+
+			let color: vec3f = textureLoad(source, texel, face, 0).rgb;
+			var basis = ShBasis(CubeTexelDirection(face, texel, size));
+
+			for (var k = 0u; k < 9u; k++)
+			{
+				sh[k] += color * basis[k] * solidAngle;
+			}
+
+			weight += solidAngle;
+		}
+
+		sharedSh[localIndex] = sh;
+		sharedWeight[localIndex] = weight;
+
+		workgroupBarrier();
+
+		if (localIndex != 0u)
+		{
+			return;
+		}
+
+		var total: array<vec3f, 9>;
+		var totalWeight: f32 = 0.0;
+
+		for (var t = 0u; t < SH_GROUP_SIZE; t++)
+		{
+			for (var k = 0u; k < 9u; k++)
+			{
+				total[k] += sharedSh[t][k];
+			}
+
+			totalWeight += sharedWeight[t];
+		}
+
+		// Convolve with the clamped cosine (pi, 2pi/3, pi/4 per band) and fold in Lambert's 1/pi
+		let bandScale = array<f32, 9>(1.0, 2.0 / 3.0, 2.0 / 3.0, 2.0 / 3.0, 0.25, 0.25, 0.25, 0.25, 0.25);
+		let normalization: f32 = 4.0 * PI / totalWeight;
+
+		for (var k = 0u; k < 9u; k++)
+		{
+			shCoefficients[k] = vec4f(total[k] * normalization * bandScale[k], 0.0);
+		}
+	}
+)";
+
+static const char* BrdfSource = R"(
+	@group(0) @binding(0) var brdfLut: texture_storage_2d<rgba16float, write>;
+
+	const BRDF_SAMPLE_COUNT: u32 = 512u;
+
+	// Smith-Schlick with the IBL remapping of k
+	fn GeometrySchlickGGX(NdotV: f32, roughness: f32) -> f32
+	{
+		let k: f32 = roughness * roughness * 0.5;
+		return NdotV / (NdotV * (1.0 - k) + k);
+	}
+
+	// Scale and bias to F0 of the split-sum specular, indexed by (N.V, roughness)
+	@compute @workgroup_size(8, 8, 1)
+	fn cs_brdf(@builtin(global_invocation_id) id: vec3u)
+	{
+		let size: vec2u = textureDimensions(brdfLut);
+
+		if (id.x >= size.x || id.y >= size.y)
+		{
+			return;
+		}
+
+		let NdotV: f32 = (f32(id.x) + 0.5) / f32(size.x);
+		let roughness: f32 = (f32(id.y) + 0.5) / f32(size.y);
+
+		let N: vec3f = vec3f(0.0, 0.0, 1.0);
+		let V: vec3f = vec3f(sqrt(1.0 - NdotV * NdotV), 0.0, NdotV);
+
+		var scale: f32 = 0.0;
+		var bias: f32 = 0.0;
+
+		for (var i = 0u; i < BRDF_SAMPLE_COUNT; i++)
+		{
+			let H: vec3f = ImportanceSampleGGX(Hammersley(i, BRDF_SAMPLE_COUNT), N, roughness);
+			let L: vec3f = normalize(2.0 * dot(V, H) * H - V);
+
+			let NdotL: f32 = max(L.z, 0.0);
+			let NdotH: f32 = max(H.z, 0.0);
+			let VdotH: f32 = max(dot(V, H), 0.0);
+
+			if (NdotL > 0.0)
+			{
+				let G: f32 = GeometrySchlickGGX(NdotV, roughness) * GeometrySchlickGGX(NdotL, roughness);
+				let visibility: f32 = G * VdotH / (NdotH * NdotV);
+				let fresnel: f32 = pow(1.0 - VdotH, 5.0);
+
+				scale += (1.0 - fresnel) * visibility;
+				bias += fresnel * visibility;
+			}
+		}
+
+		textureStore(brdfLut, id.xy, vec4f(scale, bias, 0.0, 1.0) / vec4f(f32(BRDF_SAMPLE_COUNT), f32(BRDF_SAMPLE_COUNT), 1.0, 1.0));
+	}
+)";
+
+/*
+ * Cache file header, followed by the prefiltered mips (6 faces each, tightly packed rows), the SH
+ * coefficients and the BRDF LUT
+ */
+struct EnvironmentCacheHeader_t
+{
+	uint32_t Magic												= 0;
+	uint32_t Version											= 0;
+	uint64_t Hash												= 0;
+	uint32_t PrefilteredSize									= 0;
+	uint32_t PrefilteredMipCount								= 0;
+	uint32_t BrdfLutSize										= 0;
+	uint32_t Padding											= 0;
+};
+
+static constexpr uint32_t EnvironmentCacheMagic					= 0x4C424932; // "2IBL"
+
+// RGBA16Float
+static constexpr uint32_t TexelSize								= 8;
+
+static uint32_t AlignTo(uint32_t value, uint32_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+static uint64_t HashBytes(uint64_t hash, const uint8_t* data, size_t size)
+{
+	size_t i = 0;
+
+	for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+	{
+		uint64_t value;
+		memcpy(&value, data + i, sizeof(uint64_t));
+		hash = HashCombine(hash, value);
+	}
+
+	for (; i < size; ++i)
+		hash = HashCombine(hash, data[i]);
+
+	return hash;
+}
+
+static WGPUTextureView MakeTextureView(WGPUTexture texture, WGPUTextureViewDimension dimension, uint32_t baseMipLevel, uint32_t mipLevelCount, uint32_t layerCount)
+{
+	WGPUTextureViewDescriptor viewDesc = {
+		.nextInChain = nullptr,
+		.format = WGPUTextureFormat_Undefined,
+		.dimension = dimension,
+		.baseMipLevel = baseMipLevel,
+		.mipLevelCount = mipLevelCount,
+		.baseArrayLayer = 0,
+		.arrayLayerCount = layerCount,
+		.aspect = WGPUTextureAspect_All
+	};
+
+	return wgpuTextureCreateView(texture, &viewDesc);
+}
+
+/*
+ * A compute pipeline with its own bind group layout, for the one-off bake passes
+ */
+struct BakePipeline_t
+{
+	WGPUBindGroupLayout BindGroupLayout							= nullptr;
+	WGPUComputePipeline Pipeline								= nullptr;
+
+	void Init(GraphicsDevice_t* gpu, const char* label, const char* source, const char* entryPoint, std::vector<WGPUBindGroupLayoutEntry> entries)
+	{
+		for (uint32_t i = 0; i < entries.size(); ++i)
+		{
+			entries[i].binding = i;
+			entries[i].visibility = WGPUShaderStage_Compute;
+		}
+
+		WGPUBindGroupLayoutDescriptor bindGroupLayoutDesc = {
+			.nextInChain = nullptr,
+			.label = label,
+			.entryCount = entries.size(),
+			.entries = entries.data()
+		};
+
+		BindGroupLayout = wgpuDeviceCreateBindGroupLayout(gpu->Device, &bindGroupLayoutDesc);
+
+		std::string shaderSource = std::string(BakeCommonSource) + source;
+		WGPUShaderModule shaderModule = Graphics::MakeShaderModule(gpu, shaderSource.c_str());
+
+		WGPUPipelineLayoutDescriptor layoutDesc = {
+			.nextInChain = nullptr,
+			.bindGroupLayoutCount = 1,
+			.bindGroupLayouts = &BindGroupLayout
+		};
+
+		WGPUPipelineLayout layout = wgpuDeviceCreatePipelineLayout(gpu->Device, &layoutDesc);
+
+		WGPUComputePipelineDescriptor pipelineDesc = {
+			.nextInChain = nullptr,
+			.label = label,
+			.layout = layout,
+			.compute = {
+				.nextInChain = nullptr,
+				.module = shaderModule,
+				.entryPoint = entryPoint,
+				.constantCount = 0,
+				.constants = nullptr
+			}
+		};
+
+		Pipeline = wgpuDeviceCreateComputePipeline(gpu->Device, &pipelineDesc);
+
+		wgpuPipelineLayoutRelease(layout);
+		wgpuShaderModuleRelease(shaderModule);
+	}
+
+	// Bind and dispatch; the bind group only has to live until the pass is encoded
+	void Dispatch(GraphicsDevice_t* gpu, WGPUComputePassEncoder computePass, std::vector<WGPUBindGroupEntry> bindings, uint32_t x, uint32_t y, uint32_t z)
+	{
+		for (uint32_t i = 0; i < bindings.size(); ++i)
+			bindings[i].binding = i;
+
+		WGPUBindGroupDescriptor bindGroupDesc = {
+			.nextInChain = nullptr,
+			.layout = BindGroupLayout,
+			.entryCount = bindings.size(),
+			.entries = bindings.data()
+		};
+
+		WGPUBindGroup bindGroup = wgpuDeviceCreateBindGroup(gpu->Device, &bindGroupDesc);
+
+		wgpuComputePassEncoderSetPipeline(computePass, Pipeline);
+		wgpuComputePassEncoderSetBindGroup(computePass, 0, bindGroup, 0, nullptr);
+		wgpuComputePassEncoderDispatchWorkgroups(computePass, x, y, z);
+
+		wgpuBindGroupRelease(bindGroup);
+	}
+
+	void Destroy()
+	{
+		wgpuComputePipelineRelease(Pipeline);
+		wgpuBindGroupLayoutRelease(BindGroupLayout);
+	}
+};
+
+static WGPUBindGroupLayoutEntry MakeTextureLayoutEntry(WGPUTextureSampleType sampleType, WGPUTextureViewDimension dimension)
+{
+	WGPUBindGroupLayoutEntry entry = {};
+	SetDefaultBindGroupLayoutEntry(entry);
+	entry.texture.sampleType = sampleType;
+	entry.texture.viewDimension = dimension;
+
+	return entry;
+}
+
+static WGPUBindGroupLayoutEntry MakeStorageTextureLayoutEntry(WGPUTextureViewDimension dimension)
+{
+	WGPUBindGroupLayoutEntry entry = {};
+	SetDefaultBindGroupLayoutEntry(entry);
+	entry.storageTexture.access = WGPUStorageTextureAccess_WriteOnly;
+	entry.storageTexture.format = EnvironmentLighting_t::Format;
+	entry.storageTexture.viewDimension = dimension;
+
+	return entry;
+}
+
+static WGPUBindGroupLayoutEntry MakeBufferLayoutEntry(WGPUBufferBindingType type)
+{
+	WGPUBindGroupLayoutEntry entry = {};
+	SetDefaultBindGroupLayoutEntry(entry);
+	entry.buffer.type = type;
+
+	return entry;
+}
+
+static WGPUBindGroupLayoutEntry MakeSamplerLayoutEntry()
+{
+	WGPUBindGroupLayoutEntry entry = {};
+	SetDefaultBindGroupLayoutEntry(entry);
+	entry.sampler.type = WGPUSamplerBindingType_Filtering;
+
+	return entry;
+}
+
+static WGPUBindGroupEntry MakeTextureBinding(WGPUTextureView textureView)
+{
+	WGPUBindGroupEntry entry = {};
+	entry.textureView = textureView;
+
+	return entry;
+}
+
+static WGPUBindGroupEntry MakeBufferBinding(WGPUBuffer buffer, uint64_t offset, uint64_t size)
+{
+	WGPUBindGroupEntry entry = {};
+	entry.buffer = buffer;
+	entry.offset = offset;
+	entry.size = size;
+
+	return entry;
+}
+
+void EnvironmentLighting_t::Init(GraphicsDevice_t* gpu)
+{
+	Gpu = gpu;
+
+	//
+	// Outputs; sizes are fixed, so loading another environment only rewrites their contents
+	//
+	WGPUTextureDescriptor prefilteredDesc = {
+		.nextInChain = nullptr,
+		.label = "Prefiltered environment",
+		.usage = WGPUTextureUsage_TextureBinding | WGPUTextureUsage_StorageBinding | WGPUTextureUsage_CopySrc | WGPUTextureUsage_CopyDst,
+		.dimension = WGPUTextureDimension_2D,
+		.size = { PrefilteredSize, PrefilteredSize, 6 },
+		.format = Format,
+		.mipLevelCount = PrefilteredMipCount,
+		.sampleCount = 1,
+		.viewFormatCount = 0,
+		.viewFormats = nullptr
+	};
+
+	PrefilteredCube = Resources::Track(wgpuDeviceCreateTexture(gpu->Device, &prefilteredDesc), prefilteredDesc.label, MemoryCategory_t::Texture, Resources::GetTextureSize(prefilteredDesc));
+	PrefilteredCubeView = Resources::Track(MakeTextureView(PrefilteredCube, WGPUTextureViewDimension_Cube, 0, PrefilteredMipCount, 6), prefilteredDesc.label);
+
+	WGPUTextureDescriptor brdfLutDesc = prefilteredDesc;
+	brdfLutDesc.label = "BRDF LUT";
+	brdfLutDesc.size = { BrdfLutSize, BrdfLutSize, 1 };
+	brdfLutDesc.mipLevelCount = 1;
+
+	BrdfLut = Resources::Track(wgpuDeviceCreateTexture(gpu->Device, &brdfLutDesc), brdfLutDesc.label, MemoryCategory_t::Texture, Resources::GetTextureSize(brdfLutDesc));
+	BrdfLutView = Resources::Track(MakeTextureView(BrdfLut, WGPUTextureViewDimension_2D, 0, 1, 1), brdfLutDesc.label);
+
+	WGPUBufferDescriptor shBufferDesc = {
+		.nextInChain = nullptr,
+		.label = "Environment SH buffer",
+		.usage = WGPUBufferUsage_Uniform | WGPUBufferUsage_Storage | WGPUBufferUsage_CopySrc | WGPUBufferUsage_CopyDst,
+		.size = ShCoefficientCount * sizeof(glm::vec4),
+		.mappedAtCreation = false
+	};
+
+	ShBuffer.DataBuffer = Resources::Track(wgpuDeviceCreateBuffer(gpu->Device, &shBufferDesc), shBufferDesc.label, MemoryCategory_t::Uniform, shBufferDesc.size);
+	ShBuffer.DataSize = shBufferDesc.size;
+	ShBuffer.Count = ShCoefficientCount;
+
+	WGPUSamplerDescriptor samplerDesc = {
+		.nextInChain = nullptr,
+		.label = "Environment sampler",
+		.addressModeU = WGPUAddressMode_ClampToEdge,
+		.addressModeV = WGPUAddressMode_ClampToEdge,
+		.addressModeW = WGPUAddressMode_ClampToEdge,
+		.magFilter = WGPUFilterMode_Linear,
+		.minFilter = WGPUFilterMode_Linear,
+		.mipmapFilter = WGPUMipmapFilterMode_Linear,
+		.lodMinClamp = 0.0f,
+		.lodMaxClamp = 32.0f,
+		.compare = WGPUCompareFunction_Undefined,
+		.maxAnisotropy = 1
+	};
+
+	Sampler = Resources::Track(wgpuDeviceCreateSampler(gpu->Device, &samplerDesc), samplerDesc.label);
+
+	Load(DefaultEnvironmentPath);
+}
+
+void EnvironmentLighting_t::Load(const char* hdrPath)
+{
+	std::ifstream file(hdrPath, std::ios::binary);
+	std::vector<uint8_t> source((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+	// The key covers the bake settings too, so changing them doesn't pick up stale results
+	uint64_t hash = HashSeed;
+	hash = HashCombine(hash, CacheVersion);
+	hash = HashCombine(hash, ((uint64_t)PrefilteredSize << 32) | (PrefilteredMipCount << 16) | BrdfLutSize);
+	hash = HashCombine(hash, ((uint64_t)SourceCubeSize << 32) | PrefilterSampleCount);
+	hash = HashBytes(hash, source.data(), source.size());
+
+	std::stringstream cachePath;
+	cachePath << CacheDirectory << "/environment_" << std::hex << hash << ".bin";
+
+	if (LoadCache(cachePath.str(), hash))
+		return;
+
+	int width = 0, height = 0, channels = 0;
+	float* pixels = source.empty() ? nullptr : stbi_loadf_from_memory(source.data(), (int)source.size(), &width, &height, &channels, 4);
+
+	if (pixels)
+	{
+		Bake(pixels, (uint32_t)width, (uint32_t)height);
+		stbi_image_free(pixels);
+	}
+	else
+	{
+		std::cout << "Couldn't load environment " << hdrPath << ", using a procedural sky" << std::endl;
+
+		// Sky fading into a darker ground, enough for some directional ambient
+		const uint32_t skyWidth = 64, skyHeight = 32;
+		std::vector<glm::vec4> sky(skyWidth * skyHeight);
+
+		for (uint32_t y = 0; y < skyHeight; ++y)
+		{
+			float elevation = 1.0f - 2.0f * (y + 0.5f) / skyHeight;
+			glm::vec4 color = elevation > 0.0f
+				? glm::mix(glm::vec4(0.6f, 0.7f, 0.8f, 1.0f), glm::vec4(0.25f, 0.4f, 0.7f, 1.0f), elevation)
+				: glm::mix(glm::vec4(0.3f, 0.28f, 0.25f, 1.0f), glm::vec4(0.1f, 0.09f, 0.08f, 1.0f), -elevation);
+
+			for (uint32_t x = 0; x < skyWidth; ++x)
+				sky[y * skyWidth + x] = color;
+		}
+
+		Bake(&sky[0].x, skyWidth, skyHeight);
+	}
+
+	SaveCache(cachePath.str(), hash);
+}
+
+void EnvironmentLighting_t::Bake(const float* pixels, uint32_t width, uint32_t height)
+{
+	//
+	// Source: the equirect map, and a mipped cube it gets resampled into
+	//
+	WGPUTextureDescriptor equirectDesc = {
+		.nextInChain = nullptr,
+		.label = "Environment equirect",
+		.usage = WGPUTextureUsage_TextureBinding | WGPUTextureUsage_CopyDst,
+		.dimension = WGPUTextureDimension_2D,
+		.size = { width, height, 1 },
+		.format = WGPUTextureFormat_RGBA32Float,
+		.mipLevelCount = 1,
+		.sampleCount = 1,
+		.viewFormatCount = 0,
+		.viewFormats = nullptr
+	};
+
+	WGPUTexture equirect = wgpuDeviceCreateTexture(Gpu->Device, &equirectDesc);
+
+	WGPUImageCopyTexture destination = {
+		.nextInChain = nullptr,
+		.texture = equirect,
+		.mipLevel = 0,
+		.origin = { 0, 0, 0 },
+		.aspect = WGPUTextureAspect_All
+	};
+
+	Gpu->Uploads->UploadTexture(destination, pixels, width * 4 * (uint32_t)sizeof(float), height, equirectDesc.size);
+
+	WGPUTextureDescriptor sourceCubeDesc = {
+		.nextInChain = nullptr,
+		.label = "Environment source cube",
+		.usage = WGPUTextureUsage_TextureBinding | WGPUTextureUsage_StorageBinding,
+		.dimension = WGPUTextureDimension_2D,
+		.size = { SourceCubeSize, SourceCubeSize, 6 },
+		.format = Format,
+		.mipLevelCount = SourceMipCount,
+		.sampleCount = 1,
+		.viewFormatCount = 0,
+		.viewFormats = nullptr
+	};
+
+	WGPUTexture sourceCube = wgpuDeviceCreateTexture(Gpu->Device, &sourceCubeDesc);
+
+	//
+	// Per-mip parameters for the prefilter, at uniform buffer offset alignment
+	//
+	struct PrefilterUniforms_t
+	{
+		float Roughness;
+		float SourceSize;
+		uint32_t SampleCount;
+		float Padding;
+	};
+
+	const uint32_t uniformStride = 256;
+	std::vector<uint8_t> prefilterUniforms(PrefilteredMipCount * uniformStride);
+
+	for (uint32_t mip = 0; mip < PrefilteredMipCount; ++mip)
+	{
+		PrefilterUniforms_t uniforms = {
+			.Roughness = (float)mip / (PrefilteredMipCount - 1),
+			.SourceSize = (float)SourceCubeSize,
+			.SampleCount = PrefilterSampleCount,
+			.Padding = 0.0f
+		};
+
+		memcpy(&prefilterUniforms[mip * uniformStride], &uniforms, sizeof(uniforms));
+	}
+
+	WGPUBufferDescriptor uniformBufferDesc = {
+		.nextInChain = nullptr,
+		.label = "Prefilter uniform buffer",
+		.usage = WGPUBufferUsage_Uniform | WGPUBufferUsage_CopyDst,
+		.size = prefilterUniforms.size(),
+		.mappedAtCreation = false
+	};
+
+	WGPUBuffer uniformBuffer = wgpuDeviceCreateBuffer(Gpu->Device, &uniformBufferDesc);
+	Gpu->Uploads->UploadBuffer(uniformBuffer, 0, prefilterUniforms.data(), prefilterUniforms.size());
+
+	//
+	// Pipelines
+	//
+	BakePipeline_t equirectPipeline, downsamplePipeline, prefilterPipeline, irradiancePipeline, brdfPipeline;
+
+	equirectPipeline.Init(Gpu, "Environment equirect to cube", EquirectSource, "cs_equirect", {
+		MakeTextureLayoutEntry(WGPUTextureSampleType_UnfilterableFloat, WGPUTextureViewDimension_2D),
+		MakeStorageTextureLayoutEntry(WGPUTextureViewDimension_2DArray)
+	});
+
+	downsamplePipeline.Init(Gpu, "Environment downsample", DownsampleSource, "cs_downsample", {
+		MakeTextureLayoutEntry(WGPUTextureSampleType_UnfilterableFloat, WGPUTextureViewDimension_2DArray),
+		MakeStorageTextureLayoutEntry(WGPUTextureViewDimension_2DArray)
+	});
+
+	prefilterPipeline.Init(Gpu, "Environment prefilter", PrefilterSource, "cs_prefilter", {
+		MakeTextureLayoutEntry(WGPUTextureSampleType_Float, WGPUTextureViewDimension_Cube),
+		MakeSamplerLayoutEntry(),
+		MakeStorageTextureLayoutEntry(WGPUTextureViewDimension_2DArray),
+		MakeBufferLayoutEntry(WGPUBufferBindingType_Uniform)
+	});
+
+	irradiancePipeline.Init(Gpu, "Environment irradiance", IrradianceSource, "cs_irradiance", {
+		MakeTextureLayoutEntry(WGPUTextureSampleType_UnfilterableFloat, WGPUTextureViewDimension_2DArray),
+		MakeBufferLayoutEntry(WGPUBufferBindingType_Storage)
+	});
+
+	brdfPipeline.Init(Gpu, "BRDF integration", BrdfSource, "cs_brdf", {
+		MakeStorageTextureLayoutEntry(WGPUTextureViewDimension_2D)
+	});
+
+	//
+	// Dispatch everything in one pass; each dispatch sees the previous one's writes
+	//
+	std::vector<WGPUTextureView> views = {};
+
+	auto makeView = [&views](WGPUTexture texture, WGPUTextureViewDimension dimension, uint32_t baseMipLevel, uint32_t mipLevelCount, uint32_t layerCount)
+		{
+			views.push_back(MakeTextureView(texture, dimension, baseMipLevel, mipLevelCount, layerCount));
+			return views.back();
+		};
+
+	WGPUCommandEncoderDescriptor encoderDesc = {
+		.nextInChain = nullptr,
+		.label = "Environment bake encoder"
+	};
+
+	WGPUCommandEncoder encoder = wgpuDeviceCreateCommandEncoder(Gpu->Device, &encoderDesc);
+
+	WGPUComputePassDescriptor computePassDesc = {
+		.nextInChain = nullptr,
+		.label = "Environment bake",
+		.timestampWrites = nullptr
+	};
+
+	WGPUComputePassEncoder computePass = wgpuCommandEncoderBeginComputePass(encoder, &computePassDesc);
+
+	equirectPipeline.Dispatch(Gpu, computePass, {
+		MakeTextureBinding(makeView(equirect, WGPUTextureViewDimension_2D, 0, 1, 1)),
+		MakeTextureBinding(makeView(sourceCube, WGPUTextureViewDimension_2DArray, 0, 1, 6))
+	}, AlignTo(SourceCubeSize, 8) / 8, AlignTo(SourceCubeSize, 8) / 8, 6);
+
+	for (uint32_t mip = 1; mip < SourceMipCount; ++mip)
+	{
+		uint32_t size = std::max(SourceCubeSize >> mip, 1u);
+
+		downsamplePipeline.Dispatch(Gpu, computePass, {
+			MakeTextureBinding(makeView(sourceCube, WGPUTextureViewDimension_2DArray, mip - 1, 1, 6)),
+			MakeTextureBinding(makeView(sourceCube, WGPUTextureViewDimension_2DArray, mip, 1, 6))
+		}, AlignTo(size, 8) / 8, AlignTo(size, 8) / 8, 6);
+	}
+
+	WGPUTextureView sourceCubeView = makeView(sourceCube, WGPUTextureViewDimension_Cube, 0, SourceMipCount, 6);
+
+	for (uint32_t mip = 0; mip < PrefilteredMipCount; ++mip)
+	{
+		uint32_t size = std::max(PrefilteredSize >> mip, 1u);
+
+		WGPUBindGroupEntry samplerBinding = {};
+		samplerBinding.sampler = Sampler;
+
+		prefilterPipeline.Dispatch(Gpu, computePass, {
+			MakeTextureBinding(sourceCubeView),
+			samplerBinding,
+			MakeTextureBinding(makeView(PrefilteredCube, WGPUTextureViewDimension_2DArray, mip, 1, 6)),
+			MakeBufferBinding(uniformBuffer, mip * uniformStride, sizeof(PrefilterUniforms_t))
+		}, AlignTo(size, 8) / 8, AlignTo(size, 8) / 8, 6);
+	}
+
+	irradiancePipeline.Dispatch(Gpu, computePass, {
+		MakeTextureBinding(makeView(sourceCube, WGPUTextureViewDimension_2DArray, ShSourceMip, 1, 6)),
+		MakeBufferBinding(ShBuffer.DataBuffer, 0, ShBuffer.DataSize)
+	}, 1, 1, 1);
+
+	brdfPipeline.Dispatch(Gpu, computePass, {
+		MakeTextureBinding(BrdfLutView)
+	}, AlignTo(BrdfLutSize, 8) / 8, AlignTo(BrdfLutSize, 8) / 8, 1);
+
+	wgpuComputePassEncoderEnd(computePass);
+	wgpuComputePassEncoderRelease(computePass);
+
+	WGPUCommandBufferDescriptor commandBufferDesc = {
+		.nextInChain = nullptr,
+		.label = "Environment bake commands"
+	};
+
+	WGPUCommandBuffer commands = wgpuCommandEncoderFinish(encoder, &commandBufferDesc);
+
+	// The equirect and the uniforms have to be there first
+	Gpu->Uploads->Flush();
+	wgpuQueueSubmit(Gpu->Queue, 1, &commands);
+
+	wgpuCommandBufferRelease(commands);
+	wgpuCommandEncoderRelease(encoder);
+
+	//
+	// Cleanup, the queue keeps whatever it still needs alive
+	//
+	for (WGPUTextureView view : views)
+		wgpuTextureViewRelease(view);
+
+	equirectPipeline.Destroy();
+	downsamplePipeline.Destroy();
+	prefilterPipeline.Destroy();
+	irradiancePipeline.Destroy();
+	brdfPipeline.Destroy();
+
+	wgpuBufferRelease(uniformBuffer);
+	wgpuTextureRelease(sourceCube);
+	wgpuTextureRelease(equirect);
+}
+
+bool EnvironmentLighting_t::LoadCache(const std::string& path, uint64_t hash)
+{
+	std::ifstream file(path, std::ios::binary);
+
+	if (!file)
+		return false;
+
+	EnvironmentCacheHeader_t header = {};
+	file.read((char*)&header, sizeof(header));
+
+	if (!file || header.Magic != EnvironmentCacheMagic || header.Version != CacheVersion || header.Hash != hash
+		|| header.PrefilteredSize != PrefilteredSize || header.PrefilteredMipCount != PrefilteredMipCount || header.BrdfLutSize != BrdfLutSize)
+	{
+		return false;
+	}
+
+	std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+	size_t expectedSize = ShBuffer.DataSize + (size_t)BrdfLutSize * BrdfLutSize * TexelSize;
+
+	for (uint32_t mip = 0; mip < PrefilteredMipCount; ++mip)
+	{
+		uint32_t size = std::max(PrefilteredSize >> mip, 1u);
+		expectedSize += (size_t)size * size * 6 * TexelSize;
+	}
+
+	if (data.size() != expectedSize)
+		return false;
+
+	//
+	// Upload
+	//
+	size_t offset = 0;
+
+	for (uint32_t mip = 0; mip < PrefilteredMipCount; ++mip)
+	{
+		uint32_t size = std::max(PrefilteredSize >> mip, 1u);
+
+		WGPUImageCopyTexture destination = {
+			.nextInChain = nullptr,
+			.texture = PrefilteredCube,
+			.mipLevel = mip,
+			.origin = { 0, 0, 0 },
+			.aspect = WGPUTextureAspect_All
+		};
+
+		WGPUExtent3D writeSize = { size, size, 6 };
+		size_t mipSize = (size_t)size * size * 6 * TexelSize;
+
+		Gpu->Uploads->UploadTexture(destination, data.data() + offset, size * TexelSize, size, writeSize);
+		offset += mipSize;
+	}
+
+	Gpu->Uploads->UploadBuffer(ShBuffer.DataBuffer, 0, data.data() + offset, ShBuffer.DataSize);
+	offset += ShBuffer.DataSize;
+
+	WGPUImageCopyTexture destination = {
+		.nextInChain = nullptr,
+		.texture = BrdfLut,
+		.mipLevel = 0,
+		.origin = { 0, 0, 0 },
+		.aspect = WGPUTextureAspect_All
+	};
+
+	WGPUExtent3D writeSize = { BrdfLutSize, BrdfLutSize, 1 };
+
+	Gpu->Uploads->UploadTexture(destination, data.data() + offset, BrdfLutSize * TexelSize, BrdfLutSize, writeSize);
+
+	return true;
+}
+
+void EnvironmentLighting_t::SaveCache(const std::string& path, uint64_t hash)
+{
+	//
+	// Copy everything into one readback buffer; texture rows are padded to 256 bytes there
+	//
+	struct CopyRegion_t
+	{
+		WGPUTexture Texture;
+		uint32_t MipLevel;
+		uint32_t Size;
+		uint32_t LayerCount;
+		uint64_t Offset;
+		uint32_t BytesPerRow;
+	};
+
+	std::vector<CopyRegion_t> regions = {};
+	uint64_t readbackSize = 0;
+
+	auto addRegion = [&regions, &readbackSize](WGPUTexture texture, uint32_t mipLevel, uint32_t size, uint32_t layerCount)
+		{
+			uint32_t bytesPerRow = AlignTo(size * TexelSize, 256);
+			regions.push_back({ texture, mipLevel, size, layerCount, readbackSize, bytesPerRow });
+			readbackSize += (uint64_t)bytesPerRow * size * layerCount;
+		};
+
+	for (uint32_t mip = 0; mip < PrefilteredMipCount; ++mip)
+		addRegion(PrefilteredCube, mip, std::max(PrefilteredSize >> mip, 1u), 6);
+
+	addRegion(BrdfLut, 0, BrdfLutSize, 1);
+
+	uint64_t shOffset = readbackSize;
+	readbackSize += ShBuffer.DataSize;
+
+	WGPUBufferDescriptor readbackDesc = {
+		.nextInChain = nullptr,
+		.label = "Environment readback buffer",
+		.usage = WGPUBufferUsage_MapRead | WGPUBufferUsage_CopyDst,
+		.size = readbackSize,
+		.mappedAtCreation = false
+	};
+
+	WGPUBuffer readback = wgpuDeviceCreateBuffer(Gpu->Device, &readbackDesc);
+
+	WGPUCommandEncoderDescriptor encoderDesc = {
+		.nextInChain = nullptr,
+		.label = "Environment readback encoder"
+	};
+
+	WGPUCommandEncoder encoder = wgpuDeviceCreateCommandEncoder(Gpu->Device, &encoderDesc);
+
+	for (const CopyRegion_t& region : regions)
+	{
+		WGPUImageCopyTexture source = {
+			.nextInChain = nullptr,
+			.texture = region.Texture,
+			.mipLevel = region.MipLevel,
+			.origin = { 0, 0, 0 },
+			.aspect = WGPUTextureAspect_All
+		};
+
+		WGPUImageCopyBuffer destination = {
+			.nextInChain = nullptr,
+			.layout = {
+				.nextInChain = nullptr,
+				.offset = region.Offset,
+				.bytesPerRow = region.BytesPerRow,
+				.rowsPerImage = region.Size
+			},
+			.buffer = readback
+		};
+
+		WGPUExtent3D copySize = { region.Size, region.Size, region.LayerCount };
+
+		wgpuCommandEncoderCopyTextureToBuffer(encoder, &source, &destination, &copySize);
+	}
+
+	wgpuCommandEncoderCopyBufferToBuffer(encoder, ShBuffer.DataBuffer, 0, readback, shOffset, ShBuffer.DataSize);
+
+	WGPUCommandBufferDescriptor commandBufferDesc = {
+		.nextInChain = nullptr,
+		.label = "Environment readback commands"
+	};
+
+	WGPUCommandBuffer commands = wgpuCommandEncoderFinish(encoder, &commandBufferDesc);
+	wgpuQueueSubmit(Gpu->Queue, 1, &commands);
+
+	wgpuCommandBufferRelease(commands);
+	wgpuCommandEncoderRelease(encoder);
+
+	//
+	// Wait for it; this only happens the first time an environment is seen
+	//
+	struct MapResult_t
+	{
+		bool IsDone = false;
+		bool IsMapped = false;
+	} mapResult;
+
+	auto onMapped = [](WGPUBufferMapAsyncStatus status, void* userData)
+		{
+			MapResult_t& result = *(MapResult_t*)userData;
+			result.IsMapped = status == WGPUBufferMapAsyncStatus_Success;
+			result.IsDone = true;
+		};
+
+	wgpuBufferMapAsync(readback, WGPUMapMode_Read, 0, readbackSize, onMapped, &mapResult);
+
+	Gpu->Frames->WaitUntil([&mapResult]() { return mapResult.IsDone; });
+
+	if (!mapResult.IsMapped)
+	{
+		std::cout << "Couldn't read back the environment, it won't be cached" << std::endl;
+		wgpuBufferRelease(readback);
+		return;
+	}
+
+	const uint8_t* mapped = (const uint8_t*)wgpuBufferGetConstMappedRange(readback, 0, readbackSize);
+
+	//
+	// Write, dropping the row padding
+	//
+	std::error_code error;
+	std::filesystem::create_directories(CacheDirectory, error);
+
+	std::ofstream file(path, std::ios::binary);
+
+	if (file)
+	{
+		EnvironmentCacheHeader_t header = {
+			.Magic = EnvironmentCacheMagic,
+			.Version = CacheVersion,
+			.Hash = hash,
+			.PrefilteredSize = PrefilteredSize,
+			.PrefilteredMipCount = PrefilteredMipCount,
+			.BrdfLutSize = BrdfLutSize,
+			.Padding = 0
+		};
+
+		file.write((const char*)&header, sizeof(header));
+
+		// Prefiltered mips first, then the SH, then the LUT, matching LoadCache
+		auto writeRegion = [&file, mapped](const CopyRegion_t& region)
+			{
+				for (uint32_t row = 0; row < region.Size * region.LayerCount; ++row)
+					file.write((const char*)mapped + region.Offset + (uint64_t)row * region.BytesPerRow, region.Size * TexelSize);
+			};
+
+		for (uint32_t mip = 0; mip < PrefilteredMipCount; ++mip)
+			writeRegion(regions[mip]);
+
+		file.write((const char*)mapped + shOffset, ShBuffer.DataSize);
+
+		writeRegion(regions.back());
+	}
+	else
+	{
+		std::cout << "Couldn't write environment cache " << path << std::endl;
+	}
+
+	wgpuBufferUnmap(readback);
+	wgpuBufferRelease(readback);
+}
+
+void EnvironmentLighting_t::Destroy()
+{
+	Resources::Release(PrefilteredCubeView);
+	Resources::Release(PrefilteredCube);
+	Resources::Release(BrdfLutView);
+	Resources::Release(BrdfLut);
+	Resources::Release(Sampler);
+
+	ShBuffer.Destroy();
+}
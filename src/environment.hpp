@@ -0,0 +1,73 @@
+#pragma once
+
+#include "gpu.hpp"
+
+#include <webgpu/webgpu.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Image-based lighting from an equirectangular HDR map:
+ *   - a prefiltered specular cube, one GGX roughness per mip
+ *   - 9 spherical harmonics coefficients for diffuse, pre-convolved with the cosine lobe
+ *   - a split-sum BRDF integration LUT
+ *
+ * All three come out of compute passes that run once per environment; the results are written to
+ * content/cache keyed by a hash of the source file and the bake settings, so later runs just upload them.
+ */
+struct EnvironmentLighting_t
+{
+public:
+	static constexpr uint32_t SourceCubeSize					= 512;
+	static constexpr uint32_t SourceMipCount					= 10;
+
+	// The diffuse projection reads this mip of the source cube
+	static constexpr uint32_t ShSourceMip						= 4;
+	static constexpr uint32_t ShCoefficientCount				= 9;
+
+	static constexpr uint32_t PrefilteredSize					= 128;
+	static constexpr uint32_t PrefilteredMipCount				= 5;
+	static constexpr uint32_t PrefilterSampleCount				= 256;
+
+	static constexpr uint32_t BrdfLutSize						= 128;
+
+	// Bump when anything about the bake changes, so stale cache files get ignored
+	static constexpr uint32_t CacheVersion						= 1;
+
+	static constexpr WGPUTextureFormat Format					= WGPUTextureFormat_RGBA16Float;
+
+	static constexpr const char* DefaultEnvironmentPath			= "content/environments/default.hdr";
+	static constexpr const char* CacheDirectory					= "content/cache";
+
+private:
+	GraphicsDevice_t* Gpu										= nullptr;
+
+	WGPUTexture PrefilteredCube									= nullptr;
+	WGPUTextureView PrefilteredCubeView							= nullptr;
+	WGPUTexture BrdfLut											= nullptr;
+	WGPUTextureView BrdfLutView									= nullptr;
+	WGPUSampler Sampler											= nullptr;
+
+	GraphicsBuffer_t ShBuffer									= {};
+
+	void Bake(const float* pixels, uint32_t width, uint32_t height);
+
+	bool LoadCache(const std::string& path, uint64_t hash);
+	void SaveCache(const std::string& path, uint64_t hash);
+
+public:
+	// Creates the output resources and loads the default environment
+	void Init(GraphicsDevice_t* gpu);
+
+	// Falls back to a procedural sky if the file can't be read
+	void Load(const char* hdrPath);
+
+	WGPUTextureView GetPrefilteredView()						{ return PrefilteredCubeView; }
+	WGPUTextureView GetBrdfLutView()							{ return BrdfLutView; }
+	WGPUSampler GetSampler()									{ return Sampler; }
+	GraphicsBuffer_t& GetShBuffer()								{ return ShBuffer; }
+
+	void Destroy();
+};
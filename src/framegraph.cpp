@@ -0,0 +1,635 @@
+#include "framegraph.hpp"
+#include "gpu.hpp"
+#include "profiler.hpp"
+#include "resources.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+
+WGPUTexture FrameGraphContext_t::GetTexture(FrameGraphResource_t resource)
+{
+	return Graph->Resources[resource.Index].Texture;
+}
+
+WGPUTextureView FrameGraphContext_t::GetTextureView(FrameGraphResource_t resource)
+{
+	return Graph->Resources[resource.Index].TextureView;
+}
+
+WGPUBuffer FrameGraphContext_t::GetBuffer(FrameGraphResource_t resource)
+{
+	return Graph->Resources[resource.Index].Buffer;
+}
+
+void FrameGraphContext_t::BeginScope(const char* name)
+{
+	if (RenderPass)
+		Gpu->Profiler->BeginScope(RenderPass, name);
+	else if (ComputePass)
+		Gpu->Profiler->BeginScope(ComputePass, name);
+	else
+		Gpu->Profiler->BeginScope(Encoder, name);
+}
+
+void FrameGraphContext_t::EndScope()
+{
+	if (RenderPass)
+		Gpu->Profiler->EndScope(RenderPass);
+	else if (ComputePass)
+		Gpu->Profiler->EndScope(ComputePass);
+	else
+		Gpu->Profiler->EndScope(Encoder);
+}
+
+inline void AddUnique(ArenaVector_t<uint32_t>& list, uint32_t value)
+{
+	if (std::find(list.begin(), list.end(), value) == list.end())
+		list.push_back(value);
+}
+
+FrameGraphPassBuilder_t& FrameGraphPassBuilder_t::Read(FrameGraphResource_t resource)
+{
+	assert(resource.IsValid());
+
+	AddUnique(Graph->Passes[PassIndex].Reads, resource.Index);
+	return *this;
+}
+
+FrameGraphPassBuilder_t& FrameGraphPassBuilder_t::Write(FrameGraphResource_t resource)
+{
+	assert(resource.IsValid());
+
+	AddUnique(Graph->Passes[PassIndex].Writes, resource.Index);
+	return *this;
+}
+
+FrameGraphPassBuilder_t& FrameGraphPassBuilder_t::WriteColor(FrameGraphResource_t resource, WGPULoadOp loadOp, WGPUColor clearColor)
+{
+	auto& pass = Graph->Passes[PassIndex];
+	assert(pass.Type == FrameGraphPassType_t::Render);
+
+	FrameGraphAttachment_t attachment = {
+		.Resource = resource,
+		.LoadOp = loadOp,
+		.ClearColor = clearColor
+	};
+
+	pass.ColorAttachments.push_back(attachment);
+
+	// Loading keeps the previous contents, so that's a read too
+	if (loadOp == WGPULoadOp_Load)
+		Read(resource);
+
+	return Write(resource);
+}
+
+FrameGraphPassBuilder_t& FrameGraphPassBuilder_t::WriteDepth(FrameGraphResource_t resource, WGPULoadOp loadOp, float clearDepth)
+{
+	auto& pass = Graph->Passes[PassIndex];
+	assert(pass.Type == FrameGraphPassType_t::Render);
+
+	pass.DepthAttachment = {
+		.Resource = resource,
+		.LoadOp = loadOp,
+		.ClearDepth = clearDepth,
+		.IsReadOnly = false
+	};
+
+	if (loadOp == WGPULoadOp_Load)
+		Read(resource);
+
+	return Write(resource);
+}
+
+FrameGraphPassBuilder_t& FrameGraphPassBuilder_t::ReadDepth(FrameGraphResource_t resource)
+{
+	auto& pass = Graph->Passes[PassIndex];
+	assert(pass.Type == FrameGraphPassType_t::Render);
+
+	pass.DepthAttachment = {
+		.Resource = resource,
+		.LoadOp = WGPULoadOp_Undefined,
+		.IsReadOnly = true
+	};
+
+	return Read(resource);
+}
+
+FrameGraphPassBuilder_t& FrameGraphPassBuilder_t::SetSideEffects()
+{
+	Graph->Passes[PassIndex].HasSideEffects = true;
+	return *this;
+}
+
+void FrameGraph_t::Reset()
+{
+	FrameIndex++;
+
+	Resources.clear();
+	Passes.clear();
+	ExecutionOrder.clear();
+
+	TrimPools();
+}
+
+FrameGraphResource_t FrameGraph_t::CreateTexture(const char* name, FrameGraphTextureDesc_t desc)
+{
+	ResourceNode_t resource = {};
+	resource.Name = name;
+	resource.IsTexture = true;
+	resource.TextureDesc = desc;
+
+	Resources.push_back(resource);
+	return { (uint32_t)Resources.size() - 1 };
+}
+
+FrameGraphResource_t FrameGraph_t::CreateBuffer(const char* name, FrameGraphBufferDesc_t desc)
+{
+	ResourceNode_t resource = {};
+	resource.Name = name;
+	resource.IsTexture = false;
+	resource.BufferDesc = desc;
+
+	Resources.push_back(resource);
+	return { (uint32_t)Resources.size() - 1 };
+}
+
+FrameGraphResource_t FrameGraph_t::ImportTexture(const char* name, WGPUTexture texture, WGPUTextureView textureView, FrameGraphTextureDesc_t desc)
+{
+	ResourceNode_t resource = {};
+	resource.Name = name;
+	resource.IsTexture = true;
+	resource.IsImported = true;
+	resource.TextureDesc = desc;
+	resource.Texture = texture;
+	resource.TextureView = textureView;
+
+	Resources.push_back(resource);
+	return { (uint32_t)Resources.size() - 1 };
+}
+
+FrameGraphResource_t FrameGraph_t::ImportBuffer(const char* name, WGPUBuffer buffer, FrameGraphBufferDesc_t desc)
+{
+	ResourceNode_t resource = {};
+	resource.Name = name;
+	resource.IsTexture = false;
+	resource.IsImported = true;
+	resource.BufferDesc = desc;
+	resource.Buffer = buffer;
+
+	Resources.push_back(resource);
+	return { (uint32_t)Resources.size() - 1 };
+}
+
+FrameGraphPassBuilder_t FrameGraph_t::AddPass(const char* name, FrameGraphPassType_t type, FrameGraphExecuteFunc_t executeFunc)
+{
+	PassNode_t pass = {};
+	pass.Name = name;
+	pass.Type = type;
+	pass.ExecuteFunc = executeFunc;
+
+	Passes.push_back(std::move(pass));
+	return FrameGraphPassBuilder_t(this, (uint32_t)Passes.size() - 1);
+}
+
+void FrameGraph_t::Compile()
+{
+	CullPasses();
+	SchedulePasses();
+	AllocateResources();
+}
+
+void FrameGraph_t::CullPasses()
+{
+	//
+	// Reference counts: passes count the resources they write, resources count the passes reading them.
+	// Imported resources are outputs of the frame, so they're always referenced.
+	//
+	for (auto& pass : Passes)
+	{
+		pass.RefCount = (uint32_t)pass.Writes.size();
+
+		for (uint32_t resource : pass.Reads)
+			Resources[resource].RefCount++;
+	}
+
+	ArenaVector_t<uint32_t> unreferenced = {};
+	unreferenced.reserve(Resources.size());
+
+	for (uint32_t i = 0; i < Resources.size(); ++i)
+	{
+		if (Resources[i].IsImported)
+			Resources[i].RefCount++;
+
+		if (Resources[i].RefCount == 0)
+			unreferenced.push_back(i);
+	}
+
+	auto cullPass = [&](PassNode_t& pass)
+		{
+			pass.IsCulled = true;
+
+			for (uint32_t resource : pass.Reads)
+			{
+				if (--Resources[resource].RefCount == 0)
+					unreferenced.push_back(resource);
+			}
+		};
+
+	// Passes that write nothing can only be useful for their side effects
+	for (auto& pass : Passes)
+	{
+		if (pass.RefCount == 0 && !pass.HasSideEffects)
+			cullPass(pass);
+	}
+
+	// Walk back from unreferenced resources, culling producers that end up with nothing left to write for
+	while (!unreferenced.empty())
+	{
+		uint32_t resource = unreferenced.back();
+		unreferenced.pop_back();
+
+		for (auto& pass : Passes)
+		{
+			if (pass.IsCulled || std::find(pass.Writes.begin(), pass.Writes.end(), resource) == pass.Writes.end())
+				continue;
+
+			if (--pass.RefCount == 0 && !pass.HasSideEffects)
+				cullPass(pass);
+		}
+	}
+}
+
+void FrameGraph_t::SchedulePasses()
+{
+	//
+	// Build dependency edges per resource, in declaration order:
+	// read-after-write, write-after-write and write-after-read
+	//
+	ArenaVector_t<ArenaVector_t<uint32_t>> edges(Passes.size());
+	ArenaVector_t<uint32_t> inDegree(Passes.size(), 0);
+
+	auto addEdge = [&](uint32_t from, uint32_t to)
+		{
+			if (from == to)
+				return;
+
+			edges[from].push_back(to);
+			inDegree[to]++;
+		};
+
+	// Shared by all resources; growing it leaves the old storage behind in the arena
+	ArenaVector_t<uint32_t> readersSinceWrite = {};
+	readersSinceWrite.reserve(Passes.size());
+
+	for (uint32_t resource = 0; resource < Resources.size(); ++resource)
+	{
+		uint32_t lastWriter = UINT32_MAX;
+		readersSinceWrite.clear();
+
+		for (uint32_t passIndex = 0; passIndex < Passes.size(); ++passIndex)
+		{
+			auto& pass = Passes[passIndex];
+
+			if (pass.IsCulled)
+				continue;
+
+			bool isRead = std::find(pass.Reads.begin(), pass.Reads.end(), resource) != pass.Reads.end();
+			bool isWrite = std::find(pass.Writes.begin(), pass.Writes.end(), resource) != pass.Writes.end();
+
+			if (isRead)
+			{
+				if (lastWriter != UINT32_MAX)
+					addEdge(lastWriter, passIndex);
+
+				readersSinceWrite.push_back(passIndex);
+			}
+
+			if (isWrite)
+			{
+				if (lastWriter != UINT32_MAX)
+					addEdge(lastWriter, passIndex);
+
+				for (uint32_t reader : readersSinceWrite)
+					addEdge(reader, passIndex);
+
+				readersSinceWrite.clear();
+				lastWriter = passIndex;
+			}
+		}
+	}
+
+	//
+	// Topological sort, preferring declaration order among passes that are ready
+	//
+	ArenaVector_t<bool> isScheduled(Passes.size(), false);
+
+	for (;;)
+	{
+		uint32_t next = UINT32_MAX;
+
+		for (uint32_t passIndex = 0; passIndex < Passes.size(); ++passIndex)
+		{
+			if (!Passes[passIndex].IsCulled && !isScheduled[passIndex] && inDegree[passIndex] == 0)
+			{
+				next = passIndex;
+				break;
+			}
+		}
+
+		if (next == UINT32_MAX)
+			break;
+
+		isScheduled[next] = true;
+		ExecutionOrder.push_back(next);
+
+		for (uint32_t dependent : edges[next])
+			inDegree[dependent]--;
+	}
+}
+
+void FrameGraph_t::AllocateResources()
+{
+	//
+	// Lifetimes, in execution order
+	//
+	for (uint32_t orderIndex = 0; orderIndex < ExecutionOrder.size(); ++orderIndex)
+	{
+		auto& pass = Passes[ExecutionOrder[orderIndex]];
+
+		auto extendLifetime = [&](uint32_t resource)
+			{
+				Resources[resource].FirstUse = std::min(Resources[resource].FirstUse, orderIndex);
+				Resources[resource].LastUse = std::max(Resources[resource].LastUse, orderIndex);
+			};
+
+		for (uint32_t resource : pass.Reads)
+			extendLifetime(resource);
+
+		for (uint32_t resource : pass.Writes)
+			extendLifetime(resource);
+	}
+
+	//
+	// Walk the schedule, handing out pooled objects as lifetimes begin and returning them as they end.
+	// Anything returned can be picked up again by a later resource in the same frame.
+	//
+	for (uint32_t orderIndex = 0; orderIndex < ExecutionOrder.size(); ++orderIndex)
+	{
+		for (auto& resource : Resources)
+		{
+			if (resource.IsImported || resource.FirstUse != orderIndex)
+				continue;
+
+			if (resource.IsTexture)
+			{
+				resource.PhysicalIndex = AcquireTexture(resource);
+				resource.Texture = TexturePool[resource.PhysicalIndex].Texture;
+				resource.TextureView = TexturePool[resource.PhysicalIndex].TextureView;
+			}
+			else
+			{
+				resource.PhysicalIndex = AcquireBuffer(resource);
+				resource.Buffer = BufferPool[resource.PhysicalIndex].Buffer;
+			}
+		}
+
+		for (auto& resource : Resources)
+		{
+			if (resource.IsImported || resource.LastUse != orderIndex || resource.PhysicalIndex == SIZE_MAX)
+				continue;
+
+			if (resource.IsTexture)
+				TexturePool[resource.PhysicalIndex].IsInUse = false;
+			else
+				BufferPool[resource.PhysicalIndex].IsInUse = false;
+		}
+	}
+}
+
+size_t FrameGraph_t::AcquireTexture(const ResourceNode_t& resource)
+{
+	for (size_t i = 0; i < TexturePool.size(); ++i)
+	{
+		auto& texture = TexturePool[i];
+
+		if (!texture.IsInUse && texture.Desc == resource.TextureDesc)
+		{
+			texture.IsInUse = true;
+			texture.LastUsedFrame = FrameIndex;
+			texture.LastUsedResize = ResizeIndex;
+			return i;
+		}
+	}
+
+	WGPUTextureDescriptor textureDesc = {
+		.nextInChain = nullptr,
+		.label = resource.Name,
+		.usage = resource.TextureDesc.Usage,
+		.dimension = WGPUTextureDimension_2D,
+		.size = { resource.TextureDesc.Width, resource.TextureDesc.Height, 1 },
+		.format = resource.TextureDesc.Format,
+		.mipLevelCount = 1,
+		.sampleCount = 1,
+		.viewFormatCount = 0,
+		.viewFormats = nullptr
+	};
+
+	PhysicalTexture_t texture = {};
+	texture.Desc = resource.TextureDesc;
+	texture.Texture = Resources::Track(wgpuDeviceCreateTexture(Gpu->Device, &textureDesc), textureDesc.label, MemoryCategory_t::RenderTarget, Resources::GetTextureSize(textureDesc));
+	texture.TextureView = wgpuTextureCreateView(texture.Texture, nullptr);
+	texture.LastUsedFrame = FrameIndex;
+	texture.LastUsedResize = ResizeIndex;
+	texture.IsInUse = true;
+
+	TexturePool.push_back(texture);
+	return TexturePool.size() - 1;
+}
+
+size_t FrameGraph_t::AcquireBuffer(const ResourceNode_t& resource)
+{
+	for (size_t i = 0; i < BufferPool.size(); ++i)
+	{
+		auto& buffer = BufferPool[i];
+
+		if (!buffer.IsInUse && buffer.Desc == resource.BufferDesc)
+		{
+			buffer.IsInUse = true;
+			buffer.LastUsedFrame = FrameIndex;
+			return i;
+		}
+	}
+
+	WGPUBufferDescriptor bufferDesc = {
+		.nextInChain = nullptr,
+		.label = resource.Name,
+		.usage = resource.BufferDesc.Usage,
+		.size = resource.BufferDesc.Size,
+		.mappedAtCreation = false
+	};
+
+	PhysicalBuffer_t buffer = {};
+	buffer.Desc = resource.BufferDesc;
+	buffer.Buffer = Resources::Track(wgpuDeviceCreateBuffer(Gpu->Device, &bufferDesc), bufferDesc.label, MemoryCategory_t::RenderTarget, bufferDesc.size);
+	buffer.LastUsedFrame = FrameIndex;
+	buffer.IsInUse = true;
+
+	BufferPool.push_back(buffer);
+	return BufferPool.size() - 1;
+}
+
+void FrameGraph_t::TrimPools()
+{
+	auto isStale = [&](uint64_t lastUsedFrame) { return FrameIndex - lastUsedFrame > MaxIdleFrames; };
+
+	std::erase_if(TexturePool, [&](PhysicalTexture_t& texture)
+		{
+			bool isFromRecentSize = texture.LastUsedResize < ResizeIndex && texture.LastUsedResize + RetainedResizeCount >= ResizeIndex;
+
+			if (isFromRecentSize ? FrameIndex - texture.LastUsedFrame <= MaxRetainedIdleFrames : !isStale(texture.LastUsedFrame))
+				return false;
+
+			wgpuTextureViewRelease(texture.TextureView);
+			Resources::Release(texture.Texture);
+			return true;
+		});
+
+	std::erase_if(BufferPool, [&](PhysicalBuffer_t& buffer)
+		{
+			if (!isStale(buffer.LastUsedFrame))
+				return false;
+
+			Resources::Release(buffer.Buffer);
+			return true;
+		});
+}
+
+WGPUStoreOp FrameGraph_t::GetStoreOp(uint32_t resource, uint32_t orderIndex)
+{
+	// Nobody looks at transient contents once their lifetime is over
+	if (Resources[resource].IsImported || Resources[resource].LastUse > orderIndex)
+		return WGPUStoreOp_Store;
+
+	return WGPUStoreOp_Discard;
+}
+
+void FrameGraph_t::Execute(WGPUCommandEncoder encoder)
+{
+	for (uint32_t orderIndex = 0; orderIndex < ExecutionOrder.size(); ++orderIndex)
+	{
+		auto& pass = Passes[ExecutionOrder[orderIndex]];
+
+		FrameGraphContext_t context = {
+			.Gpu = Gpu,
+			.Graph = this,
+			.Encoder = encoder
+		};
+
+		wgpuCommandEncoderPushDebugGroup(encoder, pass.Name);
+
+		switch (pass.Type)
+		{
+		case FrameGraphPassType_t::Render:
+		{
+			ArenaVector_t<WGPURenderPassColorAttachment> colorAttachments = {};
+			colorAttachments.reserve(pass.ColorAttachments.size());
+
+			for (auto& attachment : pass.ColorAttachments)
+			{
+				WGPURenderPassColorAttachment colorAttachment = {
+					.view = Resources[attachment.Resource.Index].TextureView,
+					.resolveTarget = nullptr,
+					.loadOp = attachment.LoadOp,
+					.storeOp = GetStoreOp(attachment.Resource.Index, orderIndex),
+					.clearValue = attachment.ClearColor
+				};
+
+				colorAttachments.push_back(colorAttachment);
+			}
+
+			WGPURenderPassDepthStencilAttachment depthAttachment = {};
+			FrameGraphAttachment_t& depth = pass.DepthAttachment;
+
+			if (depth.Resource.IsValid())
+			{
+				depthAttachment = {
+					.view = Resources[depth.Resource.Index].TextureView,
+
+					.depthLoadOp = depth.IsReadOnly ? WGPULoadOp_Undefined : depth.LoadOp,
+					.depthStoreOp = depth.IsReadOnly ? WGPUStoreOp_Undefined : GetStoreOp(depth.Resource.Index, orderIndex),
+					.depthClearValue = depth.ClearDepth,
+					.depthReadOnly = depth.IsReadOnly,
+
+					.stencilLoadOp = WGPULoadOp_Undefined,
+					.stencilStoreOp = WGPUStoreOp_Undefined,
+					.stencilClearValue = 0,
+					.stencilReadOnly = true
+				};
+			}
+
+			WGPURenderPassTimestampWrites timestampWrites = {};
+			bool isTimed = Gpu->Profiler->GetPassTimestampWrites(pass.Name, timestampWrites);
+
+			WGPURenderPassDescriptor renderPassDesc = {
+				.nextInChain = nullptr,
+				.label = pass.Name,
+				.colorAttachmentCount = colorAttachments.size(),
+				.colorAttachments = colorAttachments.data(),
+				.depthStencilAttachment = depth.Resource.IsValid() ? &depthAttachment : nullptr,
+				.timestampWrites = isTimed ? &timestampWrites : nullptr
+			};
+
+			context.RenderPass = wgpuCommandEncoderBeginRenderPass(encoder, &renderPassDesc);
+			pass.ExecuteFunc(context);
+			wgpuRenderPassEncoderEnd(context.RenderPass);
+			wgpuRenderPassEncoderRelease(context.RenderPass);
+			break;
+		}
+		case FrameGraphPassType_t::Compute:
+		{
+			WGPUComputePassTimestampWrites timestampWrites = {};
+			bool isTimed = Gpu->Profiler->GetPassTimestampWrites(pass.Name, timestampWrites);
+
+			WGPUComputePassDescriptor computePassDesc = {
+				.nextInChain = nullptr,
+				.label = pass.Name,
+				.timestampWrites = isTimed ? &timestampWrites : nullptr
+			};
+
+			context.ComputePass = wgpuCommandEncoderBeginComputePass(encoder, &computePassDesc);
+			pass.ExecuteFunc(context);
+			wgpuComputePassEncoderEnd(context.ComputePass);
+			wgpuComputePassEncoderRelease(context.ComputePass);
+			break;
+		}
+		case FrameGraphPassType_t::Transfer:
+			// Timestamps on the encoder, around whatever the pass records
+			context.BeginScope(pass.Name);
+			pass.ExecuteFunc(context);
+			context.EndScope();
+			break;
+		}
+
+		wgpuCommandEncoderPopDebugGroup(encoder);
+	}
+}
+
+void FrameGraph_t::Destroy()
+{
+	Resources.clear();
+	Passes.clear();
+	ExecutionOrder.clear();
+
+	// Everything counts as stale
+	FrameIndex += (uint64_t)MaxIdleFrames + MaxRetainedIdleFrames + 1;
+
+	for (auto& texture : TexturePool)
+		texture.IsInUse = false;
+
+	for (auto& buffer : BufferPool)
+		buffer.IsInUse = false;
+
+	TrimPools();
+}
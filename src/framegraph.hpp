@@ -0,0 +1,275 @@
+#pragma once
+
+#include "arena.hpp"
+
+#include <webgpu/webgpu.h>
+
+#include <concepts>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+struct GraphicsDevice_t;
+struct FrameGraph_t;
+
+/*
+ * Handle to a texture or buffer declared in the frame graph
+ */
+struct FrameGraphResource_t
+{
+	uint32_t Index												= UINT32_MAX;
+
+	bool IsValid() const										{ return Index != UINT32_MAX; }
+};
+
+/*
+ *
+ */
+struct FrameGraphTextureDesc_t
+{
+	uint32_t Width												= 0;
+	uint32_t Height												= 0;
+	WGPUTextureFormat Format									= WGPUTextureFormat_Undefined;
+	WGPUTextureUsageFlags Usage									= WGPUTextureUsage_RenderAttachment;
+
+	bool operator==(const FrameGraphTextureDesc_t& other) const = default;
+};
+
+/*
+ *
+ */
+struct FrameGraphBufferDesc_t
+{
+	uint64_t Size												= 0;
+	WGPUBufferUsageFlags Usage									= WGPUBufferUsage_Storage;
+
+	bool operator==(const FrameGraphBufferDesc_t& other) const	= default;
+};
+
+enum class FrameGraphPassType_t
+{
+	Render,		// Graph begins a render pass with the declared attachments
+	Compute,	// Graph begins a compute pass
+	Transfer	// Raw access to the command encoder (copies, resolves)
+};
+
+/*
+ * Everything a pass gets to see while it executes
+ */
+struct FrameGraphContext_t
+{
+	GraphicsDevice_t* Gpu										= nullptr;
+	FrameGraph_t* Graph											= nullptr;
+
+	WGPUCommandEncoder Encoder									= nullptr;
+	WGPURenderPassEncoder RenderPass							= nullptr;
+	WGPUComputePassEncoder ComputePass							= nullptr;
+
+	WGPUTexture GetTexture(FrameGraphResource_t resource);
+	WGPUTextureView GetTextureView(FrameGraphResource_t resource);
+	WGPUBuffer GetBuffer(FrameGraphResource_t resource);
+
+	// Named GPU timing within the pass, on top of the pass' own; name has to be a literal
+	void BeginScope(const char* name);
+	void EndScope();
+};
+
+/*
+ * What a pass runs. Works like std::function, except the callable is copied into the frame arena
+ * instead of the heap and never destroyed, so captures have to be trivially destructible (pointers,
+ * handles and plain values rather than owners)
+ */
+struct FrameGraphExecuteFunc_t
+{
+private:
+	void* Callable												= nullptr;
+	void (*Invoke)(void* callable, FrameGraphContext_t& context) = nullptr;
+
+public:
+	FrameGraphExecuteFunc_t() = default;
+
+	template <typename F>
+		requires std::invocable<F&, FrameGraphContext_t&> && (!std::same_as<F, FrameGraphExecuteFunc_t>)
+	FrameGraphExecuteFunc_t(F function)
+	{
+		static_assert(std::is_trivially_destructible_v<F>, "Pass callables live in the frame arena and are never destroyed");
+
+		Callable = new (FrameArena::Get().Allocate<F>(1)) F(std::move(function));
+		Invoke = [](void* callable, FrameGraphContext_t& context) { (*(F*)callable)(context); };
+	}
+
+	void operator()(FrameGraphContext_t& context) const			{ Invoke(Callable, context); }
+};
+
+/*
+ *
+ */
+struct FrameGraphAttachment_t
+{
+	FrameGraphResource_t Resource								= {};
+	WGPULoadOp LoadOp											= WGPULoadOp_Clear;
+	WGPUColor ClearColor										= { 0.0, 0.0, 0.0, 1.0 };
+	float ClearDepth											= 1.0f;
+	bool IsReadOnly												= false;
+};
+
+/*
+ * Used to declare what a pass reads and writes
+ */
+struct FrameGraphPassBuilder_t
+{
+private:
+	FrameGraph_t* Graph											= nullptr;
+	uint32_t PassIndex											= 0;
+
+public:
+	FrameGraphPassBuilder_t(FrameGraph_t* graph, uint32_t passIndex) : Graph(graph), PassIndex(passIndex) {}
+
+	// Sampled textures, uniform/storage buffers read by this pass
+	FrameGraphPassBuilder_t& Read(FrameGraphResource_t resource);
+
+	// Storage textures/buffers or copy destinations written by this pass
+	FrameGraphPassBuilder_t& Write(FrameGraphResource_t resource);
+
+	// Render passes only
+	FrameGraphPassBuilder_t& WriteColor(FrameGraphResource_t resource, WGPULoadOp loadOp, WGPUColor clearColor = { 0.0, 0.0, 0.0, 1.0 });
+	FrameGraphPassBuilder_t& WriteDepth(FrameGraphResource_t resource, WGPULoadOp loadOp, float clearDepth = 1.0f);
+	FrameGraphPassBuilder_t& ReadDepth(FrameGraphResource_t resource);
+
+	// Never cull this pass, even if nothing reads its output (readbacks, queries)
+	FrameGraphPassBuilder_t& SetSideEffects();
+};
+
+/*
+ * Builds, culls and schedules a frame's passes, and backs transient resources with pooled GPU objects.
+ *
+ * The graph is rebuilt every frame:
+ *   Reset() -> Create/Import resources, AddPass() -> Compile() -> Execute()
+ *
+ * WebGPU has no placed resources, so aliasing is done at the object level: transient resources with
+ * matching descriptors and non-overlapping lifetimes share one physical texture or buffer. Physical
+ * objects stay pooled across frames and are only released after going unused for a while.
+ */
+struct FrameGraph_t
+{
+private:
+	friend struct FrameGraphPassBuilder_t;
+	friend struct FrameGraphContext_t;
+
+	// Names are only kept as pointers, so they have to be literals (or otherwise outlive the frame)
+	struct ResourceNode_t
+	{
+		const char* Name										= nullptr;
+		bool IsTexture											= true;
+		bool IsImported											= false;
+
+		FrameGraphTextureDesc_t TextureDesc						= {};
+		FrameGraphBufferDesc_t BufferDesc						= {};
+
+		// Imported objects, or the physical object assigned at compile time
+		WGPUTexture Texture										= nullptr;
+		WGPUTextureView TextureView								= nullptr;
+		WGPUBuffer Buffer										= nullptr;
+
+		uint32_t RefCount										= 0;
+		uint32_t FirstUse										= UINT32_MAX;
+		uint32_t LastUse										= 0;
+		size_t PhysicalIndex									= SIZE_MAX;
+	};
+
+	struct PassNode_t
+	{
+		const char* Name										= nullptr;
+		FrameGraphPassType_t Type								= FrameGraphPassType_t::Render;
+		FrameGraphExecuteFunc_t ExecuteFunc						= {};
+		bool HasSideEffects										= false;
+
+		// In the frame arena, like everything else declared during the frame
+		ArenaVector_t<uint32_t> Reads							= {};
+		ArenaVector_t<uint32_t> Writes							= {};
+
+		ArenaVector_t<FrameGraphAttachment_t> ColorAttachments	= {};
+		FrameGraphAttachment_t DepthAttachment					= {};
+
+		uint32_t RefCount										= 0;
+		bool IsCulled											= false;
+	};
+
+	struct PhysicalTexture_t
+	{
+		FrameGraphTextureDesc_t Desc							= {};
+		WGPUTexture Texture										= nullptr;
+		WGPUTextureView TextureView								= nullptr;
+		uint64_t LastUsedFrame									= 0;
+		uint64_t LastUsedResize									= 0;
+		bool IsInUse											= false;
+	};
+
+	struct PhysicalBuffer_t
+	{
+		FrameGraphBufferDesc_t Desc								= {};
+		WGPUBuffer Buffer										= nullptr;
+		uint64_t LastUsedFrame									= 0;
+		bool IsInUse											= false;
+	};
+
+	GraphicsDevice_t* Gpu										= nullptr;
+	uint64_t FrameIndex											= 0;
+
+	// Output resizes so far
+	uint64_t ResizeIndex										= 0;
+
+	std::vector<ResourceNode_t> Resources						= {};
+	std::vector<PassNode_t> Passes								= {};
+	std::vector<uint32_t> ExecutionOrder						= {};
+
+	std::vector<PhysicalTexture_t> TexturePool					= {};
+	std::vector<PhysicalBuffer_t> BufferPool					= {};
+
+	void CullPasses();
+	void SchedulePasses();
+	void AllocateResources();
+
+	size_t AcquireTexture(const ResourceNode_t& resource);
+	size_t AcquireBuffer(const ResourceNode_t& resource);
+	void TrimPools();
+
+	WGPUStoreOp GetStoreOp(uint32_t resource, uint32_t orderIndex);
+
+public:
+	// Pooled objects unused for this many frames get released
+	uint32_t MaxIdleFrames										= 120;
+
+	// Textures last used at one of the previous RetainedResizeCount output sizes are kept this long
+	// instead, so toggling back to a size doesn't reallocate everything
+	uint32_t RetainedResizeCount								= 1;
+	uint32_t MaxRetainedIdleFrames								= 3600;
+
+	void Init(GraphicsDevice_t* gpu)							{ Gpu = gpu; }
+
+	// The output changed size; the previous size's targets stay pooled for a while
+	void OnResize()												{ ResizeIndex++; }
+
+	// Start building a new frame
+	void Reset();
+
+	FrameGraphResource_t CreateTexture(const char* name, FrameGraphTextureDesc_t desc);
+	FrameGraphResource_t CreateBuffer(const char* name, FrameGraphBufferDesc_t desc);
+
+	// Resources owned outside the graph; these are always considered outputs
+	FrameGraphResource_t ImportTexture(const char* name, WGPUTexture texture, WGPUTextureView textureView, FrameGraphTextureDesc_t desc);
+	FrameGraphResource_t ImportBuffer(const char* name, WGPUBuffer buffer, FrameGraphBufferDesc_t desc);
+
+	FrameGraphPassBuilder_t AddPass(const char* name, FrameGraphPassType_t type, FrameGraphExecuteFunc_t executeFunc);
+
+	// Cull, order and allocate
+	void Compile();
+
+	// Record every surviving pass into the encoder
+	void Execute(WGPUCommandEncoder encoder);
+
+	const FrameGraphTextureDesc_t& GetTextureDesc(FrameGraphResource_t resource) { return Resources[resource.Index].TextureDesc; }
+
+	void Destroy();
+};
@@ -0,0 +1,226 @@
+#include "frames.hpp"
+#include "resources.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+void FramesInFlight_t::Init(GraphicsDevice_t* gpu, uint32_t count)
+{
+	Gpu = gpu;
+	Count = std::clamp(count, 1u, MaxCount);
+
+	for (Frame_t& frame : Frames)
+		frame.Owner = this;
+}
+
+void FramesInFlight_t::SetCount(uint32_t count)
+{
+	assert(!Current && "Can't change the frame count mid-frame");
+
+	// Slots get reassigned, so nothing may still be using them
+	WaitIdle();
+
+	Count = std::clamp(count, 1u, MaxCount);
+}
+
+void FramesInFlight_t::CreateStagingBuffer(Frame_t& frame, uint64_t size)
+{
+	WGPUBufferDescriptor stagingBufferDesc = {
+		.nextInChain = nullptr,
+		.label = "Frame staging buffer",
+		.usage = WGPUBufferUsage_MapWrite | WGPUBufferUsage_CopySrc,
+		.size = size,
+		.mappedAtCreation = true
+	};
+
+	WGPUBuffer buffer = Resources::Track(wgpuDeviceCreateBuffer(Gpu->Device, &stagingBufferDesc), stagingBufferDesc.label, MemoryCategory_t::Staging, size);
+	uint8_t* data = (uint8_t*)wgpuBufferGetMappedRange(buffer, 0, size);
+
+	// Uploads already made this frame move over; the GPU isn't using the old buffer, the frame is ours
+	if (frame.StagingData && frame.StagingUsed > 0)
+		memcpy(data, frame.StagingData, frame.StagingUsed);
+
+	Resources::Release(frame.StagingBuffer);
+
+	frame.StagingBuffer = buffer;
+	frame.StagingSize = size;
+	frame.StagingData = data;
+}
+
+void FramesInFlight_t::WaitForFrame(Frame_t& frame)
+{
+	WaitUntil([&frame]() { return frame.IsAvailable(); });
+}
+
+void FramesInFlight_t::WaitUntil(const std::function<bool()>& isDone)
+{
+	uint32_t tickCount = 0;
+	double sleep = MinWaitSleep;
+
+	while (!isDone())
+	{
+		wgpuDeviceTick(Gpu->Device);
+
+		if (isDone())
+			break;
+
+		// The frame before is usually close to done, so only start sleeping once it clearly isn't
+		if (++tickCount < WaitSpinCount)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+
+		std::this_thread::sleep_for(std::chrono::duration<double>(sleep));
+		sleep = std::min(sleep * 2.0, MaxWaitSleep);
+	}
+}
+
+void FramesInFlight_t::OnWorkDone(WGPUQueueWorkDoneStatus status, void* userData)
+{
+	Frame_t& frame = *(Frame_t*)userData;
+	frame.IsGpuBusy = false;
+	frame.Owner->CompletedFrameCount = std::max(frame.Owner->CompletedFrameCount, frame.Index + 1);
+
+	// Map the staging buffer again right away, so it's ready by the time the slot comes around
+	if (frame.StagingBuffer && !frame.StagingData)
+	{
+		frame.IsMapPending = true;
+		wgpuBufferMapAsync(frame.StagingBuffer, WGPUMapMode_Write, 0, frame.StagingSize, OnStagingMapped, &frame);
+	}
+}
+
+void FramesInFlight_t::OnStagingMapped(WGPUBufferMapAsyncStatus status, void* userData)
+{
+	Frame_t& frame = *(Frame_t*)userData;
+
+	// A failed map leaves the data null, and the next upload replaces the buffer
+	if (status == WGPUBufferMapAsyncStatus_Success)
+		frame.StagingData = (uint8_t*)wgpuBufferGetMappedRange(frame.StagingBuffer, 0, frame.StagingSize);
+
+	frame.IsMapPending = false;
+}
+
+void FramesInFlight_t::BeginFrame()
+{
+	assert(!Current && "BeginFrame without Submit");
+
+	Current = &Frames[GetFrameSlot()];
+
+	// Usually done already; only blocks when the CPU is a full Count frames ahead
+	WaitForFrame(*Current);
+}
+
+void* FramesInFlight_t::Upload(WGPUBuffer destination, uint64_t offset, uint64_t size)
+{
+	assert(Current && "Uploads have to happen between BeginFrame and Submit");
+	assert(offset % 4 == 0 && size % 4 == 0);
+
+	Frame_t& frame = *Current;
+
+	uint64_t stagingOffset = (frame.StagingUsed + UploadAlignment - 1) & ~(UploadAlignment - 1);
+	uint64_t stagingEnd = stagingOffset + size;
+
+	if (!frame.StagingData || stagingEnd > frame.StagingSize)
+	{
+		uint64_t stagingSize = std::max(frame.StagingSize, MinStagingSize);
+
+		while (stagingSize < stagingEnd)
+			stagingSize *= 2;
+
+		CreateStagingBuffer(frame, stagingSize);
+	}
+
+	frame.StagingUsed = stagingEnd;
+	frame.Uploads.push_back({
+		.Destination = destination,
+		.DestinationOffset = offset,
+		.StagingOffset = stagingOffset,
+		.Size = size
+	});
+
+	return frame.StagingData + stagingOffset;
+}
+
+void FramesInFlight_t::WriteBuffer(WGPUBuffer destination, uint64_t offset, const void* data, uint64_t size)
+{
+	memcpy(Upload(destination, offset, size), data, size);
+}
+
+void FramesInFlight_t::Submit(WGPUCommandBuffer commands)
+{
+	assert(Current && "Submit without BeginFrame");
+
+	Frame_t& frame = *Current;
+
+	WGPUCommandBuffer commandBuffers[2] = {};
+	uint32_t commandBufferCount = 0;
+
+	//
+	// Uploads; the staging buffer has to be unmapped before the GPU may copy out of it
+	//
+	if (!frame.Uploads.empty())
+	{
+		wgpuBufferUnmap(frame.StagingBuffer);
+		frame.StagingData = nullptr;
+
+		WGPUCommandEncoderDescriptor encoderDesc = {
+			.nextInChain = nullptr,
+			.label = "Frame upload encoder"
+		};
+		WGPUCommandEncoder encoder = wgpuDeviceCreateCommandEncoder(Gpu->Device, &encoderDesc);
+
+		for (const Upload_t& upload : frame.Uploads)
+			wgpuCommandEncoderCopyBufferToBuffer(encoder, frame.StagingBuffer, upload.StagingOffset, upload.Destination, upload.DestinationOffset, upload.Size);
+
+		WGPUCommandBufferDescriptor cmdBufferDescriptor = {
+			.nextInChain = nullptr,
+			.label = "Frame upload command buffer"
+		};
+		commandBuffers[commandBufferCount++] = wgpuCommandEncoderFinish(encoder, &cmdBufferDescriptor);
+
+		wgpuCommandEncoderRelease(encoder);
+
+		frame.Uploads.clear();
+		frame.StagingUsed = 0;
+	}
+
+	commandBuffers[commandBufferCount++] = commands;
+
+	wgpuQueueSubmit(Gpu->Queue, commandBufferCount, commandBuffers);
+
+	if (commandBufferCount > 1)
+		wgpuCommandBufferRelease(commandBuffers[0]);
+
+	//
+	// Track completion
+	//
+	frame.Index = FrameIndex;
+	frame.IsGpuBusy = true;
+	wgpuQueueOnSubmittedWorkDone(Gpu->Queue, OnWorkDone, &frame);
+
+	Current = nullptr;
+	FrameIndex++;
+}
+
+void FramesInFlight_t::WaitIdle()
+{
+	for (Frame_t& frame : Frames)
+		WaitForFrame(frame);
+}
+
+void FramesInFlight_t::Destroy()
+{
+	WaitIdle();
+
+	for (Frame_t& frame : Frames)
+	{
+		Resources::Release(frame.StagingBuffer);
+		frame = {};
+	}
+
+	Current = nullptr;
+}
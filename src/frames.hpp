@@ -0,0 +1,125 @@
+#pragma once
+
+#include "gpu.hpp"
+
+#include <webgpu/webgpu.h>
+
+#include <functional>
+#include <vector>
+
+/*
+ * Frames in flight.
+ *
+ * The CPU runs up to Count frames ahead of the GPU. Each of those frames gets its own resource set,
+ * which is only handed out again once wgpuQueueOnSubmittedWorkDone says the GPU is done with the frame
+ * that used it last, so building frame N + 1 never touches anything frame N still reads.
+ *
+ * Per-frame uploads go through the set's staging buffer: the CPU writes straight into mapped memory
+ * and the copies into place are submitted ahead of the frame's own commands. That replaces
+ * wgpuQueueWriteBuffer, which has to copy the data again (or wait) because it can't know when the
+ * destination is free.
+ */
+struct FramesInFlight_t
+{
+public:
+	static constexpr uint32_t MaxCount							= 3;
+
+	// Staging buffers start this big and double when a frame outgrows them
+	static constexpr uint64_t MinStagingSize					= 256 * 1024;
+
+	// Offset alignment of every upload; copies only need 4 bytes, this keeps uniform structs on their binding alignment
+	static constexpr uint64_t UploadAlignment					= 256;
+
+	// Waits tick the device this many times back to back, then sleep between ticks, doubling up
+	// to the longest sleep; in seconds
+	static constexpr uint32_t WaitSpinCount						= 16;
+	static constexpr double MinWaitSleep						= 0.0001;
+	static constexpr double MaxWaitSleep						= 0.001;
+
+private:
+	/*
+	 * Copy from the staging buffer into a GPU buffer, run before the frame's commands
+	 */
+	struct Upload_t
+	{
+		WGPUBuffer Destination									= nullptr;
+		uint64_t DestinationOffset								= 0;
+		uint64_t StagingOffset									= 0;
+		uint64_t Size											= 0;
+	};
+
+	/*
+	 * One frame's resource set
+	 */
+	struct Frame_t
+	{
+		FramesInFlight_t* Owner									= nullptr;
+
+		// Frame that last used the slot
+		uint64_t Index											= 0;
+
+		WGPUBuffer StagingBuffer								= nullptr;
+		uint64_t StagingSize									= 0;
+		uint64_t StagingUsed									= 0;
+
+		// Null while unmapped
+		uint8_t* StagingData									= nullptr;
+
+		std::vector<Upload_t> Uploads							= {};
+
+		// Submitted and not done on the GPU yet, and staging buffer on its way back to the CPU
+		bool IsGpuBusy											= false;
+		bool IsMapPending										= false;
+
+		bool IsAvailable()										{ return !IsGpuBusy && !IsMapPending; }
+	};
+
+	GraphicsDevice_t* Gpu										= nullptr;
+
+	uint32_t Count												= 2;
+	Frame_t Frames[MaxCount]									= {};
+
+	// Frames begun so far; the current one uses slot FrameIndex % Count
+	uint64_t FrameIndex											= 0;
+	Frame_t* Current											= nullptr;
+
+	// Frames the GPU has finished; they complete in submission order
+	uint64_t CompletedFrameCount								= 0;
+
+	void CreateStagingBuffer(Frame_t& frame, uint64_t size);
+	void WaitForFrame(Frame_t& frame);
+
+	static void OnWorkDone(WGPUQueueWorkDoneStatus status, void* userData);
+	static void OnStagingMapped(WGPUBufferMapAsyncStatus status, void* userData);
+
+public:
+	void Init(GraphicsDevice_t* gpu, uint32_t count = 2);
+
+	// 1 to MaxCount; waits for the GPU to go idle first
+	void SetCount(uint32_t count);
+	uint32_t GetCount()											{ return Count; }
+
+	// Which resource set the current frame uses, for modules that keep per-frame copies of their own
+	uint32_t GetFrameSlot()										{ return (uint32_t)(FrameIndex % Count); }
+	uint64_t GetFrameIndex()									{ return FrameIndex; }
+
+	// Every frame with an index below this is done on the GPU
+	uint64_t GetCompletedFrameCount()							{ return CompletedFrameCount; }
+
+	// Blocks until the GPU is done with the frame that last used this slot
+	void BeginFrame();
+
+	// Memory that gets copied to destination before this frame's commands run; only valid until the next call
+	void* Upload(WGPUBuffer destination, uint64_t offset, uint64_t size);
+	void WriteBuffer(WGPUBuffer destination, uint64_t offset, const void* data, uint64_t size);
+
+	// Submit the uploads followed by commands, and start tracking the frame
+	void Submit(WGPUCommandBuffer commands);
+
+	void WaitIdle();
+
+	// Ticks the device until isDone holds, for callbacks only a tick delivers; backs off, so a long wait doesn't hold a core
+	void WaitUntil(const std::function<bool()>& isDone);
+
+	void Destroy();
+};
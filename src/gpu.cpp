@@ -1,9 +1,28 @@
 #include "gpu.hpp"
+#include "arena.hpp"
+#include "budget.hpp"
+#include "capture.hpp"
+#include "deferred.hpp"
+#include "framegraph.hpp"
+#include "frames.hpp"
+#include "jobs.hpp"
+#include "lighting.hpp"
+#include "pacing.hpp"
+#include "profiler.hpp"
+#include "renderqueue.hpp"
+#include "resolution.hpp"
+#include "resources.hpp"
+#include "shadows.hpp"
+#include "upload.hpp"
+#include "visibility.hpp"
 #include "window.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <cfloat>
 #include <vector>
 #include <iostream>
+#include <string>
 
 #define TINYGLTF_IMPLEMENTATION
 #define TINYGLTF_NO_INCLUDE_JSON
@@ -20,9 +39,33 @@
 
 static Model_t* Model = {};
 static Camera_t* Camera = {};
+static RenderQueue_t* RenderQueue = {};
+static FrameGraph_t* FrameGraph = {};
+static Lighting_t* Lighting = {};
+static DeferredRenderer_t* Deferred = {};
+static VisibilityRenderer_t* Visibility = {};
+static DynamicResolution_t* DynamicResolution = {};
+static FramePacer_t* Pacer = {};
+static FrameCapture_t* Capture = {};
+static MemoryBudget_t* Budget = {};
 static WGPUTextureFormat DepthTextureFormat = WGPUTextureFormat_Depth24Plus;
+static WGPUTextureFormat ColorTextureFormat = WGPUTextureFormat_BGRA8Unorm;
 static float Frame = 0;
 
+static DepthPrepassMode_t DepthPrepassMode = DepthPrepassMode_t::Auto;
+static ShadingPath_t ShadingPath = ShadingPath_t::Forward;
+
+// Closed meshes rendered without culling sit at ~2 (front + back faces), anything above that overlaps itself
+static float DepthPrepassOverdrawThreshold = 2.5f;
+
+// Window size the swap chain is about to follow, and when the window took it on
+static glm::ivec2 PendingWindowSize = {};
+static double PendingWindowSizeTime = 0.0;
+
+// Seconds a new window size has to hold before anything gets recreated; dragging a window edge
+// would otherwise reallocate every target on every event
+static double ResizeDebounceTime = 0.15;
+
 WGPUAdapter RequestAdapter(WGPUInstance instance, WGPURequestAdapterOptions const* options)
 {
 	struct Data
@@ -96,46 +139,58 @@ WGPUInstance CreateInstance()
 	return instance;
 }
 
-WGPUSwapChain CreateSwapChain(WGPUDevice device, CWindow* window)
+// Dawn falls back to Fifo when the surface doesn't support the requested present mode
+WGPUSwapChain CreateSwapChain(GraphicsDevice_t* gpu)
 {
 	WGPUSwapChainDescriptor swapchainDesc = {
 		.nextInChain = nullptr,
-		.usage = WGPUTextureUsage_RenderAttachment,
-		.format = WGPUTextureFormat_BGRA8Unorm, // note: Dawn only supports this as swapchain right now, `wgpuSurfaceGetPreferredFormat` not implemented
-		.width = static_cast<unsigned int>(window->GetSize().x),
-		.height = static_cast<unsigned int>(window->GetSize().y),
-		.presentMode = WGPUPresentMode_Fifo
+		.usage = WGPUTextureUsage_RenderAttachment | WGPUTextureUsage_CopySrc, // Copied from for captures
+		.format = ColorTextureFormat, // note: Dawn only supports this as swapchain right now, `wgpuSurfaceGetPreferredFormat` not implemented
+		.width = (uint32_t)gpu->Width,
+		.height = (uint32_t)gpu->Height,
+		.presentMode = gpu->PresentMode
 	};
 
-	WGPUSurface surface = window->GetSurface();
-	WGPUSwapChain swapChain = wgpuDeviceCreateSwapChain(device, surface, &swapchainDesc);
+	WGPUSwapChain swapChain = wgpuDeviceCreateSwapChain(gpu->Device, gpu->Surface, &swapchainDesc);
 
 	return swapChain;
 }
 
-WGPUShaderModule CreateShader(WGPUDevice device)
+void RecreateSwapChain(GraphicsDevice_t* gpu)
+{
+	// Frames still in flight keep the old swap chain's textures alive until they're done with them
+	wgpuSwapChainRelease(gpu->SwapChain);
+	gpu->SwapChain = CreateSwapChain(gpu);
+}
+
+WGPUShaderModule CreateShader(GraphicsDevice_t* gpu)
 {
 	// todo: move
-	const char* shaderSource = R"(
+	const char* meshShaderSource = R"(
 		struct UniformBuffer {
 			modelMatrix: mat4x4f,
+			normalMatrix: mat4x4f,
+			instanceId: u32
+		};
+
+		struct CameraUniforms {
 			viewProjMatrix: mat4x4f,
 			cameraPosition: vec3f
 		};
 
 		@group(0) @binding(0) var<uniform> uConstants: UniformBuffer;
-		@group(0) @binding(1) var mainSampler: sampler;
-
-		@group(0) @binding(2) var colorTexture: texture_2d<f32>;
-		@group(0) @binding(3) var aoTexture: texture_2d<f32>;
-		@group(0) @binding(4) var emissiveTexture: texture_2d<f32>;
-		@group(0) @binding(5) var metalRoughnessTexture: texture_2d<f32>;
-		@group(0) @binding(6) var normalTexture: texture_2d<f32>;
+		@group(0) @binding(1) var<uniform> uCamera: CameraUniforms;
 
-		const lightPosition: vec3f = vec3f(0.0, 5.0, 1.0);
+		@group(1) @binding(0) var mainSampler: sampler;
+		@group(1) @binding(1) var colorTexture: texture_2d<f32>;
+		@group(1) @binding(2) var aoTexture: texture_2d<f32>;
+		@group(1) @binding(3) var emissiveTexture: texture_2d<f32>;
+		@group(1) @binding(4) var metalRoughnessTexture: texture_2d<f32>;
+		@group(1) @binding(5) var normalTexture: texture_2d<f32>;
 
+		// Invariant so that the depth prepass and the main pass produce bit-identical depth
 		struct VertexOutput {
-			@builtin(position) position: vec4f,
+			@builtin(position) @invariant position: vec4f,
 			@location(0) uv: vec2f,
 			@location(1) normal: vec3f,
 			@location(2) tangent: vec3f,
@@ -147,19 +202,24 @@ WGPUShaderModule CreateShader(WGPUDevice device)
 		fn vs_main(@location(0) position: vec3f, @location(1) uv: vec2f, @location(2) normal: vec3f, @location(3) tangent: vec3f) -> VertexOutput
 		{
 			var out : VertexOutput;
-			out.position = uConstants.viewProjMatrix * uConstants.modelMatrix * vec4f(position, 1.0);
+			out.position = uCamera.viewProjMatrix * uConstants.modelMatrix * vec4f(position, 1.0);
 			out.uv = uv * vec2f(1, 1);
 
-			out.normal = normal;
-			out.tangent = tangent;
-			out.bitangent = cross(normal, tangent);
+			out.normal = (uConstants.normalMatrix * vec4f(normal, 0.0)).xyz;
+			out.tangent = (uConstants.modelMatrix * vec4f(tangent, 0.0)).xyz;
+			out.bitangent = cross(out.normal, out.tangent);
 			out.fragPos = (uConstants.modelMatrix * vec4f(position, 1.0)).xyz;
 
 			return out;
 		}
 
-		@fragment
-		fn fs_main(in: VertexOutput) -> @location(0) vec4f
+		@vertex
+		fn vs_depth(@location(0) position: vec3f) -> @builtin(position) @invariant vec4f
+		{
+			return uCamera.viewProjMatrix * uConstants.modelMatrix * vec4f(position, 1.0);
+		}
+
+		fn SampleSurface(in: VertexOutput) -> Surface
 		{
 			let normalMap: vec3f = textureSample(normalTexture, mainSampler, in.uv).rgb;
 			let tangentNormal: vec3f = normalMap * 2.0 - 1.0;
@@ -168,50 +228,96 @@ WGPUShaderModule CreateShader(WGPUDevice device)
 			let B = normalize(in.bitangent);
 			let N = normalize(in.normal);
 			let TBN = mat3x3f(T, B, N); // Tangent, Bitangent, Normal matrix
-			let worldNormal: vec3f = normalize(TBN * tangentNormal);
 
-			let L: vec3f = normalize(lightPosition - in.fragPos);
-		    let V: vec3f = normalize(uConstants.cameraPosition - in.fragPos);
-			let H: vec3f = normalize(L + V);
-	
-			let diffuse: f32 = max(dot(worldNormal, L), 0.0);
-			let ambient: f32 = 0.1f;
-			
 			let textureColor: vec4f = textureSample(colorTexture, mainSampler, in.uv);
 			let emissiveColor: vec4f = textureSample(emissiveTexture, mainSampler, in.uv);
 			let aoColor: vec4f = textureSample(aoTexture, mainSampler, in.uv);
 			let metalRoughness: vec4f = textureSample(metalRoughnessTexture, mainSampler, in.uv);
-			let metalness: f32 = metalRoughness.b;
-			let roughness: f32 = metalRoughness.g;
-
-			var shadedColor: vec3f = textureColor.rgb * (diffuse + ambient);
-			shadedColor += emissiveColor.rgb;
-			shadedColor *= aoColor.r;
-
-			// Specular highlights (Blinn-Phong model)
-			let shininess: f32 = pow(2.0, (1.0 - roughness) * 10.0);
-			let specularIntensity: f32 = pow(max(dot(worldNormal, H), 0.0), shininess);
-			let specularColor: vec3f = vec3f(1.0, 1.0, 1.0) * specularIntensity;
-			shadedColor += specularColor;
+
+			var surface: Surface;
+			surface.position = in.fragPos;
+			surface.normal = normalize(TBN * tangentNormal);
+			surface.baseColor = textureColor.rgb;
+			surface.emissive = emissiveColor.rgb;
+			surface.ao = aoColor.r;
+			surface.metalness = metalRoughness.b;
+			surface.roughness = metalRoughness.g;
+
+			return surface;
+		}
+
+		@fragment
+		fn fs_main(in: VertexOutput) -> @location(0) vec4f
+		{
+			let shadedColor: vec3f = ShadeSurface(SampleSurface(in), in.position.xy, uCamera.cameraPosition);
 			
 			let linearColor = pow(shadedColor, vec3f(2.2));
 			return vec4f(shadedColor, 1.0);
 		}
+
+		// Blended over what's already there; coverage comes from the base color's alpha
+		@fragment
+		fn fs_transparent(in: VertexOutput) -> @location(0) vec4f
+		{
+			let alpha: f32 = textureSample(colorTexture, mainSampler, in.uv).a;
+			let shadedColor: vec3f = ShadeSurface(SampleSurface(in), in.position.xy, uCamera.cameraPosition);
+
+			return vec4f(shadedColor, alpha);
+		}
+
+		struct GBufferOutput {
+			@location(0) baseColorAo: vec4f,
+			@location(1) normalMetalRoughness: vec4f,
+			@location(2) emissive: vec4f
+		};
+
+		// Unit vector to the [-1, 1] square, folding the lower hemisphere over the diagonals
+		fn EncodeOctahedral(n: vec3f) -> vec2f
+		{
+			let p: vec2f = n.xy / (abs(n.x) + abs(n.y) + abs(n.z));
+
+			if (n.z >= 0.0)
+			{
+				return p;
+			}
+
+			return (1.0 - abs(p.yx)) * select(vec2f(-1.0), vec2f(1.0), p >= vec2f(0.0));
+		}
+
+		@fragment
+		fn fs_gbuffer(in: VertexOutput) -> GBufferOutput
+		{
+			let surface: Surface = SampleSurface(in);
+
+			var out: GBufferOutput;
+			out.baseColorAo = vec4f(surface.baseColor, surface.ao);
+			out.normalMetalRoughness = vec4f(EncodeOctahedral(surface.normal), surface.metalness, surface.roughness);
+			out.emissive = vec4f(surface.emissive, 1.0);
+
+			return out;
+		}
 	)";
 
+	std::string shaderSource = std::string(Lighting_t::GetShaderSource()) + meshShaderSource;
+
+	return Graphics::MakeShaderModule(gpu, shaderSource.c_str());
+}
+
+WGPUShaderModule Graphics::MakeShaderModule(GraphicsDevice_t* gpu, const char* source)
+{
 	WGPUShaderModuleWGSLDescriptor shaderCodeDesc = {
 		.chain = {
 			.next = nullptr,
 			.sType = WGPUSType_ShaderModuleWGSLDescriptor
 		},
-		.code = shaderSource
+		.code = source
 	};
 
 	WGPUShaderModuleDescriptor shaderDesc = {
 		.nextInChain = &shaderCodeDesc.chain
 	};
 
-	WGPUShaderModule shaderModule = wgpuDeviceCreateShaderModule(device, &shaderDesc);
+	WGPUShaderModule shaderModule = wgpuDeviceCreateShaderModule(gpu->Device, &shaderDesc);
 
 	return shaderModule;
 }
@@ -236,12 +342,12 @@ void SetDefaultBindGroupLayoutEntry(WGPUBindGroupLayoutEntry& bindingLayout)
 	bindingLayout.texture.viewDimension = WGPUTextureViewDimension_Undefined;
 }
 
-WGPUBindGroupEntry CreateTextureBindGroupEntry(Texture_t& texture, unsigned int binding)
+WGPUBindGroupEntry CreateTextureBindGroupEntry(Texture_t& texture, Texture_t& fallback, unsigned int binding)
 {
 	WGPUBindGroupEntry textureBinding = {
 		.nextInChain = nullptr,
 		.binding = binding,
-		.textureView = texture.TextureView
+		.textureView = texture.TextureView ? texture.TextureView : fallback.TextureView
 	};
 	
 	return WGPUBindGroupEntry(textureBinding);
@@ -270,8 +376,288 @@ void SetDefaultDepthStencilState(WGPUDepthStencilState& depthStencilState)
 	SetDefaultStencilFaceState(depthStencilState.stencilBack);
 }
 
+static WGPUVertexAttribute VertexAttributes[] = {
+	// Position
+	{
+		.format = WGPUVertexFormat_Float32x3,
+		.offset = 0,
+		.shaderLocation = 0,
+	},
+
+	// UV
+	{
+		.format = WGPUVertexFormat_Float32x2,
+		.offset = sizeof(glm::vec3),
+		.shaderLocation = 1,
+	},
+
+	// Normal
+	{
+		.format = WGPUVertexFormat_Float32x3,
+		.offset = sizeof(glm::vec3) + sizeof(glm::vec2),
+		.shaderLocation = 2,
+	},
+
+	// Tangent
+	{
+		.format = WGPUVertexFormat_Float32x3,
+		.offset = sizeof(glm::vec3) + sizeof(glm::vec2) + sizeof(glm::vec3),
+		.shaderLocation = 3,
+	}
+};
+
+WGPUVertexBufferLayout GetVertexBufferLayout()
+{
+	WGPUVertexBufferLayout vertexBufferLayout = {
+		.arrayStride = sizeof(Vertex_t),
+		.stepMode = WGPUVertexStepMode_Vertex,
+		.attributeCount = sizeof(VertexAttributes) / sizeof(VertexAttributes[0]),
+		.attributes = VertexAttributes
+	};
+
+	return vertexBufferLayout;
+}
+
+void CreateMeshPipeline(GraphicsDevice_t* gpu)
+{
+	// Shader
+	WGPUShaderModule shaderModule = CreateShader(gpu);
+
+	// Pipeline
+	WGPUBlendState blendState = {
+		.color = {
+			.operation = WGPUBlendOperation_Add,
+			.srcFactor = WGPUBlendFactor_SrcAlpha,
+			.dstFactor = WGPUBlendFactor_OneMinusSrcAlpha
+		}
+	};
+
+	WGPUColorTargetState colorTarget = {
+		.format = ColorTextureFormat,
+		.blend = &blendState,
+		.writeMask = WGPUColorWriteMask_All
+	};
+
+	WGPUFragmentState fragmentState = {
+		.module = shaderModule,
+		.entryPoint = "fs_main",
+		.constantCount = 0,
+		.constants = nullptr,
+		.targetCount = 1,
+		.targets = &colorTarget
+	};
+
+	WGPUVertexBufferLayout vertexBufferLayout = GetVertexBufferLayout();
+
+	WGPUVertexState vertexState = {
+		.module = shaderModule,
+		.entryPoint = "vs_main",
+		.constantCount = 0,
+		.constants = nullptr,
+		.bufferCount = 1,
+		.buffers = &vertexBufferLayout
+	};
+
+	//
+	// Object layout: per-draw uniforms at a dynamic offset that changes every draw, plus the camera
+	//
+	WGPUBindGroupLayoutEntry objectBindingLayouts[2] = {};
+
+	WGPUBindGroupLayoutEntry& uniformBindingLayout = objectBindingLayouts[0];
+	SetDefaultBindGroupLayoutEntry(uniformBindingLayout);
+	uniformBindingLayout.binding = 0;
+	uniformBindingLayout.visibility = WGPUShaderStage_Vertex | WGPUShaderStage_Fragment;
+	uniformBindingLayout.buffer.type = WGPUBufferBindingType_Uniform;
+	uniformBindingLayout.buffer.hasDynamicOffset = true;
+	uniformBindingLayout.buffer.minBindingSize = sizeof(UniformBuffer_t);
+
+	WGPUBindGroupLayoutEntry& cameraBindingLayout = objectBindingLayouts[1];
+	SetDefaultBindGroupLayoutEntry(cameraBindingLayout);
+	cameraBindingLayout.binding = 1;
+	cameraBindingLayout.visibility = WGPUShaderStage_Vertex | WGPUShaderStage_Fragment;
+	cameraBindingLayout.buffer.type = WGPUBufferBindingType_Uniform;
+	cameraBindingLayout.buffer.minBindingSize = sizeof(CameraUniforms_t);
+
+	WGPUBindGroupLayoutDescriptor objectBindGroupLayoutDesc = {
+		.nextInChain = nullptr,
+		.entryCount = 2,
+		.entries = objectBindingLayouts
+	};
+
+	gpu->ObjectBindGroupLayout = Resources::Track(wgpuDeviceCreateBindGroupLayout(gpu->Device, &objectBindGroupLayoutDesc), "Object bind group layout");
+
+	//
+	// Material layout: sampler + textures, shared by every mesh using the material
+	//
+	std::vector<WGPUBindGroupLayoutEntry> materialBindingLayoutEntries(6);
+
+	WGPUBindGroupLayoutEntry& samplerBindingLayout = materialBindingLayoutEntries[0];
+	SetDefaultBindGroupLayoutEntry(samplerBindingLayout);
+	samplerBindingLayout.binding = 0;
+	samplerBindingLayout.visibility = WGPUShaderStage_Fragment;
+	samplerBindingLayout.sampler.type = WGPUSamplerBindingType_Filtering;
+
+	for (int i = 1; i <= 5; ++i)
+	{
+		WGPUBindGroupLayoutEntry& fragmentBindingLayout = materialBindingLayoutEntries[i];
+		SetDefaultBindGroupLayoutEntry(fragmentBindingLayout);
+		fragmentBindingLayout.binding = i;
+		fragmentBindingLayout.visibility = WGPUShaderStage_Fragment;
+		fragmentBindingLayout.texture.sampleType = WGPUTextureSampleType_Float;
+		fragmentBindingLayout.texture.viewDimension = WGPUTextureViewDimension_2D;
+	}
+
+	WGPUBindGroupLayoutDescriptor materialBindGroupLayoutDesc = {
+		.nextInChain = nullptr,
+		.entryCount = materialBindingLayoutEntries.size(),
+		.entries = materialBindingLayoutEntries.data()
+	};
+
+	gpu->MaterialBindGroupLayout = Resources::Track(wgpuDeviceCreateBindGroupLayout(gpu->Device, &materialBindGroupLayoutDesc), "Material bind group layout");
+
+	WGPUBindGroupLayout bindGroupLayouts[] = { gpu->ObjectBindGroupLayout, gpu->MaterialBindGroupLayout, gpu->LightingBindGroupLayout };
+
+	WGPUPipelineLayoutDescriptor layoutDesc = {
+		.nextInChain = nullptr,
+		.bindGroupLayoutCount = 3,
+		.bindGroupLayouts = bindGroupLayouts
+	};
+
+	WGPUPipelineLayout layout = wgpuDeviceCreatePipelineLayout(gpu->Device, &layoutDesc);
+
+	WGPUDepthStencilState depthStencilState = {};
+	SetDefaultDepthStencilState(depthStencilState);
+	depthStencilState.depthCompare = WGPUCompareFunction_Less;
+	depthStencilState.depthWriteEnabled = true;
+	depthStencilState.format = DepthTextureFormat;
+	depthStencilState.stencilReadMask = 0;
+	depthStencilState.stencilWriteMask = 0;
+
+	WGPURenderPipelineDescriptor pipelineDesc = {
+		.nextInChain = nullptr,
+		.layout = layout,
+		.vertex = vertexState,
+
+		.primitive = {
+			.topology = WGPUPrimitiveTopology_TriangleList,
+			.stripIndexFormat = WGPUIndexFormat_Undefined,
+			.frontFace = WGPUFrontFace_CCW,
+			.cullMode = WGPUCullMode_None
+		},
+
+		.depthStencil = &depthStencilState,
+		.multisample = {
+			.count = 1,
+			.mask = ~0u,
+			.alphaToCoverageEnabled = false
+		},
+		.fragment = &fragmentState
+	};
+
+	gpu->MeshPipeline = Resources::Track(wgpuDeviceCreateRenderPipeline(gpu->Device, &pipelineDesc), "Mesh pipeline");
+
+	//
+	// Main pass variant for meshes that went through the depth prepass: only the visible fragment gets shaded
+	//
+	depthStencilState.depthCompare = WGPUCompareFunction_Equal;
+	depthStencilState.depthWriteEnabled = false;
+
+	gpu->MeshDepthEqualPipeline = Resources::Track(wgpuDeviceCreateRenderPipeline(gpu->Device, &pipelineDesc), "Mesh depth equal pipeline");
+
+	//
+	// Transparent variant: blended over the opaque result, depth tested against it but never written
+	//
+	WGPUBlendState transparentBlendState = {
+		.color = blendState.color,
+		.alpha = {
+			.operation = WGPUBlendOperation_Add,
+			.srcFactor = WGPUBlendFactor_One,
+			.dstFactor = WGPUBlendFactor_OneMinusSrcAlpha
+		}
+	};
+
+	WGPUColorTargetState transparentTarget = colorTarget;
+	transparentTarget.blend = &transparentBlendState;
+
+	WGPUFragmentState transparentFragmentState = fragmentState;
+	transparentFragmentState.entryPoint = "fs_transparent";
+	transparentFragmentState.targets = &transparentTarget;
+
+	pipelineDesc.fragment = &transparentFragmentState;
+
+	depthStencilState.depthCompare = WGPUCompareFunction_Less;
+	depthStencilState.depthWriteEnabled = false;
+
+	gpu->MeshTransparentPipeline = Resources::Track(wgpuDeviceCreateRenderPipeline(gpu->Device, &pipelineDesc), "Mesh transparent pipeline");
+
+	//
+	// G-buffer variants for the deferred path: same inputs, the surface gets written out instead of lit
+	//
+	WGPUColorTargetState gBufferTargets[DeferredRenderer_t::GBufferCount] = {};
+
+	for (uint32_t i = 0; i < DeferredRenderer_t::GBufferCount; ++i)
+	{
+		gBufferTargets[i].format = DeferredRenderer_t::GBufferFormats[i];
+		gBufferTargets[i].blend = nullptr;
+		gBufferTargets[i].writeMask = WGPUColorWriteMask_All;
+	}
+
+	WGPUFragmentState gBufferFragmentState = fragmentState;
+	gBufferFragmentState.entryPoint = "fs_gbuffer";
+	gBufferFragmentState.targetCount = DeferredRenderer_t::GBufferCount;
+	gBufferFragmentState.targets = gBufferTargets;
+
+	pipelineDesc.fragment = &gBufferFragmentState;
+
+	depthStencilState.depthCompare = WGPUCompareFunction_Less;
+	depthStencilState.depthWriteEnabled = true;
+
+	gpu->MeshGBufferPipeline = Resources::Track(wgpuDeviceCreateRenderPipeline(gpu->Device, &pipelineDesc), "Mesh G-buffer pipeline");
+
+	depthStencilState.depthCompare = WGPUCompareFunction_Equal;
+	depthStencilState.depthWriteEnabled = false;
+
+	gpu->MeshGBufferDepthEqualPipeline = Resources::Track(wgpuDeviceCreateRenderPipeline(gpu->Device, &pipelineDesc), "Mesh G-buffer depth equal pipeline");
+
+	//
+	// Depth prepass: positions only, no fragment stage
+	//
+	WGPUVertexBufferLayout positionBufferLayout = {
+		.arrayStride = sizeof(glm::vec3),
+		.stepMode = WGPUVertexStepMode_Vertex,
+		.attributeCount = 1,
+		.attributes = &VertexAttributes[0]
+	};
+
+	WGPUPipelineLayoutDescriptor depthLayoutDesc = {
+		.nextInChain = nullptr,
+		.bindGroupLayoutCount = 1,
+		.bindGroupLayouts = &gpu->ObjectBindGroupLayout
+	};
+
+	WGPUPipelineLayout depthLayout = wgpuDeviceCreatePipelineLayout(gpu->Device, &depthLayoutDesc);
+
+	depthStencilState.depthCompare = WGPUCompareFunction_Less;
+	depthStencilState.depthWriteEnabled = true;
+
+	pipelineDesc.layout = depthLayout;
+	pipelineDesc.vertex.entryPoint = "vs_depth";
+	pipelineDesc.vertex.buffers = &positionBufferLayout;
+	pipelineDesc.fragment = nullptr;
+
+	gpu->DepthPrepassPipeline = Resources::Track(wgpuDeviceCreateRenderPipeline(gpu->Device, &pipelineDesc), "Depth prepass pipeline");
+
+	// The pipelines hold their own references
+	wgpuPipelineLayoutRelease(layout);
+	wgpuPipelineLayoutRelease(depthLayout);
+	wgpuShaderModuleRelease(shaderModule);
+}
+
 GraphicsDevice_t::GraphicsDevice_t(CWindow* window)
 {
+	// Loading already spreads over the workers
+	Jobs::Init();
+
 	//
 	// Instance
 	//
@@ -291,10 +677,25 @@ GraphicsDevice_t::GraphicsDevice_t(CWindow* window)
 	//
 	// Device
 	//
+	// Timestamps drive dynamic resolution; without them the scene just renders at the maximum scale
+	std::vector<WGPUFeatureName> requiredFeatures = {};
+
+	if (wgpuAdapterHasFeature(Adapter, WGPUFeatureName_TimestampQuery))
+		requiredFeatures.push_back(WGPUFeatureName_TimestampQuery);
+
+	// Lets the profiler time scopes within a pass, not just whole passes
+	if (wgpuAdapterHasFeature(Adapter, WGPUFeatureName_ChromiumExperimentalTimestampQueryInsidePasses))
+		requiredFeatures.push_back(WGPUFeatureName_ChromiumExperimentalTimestampQueryInsidePasses);
+
+	// Lets worker threads record render bundles
+	if (wgpuAdapterHasFeature(Adapter, WGPUFeatureName_ImplicitDeviceSynchronization))
+		requiredFeatures.push_back(WGPUFeatureName_ImplicitDeviceSynchronization);
+
 	WGPUDeviceDescriptor deviceDesc = {
 		.nextInChain = nullptr,
 		.label = "Main Device",
-		.requiredFeatureCount = 0,
+		.requiredFeatureCount = requiredFeatures.size(),
+		.requiredFeatures = requiredFeatures.data(),
 		.requiredLimits = nullptr,
 
 		.defaultQueue = {
@@ -304,6 +705,10 @@ GraphicsDevice_t::GraphicsDevice_t(CWindow* window)
 	};
 	Device = RequestDevice(Adapter, &deviceDesc);
 
+	HasTimestampQuery = wgpuDeviceHasFeature(Device, WGPUFeatureName_TimestampQuery);
+	HasTimestampQueryInsidePasses = wgpuDeviceHasFeature(Device, WGPUFeatureName_ChromiumExperimentalTimestampQueryInsidePasses);
+	IsMultithreaded = wgpuDeviceHasFeature(Device, WGPUFeatureName_ImplicitDeviceSynchronization);
+
 	//
 	// Error callback
 	//
@@ -322,54 +727,164 @@ GraphicsDevice_t::GraphicsDevice_t(CWindow* window)
 	//
 	Queue = wgpuDeviceGetQueue(Device);
 
+	Pacer = new FramePacer_t();
+
+	// Releases wait for the frames in flight, so the registry goes along with them
+	Resources::Init(this);
+
+	Frames = new FramesInFlight_t();
+	Frames->Init(this, Pacer->GetFramesInFlight());
+
+	Uploads = new UploadManager_t();
+	Uploads->Init(this);
+
+	Profiler = new GpuProfiler_t();
+	Profiler->Init(this);
+
 	//
 	// Swapchain
 	//
-	SwapChain = CreateSwapChain(Device, window);
+	Width = window->GetSize().x;
+	Height = window->GetSize().y;
+	SwapChain = CreateSwapChain(this);
 
 	//
-	// Depth texture
+	// Frame graph, owns the depth buffer and every other render target
 	//
-	WGPUTextureDescriptor depthTextureDesc = {
-		.usage = WGPUTextureUsage_RenderAttachment,
-		.dimension = WGPUTextureDimension_2D,
-		.size = {(unsigned int)window->GetSize().x, (unsigned int)window->GetSize().y, 1},
-		.format = DepthTextureFormat,
-		.mipLevelCount = 1,
-		.sampleCount = 1,
-		.viewFormatCount = 1,
-		.viewFormats = &DepthTextureFormat,
-	};
+	FrameGraph = new FrameGraph_t();
+	FrameGraph->Init(this);
 
-	DepthTexture = wgpuDeviceCreateTexture(Device, &depthTextureDesc);
+	//
+	// Lighting, owns the lighting bind group layout used by the mesh pipelines
+	//
+	Lighting = new Lighting_t();
+	Lighting->Init(this);
 
-	WGPUTextureViewDescriptor depthTextureViewDesc = {
-		.format = DepthTextureFormat,
-		.dimension = WGPUTextureViewDimension_2D,
-		.baseMipLevel = 0,
-		.mipLevelCount = 1,
-		.baseArrayLayer = 0,
-		.arrayLayerCount = 1,
-		.aspect = WGPUTextureAspect_DepthOnly
-	};
+	Light_t light = {};
+	light.Position = glm::vec3(0.0f, 5.0f, 1.0f);
+	light.Range = 100.0f;
+	Lighting->AddLight(light);
 
-	DepthTextureView = wgpuTextureCreateView(DepthTexture, &depthTextureViewDesc);
-	
 	//
-	// Model
+	// Pipelines
 	//
-	Model = new Model_t();
-	Model->Init(this, "content/models/DamagedHelmet/DamagedHelmet.gltf");
-
-	Camera = new Camera_t();
-	Camera->Transform = *Transform_t::MakeDefault();
-	Camera->Transform.SetPosition(glm::vec3(-1, 0, 0));
-}
+	CreateMeshPipeline(this);
+
+	WGPUBufferDescriptor cameraBufferDesc = {
+		.nextInChain = nullptr,
+		.label = "Camera uniform buffer",
+		.usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Uniform,
+		.size = sizeof(CameraUniforms_t),
+		.mappedAtCreation = false
+	};
+
+	CameraBuffer = Resources::Track(wgpuDeviceCreateBuffer(Device, &cameraBufferDesc), cameraBufferDesc.label, MemoryCategory_t::Uniform, cameraBufferDesc.size);
+
+	Deferred = new DeferredRenderer_t();
+	Deferred->Init(this, ColorTextureFormat);
+
+	// Also creates the mesh geometry layout, so it has to come before any mesh
+	Visibility = new VisibilityRenderer_t();
+	Visibility->Init(this, ColorTextureFormat, DepthTextureFormat);
+
+	DynamicResolution = new DynamicResolution_t();
+	DynamicResolution->Init(this, ColorTextureFormat);
+
+	Capture = new FrameCapture_t();
+	Capture->Init(this);
+
+	Budget = new MemoryBudget_t();
+	Budget->Init(this);
+
+	const uint8_t white[4] = { 255, 255, 255, 255 };
+	const uint8_t black[4] = { 0, 0, 0, 255 };
+	const uint8_t flatNormal[4] = { 128, 128, 255, 255 };
+
+	WhiteTexture.LoadFromMemory(this, white, 1, 1, 4);
+	BlackTexture.LoadFromMemory(this, black, 1, 1, 4);
+	FlatNormalTexture.LoadFromMemory(this, flatNormal, 1, 1, 4);
+	
+	//
+	// Model
+	//
+	RenderQueue = new RenderQueue_t();
+
+	Model = new Model_t();
+	Model->Init(this, "content/models/DamagedHelmet/DamagedHelmet.gltf");
+
+	Camera = new Camera_t();
+	Camera->Transform = Transform_t::MakeDefault();
+	Camera->Transform.SetPosition(glm::vec3(-1, 0, 0));
+	Camera->Aspect = (float)Width / (float)Height;
+
+	// Everything loaded above goes to the GPU in one batch
+	Uploads->Flush();
+}
 
 GraphicsDevice_t::~GraphicsDevice_t()
 {
+	// Nothing below may go away while the GPU still uses it
+	Frames->WaitIdle();
+
+	Uploads->Destroy();
+	delete Uploads;
+
+	Profiler->Destroy();
+	delete Profiler;
+
+	delete Pacer;
+
+	Model->Destroy();
 	delete Model;
 
+	WhiteTexture.Destroy();
+	BlackTexture.Destroy();
+	FlatNormalTexture.Destroy();
+
+	delete Camera;
+
+	Budget->Destroy();
+	delete Budget;
+
+	RenderQueue->Destroy();
+	delete RenderQueue;
+
+	FrameGraph->Destroy();
+	delete FrameGraph;
+
+	Deferred->Destroy();
+	delete Deferred;
+
+	Visibility->Destroy();
+	delete Visibility;
+
+	DynamicResolution->Destroy();
+	delete DynamicResolution;
+
+	Capture->Destroy();
+	delete Capture;
+
+	Lighting->Destroy();
+	delete Lighting;
+
+	// The layouts owned by lighting and visibility went with them
+	Resources::Release(MeshPipeline);
+	Resources::Release(MeshDepthEqualPipeline);
+	Resources::Release(MeshTransparentPipeline);
+	Resources::Release(DepthPrepassPipeline);
+	Resources::Release(MeshGBufferPipeline);
+	Resources::Release(MeshGBufferDepthEqualPipeline);
+	Resources::Release(ObjectBindGroupLayout);
+	Resources::Release(MaterialBindGroupLayout);
+	Resources::Release(CameraBuffer);
+
+	Frames->Destroy();
+
+	// The GPU is idle, so everything released above can go right away; whatever is left leaked
+	Resources::Shutdown();
+
+	delete Frames;
+
 #define RELEASE(x) do { if(x) { wgpu##x##Release(x); x = nullptr; } } while(0)
 	RELEASE(Instance);
 	RELEASE(Adapter);
@@ -378,24 +893,82 @@ GraphicsDevice_t::~GraphicsDevice_t()
 	RELEASE(SwapChain);
 #undef RELEASE
 
-	wgpuTextureViewRelease(DepthTextureView);
-	wgpuTextureDestroy(DepthTexture);
-	wgpuTextureRelease(DepthTexture);
+	Jobs::Shutdown();
+
+	// Workers are gone, nothing allocates from the arenas anymore
+	FrameArena::Shutdown();
 }
 
-void Graphics::OnRender(GraphicsDevice_t* gpu)
+void Graphics::OnRender(GraphicsDevice_t* gpu, const FrameState_t& state)
 {
 	Frame++;
 
+	// Device work queued from other threads since the last frame
+	Jobs::ExecuteMainThreadJobs();
+
+	//
+	// Present settings; changes to these wait for the frame boundary
+	//
+	const PresentSettings_t& presentSettings = Pacer->GetSettings();
+
+	if (presentSettings.PresentMode != gpu->PresentMode)
+	{
+		gpu->PresentMode = presentSettings.PresentMode;
+		RecreateSwapChain(gpu);
+	}
+
+	//
+	// Resize once the window size settles; until then frames render at the old size and get scaled to
+	// the window. Nothing waits for the GPU: frames in flight hold on to the old-size resources, and
+	// the frame graph keeps those pooled in case the size comes back
+	//
+	if (state.WindowSize != PendingWindowSize)
+	{
+		PendingWindowSize = state.WindowSize;
+		PendingWindowSizeTime = state.Time;
+	}
+
+	bool isMinimized = PendingWindowSize.x <= 0 || PendingWindowSize.y <= 0;
+	bool hasSizeChanged = PendingWindowSize != glm::ivec2(gpu->Width, gpu->Height);
+
+	if (!isMinimized && hasSizeChanged && state.Time - PendingWindowSizeTime >= ResizeDebounceTime)
+	{
+		gpu->Width = PendingWindowSize.x;
+		gpu->Height = PendingWindowSize.y;
+		RecreateSwapChain(gpu);
+
+		FrameGraph->OnResize();
+		Camera->Aspect = (float)gpu->Width / (float)gpu->Height;
+	}
+
+	if (Pacer->GetFramesInFlight() != gpu->Frames->GetCount())
+		gpu->Frames->SetCount(Pacer->GetFramesInFlight());
+
+	// Callbacks of whatever the GPU finished since last frame: frame completions, profiler readbacks
+	wgpuDeviceTick(gpu->Device);
+
+	// Waits if the GPU is a full set of frames behind
+	gpu->Frames->BeginFrame();
+
+	// No jobs are running between frames, so last frame's transient data can go
+	FrameArena::Reset();
+
+	// Objects released a few frames ago that the GPU has finished with by now
+	Resources::Collect();
+
+	// Make room before this frame's draws load anything back in
+	Budget->Update();
+
 	float d = Frame / 144.0f; // lol
 
 	Camera->Transform.SetPosition(glm::vec3(
 		-3.0f, -3.0f, 0
 	));
 
-	WGPUTextureView nextTexture = wgpuSwapChainGetCurrentTextureView(gpu->SwapChain);
+	WGPUTexture nextTexture = wgpuSwapChainGetCurrentTexture(gpu->SwapChain);
+	WGPUTextureView nextTextureView = wgpuSwapChainGetCurrentTextureView(gpu->SwapChain);
 
-	if (!nextTexture)
+	if (!nextTexture || !nextTextureView)
 	{
 		std::cout << "Couldn't get next texture!" << std::endl;
 		assert(false);
@@ -410,46 +983,136 @@ void Graphics::OnRender(GraphicsDevice_t* gpu)
 	};
 	WGPUCommandEncoder encoder = wgpuDeviceCreateCommandEncoder(gpu->Device, &encoderDesc);
 
+	DynamicResolution->BeginFrame();
+	gpu->Profiler->BeginFrame(encoder);
+
+	// The scene renders at a scaled size, everything after the upscale at the window size
+	uint32_t renderWidth, renderHeight;
+	DynamicResolution->GetRenderSize((uint32_t)gpu->Width, (uint32_t)gpu->Height, renderWidth, renderHeight);
+
+	bool isUpscaled = renderWidth != (uint32_t)gpu->Width || renderHeight != (uint32_t)gpu->Height;
+
+	// Shared by every draw, so moving the camera leaves the object uniforms alone
+	CameraUniforms_t cameraUniforms = {
+		.ViewProjMatrix = Camera->GetViewProjMatrix(),
+		.CameraPosition = Camera->Transform.GetPosition()
+	};
+
+	gpu->Frames->WriteBuffer(gpu->CameraBuffer, 0, &cameraUniforms, sizeof(cameraUniforms));
+
 	//
-	// Encode commands
+	// Gather and sort draws
 	//
-	wgpuCommandEncoderInsertDebugMarker(encoder, "Main render pass");
+	RenderQueue->Clear();
+	Model->Submit(gpu, *RenderQueue);
+	RenderQueue->Sort();
 
-	WGPURenderPassColorAttachment renderPassColorAttachment = {
-		.view = nextTexture,
-		.resolveTarget = nullptr,
-		.loadOp = WGPULoadOp_Clear,
-		.storeOp = WGPUStoreOp_Store,
-		.clearValue = WGPUColor{ 0.0, 0.0, 0.0, 1.0 }
-	};
+	ShadowAtlas_t& shadows = Lighting->GetShadows();
+	shadows.ClearCasters();
+	Model->SubmitShadowCasters(shadows);
 
-	WGPURenderPassDepthStencilAttachment renderPassDepthAttachment = {
-		.view = gpu->DepthTextureView,
+	Lighting->Update(*Camera, renderWidth, renderHeight);
+	RenderQueue->SetSharedBindGroup(2, Lighting->GetBindGroup());
 
-		.depthLoadOp = WGPULoadOp_Clear,
-		.depthStoreOp = WGPUStoreOp_Store,
-		.depthClearValue = 1.0f,
-		.depthReadOnly = false,
+	//
+	// Build frame graph
+	//
+	FrameGraph->Reset();
 
-		.stencilLoadOp = WGPULoadOp_Undefined,
-		.stencilStoreOp = WGPUStoreOp_Undefined,
-		.stencilClearValue = 0,
-		.stencilReadOnly = true
-	};
+	FrameGraphResource_t backbuffer = FrameGraph->ImportTexture("Backbuffer", nextTexture, nextTextureView, {
+		.Width = (uint32_t)gpu->Width,
+		.Height = (uint32_t)gpu->Height,
+		.Format = ColorTextureFormat,
+		.Usage = WGPUTextureUsage_RenderAttachment | WGPUTextureUsage_CopySrc
+	});
 
-	WGPURenderPassDescriptor renderPassDesc = {
-		.nextInChain = nullptr,
-		.colorAttachmentCount = 1,
-		.colorAttachments = &renderPassColorAttachment,
-		.depthStencilAttachment = &renderPassDepthAttachment,
-		.timestampWrites = nullptr
-	};
+	FrameGraphResource_t sceneColor = backbuffer;
+
+	if (isUpscaled)
+	{
+		sceneColor = FrameGraph->CreateTexture("Scene color", {
+			.Width = renderWidth,
+			.Height = renderHeight,
+			.Format = ColorTextureFormat,
+			.Usage = WGPUTextureUsage_RenderAttachment | WGPUTextureUsage_TextureBinding
+		});
+	}
+
+	bool isDeferred = ShadingPath == ShadingPath_t::Deferred;
+
+	// The deferred lighting pass reconstructs positions from depth
+	WGPUTextureUsageFlags depthUsage = WGPUTextureUsage_RenderAttachment;
+	if (isDeferred)
+		depthUsage |= WGPUTextureUsage_TextureBinding;
+
+	FrameGraphResource_t depth = FrameGraph->CreateTexture("Depth", {
+		.Width = renderWidth,
+		.Height = renderHeight,
+		.Format = DepthTextureFormat,
+		.Usage = depthUsage
+	});
+
+	LightingResources_t lighting = Lighting->AddPasses(*FrameGraph);
+
+	bool hasDepthPrepass = RenderQueue->HasDraws(DrawPass_t::DepthPrepass);
+
+	if (hasDepthPrepass)
+	{
+		FrameGraph->AddPass("Depth prepass", FrameGraphPassType_t::Render, [](FrameGraphContext_t& context)
+			{
+				RenderQueue->Execute(context.Gpu, context.RenderPass, DrawPass_t::DepthPrepass);
+			})
+			.WriteDepth(depth, WGPULoadOp_Clear, 1.0f);
+	}
+
+	if (isDeferred)
+	{
+		Deferred->AddPasses(*FrameGraph, *RenderQueue, *Camera, *Lighting, lighting, sceneColor, depth, hasDepthPrepass);
+	}
+	else if (ShadingPath == ShadingPath_t::Visibility)
+	{
+		Visibility->AddPasses(*FrameGraph, *RenderQueue, *Camera, *Lighting, lighting, sceneColor, depth);
+	}
+	else
+	{
+		FrameGraph->AddPass("Main render pass", FrameGraphPassType_t::Render, [](FrameGraphContext_t& context)
+			{
+				RenderQueue->Execute(context.Gpu, context.RenderPass, DrawPass_t::Opaque);
+			})
+			.WriteColor(sceneColor, WGPULoadOp_Clear, { 0.0, 0.0, 0.0, 1.0 })
+			.WriteDepth(depth, hasDepthPrepass ? WGPULoadOp_Load : WGPULoadOp_Clear, 1.0f)
+			.Read(lighting.ClusterLightCounts)
+			.Read(lighting.ClusterLightIndices)
+			.Read(lighting.ShadowAtlas);
+	}
+
+	// Blended materials go on top of whatever path shaded the opaque ones
+	if (RenderQueue->HasDraws(DrawPass_t::Transparent))
+	{
+		FrameGraph->AddPass("Transparent pass", FrameGraphPassType_t::Render, [](FrameGraphContext_t& context)
+			{
+				RenderQueue->Execute(context.Gpu, context.RenderPass, DrawPass_t::Transparent);
+			})
+			.Read(lighting.ClusterLightCounts)
+			.Read(lighting.ClusterLightIndices)
+			.Read(lighting.ShadowAtlas)
+			.WriteColor(sceneColor, WGPULoadOp_Load)
+			.WriteDepth(depth, WGPULoadOp_Load);
+	}
 
-	WGPURenderPassEncoder renderPass = wgpuCommandEncoderBeginRenderPass(encoder, &renderPassDesc);
+	if (isUpscaled)
+		DynamicResolution->AddUpscalePass(*FrameGraph, sceneColor, backbuffer);
 
-	Model->Draw(gpu, renderPass);
+	// Screenshots and frame capture see exactly what gets presented
+	Capture->AddPasses(*FrameGraph, backbuffer);
+
+	//
+	// Encode commands
+	//
+	FrameGraph->Compile();
+	FrameGraph->Execute(encoder);
 
-	wgpuRenderPassEncoderEnd(renderPass);
+	gpu->Profiler->EndFrame(encoder);
 
 	//
 	// Finish rendering
@@ -460,34 +1123,41 @@ void Graphics::OnRender(GraphicsDevice_t* gpu)
 	};
 	WGPUCommandBuffer command = wgpuCommandEncoderFinish(encoder, &cmdBufferDescriptor);
 
-	wgpuQueueSubmit(gpu->Queue, 1, &command);
+	// Uploads queued during the frame have to land before it runs
+	gpu->Uploads->Flush();
+	gpu->Frames->Submit(command);
+
+	gpu->Profiler->OnSubmitted();
+	Capture->OnSubmitted();
 
 	wgpuCommandEncoderRelease(encoder);
 	wgpuCommandBufferRelease(command);
 
 	wgpuSwapChainPresent(gpu->SwapChain);
+	Pacer->OnPresented();
 
 	//
 	// Cleanup
 	//
-	wgpuTextureViewRelease(nextTexture);
+	wgpuTextureViewRelease(nextTextureView);
+	wgpuTextureRelease(nextTexture);
 }
 
-GraphicsBuffer_t Graphics::MakeVertexBuffer(GraphicsDevice_t* gpu, std::vector<Vertex_t> vertexData, WGPUVertexBufferLayout vertexBufferLayout)
+GraphicsBuffer_t Graphics::MakeVertexBuffer(GraphicsDevice_t* gpu, std::span<const Vertex_t> vertexData, WGPUVertexBufferLayout vertexBufferLayout)
 {
 	GraphicsBuffer_t vertexBuffer;
 
 	WGPUBufferDescriptor vertexBufferDesc = {
 		.nextInChain = nullptr,
 		.label = "Vertex Data Buffer",
-		.usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Vertex,
+		.usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Vertex | WGPUBufferUsage_Storage,
 		.size = vertexData.size() * sizeof(Vertex_t),
 		.mappedAtCreation = false
 	};
 
-	vertexBuffer.DataBuffer = wgpuDeviceCreateBuffer(gpu->Device, &vertexBufferDesc);
+	vertexBuffer.DataBuffer = Resources::Track(wgpuDeviceCreateBuffer(gpu->Device, &vertexBufferDesc), vertexBufferDesc.label, MemoryCategory_t::Geometry, vertexBufferDesc.size);
 
-	wgpuQueueWriteBuffer(gpu->Queue, vertexBuffer.DataBuffer, 0, vertexData.data(), vertexBufferDesc.size);
+	gpu->Uploads->UploadBuffer(vertexBuffer.DataBuffer, 0, vertexData.data(), vertexBufferDesc.size);
 
 	vertexBuffer.Count = vertexData.size();
 	vertexBuffer.DataSize = vertexData.size();
@@ -495,20 +1165,42 @@ GraphicsBuffer_t Graphics::MakeVertexBuffer(GraphicsDevice_t* gpu, std::vector<V
 	return vertexBuffer;
 }
 
-GraphicsBuffer_t Graphics::MakeIndexBuffer(GraphicsDevice_t* gpu, std::vector<unsigned int> indexData)
+GraphicsBuffer_t Graphics::MakePositionBuffer(GraphicsDevice_t* gpu, std::span<const glm::vec3> positionData)
+{
+	GraphicsBuffer_t positionBuffer;
+
+	WGPUBufferDescriptor positionBufferDesc = {
+		.nextInChain = nullptr,
+		.label = "Position Data Buffer",
+		.usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Vertex,
+		.size = positionData.size() * sizeof(glm::vec3),
+		.mappedAtCreation = false
+	};
+
+	positionBuffer.DataBuffer = Resources::Track(wgpuDeviceCreateBuffer(gpu->Device, &positionBufferDesc), positionBufferDesc.label, MemoryCategory_t::Geometry, positionBufferDesc.size);
+
+	gpu->Uploads->UploadBuffer(positionBuffer.DataBuffer, 0, positionData.data(), positionBufferDesc.size);
+
+	positionBuffer.Count = positionData.size();
+	positionBuffer.DataSize = positionData.size();
+
+	return positionBuffer;
+}
+
+GraphicsBuffer_t Graphics::MakeIndexBuffer(GraphicsDevice_t* gpu, std::span<const unsigned int> indexData)
 {
 	GraphicsBuffer_t indexBuffer;
 
 	WGPUBufferDescriptor indexBufferDesc = {
 		.nextInChain = nullptr,
 		.label = "Index Data Buffer",
-		.usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Index,
+		.usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Index | WGPUBufferUsage_Storage,
 		.size = indexData.size() * sizeof(unsigned int),
 		.mappedAtCreation = false
 	};
 
-	indexBuffer.DataBuffer = wgpuDeviceCreateBuffer(gpu->Device, &indexBufferDesc);
-	wgpuQueueWriteBuffer(gpu->Queue, indexBuffer.DataBuffer, 0, indexData.data(), indexBufferDesc.size);
+	indexBuffer.DataBuffer = Resources::Track(wgpuDeviceCreateBuffer(gpu->Device, &indexBufferDesc), indexBufferDesc.label, MemoryCategory_t::Geometry, indexBufferDesc.size);
+	gpu->Uploads->UploadBuffer(indexBuffer.DataBuffer, 0, indexData.data(), indexBufferDesc.size);
 
 	indexBuffer.Count = indexData.size();
 	indexBuffer.DataSize = indexData.size();
@@ -516,247 +1208,403 @@ GraphicsBuffer_t Graphics::MakeIndexBuffer(GraphicsDevice_t* gpu, std::vector<un
 	return indexBuffer;
 }
 
-GraphicsBuffer_t Graphics::MakeUniformBuffer(GraphicsDevice_t* gpu)
+GraphicsBuffer_t Graphics::MakeUniformBuffer(GraphicsDevice_t* gpu, size_t objectCount)
 {
 	GraphicsBuffer_t uniformBuffer;
 
 	WGPUBufferDescriptor uniformBufferDesc = {
 		.nextInChain = nullptr,
 		.usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Uniform,
-		.size = sizeof(UniformBuffer_t),
+		.size = objectCount * sizeof(ObjectUniforms_t),
 		.mappedAtCreation = false
 	};
 
-	uniformBuffer.DataBuffer = wgpuDeviceCreateBuffer(gpu->Device, &uniformBufferDesc);
-	uniformBuffer.Count = 1;
-	uniformBuffer.DataSize = sizeof(UniformBuffer_t);
+	uniformBuffer.DataBuffer = Resources::Track(wgpuDeviceCreateBuffer(gpu->Device, &uniformBufferDesc), "Object uniform buffer", MemoryCategory_t::Uniform, uniformBufferDesc.size);
+	uniformBuffer.Count = (int)objectCount;
+	uniformBuffer.DataSize = uniformBufferDesc.size;
 
 	return uniformBuffer;
 }
 
-void Graphics::UpdateUniformBuffer(GraphicsDevice_t* gpu, GraphicsBuffer_t uniformBuffer, UniformBuffer_t uniformBufferData)
+void Graphics::SetDepthPrepassMode(DepthPrepassMode_t mode)
 {
-	wgpuQueueWriteBuffer(gpu->Queue, uniformBuffer.DataBuffer, 0, (void*)&uniformBufferData, sizeof(UniformBuffer_t));
+	Jobs::RunOnMainThread([mode]()
+		{
+			DepthPrepassMode = mode;
+		});
 }
 
-void GraphicsBuffer_t::Destroy()
+void Graphics::SetShadingPath(ShadingPath_t path)
 {
-	wgpuBufferDestroy(DataBuffer);
-	wgpuBufferRelease(DataBuffer);
+	// Between frames, so gathering draws and building the graph always agree on the path
+	Jobs::RunOnMainThread([path]()
+		{
+			ShadingPath = path;
+		});
 }
 
-void Mesh_t::Init(GraphicsDevice_t* gpu, std::vector<Vertex_t> vertices, std::vector<unsigned int> indices, Material_t material)
+void Graphics::SetDynamicResolution(const DynamicResolutionSettings_t& settings)
 {
-	Material = material;
-	UniformBuffer = Graphics::MakeUniformBuffer(gpu);
+	Jobs::RunOnMainThread([settings]()
+		{
+			DynamicResolution->SetSettings(settings);
+		});
+}
 
-	// Vertices
-	WGPUVertexAttribute vertexAttribute = {
-		.format = WGPUVertexFormat_Float32x3,
-		.offset = 0,
-		.shaderLocation = 0,
-	};
+void Graphics::SetPresentSettings(const PresentSettings_t& settings)
+{
+	// Picked up by the device thread at the start of its next frame
+	Jobs::RunOnMainThread([settings]()
+		{
+			Pacer->SetSettings(settings);
+		});
+}
 
-	WGPUVertexAttribute uvAttribute = {
-		.format = WGPUVertexFormat_Float32x2,
-		.offset = sizeof(glm::vec3),
-		.shaderLocation = 1,
-	};
+void Graphics::WaitForNextFrame(GraphicsDevice_t* gpu)
+{
+	Pacer->WaitForFrameStart(DynamicResolution->GetLastFrameTime());
+}
 
-	WGPUVertexAttribute normalAttribute = {
-		.format = WGPUVertexFormat_Float32x3,
-		.offset = sizeof(glm::vec3) + sizeof(glm::vec2),
-		.shaderLocation = 2,
-	};
+void Graphics::CaptureScreenshot(const char* path)
+{
+	Jobs::RunOnMainThread([path = std::string(path)]()
+		{
+			Capture->RequestScreenshot(path);
+		});
+}
 
-	WGPUVertexAttribute tangentAttribute = {
-		.format = WGPUVertexFormat_Float32x3,
-		.offset = sizeof(glm::vec3) + sizeof(glm::vec2) + sizeof(glm::vec3),
-		.shaderLocation = 3,
-	};
+void Graphics::StartFrameCapture(const char* directory, CaptureFormat_t format)
+{
+	Jobs::RunOnMainThread([directory = std::string(directory), format]()
+		{
+			Capture->StartCapture(directory, format);
+		});
+}
 
-	std::vector<WGPUVertexAttribute> vertexAttributes = { vertexAttribute, uvAttribute, normalAttribute, tangentAttribute };
+void Graphics::StopFrameCapture()
+{
+	Jobs::RunOnMainThread([]()
+		{
+			Capture->StopCapture();
+		});
+}
 
-	WGPUVertexBufferLayout vertexBufferLayout = {
-		.arrayStride = sizeof(Vertex_t),
-		.stepMode = WGPUVertexStepMode_Vertex,
-		.attributeCount = vertexAttributes.size(),
-		.attributes = vertexAttributes.data()
-	};
+void Graphics::SetEnvironment(const char* hdrPath)
+{
+	// Bakes on the device thread between frames instead of under the ones being recorded
+	Jobs::RunOnMainThread([hdrPath = std::string(hdrPath)]()
+		{
+			Lighting->SetEnvironment(hdrPath.c_str());
+		});
+}
 
-	VertexBuffer = Graphics::MakeVertexBuffer(gpu, vertices, vertexBufferLayout);
+void Graphics::SetMemoryBudget(uint64_t bytes)
+{
+	Jobs::RunOnMainThread([bytes]()
+		{
+			Budget->SetBudget(bytes);
+		});
+}
 
-	// Indices
-	IndexBuffer = Graphics::MakeIndexBuffer(gpu, indices);
+void Graphics::ReportMemoryUsage()
+{
+	std::cout << "GPU memory, budget " << Budget->GetBudget() / 1024 << " KB" << std::endl;
+	Resources::ReportMemoryUsage();
+	std::cout << "  Evictions: " << Budget->GetEvictionCount() << ", reloads: " << Budget->GetReloadCount() << std::endl;
+}
 
-	// Shader
-	WGPUShaderModule shaderModule = CreateShader(gpu->Device);
+void Graphics::ReportGpuTimings(GraphicsDevice_t* gpu)
+{
+	// Timings are updated from readback callbacks on the device thread
+	Jobs::RunOnMainThread([gpu]()
+		{
+			if (!gpu->Profiler->IsEnabled())
+			{
+				std::cout << "GPU timings unavailable, no timestamp query support" << std::endl;
+				return;
+			}
 
-	// Pipeline
-	WGPUBlendState blendState = {
-		.color = {
-			.operation = WGPUBlendOperation_Add,
-			.srcFactor = WGPUBlendFactor_SrcAlpha,
-			.dstFactor = WGPUBlendFactor_OneMinusSrcAlpha
-		}
-	};
+			std::cout << "GPU timings" << std::endl;
 
-	WGPUColorTargetState colorTarget = {
-		.format = WGPUTextureFormat_BGRA8Unorm,
-		.blend = &blendState,
-		.writeMask = WGPUColorWriteMask_All
-	};
+			for (const GpuTiming_t& timing : gpu->Profiler->GetTimings())
+				std::cout << "  " << timing.Name << ": " << timing.Milliseconds << " ms (last " << timing.LastMilliseconds << " ms)" << std::endl;
+		});
+}
 
-	WGPUFragmentState fragmentState = {
-		.module = shaderModule,
-		.entryPoint = "fs_main",
-		.constantCount = 0,
-		.constants = nullptr,
-		.targetCount = 1,
-		.targets = &colorTarget
-	};
+size_t Graphics::AddLight(const Light_t& light)
+{
+	return Lighting->AddLight(light);
+}
 
-	WGPUVertexState vertexState = {
-		.module = shaderModule,
-		.entryPoint = "vs_main",
-		.constantCount = 0,
-		.constants = nullptr,
-		.bufferCount = 1,
-		.buffers = &vertexBufferLayout
+Light_t& Graphics::GetLight(size_t index)
+{
+	return Lighting->GetLight(index);
+}
+
+WGPURenderBundleEncoder Graphics::MakeRenderBundleEncoder(GraphicsDevice_t* gpu, DrawPass_t pass, const char* label)
+{
+	// The depth prepass has no color attachment, the G-buffer pass has one per target, the visibility pass one IDs target
+	size_t colorFormatCount = 1;
+	const WGPUTextureFormat* colorFormats = &ColorTextureFormat;
+
+	if (pass == DrawPass_t::DepthPrepass)
+	{
+		colorFormatCount = 0;
+		colorFormats = nullptr;
+	}
+	else if (pass == DrawPass_t::GBuffer)
+	{
+		colorFormatCount = DeferredRenderer_t::GBufferCount;
+		colorFormats = DeferredRenderer_t::GBufferFormats;
+	}
+	else if (pass == DrawPass_t::Visibility)
+	{
+		colorFormats = &VisibilityRenderer_t::VisibilityFormat;
+	}
+
+	// Must stay compatible with the attachments used by the render pass the bundle gets replayed in
+	WGPURenderBundleEncoderDescriptor bundleEncoderDesc = {
+		.nextInChain = nullptr,
+		.label = label,
+		.colorFormatCount = colorFormatCount,
+		.colorFormats = colorFormats,
+		.depthStencilFormat = DepthTextureFormat,
+		.sampleCount = 1,
+		.depthReadOnly = false,
+		.stencilReadOnly = true
 	};
 
-	std::vector<WGPUBindGroupLayoutEntry> bindingLayoutEntries(7);
+	return wgpuDeviceCreateRenderBundleEncoder(gpu->Device, &bundleEncoderDesc);
+}
 
-	//
-	// Uniform binding
-	//
-	WGPUBindGroupLayoutEntry& vertexBindingLayout = bindingLayoutEntries[0];
-	SetDefaultBindGroupLayoutEntry(vertexBindingLayout);
-	vertexBindingLayout.binding = 0;
-	vertexBindingLayout.visibility = WGPUShaderStage_Vertex | WGPUShaderStage_Fragment;
-	vertexBindingLayout.buffer.type = WGPUBufferBindingType_Uniform;
-	vertexBindingLayout.buffer.minBindingSize = sizeof(UniformBuffer_t);
+void RenderBundle_t::Destroy()
+{
+	if (Bundle)
+		wgpuRenderBundleRelease(Bundle);
+
+	Bundle = nullptr;
+	Signature = 0;
+}
+
+void GraphicsBuffer_t::Destroy()
+{
+	// Frames still in flight may read it
+	DataBuffer.Reset();
+}
+
+void Material_t::Init(GraphicsDevice_t* gpu)
+{
+	static uint32_t nextMaterialId = 0;
+	Id = nextMaterialId++;
 
-	WGPUBindGroupEntry uniformBinding = {
+	CreateBindGroup(gpu);
+}
+
+void Material_t::CreateBindGroup(GraphicsDevice_t* gpu)
+{
+	// Frames in flight may still use the old one
+	BindGroup.Reset();
+
+	WGPUBindGroupEntry samplerBinding = {
 		.nextInChain = nullptr,
 		.binding = 0,
-		.buffer = UniformBuffer.DataBuffer,
-		.offset = 0,
-		.size = sizeof(UniformBuffer_t)
+		.sampler = Sampler
+	};
+
+	WGPUBindGroupEntry bindings[] = {
+		samplerBinding,
+
+		// Missing textures leave the shading they feed unchanged
+		CreateTextureBindGroupEntry(ColorTexture, gpu->WhiteTexture, 1),
+		CreateTextureBindGroupEntry(AoTexture, gpu->WhiteTexture, 2),
+		CreateTextureBindGroupEntry(EmissiveTexture, gpu->BlackTexture, 3),
+		CreateTextureBindGroupEntry(MetalRoughnessTexture, gpu->WhiteTexture, 4),
+		CreateTextureBindGroupEntry(NormalTexture, gpu->FlatNormalTexture, 5)
 	};
 
-	//
-	// Sampler
-	//
-	WGPUBindGroupLayoutEntry& samplerBindingLayout = bindingLayoutEntries[1];
-	samplerBindingLayout.binding = 1;
-	samplerBindingLayout.visibility = WGPUShaderStage_Fragment;
-	samplerBindingLayout.sampler.type = WGPUSamplerBindingType_Filtering;
+	WGPUBindGroupDescriptor bindGroupDesc = {
+		.nextInChain = nullptr,
+		.layout = gpu->MaterialBindGroupLayout,
+		.entryCount = (unsigned int)std::size(bindings),
+		.entries = bindings
+	};
+
+	BindGroup = Resources::Track(wgpuDeviceCreateBindGroup(gpu->Device, &bindGroupDesc), "Material bind group");
+}
+
+bool Material_t::DropTopMip(GraphicsDevice_t* gpu, uint32_t minSize)
+{
+	bool isDropped = false;
+
+	for (Texture_t* texture : { &ColorTexture, &AoTexture, &EmissiveTexture, &MetalRoughnessTexture, &NormalTexture })
+	{
+		if (!texture->CanDropMip(minSize))
+			continue;
+
+		texture->SetResidentMip(gpu, texture->ResidentMip + 1);
+		isDropped = true;
+	}
+
+	if (isDropped)
+		CreateBindGroup(gpu);
+
+	return isDropped;
+}
+
+bool Material_t::Restore(GraphicsDevice_t* gpu)
+{
+	bool isRestored = false;
+
+	for (Texture_t* texture : { &ColorTexture, &AoTexture, &EmissiveTexture, &MetalRoughnessTexture, &NormalTexture })
+	{
+		if (texture->ResidentMip == 0)
+			continue;
+
+		texture->SetResidentMip(gpu, 0);
+		isRestored = true;
+	}
+
+	if (isRestored)
+		CreateBindGroup(gpu);
+
+	return isRestored;
+}
+
+void Material_t::Destroy()
+{
+	BindGroup.Reset();
+	Sampler.Reset();
+
+	ColorTexture.Destroy();
+	AoTexture.Destroy();
+	EmissiveTexture.Destroy();
+	MetalRoughnessTexture.Destroy();
+	NormalTexture.Destroy();
+}
+
+void Mesh_t::Init(GraphicsDevice_t* gpu, std::vector<Vertex_t> vertices, std::vector<unsigned int> indices, Handle_t<Material_t> material, WGPUBindGroup objectBindGroup, uint32_t objectIndex)
+{
+	Material = material;
+	ObjectBindGroup = objectBindGroup;
+	ObjectIndex = objectIndex;
 
-	WGPUBindGroupEntry samplerBinding = {
-		.nextInChain = nullptr,
-		.binding = 1,
-		.sampler = material.Sampler
-	};
+	// Bounds
+	BoundsMin = glm::vec3(FLT_MAX);
+	BoundsMax = glm::vec3(-FLT_MAX);
+
+	for (auto& vertex : vertices)
+	{
+		BoundsMin = glm::min(BoundsMin, vertex.Position);
+		BoundsMax = glm::max(BoundsMax, vertex.Position);
+	}
 
 	//
-	// Texture binding
+	// Overdraw estimate: averaged over all view directions, the triangles cover half their area on screen,
+	// while the (convex) bounding box covers a quarter of its surface area
 	//
-	WGPUBindGroupEntry colorTextureBinding				= CreateTextureBindGroupEntry(material.ColorTexture, 2);
-	WGPUBindGroupEntry aoTextureBinding					= CreateTextureBindGroupEntry(material.AoTexture, 3);
-	WGPUBindGroupEntry emissiveTextureBinding			= CreateTextureBindGroupEntry(material.EmissiveTexture, 4);
-	WGPUBindGroupEntry metalRoughnessTextureBinding		= CreateTextureBindGroupEntry(material.MetalRoughnessTexture, 5);
-	WGPUBindGroupEntry normalTextureBinding				= CreateTextureBindGroupEntry(material.NormalTexture, 6);
+	float triangleArea = 0.0f;
 
-	for (int i = 2; i <= 6; ++i)
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
 	{
-		WGPUBindGroupLayoutEntry& fragmentBindingLayout = bindingLayoutEntries[i];
-		SetDefaultBindGroupLayoutEntry(fragmentBindingLayout);
-		fragmentBindingLayout.binding = i;
-		fragmentBindingLayout.visibility = WGPUShaderStage_Fragment;
-		fragmentBindingLayout.texture.sampleType = WGPUTextureSampleType_Float;
-		fragmentBindingLayout.texture.viewDimension = WGPUTextureViewDimension_2D;
+		glm::vec3 a = vertices[indices[i]].Position;
+		glm::vec3 b = vertices[indices[i + 1]].Position;
+		glm::vec3 c = vertices[indices[i + 2]].Position;
+
+		triangleArea += 0.5f * glm::length(glm::cross(b - a, c - a));
 	}
 
-	std::vector<WGPUBindGroupEntry> bindings = { 
-		// Misc.
-		uniformBinding, samplerBinding,
+	glm::vec3 extents = BoundsMax - BoundsMin;
+	float boundsArea = 2.0f * (extents.x * extents.y + extents.y * extents.z + extents.z * extents.x);
 
-		// Material
-		colorTextureBinding, aoTextureBinding, emissiveTextureBinding, metalRoughnessTextureBinding, normalTextureBinding 
-	};
+	OverdrawEstimate = boundsArea > 0.0f ? (2.0f * triangleArea) / boundsArea : 0.0f;
 
-	WGPUBindGroupLayoutDescriptor bindGroupLayoutDesc = {
-		.nextInChain = nullptr,
-		.entryCount = bindingLayoutEntries.size(),
-		.entries = bindingLayoutEntries.data()
-	};
+	Vertices = std::move(vertices);
+	Indices = std::move(indices);
+
+	CreateGeometry(gpu);
+}
 
-	WGPUBindGroupLayout bindGroupLayout = wgpuDeviceCreateBindGroupLayout(gpu->Device, &bindGroupLayoutDesc);
+void Mesh_t::CreateGeometry(GraphicsDevice_t* gpu)
+{
+	// Also runs while loading, outside any frame, so give the scratch back right away
+	LinearArena_t& arena = FrameArena::Get();
+	ArenaScope_t scope(arena);
 
-	WGPUPipelineLayoutDescriptor layoutDesc = {
-		.nextInChain = nullptr,
-		.bindGroupLayoutCount = 1,
-		.bindGroupLayouts = &bindGroupLayout
-	};
+	ArenaVector_t<glm::vec3> positions(arena);
+	positions.reserve(Vertices.size());
 
-	WGPUPipelineLayout layout = wgpuDeviceCreatePipelineLayout(gpu->Device, &layoutDesc);
+	for (auto& vertex : Vertices)
+		positions.push_back(vertex.Position);
 
-	WGPUBindGroupDescriptor bindGroupDesc = {
+	// Vertices
+	VertexBuffer = Graphics::MakeVertexBuffer(gpu, Vertices, GetVertexBufferLayout());
+	PositionBuffer = Graphics::MakePositionBuffer(gpu, positions);
+
+	// Indices
+	IndexBuffer = Graphics::MakeIndexBuffer(gpu, Indices);
+
+	//
+	// Geometry binding
+	//
+	WGPUBindGroupEntry geometryBindings[2] = {};
+	geometryBindings[0].binding = 0;
+	geometryBindings[0].buffer = IndexBuffer.DataBuffer;
+	geometryBindings[0].size = Indices.size() * sizeof(unsigned int);
+	geometryBindings[1].binding = 1;
+	geometryBindings[1].buffer = VertexBuffer.DataBuffer;
+	geometryBindings[1].size = Vertices.size() * sizeof(Vertex_t);
+
+	WGPUBindGroupDescriptor geometryBindGroupDesc = {
 		.nextInChain = nullptr,
-		.layout = bindGroupLayout,
-		.entryCount = (unsigned int)bindings.size(),
-		.entries = bindings.data()
+		.layout = gpu->MeshGeometryBindGroupLayout,
+		.entryCount = 2,
+		.entries = geometryBindings
 	};
 
-	BindGroup = wgpuDeviceCreateBindGroup(gpu->Device, &bindGroupDesc);
+	GeometryBindGroup = Resources::Track(wgpuDeviceCreateBindGroup(gpu->Device, &geometryBindGroupDesc), "Mesh geometry bind group");
 
-	WGPUDepthStencilState depthStencilState = {};
-	SetDefaultDepthStencilState(depthStencilState);
-	depthStencilState.depthCompare = WGPUCompareFunction_Less;
-	depthStencilState.depthWriteEnabled = true;
-	depthStencilState.format = DepthTextureFormat;
-	depthStencilState.stencilReadMask = 0;
-	depthStencilState.stencilWriteMask = 0;
+	IsResident = true;
+}
 
-	WGPURenderPipelineDescriptor pipelineDesc = {
-		.nextInChain = nullptr,
-		.layout = layout,
-		.vertex = vertexState,
+void Mesh_t::DestroyGeometry()
+{
+	VertexBuffer.Destroy();
+	PositionBuffer.Destroy();
+	IndexBuffer.Destroy();
 
-		.primitive = {
-			.topology = WGPUPrimitiveTopology_TriangleList,
-			.stripIndexFormat = WGPUIndexFormat_Undefined,
-			.frontFace = WGPUFrontFace_CCW,
-			.cullMode = WGPUCullMode_None
-		},
+	GeometryBindGroup.Reset();
 
-		.depthStencil = &depthStencilState,
-		.multisample = {
-			.count = 1,
-			.mask = ~0u,
-			.alphaToCoverageEnabled = false
-		},
-		.fragment = &fragmentState
-	};
+	IsResident = false;
+}
 
-	Pipeline = wgpuDeviceCreateRenderPipeline(gpu->Device, &pipelineDesc);
+uint64_t Mesh_t::GetGeometrySize()
+{
+	return Vertices.size() * (sizeof(Vertex_t) + sizeof(glm::vec3)) + Indices.size() * sizeof(unsigned int);
 }
 
-void Mesh_t::Draw(GraphicsDevice_t* gpu, WGPURenderPassEncoder renderPass)
+void Mesh_t::GetWorldBoundingSphere(glm::vec3& center, float& radius)
 {
-	UniformBuffer_t uniformBufferData;
-	uniformBufferData.ModelMatrix = GetModelMatrix();
-	uniformBufferData.ViewProjMatrix = Camera->GetViewProjMatrix();
-	uniformBufferData.CameraPosition = Camera->Transform.GetPosition();
-	Graphics::UpdateUniformBuffer(gpu, UniformBuffer, uniformBufferData);
+	const glm::mat4& modelMatrix = GetModelMatrix();
+
+	center = glm::vec3(modelMatrix * glm::vec4((BoundsMin + BoundsMax) * 0.5f, 1.0f));
 
-	wgpuRenderPassEncoderSetPipeline(renderPass, Pipeline);
-	wgpuRenderPassEncoderSetVertexBuffer(renderPass, 0, VertexBuffer.DataBuffer, 0, VertexBuffer.DataSize * sizeof(float));
-	wgpuRenderPassEncoderSetIndexBuffer(renderPass, IndexBuffer.DataBuffer, WGPUIndexFormat_Uint32, 0, IndexBuffer.DataSize * sizeof(unsigned int));
-	wgpuRenderPassEncoderSetBindGroup(renderPass, 0, BindGroup, 0, nullptr);
+	// The largest axis scale keeps the sphere conservative under non-uniform scaling
+	float scale = glm::max(glm::length(glm::vec3(modelMatrix[0])), glm::max(glm::length(glm::vec3(modelMatrix[1])), glm::length(glm::vec3(modelMatrix[2]))));
+	radius = glm::length(BoundsMax - BoundsMin) * 0.5f * scale;
+}
 
-	wgpuRenderPassEncoderDrawIndexed(renderPass, IndexBuffer.Count, 1, 0, 0, 0);
+uint64_t Mesh_t::GetSignature(uint64_t hash)
+{
+	// Everything that ends up baked into the recorded commands
+	hash = HashCombine(hash, (uint64_t)ObjectBindGroup);
+	hash = HashCombine(hash, (uint64_t)ObjectIndex);
+	hash = HashCombine(hash, (uint64_t)GeometryBindGroup.Get());
+	hash = HashCombine(hash, (uint64_t)VertexBuffer.DataBuffer.Get());
+	hash = HashCombine(hash, (uint64_t)PositionBuffer.DataBuffer.Get());
+	hash = HashCombine(hash, (uint64_t)IndexBuffer.DataBuffer.Get());
+	hash = HashCombine(hash, (uint64_t)IndexBuffer.Count);
+
+	return hash;
 }
 
 inline void LoadTextureIfAvailable(GraphicsDevice_t* gpu, const tinygltf::Model& model, const tinygltf::TextureInfo& textureInfo, Texture_t& texture)
@@ -781,8 +1629,73 @@ inline void LoadTextureIfAvailable(GraphicsDevice_t* gpu, const tinygltf::Model&
 	LoadTextureIfAvailable(gpu, model, (const tinygltf::TextureInfo&)textureInfo, texture);
 }
 
+static void LoadPrimitive(const tinygltf::Model& model, const tinygltf::Primitive& primitive, std::vector<Vertex_t>& vertices, std::vector<unsigned int>& indices)
+{
+	// Load indices
+	{
+		auto& accessor = model.accessors[primitive.indices];
+		auto& bufferView = model.bufferViews[accessor.bufferView];
+		auto& buffer = model.buffers[bufferView.buffer];
+
+		auto& data = buffer.data[accessor.byteOffset + bufferView.byteOffset];
+
+		for (int i = 0; i < accessor.count; ++i)
+		{
+			unsigned int index = 0;
+
+			// GLTF stores indices as uint16 - this line is correct!
+			memcpy(&index, &buffer.data[accessor.byteOffset + bufferView.byteOffset + i * sizeof(uint16_t)], sizeof(uint16_t));
+
+			indices.emplace_back(index);
+		}
+	}
+
+	// Load vertices
+	{
+		auto& posAccessor = model.accessors[primitive.attributes.at("POSITION")];
+		auto& posBufferView = model.bufferViews[posAccessor.bufferView];
+		auto& posBuffer = model.buffers[posBufferView.buffer];
+
+		auto& uvAccessor = model.accessors[primitive.attributes.at("TEXCOORD_0")];
+		auto& uvBufferView = model.bufferViews[uvAccessor.bufferView];
+		auto& uvBuffer = model.buffers[uvBufferView.buffer];
+
+		auto& normAccessor = model.accessors[primitive.attributes.at("NORMAL")];
+		auto& normBufferView = model.bufferViews[normAccessor.bufferView];
+		auto& normBuffer = model.buffers[normBufferView.buffer];
+
+		auto& tangAccessor = model.accessors[primitive.attributes.at("TANGENT")];
+		auto& tangBufferView = model.bufferViews[tangAccessor.bufferView];
+		auto& tangBuffer = model.buffers[tangBufferView.buffer];
+
+		for (int i = 0; i < posAccessor.count; ++i)
+		{
+			Vertex_t vertex = {};
+
+			// Load position
+			memcpy(&vertex.Position, &posBuffer.data[posAccessor.byteOffset + posBufferView.byteOffset + i * sizeof(glm::vec3)], sizeof(glm::vec3));
+
+			// Load UVs
+			assert(primitive.attributes.find("TEXCOORD_0") != primitive.attributes.end());
+			memcpy(&vertex.TexCoords, &uvBuffer.data[uvAccessor.byteOffset + uvBufferView.byteOffset + i * sizeof(glm::vec2)], sizeof(glm::vec2));
+
+			// Load normals
+			assert(primitive.attributes.find("NORMAL") != primitive.attributes.end());
+			memcpy(&vertex.Normal, &posBuffer.data[normAccessor.byteOffset + normBufferView.byteOffset + i * sizeof(glm::vec3)], sizeof(glm::vec3));
+
+			// Load normals
+			assert(primitive.attributes.find("TANGENT") != primitive.attributes.end());
+			memcpy(&vertex.Tangent, &posBuffer.data[tangAccessor.byteOffset + tangBufferView.byteOffset + i * sizeof(glm::vec3)], sizeof(glm::vec3));
+
+			vertices.emplace_back(vertex);
+		}
+	}
+}
+
 void Model_t::Init(GraphicsDevice_t* gpu, const char* gltfPath)
 {
+	Gpu = gpu;
+
 	tinygltf::Model model;
 	tinygltf::TinyGLTF loader;
 
@@ -819,174 +1732,481 @@ void Model_t::Init(GraphicsDevice_t* gpu, const char* gltfPath)
 
 	std::cout << "GLTF loaded: " << gltfPath << std::endl;
 
-	// Load all meshes
-	for (auto& mesh : model.meshes)
+	// Primitives without a material get a slot of their own after the model's, only if there are any
+	bool needsFallbackMaterial = false;
+
+	for (auto& gltfMesh : model.meshes)
+		for (auto& primitive : gltfMesh.primitives)
+			needsFallbackMaterial |= primitive.material < 0;
+
+	// Load all materials up front so that primitives sharing a material share its textures and bind group
+	Materials.resize(model.materials.size() + (needsFallbackMaterial ? 1 : 0));
+
+	for (size_t i = 0; i < Materials.size(); ++i)
 	{
-		std::vector<Vertex_t> vertices = {};
-		std::vector<unsigned int> indices = {};
+		Materials[i] = gpu->MaterialPool.Create();
+		Material_t& material = *gpu->MaterialPool.Get(Materials[i]);
+
+		WGPUSamplerDescriptor samplerDesc = {
+			.addressModeU = WGPUAddressMode_Repeat,
+			.addressModeV = WGPUAddressMode_Repeat,
+			.addressModeW = WGPUAddressMode_Repeat,
+			.magFilter = WGPUFilterMode_Linear,
+			.minFilter = WGPUFilterMode_Linear,
+			.mipmapFilter = WGPUMipmapFilterMode_Linear,
+			.lodMinClamp = 0.0f,
+			.lodMaxClamp = 32.0f,
+			.compare = WGPUCompareFunction_Undefined,
+			.maxAnisotropy = 1
+		};
 
-		for (auto& primitive : mesh.primitives)
+		material.Sampler = Resources::Track(wgpuDeviceCreateSampler(gpu->Device, &samplerDesc), "Material sampler");
+
+		if (i < model.materials.size())
 		{
-			// Load indices
-			{
-				auto& accessor = model.accessors[primitive.indices];
-				auto& bufferView = model.bufferViews[accessor.bufferView];
-				auto& buffer = model.buffers[bufferView.buffer];
+			const tinygltf::Material& gltfMaterial = model.materials[i];
 
-				auto& data = buffer.data[accessor.byteOffset + bufferView.byteOffset];
+			LoadTextureIfAvailable(gpu, model, gltfMaterial.pbrMetallicRoughness.baseColorTexture, material.ColorTexture);
+			LoadTextureIfAvailable(gpu, model, gltfMaterial.pbrMetallicRoughness.metallicRoughnessTexture, material.MetalRoughnessTexture);
+			LoadTextureIfAvailable(gpu, model, gltfMaterial.emissiveTexture, material.EmissiveTexture);
+			LoadTextureIfAvailable(gpu, model, gltfMaterial.occlusionTexture, material.AoTexture);
+			LoadTextureIfAvailable(gpu, model, gltfMaterial.normalTexture, material.NormalTexture);
 
-				for (int i = 0; i < accessor.count; ++i)
-				{
-					unsigned int index = 0;
+			material.IsTransparent = gltfMaterial.alphaMode == "BLEND";
+		}
 
-					// GLTF stores indices as uint16 - this line is correct!
-					memcpy(&index, &buffer.data[accessor.byteOffset + bufferView.byteOffset + i * sizeof(uint16_t)], sizeof(uint16_t));
+		material.Init(gpu);
+	}
 
-					indices.emplace_back(index);
-				}
-			}
+	//
+	// Nodes of the default scene, flattened parents-first; each mesh primitive becomes a draw following its node
+	//
+	int sceneIndex = model.defaultScene >= 0 ? model.defaultScene : 0;
 
-			// Load vertices
-			{
-				auto& posAccessor = model.accessors[primitive.attributes["POSITION"]];
-				auto& posBufferView = model.bufferViews[posAccessor.bufferView];
-				auto& posBuffer = model.buffers[posBufferView.buffer];
+	std::vector<std::pair<int, int32_t>> pendingNodes = {};
 
-				auto& uvAccessor = model.accessors[primitive.attributes["TEXCOORD_0"]];
-				auto& uvBufferView = model.bufferViews[uvAccessor.bufferView];
-				auto& uvBuffer = model.buffers[uvBufferView.buffer];
+	if (sceneIndex < (int)model.scenes.size())
+	{
+		for (int root : model.scenes[sceneIndex].nodes)
+			pendingNodes.push_back({ root, SceneGraph_t::NoParent });
+	}
+	else
+	{
+		// No scenes, so every node that isn't somebody's child is a root
+		std::vector<bool> isChild(model.nodes.size(), false);
 
-				auto& normAccessor = model.accessors[primitive.attributes["NORMAL"]];
-				auto& normBufferView = model.bufferViews[normAccessor.bufferView];
-				auto& normBuffer = model.buffers[normBufferView.buffer];
+		for (auto& node : model.nodes)
+			for (int child : node.children)
+				isChild[child] = true;
 
-				auto& tangAccessor = model.accessors[primitive.attributes["TANGENT"]];
-				auto& tangBufferView = model.bufferViews[tangAccessor.bufferView];
-				auto& tangBuffer = model.buffers[tangBufferView.buffer];
+		for (int i = 0; i < (int)model.nodes.size(); ++i)
+			if (!isChild[i])
+				pendingNodes.push_back({ i, SceneGraph_t::NoParent });
+	}
 
-				for (int i = 0; i < posAccessor.count; ++i)
-				{
-					Vertex_t vertex = {};
+	// Scene nodes with a mesh, and which glTF mesh that is
+	std::vector<std::pair<uint32_t, int>> meshNodes = {};
+
+	for (size_t next = 0; next < pendingNodes.size(); ++next)
+	{
+		auto [gltfIndex, parent] = pendingNodes[next];
+		tinygltf::Node& node = model.nodes[gltfIndex];
 
-					// Load position
-					memcpy(&vertex.Position, &posBuffer.data[posAccessor.byteOffset + posBufferView.byteOffset + i * sizeof(glm::vec3)], sizeof(glm::vec3));
+		NodeTransform_t transform = {};
 
-					// Load UVs
-					assert(primitive.attributes.find("TEXCOORD_0") != primitive.attributes.end());
-					memcpy(&vertex.TexCoords, &uvBuffer.data[uvAccessor.byteOffset + uvBufferView.byteOffset + i * sizeof(glm::vec2)], sizeof(glm::vec2));
+		if (node.matrix.size() == 16)
+		{
+			glm::mat4 matrix;
 
-					// Load normals
-					assert(primitive.attributes.find("NORMAL") != primitive.attributes.end());
-					memcpy(&vertex.Normal, &posBuffer.data[normAccessor.byteOffset + normBufferView.byteOffset + i * sizeof(glm::vec3)], sizeof(glm::vec3));
+			for (int i = 0; i < 16; ++i)
+				matrix[i / 4][i % 4] = (float)node.matrix[i];
 
-					// Load normals
-					assert(primitive.attributes.find("TANGENT") != primitive.attributes.end());
-					memcpy(&vertex.Tangent, &posBuffer.data[tangAccessor.byteOffset + tangBufferView.byteOffset + i * sizeof(glm::vec3)], sizeof(glm::vec3));
+			transform = NodeTransform_t::FromMatrix(matrix);
+		}
+		else
+		{
+			if (node.translation.size() == 3)
+				transform.Position = glm::vec3(node.translation[0], node.translation[1], node.translation[2]);
 
-					vertices.emplace_back(vertex);
-				}
-			}
+			// glTF stores quaternions as xyzw
+			if (node.rotation.size() == 4)
+				transform.Rotation = glm::quat((float)node.rotation[3], (float)node.rotation[0], (float)node.rotation[1], (float)node.rotation[2]);
 
-			Material_t material;
+			if (node.scale.size() == 3)
+				transform.Scale = glm::vec3(node.scale[0], node.scale[1], node.scale[2]);
+		}
 
-			WGPUSamplerDescriptor samplerDesc = {
-				.addressModeU = WGPUAddressMode_Repeat,
-				.addressModeV = WGPUAddressMode_Repeat,
-				.addressModeW = WGPUAddressMode_Repeat,
-				.magFilter = WGPUFilterMode_Linear,
-				.minFilter = WGPUFilterMode_Linear,
-				.mipmapFilter = WGPUMipmapFilterMode_Linear,
-				.lodMinClamp = 0.0f,
-				.lodMaxClamp = 1.0f,
-				.compare = WGPUCompareFunction_Undefined,
-				.maxAnisotropy = 1
-			};
+		uint32_t nodeIndex = Scene.AddNode(parent, transform, node.name);
 
-			material.Sampler = wgpuDeviceCreateSampler(gpu->Device, &samplerDesc);
+		// Breadth-first, so parents are always added before their children
+		for (int child : node.children)
+			pendingNodes.push_back({ child, (int32_t)nodeIndex });
 
-			if (primitive.material >= 0)
-			{
-				const tinygltf::Material& gltfMaterial = model.materials[primitive.material];
+		if (node.mesh >= 0)
+			meshNodes.push_back({ nodeIndex, node.mesh });
+	}
 
-				LoadTextureIfAvailable(gpu, model, gltfMaterial.pbrMetallicRoughness.baseColorTexture, material.ColorTexture);
-				LoadTextureIfAvailable(gpu, model, gltfMaterial.pbrMetallicRoughness.metallicRoughnessTexture, material.MetalRoughnessTexture);
-				LoadTextureIfAvailable(gpu, model, gltfMaterial.emissiveTexture, material.EmissiveTexture);
-				LoadTextureIfAvailable(gpu, model, gltfMaterial.occlusionTexture, material.AoTexture);
-				LoadTextureIfAvailable(gpu, model, gltfMaterial.normalTexture, material.NormalTexture);
+	//
+	// One object buffer slot per primitive instance
+	//
+	size_t objectCount = 0;
+
+	for (auto [nodeIndex, meshIndex] : meshNodes)
+		objectCount += model.meshes[meshIndex].primitives.size();
+
+	ObjectUniforms.resize(std::max<size_t>(objectCount, 1));
+	ObjectBuffer = Graphics::MakeUniformBuffer(gpu, ObjectUniforms.size());
+
+	WGPUBindGroupEntry objectBindings[2] = {};
+	objectBindings[0].binding = 0;
+	objectBindings[0].buffer = ObjectBuffer.DataBuffer;
+	objectBindings[0].size = sizeof(UniformBuffer_t);
+	objectBindings[1].binding = 1;
+	objectBindings[1].buffer = gpu->CameraBuffer;
+	objectBindings[1].size = sizeof(CameraUniforms_t);
+
+	WGPUBindGroupDescriptor objectBindGroupDesc = {
+		.nextInChain = nullptr,
+		.label = "Model object bind group",
+		.layout = gpu->ObjectBindGroupLayout,
+		.entryCount = 2,
+		.entries = objectBindings
+	};
+
+	ObjectBindGroup = Resources::Track(wgpuDeviceCreateBindGroup(gpu->Device, &objectBindGroupDesc), objectBindGroupDesc.label);
+
+	//
+	// Decode primitives on every core, then create their GPU resources here
+	//
+	struct PrimitiveLoad_t
+	{
+		uint32_t NodeIndex;
+		const tinygltf::Primitive* Primitive;
+		std::vector<Vertex_t> Vertices;
+		std::vector<unsigned int> Indices;
+	};
+
+	std::vector<PrimitiveLoad_t> primitiveLoads = {};
+	primitiveLoads.reserve(objectCount);
+
+	// Meshes referenced from several nodes get their own copy of the geometry per node
+	for (auto [nodeIndex, meshIndex] : meshNodes)
+		for (auto& primitive : model.meshes[meshIndex].primitives)
+			primitiveLoads.push_back({ nodeIndex, &primitive, {}, {} });
+
+	Jobs::ParallelFor((uint32_t)primitiveLoads.size(), 1, [&model, &primitiveLoads](uint32_t first, uint32_t last)
+		{
+			for (uint32_t i = first; i < last; ++i)
+				LoadPrimitive(model, *primitiveLoads[i].Primitive, primitiveLoads[i].Vertices, primitiveLoads[i].Indices);
+		});
+
+	for (PrimitiveLoad_t& load : primitiveLoads)
+	{
+		// Primitives without a material fall back to the last slot
+		Handle_t<Material_t> material = load.Primitive->material >= 0 ? Materials[load.Primitive->material] : Materials.back();
+
+		Handle_t<Mesh_t> meshHandle = gpu->MeshPool.Create();
+		Mesh_t& mesh = *gpu->MeshPool.Get(meshHandle);
+
+		mesh.Init(gpu, std::move(load.Vertices), std::move(load.Indices), material, ObjectBindGroup, (uint32_t)Meshes.size());
+		mesh.NodeIndex = load.NodeIndex;
+		Meshes.push_back(meshHandle);
+
+		// The pool slot, so IDs of destroyed meshes come back and stay as small as the number of live meshes
+		mesh.InstanceId = meshHandle.Index;
+
+		// ObjectUniforms never grows after this, so the scene can write the node's matrices straight into it
+		UniformBuffer_t& uniforms = ObjectUniforms[mesh.ObjectIndex].Data;
+		uniforms.InstanceId = mesh.InstanceId;
+
+		Scene.AddWorldOutput(mesh.NodeIndex, &uniforms.ModelMatrix, &uniforms.NormalMatrix);
+		mesh.ModelMatrix = &uniforms.ModelMatrix;
+	}
+
+	// Every slot once; from here on only the ones whose node moved
+	Scene.Update();
+	gpu->Uploads->UploadBuffer(ObjectBuffer.DataBuffer, 0, ObjectUniforms.data(), ObjectUniforms.size() * sizeof(ObjectUniforms_t));
+}
+
+void Model_t::UploadObjects(uint32_t first, uint32_t count)
+{
+	if (count > 0)
+		Gpu->Frames->WriteBuffer(ObjectBuffer.DataBuffer, first * sizeof(ObjectUniforms_t), &ObjectUniforms[first], count * sizeof(ObjectUniforms_t));
+}
+
+void Model_t::Submit(GraphicsDevice_t* gpu, RenderQueue_t& queue)
+{
+	Scene.Update();
+
+	glm::mat4 viewMatrix = Camera->GetViewMatrix();
+
+	// Slots of meshes that moved, in runs of neighbouring slots so each run is one upload
+	uint32_t uploadFirst = 0;
+	uint32_t uploadCount = 0;
+
+	for (Handle_t<Mesh_t> meshHandle : Meshes)
+	{
+		Mesh_t& mesh = *gpu->MeshPool.Get(meshHandle);
+
+		// Hidden meshes too, so they're current once they show up again
+		if (Scene.HasWorldChanged(mesh.NodeIndex))
+		{
+			if (uploadCount > 0 && mesh.ObjectIndex != uploadFirst + uploadCount)
+			{
+				UploadObjects(uploadFirst, uploadCount);
+				uploadCount = 0;
 			}
 
-			Mesh_t newMesh;
-			newMesh.Init(gpu, vertices, indices, material);
-			Meshes.push_back(newMesh);
+			if (uploadCount == 0)
+				uploadFirst = mesh.ObjectIndex;
+
+			uploadCount++;
+		}
+
+		if (!mesh.IsVisible)
+			continue;
+
+		// Brings back evicted geometry and textures before anything records the mesh
+		Budget->MakeResident(mesh);
+
+		Material_t* material = gpu->MaterialPool.Get(mesh.Material);
+
+		// Sort on the view-space depth of the mesh's bounds centre, normalised to the clip range
+		glm::vec3 boundsCenter = (mesh.BoundsMin + mesh.BoundsMax) * 0.5f;
+		glm::vec4 viewPosition = viewMatrix * mesh.GetModelMatrix() * glm::vec4(boundsCenter, 1.0f);
+		float depth = (-viewPosition.z - Camera->ZNear) / (Camera->ZFar - Camera->ZNear);
+
+		// Neither the G-buffer nor the visibility buffer can blend, so these are shaded forward on every path
+		if (material->IsTransparent)
+		{
+			queue.Push(DrawPass_t::Transparent, &mesh, material, gpu->MeshTransparentPipeline, depth);
+			continue;
+		}
+
+		bool useDepthPrepass = DepthPrepassMode == DepthPrepassMode_t::On
+			|| (DepthPrepassMode == DepthPrepassMode_t::Auto && mesh.OverdrawEstimate > DepthPrepassOverdrawThreshold);
+
+		// The visibility pass is cheap enough on its own that a depth prepass wouldn't pay off; meshes whose
+		// IDs don't fit the visibility buffer get shaded forward after the resolve instead
+		if (ShadingPath == ShadingPath_t::Visibility)
+		{
+			if (VisibilityRenderer_t::CanDraw(mesh))
+				queue.Push(DrawPass_t::Visibility, &mesh, material, Visibility->GetGeometryPipeline(), depth);
+			else
+				queue.Push(DrawPass_t::Opaque, &mesh, material, gpu->MeshPipeline, depth);
+
+			continue;
+		}
+
+		// Deferred meshes go to the G-buffer instead of being lit straight away
+		DrawPass_t shadingPass = ShadingPath == ShadingPath_t::Deferred ? DrawPass_t::GBuffer : DrawPass_t::Opaque;
+		WGPURenderPipeline pipeline = shadingPass == DrawPass_t::GBuffer ? gpu->MeshGBufferPipeline : gpu->MeshPipeline;
+		WGPURenderPipeline depthEqualPipeline = shadingPass == DrawPass_t::GBuffer ? gpu->MeshGBufferDepthEqualPipeline : gpu->MeshDepthEqualPipeline;
+
+		if (useDepthPrepass)
+		{
+			queue.Push(DrawPass_t::DepthPrepass, &mesh, material, gpu->DepthPrepassPipeline, depth);
+			queue.Push(shadingPass, &mesh, material, depthEqualPipeline, depth);
+		}
+		else
+		{
+			queue.Push(shadingPass, &mesh, material, pipeline, depth);
 		}
 	}
+
+	UploadObjects(uploadFirst, uploadCount);
 }
 
-void Model_t::Draw(GraphicsDevice_t* gpu, WGPURenderPassEncoder renderPass)
+void Model_t::SubmitShadowCasters(ShadowAtlas_t& atlas)
 {
-	for (auto& mesh : Meshes)
+	for (Handle_t<Mesh_t> meshHandle : Meshes)
 	{
-		mesh.Draw(gpu, renderPass);
+		Mesh_t& mesh = *Gpu->MeshPool.Get(meshHandle);
+
+		if (mesh.IsVisible)
+			atlas.AddCaster(&mesh, mesh.IsStatic);
 	}
 }
 
+void Model_t::SetMeshVisible(size_t index, bool isVisible)
+{
+	Gpu->MeshPool.Get(Meshes[index])->IsVisible = isVisible;
+}
+
+void Model_t::SetMeshStatic(size_t index, bool isStatic)
+{
+	Gpu->MeshPool.Get(Meshes[index])->IsStatic = isStatic;
+}
+
 void Model_t::Destroy()
 {
-	for (auto& mesh : Meshes)
+	for (Handle_t<Mesh_t> meshHandle : Meshes)
 	{
-		mesh.Destroy();
+		Gpu->MeshPool.Get(meshHandle)->Destroy();
+		Gpu->MeshPool.Destroy(meshHandle);
 	}
+
+	// Meshes only refer to these, the model owns them
+	for (Handle_t<Material_t> materialHandle : Materials)
+	{
+		Gpu->MaterialPool.Get(materialHandle)->Destroy();
+		Gpu->MaterialPool.Destroy(materialHandle);
+	}
+
+	Meshes.clear();
+	Materials.clear();
+
+	// The scene writes into the object uniforms, so both go together
+	Scene.Clear();
+	ObjectUniforms.clear();
+
+	ObjectBindGroup.Reset();
+
+	if (ObjectBuffer.DataBuffer)
+		ObjectBuffer.Destroy();
 }
 
 void Mesh_t::Destroy()
 {
-	VertexBuffer.Destroy();
-	IndexBuffer.Destroy();
+	DestroyGeometry();
+
+	ObjectBindGroup = nullptr;
 }
 
 void Texture_t::LoadFromMemory(GraphicsDevice_t* gpu, const unsigned char* data, int width, int height, int channels)
 {
+	Width = (uint32_t)width;
+	Height = (uint32_t)height;
+
+	//
+	// Mip 0, expanded to RGBA
+	//
+	Mips.clear();
+	Mips.emplace_back((size_t)Width * Height * 4);
+
+	for (size_t i = 0; i < (size_t)Width * Height; ++i)
+	{
+		const unsigned char* texel = data + i * channels;
+		uint8_t* rgba = Mips[0].data() + i * 4;
+
+		// Grey (and alpha) images repeat the grey value
+		bool isGrey = channels < 3;
+
+		rgba[0] = texel[0];
+		rgba[1] = texel[isGrey ? 0 : 1];
+		rgba[2] = texel[isGrey ? 0 : 2];
+		rgba[3] = channels == 4 || channels == 2 ? texel[channels - 1] : 255;
+	}
+
+	//
+	// The rest of the chain, 2x2 box filtered; odd edges repeat their last texel
+	//
+	uint32_t mipWidth = Width;
+	uint32_t mipHeight = Height;
+
+	while (mipWidth > 1 || mipHeight > 1)
+	{
+		uint32_t nextWidth = std::max(mipWidth / 2, 1u);
+		uint32_t nextHeight = std::max(mipHeight / 2, 1u);
+
+		const std::vector<uint8_t>& source = Mips.back();
+		std::vector<uint8_t> next((size_t)nextWidth * nextHeight * 4);
+
+		for (uint32_t y = 0; y < nextHeight; ++y)
+		{
+			uint32_t y0 = std::min(y * 2, mipHeight - 1);
+			uint32_t y1 = std::min(y * 2 + 1, mipHeight - 1);
+
+			for (uint32_t x = 0; x < nextWidth; ++x)
+			{
+				uint32_t x0 = std::min(x * 2, mipWidth - 1);
+				uint32_t x1 = std::min(x * 2 + 1, mipWidth - 1);
+
+				for (uint32_t c = 0; c < 4; ++c)
+				{
+					uint32_t sum = source[((size_t)y0 * mipWidth + x0) * 4 + c] + source[((size_t)y0 * mipWidth + x1) * 4 + c]
+						+ source[((size_t)y1 * mipWidth + x0) * 4 + c] + source[((size_t)y1 * mipWidth + x1) * 4 + c];
+
+					next[((size_t)y * nextWidth + x) * 4 + c] = (uint8_t)((sum + 2) / 4);
+				}
+			}
+		}
+
+		Mips.push_back(std::move(next));
+
+		mipWidth = nextWidth;
+		mipHeight = nextHeight;
+	}
+
+	SetResidentMip(gpu, 0);
+}
+
+void Texture_t::SetResidentMip(GraphicsDevice_t* gpu, uint32_t mip)
+{
+	if (Mips.empty())
+		return;
+
+	mip = std::min(mip, (uint32_t)Mips.size() - 1);
+
+	// Frames in flight may still sample the old one
+	TextureView.Reset();
+	Texture.Reset();
+
+	uint32_t mipCount = (uint32_t)Mips.size() - mip;
+
 	WGPUTextureDescriptor textureDesc = {
 		.nextInChain = nullptr,
+		.label = "Material texture",
 		.usage = WGPUTextureUsage_TextureBinding | WGPUTextureUsage_CopyDst,
 		.dimension = WGPUTextureDimension_2D,
-		.size = { (unsigned int)width, (unsigned int)height, 1 },
+		.size = { std::max(Width >> mip, 1u), std::max(Height >> mip, 1u), 1 },
 		.format = WGPUTextureFormat_RGBA8Unorm,
 
-		.mipLevelCount = 1,
+		.mipLevelCount = mipCount,
 		.sampleCount = 1,
 		.viewFormatCount = 0,
 		.viewFormats = nullptr
 	};
 
-	Texture = wgpuDeviceCreateTexture(gpu->Device, &textureDesc);
+	Texture = Resources::Track(wgpuDeviceCreateTexture(gpu->Device, &textureDesc), textureDesc.label, MemoryCategory_t::Texture, Resources::GetTextureSize(textureDesc));
 
-	WGPUImageCopyTexture destination = {
-		.nextInChain = nullptr,
-		.texture = Texture,
-		.mipLevel = 0,
-		.origin = { 0, 0, 0 },
-		.aspect = WGPUTextureAspect_All,
-	};
+	for (uint32_t level = 0; level < mipCount; ++level)
+	{
+		WGPUImageCopyTexture destination = {
+			.nextInChain = nullptr,
+			.texture = Texture,
+			.mipLevel = level,
+			.origin = { 0, 0, 0 },
+			.aspect = WGPUTextureAspect_All,
+		};
 
-	WGPUTextureDataLayout source = {
-		.offset = 0,
-		.bytesPerRow = (unsigned int)(channels * width),
-		.rowsPerImage = (unsigned int)height
-	};
+		WGPUExtent3D levelSize = { std::max(textureDesc.size.width >> level, 1u), std::max(textureDesc.size.height >> level, 1u), 1 };
 
-	wgpuQueueWriteTexture(gpu->Queue, &destination, data, static_cast<size_t>(width * height * channels), &source, &textureDesc.size);
+		gpu->Uploads->UploadTexture(destination, Mips[mip + level].data(), levelSize.width * 4, levelSize.height, levelSize);
+	}
 
 	WGPUTextureViewDescriptor textureViewDesc = {
 		.nextInChain = nullptr,
 		.format = textureDesc.format,
 		.dimension = WGPUTextureViewDimension_2D,
 		.baseMipLevel = 0,
-		.mipLevelCount = 1,
+		.mipLevelCount = mipCount,
 		.baseArrayLayer = 0,
 		.arrayLayerCount = 1,
 		.aspect = WGPUTextureAspect_All
 	};
 
-	TextureView = wgpuTextureCreateView(Texture, &textureViewDesc);
+	TextureView = Resources::Track(wgpuTextureCreateView(Texture, &textureViewDesc), "Material texture view");
+	ResidentMip = mip;
+}
+
+bool Texture_t::CanDropMip(uint32_t minSize)
+{
+	return ResidentMip + 1 < Mips.size() && std::max(Width, Height) >> (ResidentMip + 1) >= minSize;
+}
+
+void Texture_t::Destroy()
+{
+	TextureView.Reset();
+	Texture.Reset();
 }
\ No newline at end of file
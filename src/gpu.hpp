@@ -1,15 +1,30 @@
 #pragma once
 
+#include "pool.hpp"
+#include "resources.hpp"
+#include "scene.hpp"
+
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <webgpu/webgpu.h>
 
+#include <span>
 #include <vector>
 
 class CWindow;
+enum class CaptureFormat_t;
+struct DynamicResolutionSettings_t;
+struct FramesInFlight_t;
+struct PresentSettings_t;
+struct UploadManager_t;
+struct GpuProfiler_t;
+struct FrameState_t;
 struct GraphicsDevice_t;
+struct Light_t;
+struct RenderQueue_t;
+struct ShadowAtlas_t;
 struct Vector3_t;
 
 /*
@@ -42,11 +57,11 @@ public:
 	glm::quat GetRotation()										{ return Rotation; }
 	void SetRotation(glm::quat newRot)							{ Rotation = newRot; }
 
-	static Transform_t* MakeDefault()
+	static Transform_t MakeDefault()
 	{
-		Transform_t* tx = new Transform_t();
-		tx->PositionAndScale = { 0,0,0,1 };
-		tx->Rotation = { 0,0,0,1 };
+		Transform_t tx = {};
+		tx.PositionAndScale = { 0,0,0,1 };
+		tx.Rotation = { 0,0,0,1 };
 		return tx;
 	}
 };
@@ -63,12 +78,19 @@ struct Camera_t
 	float ZFar													= 100.0f;
 	float Aspect												= 16.0f / 9.0f;
 
-	inline glm::mat4 GetViewProjMatrix()
+	inline glm::mat4 GetViewMatrix()
+	{
+		return glm::lookAt(Transform.GetPosition(), glm::vec3(0, 0, 0), glm::vec3(0, 0, -1));
+	}
+
+	inline glm::mat4 GetProjectionMatrix()
 	{
-		glm::mat4 view = glm::lookAt(Transform.GetPosition(), glm::vec3(0, 0, 0), glm::vec3(0, 0, -1));
-		glm::mat4 projection = glm::perspective(glm::radians(FieldOfView), Aspect, ZNear, ZFar);
+		return glm::perspective(glm::radians(FieldOfView), Aspect, ZNear, ZFar);
+	}
 
-		return projection * view;
+	inline glm::mat4 GetViewProjMatrix()
+	{
+		return GetProjectionMatrix() * GetViewMatrix();
 	}
 };
 
@@ -77,7 +99,7 @@ struct Camera_t
  */
 struct GraphicsBuffer_t
 {
-	WGPUBuffer DataBuffer										= nullptr;
+	GpuObject_t<WGPUBuffer> DataBuffer							= {};
 	size_t DataSize												= SIZE_MAX;
 	int Count													= -1;
 
@@ -89,21 +111,151 @@ struct GraphicsBuffer_t
  */
 struct Texture_t
 {
-	WGPUTexture Texture											= nullptr;
-	WGPUTextureView TextureView									= nullptr;
+	GpuObject_t<WGPUTexture> Texture							= {};
+	GpuObject_t<WGPUTextureView> TextureView					= {};
+
+	// RGBA8 mip chain on the CPU, so mips dropped from the GPU can be uploaded again
+	std::vector<std::vector<uint8_t>> Mips						= {};
+	uint32_t Width												= 0;
+	uint32_t Height												= 0;
+
+	// Largest mip on the GPU; the ones above it were dropped to save memory
+	uint32_t ResidentMip										= 0;
 
 	void LoadFromMemory(GraphicsDevice_t* gpu, const unsigned char* data, int width, int height, int channels);
+
+	// Recreate the GPU texture starting at mip; bind groups using the old view have to be recreated
+	void SetResidentMip(GraphicsDevice_t* gpu, uint32_t mip);
+
+	// Whether the next mip down still has minSize texels on its larger side
+	bool CanDropMip(uint32_t minSize);
+
+	void Destroy();
 };
 
 struct Material_t
 {
+	uint32_t Id													= 0;
+
 	Texture_t ColorTexture										= {};
 	Texture_t AoTexture											= {};
 	Texture_t EmissiveTexture									= {};
 	Texture_t MetalRoughnessTexture								= {};
 	Texture_t NormalTexture										= {};
 
-	WGPUSampler Sampler											= nullptr;
+	GpuObject_t<WGPUSampler> Sampler							= {};
+	GpuObject_t<WGPUBindGroup> BindGroup						= {};
+
+	// glTF alphaMode BLEND: shaded forward after everything opaque, blended back-to-front
+	bool IsTransparent											= false;
+
+	// Frame the material was last drawn with, for eviction
+	uint64_t LastUsedFrame										= 0;
+
+	// Create the material bind group once textures & sampler are loaded
+	void Init(GraphicsDevice_t* gpu);
+
+	// Halve every texture that's still larger than minSize; false when none was
+	bool DropTopMip(GraphicsDevice_t* gpu, uint32_t minSize);
+
+	// Upload dropped mips again; false when nothing was dropped
+	bool Restore(GraphicsDevice_t* gpu);
+
+	void Destroy();
+
+private:
+	void CreateBindGroup(GraphicsDevice_t* gpu);
+};
+
+/*
+ * Which pass a draw belongs to - the most significant part of the render queue's sort key
+ */
+enum class DrawPass_t : uint8_t
+{
+	DepthPrepass = 0,
+	GBuffer,
+	Visibility,
+	Opaque,
+	Transparent,
+
+	Count
+};
+
+enum class DepthPrepassMode_t
+{
+	Off,	// Every mesh is shaded with a regular depth test
+	On,		// Every mesh goes through the depth prepass
+	Auto	// Only meshes with a high overdraw estimate go through the depth prepass
+};
+
+enum class ShadingPath_t
+{
+	Forward,	// Opaque meshes are lit as they're drawn
+	Deferred,	// Opaque meshes fill a G-buffer, lit afterwards in one full-screen pass
+	Visibility	// Opaque meshes write triangle IDs only, materials and lights run once per pixel afterwards
+};
+
+/*
+ * FNV-1a, one byte at a time
+ */
+inline uint64_t HashCombine(uint64_t hash, uint64_t value)
+{
+	for (int i = 0; i < 8; ++i)
+	{
+		hash ^= (value >> (i * 8)) & 0xFF;
+		hash *= 0x100000001B3ull;
+	}
+
+	return hash;
+}
+
+constexpr uint64_t HashSeed										= 0xCBF29CE484222325ull;
+
+/*
+ * Per-object uniforms, must match `UniformBuffer` in the WGSL sources
+ */
+struct UniformBuffer_t
+{
+	glm::mat4 ModelMatrix										= {};
+
+	// Inverse transpose of the model matrix, for normals
+	glm::mat4 NormalMatrix										= {};
+
+	uint32_t InstanceId											= 0;
+	uint32_t Padding[3]											= {};
+};
+
+/*
+ * UniformBuffer_t padded out to the uniform buffer offset alignment; the object buffer is an array of these
+ */
+struct alignas(256) ObjectUniforms_t
+{
+	UniformBuffer_t Data										= {};
+};
+
+/*
+ * Per-frame uniforms every draw shares, must match `CameraUniforms` in the WGSL sources
+ */
+struct CameraUniforms_t
+{
+	glm::mat4 ViewProjMatrix									= {};
+	glm::vec3 CameraPosition									= {};
+	float Padding												= 0.0f;
+};
+
+/*
+ * A pre-recorded list of draw commands that gets replayed every frame
+ */
+struct RenderBundle_t
+{
+	WGPURenderBundle Bundle										= nullptr;
+
+	// Hash of the state that was recorded into Bundle
+	uint64_t Signature											= 0;
+
+	bool IsValid(uint64_t signature)							{ return Bundle != nullptr && Signature == signature; }
+
+	void Destroy();
 };
 
 /*
@@ -113,27 +265,69 @@ struct Mesh_t
 {
 private:
 	friend struct Model_t;
+	friend struct RenderQueue_t;
+	friend struct ShadowAtlas_t;
+	friend struct VisibilityRenderer_t;
+	friend struct MemoryBudget_t;
 	
-	WGPURenderPipeline Pipeline									= nullptr;
-	WGPUBindGroup BindGroup										= nullptr;
+	bool IsVisible												= true;
+
+	// Static meshes get their shadows cached
+	bool IsStatic												= true;
+
+	// The model's object bind group, bound at GetObjectOffset; owned by the model
+	WGPUBindGroup ObjectBindGroup								= nullptr;
+
+	// Index and vertex buffers as storage, for passes that fetch vertices themselves
+	GpuObject_t<WGPUBindGroup> GeometryBindGroup				= {};
+
+	// Written into the visibility buffer to tell meshes apart
+	uint32_t InstanceId											= 0;
+
+	glm::vec3 BoundsMin											= {};
+	glm::vec3 BoundsMax											= {};
+
+	// Average number of times each covered pixel gets rasterized
+	float OverdrawEstimate										= 0.0f;
+
 	GraphicsBuffer_t IndexBuffer								= {};
 	GraphicsBuffer_t VertexBuffer								= {};
-	Transform_t Transform										= {};
-	GraphicsBuffer_t UniformBuffer								= {};
+	GraphicsBuffer_t PositionBuffer								= {};
 
-	Material_t Material											= {};
+	// Geometry is kept on the CPU as well, so it can be evicted from the GPU and loaded again
+	std::vector<Vertex_t> Vertices								= {};
+	std::vector<unsigned int> Indices							= {};
+	bool IsResident												= false;
 
-	void Init(GraphicsDevice_t* gpu, std::vector<Vertex_t> vertices, std::vector<unsigned int> indices, Material_t material);
-	void Draw(GraphicsDevice_t* gpu, WGPURenderPassEncoder renderPass);
+	// Frame the mesh was last drawn in, for eviction
+	uint64_t LastUsedFrame										= 0;
 
-	inline glm::mat4 GetModelMatrix()
-	{
-		glm::mat4 scaleMatrix = glm::scale(glm::mat4(1.0f), glm::vec3(Transform.GetScale()));
-		glm::mat4 rotationMatrix = glm::mat4_cast(Transform.GetRotation());
-		glm::mat4 translationMatrix = glm::translate(glm::mat4(1.0f), Transform.GetPosition());
+	// Slot in the model's object buffer
+	uint32_t ObjectIndex										= 0;
 
-		return translationMatrix * rotationMatrix * scaleMatrix;
-	}
+	// Scene node the mesh hangs off, and that node's world matrix as of the last scene update; the
+	// scene writes it straight into the model's object uniforms
+	uint32_t NodeIndex											= 0;
+	const glm::mat4* ModelMatrix								= nullptr;
+
+	// Owned by the model, shared between its meshes
+	Handle_t<Material_t> Material								= {};
+
+	void Init(GraphicsDevice_t* gpu, std::vector<Vertex_t> vertices, std::vector<unsigned int> indices, Handle_t<Material_t> material, WGPUBindGroup objectBindGroup, uint32_t objectIndex);
+
+	// Vertex, position and index buffers plus the geometry bind group
+	void CreateGeometry(GraphicsDevice_t* gpu);
+	void DestroyGeometry();
+	uint64_t GetGeometrySize();
+
+	uint64_t GetSignature(uint64_t hash);
+
+	// Dynamic offset of the mesh's slot in the object bind group
+	uint32_t GetObjectOffset()									{ return ObjectIndex * (uint32_t)sizeof(ObjectUniforms_t); }
+
+	const glm::mat4& GetModelMatrix()							{ return *ModelMatrix; }
+
+	void GetWorldBoundingSphere(glm::vec3& center, float& radius);
 
 	void Destroy();
 };
@@ -144,11 +338,47 @@ private:
 struct Model_t
 {
 private:
-	std::vector<Mesh_t> Meshes = {};
+	GraphicsDevice_t* Gpu = nullptr;
+
+	// In the device's pools
+	std::vector<Handle_t<Mesh_t>> Meshes = {};
+	std::vector<Handle_t<Material_t>> Materials = {};
+
+	// glTF nodes of the loaded scene; meshes follow the node they were instanced from
+	SceneGraph_t Scene = {};
+
+	// Per-object uniforms of every mesh, written by the scene update; only the slots of nodes that
+	// moved get uploaded again
+	std::vector<ObjectUniforms_t> ObjectUniforms = {};
+	GraphicsBuffer_t ObjectBuffer = {};
+
+	// Every mesh's slot through one dynamic offset, plus the device's camera uniforms
+	GpuObject_t<WGPUBindGroup> ObjectBindGroup = {};
+
+	// Slots [first, first + count) of ObjectUniforms, copied over before the frame runs
+	void UploadObjects(uint32_t first, uint32_t count);
 
 public:
 	void Init(GraphicsDevice_t* gpu, const char* gltfPath);
-	void Draw(GraphicsDevice_t* gpu, WGPURenderPassEncoder renderPass);
+
+	// Push every visible mesh into the render queue, and upload the uniforms of meshes that moved
+	void Submit(GraphicsDevice_t* gpu, RenderQueue_t& queue);
+
+	// Every visible mesh casts shadows
+	void SubmitShadowCasters(ShadowAtlas_t& atlas);
+
+	// Show or hide a mesh; the render queue picks this up on the next submit
+	void SetMeshVisible(size_t index, bool isVisible);
+
+	// Meshes that move should be marked dynamic, otherwise every move invalidates cached shadows
+	void SetMeshStatic(size_t index, bool isStatic);
+
+	// Node indices are in load order, not glTF order; look them up by name
+	int32_t FindNode(const std::string& name)					{ return Scene.FindNode(name); }
+	NodeTransform_t GetNodeTransform(uint32_t node)				{ return Scene.GetLocalTransform(node); }
+
+	// Moves the node and everything under it, from the next submit on
+	void SetNodeTransform(uint32_t node, const NodeTransform_t& transform) { Scene.SetLocalTransform(node, transform); }
 
 	void Destroy();
 };
@@ -164,35 +394,114 @@ struct GraphicsDevice_t
 	WGPUDevice Device											= nullptr;
 	WGPUQueue Queue												= nullptr;
 	WGPUSwapChain SwapChain										= nullptr;
-
-	WGPUTextureView DepthTextureView							= nullptr;
-	WGPUTexture DepthTexture									= nullptr;
+	WGPUPresentMode PresentMode									= WGPUPresentMode_Fifo;
+
+	// Size of the swap chain
+	int Width													= 0;
+	int Height													= 0;
+
+	// Optional features the device got created with
+	bool HasTimestampQuery										= false;
+	bool HasTimestampQueryInsidePasses							= false;
+
+	// Device calls are safe from any thread, not just the one that created it
+	bool IsMultithreaded										= false;
+
+	// Per-frame resource sets and GPU completion tracking; per-frame uploads go through here
+	FramesInFlight_t* Frames									= nullptr;
+
+	// Everything else that gets uploaded, batched through staging chunks
+	UploadManager_t* Uploads									= nullptr;
+
+	// GPU timings of every frame graph pass, and of scopes within them
+	GpuProfiler_t* Profiler										= nullptr;
+
+	// Every mesh and material of every model; models refer to theirs by handle
+	Pool_t<Mesh_t> MeshPool										= {};
+	Pool_t<Material_t> MaterialPool								= {};
+
+	// 1x1 stand-ins bound wherever a material has no texture of its own
+	Texture_t WhiteTexture										= {};
+	Texture_t BlackTexture										= {};
+	Texture_t FlatNormalTexture									= {};
+
+	//
+	// Shared pipeline state
+	//
+	WGPUBindGroupLayout ObjectBindGroupLayout					= nullptr;
+	WGPUBindGroupLayout MaterialBindGroupLayout					= nullptr;
+	WGPUBindGroupLayout LightingBindGroupLayout					= nullptr;
+	WGPUBindGroupLayout MeshGeometryBindGroupLayout				= nullptr;
+	WGPURenderPipeline MeshPipeline								= nullptr;
+	WGPURenderPipeline MeshDepthEqualPipeline					= nullptr;
+	WGPURenderPipeline MeshTransparentPipeline					= nullptr;
+	WGPURenderPipeline DepthPrepassPipeline						= nullptr;
+	WGPURenderPipeline MeshGBufferPipeline						= nullptr;
+	WGPURenderPipeline MeshGBufferDepthEqualPipeline			= nullptr;
+
+	// Camera uniforms, written once a frame and bound with every object bind group
+	WGPUBuffer CameraBuffer										= nullptr;
 
 	GraphicsDevice_t(CWindow* window);
 	~GraphicsDevice_t();
 };
 
-/*
- *
- */
-struct UniformBuffer_t
-{
-	glm::mat4 ModelMatrix										= {};
-	glm::mat4 ViewProjMatrix									= {};
-	glm::vec3 CameraPosition									= {};
-	float unused												= -1.0f;
-};
+// Pipeline helpers
+void SetDefaultBindGroupLayoutEntry(WGPUBindGroupLayoutEntry& bindingLayout);
+void SetDefaultDepthStencilState(WGPUDepthStencilState& depthStencilState);
 
 /*
  * Rendering functions
  */
 namespace Graphics
 {
-	void OnRender(GraphicsDevice_t* gpu);
+	// Runs on whichever thread owns the device, see ThreadingMode_t
+	void OnRender(GraphicsDevice_t* gpu, const FrameState_t& state);
+
+	// Frame limiter and low-latency delay; runs right before the frame samples its input
+	void WaitForNextFrame(GraphicsDevice_t* gpu);
+
+	GraphicsBuffer_t MakeVertexBuffer(GraphicsDevice_t* gpu, std::span<const Vertex_t> vertexData, WGPUVertexBufferLayout vertexBufferLayout);
+	GraphicsBuffer_t MakePositionBuffer(GraphicsDevice_t* gpu, std::span<const glm::vec3> positionData);
+	GraphicsBuffer_t MakeIndexBuffer(GraphicsDevice_t* gpu, std::span<const unsigned int> indexData);
+
+	// Room for objectCount ObjectUniforms_t slots
+	GraphicsBuffer_t MakeUniformBuffer(GraphicsDevice_t* gpu, size_t objectCount);
+
+	WGPUShaderModule MakeShaderModule(GraphicsDevice_t* gpu, const char* source);
+	WGPURenderBundleEncoder MakeRenderBundleEncoder(GraphicsDevice_t* gpu, DrawPass_t pass, const char* label);
+
+	// Lights live until the device goes away; returns the index to pass to GetLight
+	size_t AddLight(const Light_t& light);
+	Light_t& GetLight(size_t index);
+
+	void SetDepthPrepassMode(DepthPrepassMode_t mode);
+
+	// Transparent meshes are always shaded forward
+	void SetShadingPath(ShadingPath_t path);
+
+	// Scene resolution bounds and GPU time target; the swap chain always stays at the window size
+	void SetDynamicResolution(const DynamicResolutionSettings_t& settings);
+
+	// Present mode, frame limit and latency mode; applied from the next frame on
+	void SetPresentSettings(const PresentSettings_t& settings);
+
+	// Written by a worker a few frames later; .png as PNG, anything else as raw RGBA8
+	void CaptureScreenshot(const char* path);
+
+	// Every frame until stopped; frames are dropped rather than waited for when readback falls behind
+	void StartFrameCapture(const char* directory, CaptureFormat_t format);
+	void StopFrameCapture();
+
+	// Equirectangular .hdr for image-based lighting; baked results are cached under content/cache
+	void SetEnvironment(const char* hdrPath);
+
+	// Least recently drawn meshes and textures get evicted above this many bytes; 0 for no limit
+	void SetMemoryBudget(uint64_t bytes);
 
-	GraphicsBuffer_t MakeVertexBuffer(GraphicsDevice_t* gpu, std::vector<Vertex_t> vertexData, WGPUVertexBufferLayout vertexBufferLayout);
-	GraphicsBuffer_t MakeIndexBuffer(GraphicsDevice_t* gpu, std::vector<unsigned int> indexData);
+	// Prints GPU memory usage per category against the budget
+	void ReportMemoryUsage();
 
-	GraphicsBuffer_t MakeUniformBuffer(GraphicsDevice_t* gpu);
-	void UpdateUniformBuffer(GraphicsDevice_t* gpu, GraphicsBuffer_t uniformBuffer, UniformBuffer_t uniformBufferData);
+	// Prints the smoothed GPU time of every pass and profiler scope, from the device thread
+	void ReportGpuTimings(GraphicsDevice_t* gpu);
 }
\ No newline at end of file
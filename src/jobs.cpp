@@ -0,0 +1,383 @@
+#include "jobs.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <thread>
+
+/*
+ * Scheduler state, shared by every thread
+ */
+struct JobScheduler_t
+{
+	/*
+	 * One thread's deque; the owner works at the back, thieves take from the front.
+	 *
+	 * A ring over slots that are never given back, so once it has grown to the most jobs a frame
+	 * queues at once, pushing and popping stop touching the heap
+	 */
+	struct Queue_t
+	{
+		static constexpr uint32_t InitialCapacity				= 256;
+
+		std::mutex Mutex										= {};
+
+		// Power of two in size; jobs sit in [Head, Head + Count), wrapping around
+		std::vector<Job_t> Slots								= std::vector<Job_t>(InitialCapacity);
+		uint32_t Head											= 0;
+		uint32_t Count											= 0;
+
+		bool IsEmpty()											{ return Count == 0; }
+		Job_t& GetSlot(uint32_t index)							{ return Slots[(Head + index) & (Slots.size() - 1)]; }
+
+		void PushBack(Job_t job);
+		Job_t PopBack();
+		Job_t PopFront();
+	};
+
+	// Index 0 belongs to the main thread
+	std::vector<std::unique_ptr<Queue_t>> Queues				= {};
+	std::vector<std::thread> Workers							= {};
+
+	std::mutex MainThreadMutex									= {};
+	std::vector<Job_t> MainThreadJobs							= {};
+
+	// Main thread jobs taken out to run, one batch per nesting level (a main thread job can wait, which
+	// runs main thread jobs again); swapped with MainThreadJobs, so both keep their capacity
+	std::deque<std::vector<Job_t>> MainThreadBatches			= {};
+	uint32_t MainThreadBatchDepth								= 0;
+
+	// Idle workers sleep until something gets queued
+	std::mutex SleepMutex										= {};
+	std::condition_variable WakeUp								= {};
+	std::atomic<uint32_t> QueuedJobs							= 0;
+
+	std::atomic<bool> IsRunning									= false;
+	// Changes hands when the window moves rendering onto its own thread, while others ask IsMainThread
+	std::atomic<std::thread::id> MainThreadId					= {};
+
+	void Push(Job_t job);
+	bool Pop(Job_t& job);
+	void Execute(Job_t& job);
+
+	// Block until the job that took the counter to zero is done touching it
+	void WaitForLastJob(JobCounter_t& counter);
+
+	// Queue the job, or park it on its dependency until that's done
+	void Submit(Job_t job, JobCounter_t* dependency);
+
+	void WorkerLoop(uint32_t index);
+};
+
+static JobScheduler_t Scheduler;
+static thread_local uint32_t ThreadIndex						= 0;
+
+void JobScheduler_t::Queue_t::PushBack(Job_t job)
+{
+	// Full; double, unwrapping the jobs to the start of the new ring
+	if (Count == Slots.size())
+	{
+		std::vector<Job_t> slots(Slots.size() * 2);
+
+		for (uint32_t i = 0; i < Count; ++i)
+			slots[i] = std::move(GetSlot(i));
+
+		Slots.swap(slots);
+		Head = 0;
+	}
+
+	GetSlot(Count++) = std::move(job);
+}
+
+Job_t JobScheduler_t::Queue_t::PopBack()
+{
+	return std::move(GetSlot(--Count));
+}
+
+Job_t JobScheduler_t::Queue_t::PopFront()
+{
+	Job_t job = std::move(GetSlot(0));
+
+	Head = (Head + 1) & (Slots.size() - 1);
+	Count--;
+
+	return job;
+}
+
+void JobScheduler_t::Push(Job_t job)
+{
+	if (job.IsMainThreadOnly)
+	{
+		std::lock_guard<std::mutex> lock(MainThreadMutex);
+		MainThreadJobs.push_back(std::move(job));
+		return;
+	}
+
+	Queue_t& queue = *Queues[ThreadIndex];
+
+	{
+		std::lock_guard<std::mutex> lock(queue.Mutex);
+		queue.PushBack(std::move(job));
+	}
+
+	QueuedJobs.fetch_add(1, std::memory_order_release);
+	WakeUp.notify_one();
+}
+
+bool JobScheduler_t::Pop(Job_t& job)
+{
+	// Own work first, newest first
+	{
+		Queue_t& queue = *Queues[ThreadIndex];
+		std::lock_guard<std::mutex> lock(queue.Mutex);
+
+		if (!queue.IsEmpty())
+		{
+			job = queue.PopBack();
+			QueuedJobs.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+
+	// Then steal the oldest job of whoever has one, starting with the next thread over
+	for (size_t i = 1; i < Queues.size(); ++i)
+	{
+		Queue_t& victim = *Queues[(ThreadIndex + i) % Queues.size()];
+		std::lock_guard<std::mutex> lock(victim.Mutex);
+
+		if (!victim.IsEmpty())
+		{
+			job = victim.PopFront();
+			QueuedJobs.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void JobScheduler_t::Execute(Job_t& job)
+{
+	job.Function();
+
+	JobCounter_t* counter = job.Counter;
+
+	if (!counter)
+		return;
+
+	// The last job out releases everything that waited on the counter
+	Job_t inlineContinuations[JobCounter_t::InlineContinuationCapacity];
+	uint32_t inlineContinuationCount = 0;
+	std::vector<Job_t> continuations = {};
+
+	{
+		std::lock_guard<std::mutex> lock(counter->Mutex);
+
+		if (counter->Count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			inlineContinuationCount = counter->InlineContinuationCount;
+
+			for (uint32_t i = 0; i < inlineContinuationCount; ++i)
+				inlineContinuations[i] = std::move(counter->InlineContinuations[i]);
+
+			counter->InlineContinuationCount = 0;
+			continuations.swap(counter->Continuations);
+		}
+	}
+
+	for (uint32_t i = 0; i < inlineContinuationCount; ++i)
+		Push(std::move(inlineContinuations[i]));
+
+	for (Job_t& continuation : continuations)
+		Push(std::move(continuation));
+}
+
+void JobScheduler_t::WaitForLastJob(JobCounter_t& counter)
+{
+	// The last job drops the count while it still holds the lock, so once we've had the lock
+	// ourselves it has moved on and the counter can go away
+	std::lock_guard<std::mutex> lock(counter.Mutex);
+}
+
+void JobScheduler_t::Submit(Job_t job, JobCounter_t* dependency)
+{
+	assert(!Queues.empty() && "Jobs::Init must run first");
+
+	if (job.Counter)
+		job.Counter->Count.fetch_add(1, std::memory_order_relaxed);
+
+	if (dependency)
+	{
+		std::lock_guard<std::mutex> lock(dependency->Mutex);
+
+		if (!dependency->IsDone())
+		{
+			if (dependency->InlineContinuationCount < JobCounter_t::InlineContinuationCapacity)
+				dependency->InlineContinuations[dependency->InlineContinuationCount++] = std::move(job);
+			else
+				dependency->Continuations.push_back(std::move(job));
+
+			return;
+		}
+	}
+
+	Push(std::move(job));
+}
+
+void JobScheduler_t::WorkerLoop(uint32_t index)
+{
+	ThreadIndex = index;
+
+	while (IsRunning.load(std::memory_order_acquire))
+	{
+		Job_t job;
+
+		if (Pop(job))
+		{
+			Execute(job);
+			continue;
+		}
+
+		// Timed, so a wake-up that slips in between the check and the wait costs a millisecond at most
+		std::unique_lock<std::mutex> lock(SleepMutex);
+		WakeUp.wait_for(lock, std::chrono::milliseconds(1), [this]()
+			{
+				return QueuedJobs.load(std::memory_order_acquire) > 0 || !IsRunning.load(std::memory_order_acquire);
+			});
+	}
+}
+
+void Jobs::Init(uint32_t workerCount)
+{
+	assert(Scheduler.Queues.empty());
+
+	if (workerCount == 0)
+		workerCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+
+	Scheduler.MainThreadId = std::this_thread::get_id();
+	Scheduler.IsRunning = true;
+
+	for (uint32_t i = 0; i < workerCount + 1; ++i)
+		Scheduler.Queues.push_back(std::make_unique<JobScheduler_t::Queue_t>());
+
+	for (uint32_t i = 0; i < workerCount; ++i)
+		Scheduler.Workers.emplace_back(&JobScheduler_t::WorkerLoop, &Scheduler, i + 1);
+}
+
+void Jobs::Shutdown()
+{
+	Scheduler.IsRunning = false;
+	Scheduler.WakeUp.notify_all();
+
+	for (std::thread& worker : Scheduler.Workers)
+		worker.join();
+
+	Scheduler.Workers.clear();
+	Scheduler.Queues.clear();
+	Scheduler.MainThreadJobs.clear();
+	Scheduler.MainThreadBatches.clear();
+	Scheduler.QueuedJobs = 0;
+}
+
+uint32_t Jobs::GetWorkerCount()
+{
+	return (uint32_t)Scheduler.Workers.size();
+}
+
+uint32_t Jobs::GetThreadIndex()
+{
+	return ThreadIndex;
+}
+
+bool Jobs::IsMainThread()
+{
+	return std::this_thread::get_id() == Scheduler.MainThreadId.load(std::memory_order_acquire);
+}
+
+void Jobs::SetMainThread()
+{
+	Scheduler.MainThreadId.store(std::this_thread::get_id(), std::memory_order_release);
+}
+
+void Jobs::Run(JobFunction_t function, JobCounter_t* counter, JobCounter_t* dependency)
+{
+	Scheduler.Submit({ .Function = std::move(function), .Counter = counter, .IsMainThreadOnly = false }, dependency);
+}
+
+void Jobs::RunOnMainThread(JobFunction_t function, JobCounter_t* counter, JobCounter_t* dependency)
+{
+	Scheduler.Submit({ .Function = std::move(function), .Counter = counter, .IsMainThreadOnly = true }, dependency);
+}
+
+void Jobs::Wait(JobCounter_t& counter)
+{
+	bool isMainThread = IsMainThread();
+
+	while (!counter.IsDone())
+	{
+		if (isMainThread)
+			ExecuteMainThreadJobs();
+
+		Job_t job;
+
+		if (Scheduler.Pop(job))
+			Scheduler.Execute(job);
+		else
+			std::this_thread::yield();
+	}
+
+	Scheduler.WaitForLastJob(counter);
+}
+
+void Jobs::ExecuteMainThreadJobs()
+{
+	assert(IsMainThread());
+
+	// Growing the deque leaves the batches further up where they are
+	if (Scheduler.MainThreadBatchDepth == Scheduler.MainThreadBatches.size())
+		Scheduler.MainThreadBatches.emplace_back();
+
+	std::vector<Job_t>& jobs = Scheduler.MainThreadBatches[Scheduler.MainThreadBatchDepth++];
+
+	// Jobs can queue more main thread jobs; those wait for the next call
+	{
+		std::lock_guard<std::mutex> lock(Scheduler.MainThreadMutex);
+		jobs.swap(Scheduler.MainThreadJobs);
+	}
+
+	for (Job_t& job : jobs)
+		Scheduler.Execute(job);
+
+	jobs.clear();
+	Scheduler.MainThreadBatchDepth--;
+}
+
+void Jobs::ParallelFor(uint32_t count, uint32_t grainSize, const void* function, RangeFunc_t invoke)
+{
+	grainSize = std::max(grainSize, 1u);
+
+	// Not worth the queueing
+	if (count <= grainSize || GetWorkerCount() == 0)
+	{
+		if (count > 0)
+			invoke(function, 0, count);
+
+		return;
+	}
+
+	JobCounter_t counter;
+
+	// The calling thread takes the first range itself
+	for (uint32_t first = grainSize; first < count; first += grainSize)
+	{
+		uint32_t last = std::min(first + grainSize, count);
+		Run([function, invoke, first, last]() { invoke(function, first, last); }, &counter);
+	}
+
+	invoke(function, 0, grainSize);
+
+	Wait(counter);
+}
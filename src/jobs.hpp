@@ -0,0 +1,193 @@
+#pragma once
+
+#include <atomic>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+struct JobCounter_t;
+
+/*
+ * What a job runs. Works like std::function, except callables of up to InlineSize bytes (a few
+ * pointers, indices or a string, which is what jobs capture) are stored in place rather than on the
+ * heap; only bigger ones get allocated. Move-only, so captures can own what they hold.
+ */
+struct JobFunction_t
+{
+public:
+	static constexpr size_t InlineSize							= 48;
+
+private:
+	alignas(std::max_align_t) std::byte Storage[InlineSize];
+
+	void (*Invoke)(void* storage)								= nullptr;
+
+	// Moves the callable into destination and destroys it at source; only destroys it when destination is null
+	void (*Relocate)(void* destination, void* source)			= nullptr;
+
+	template <typename F>
+	static constexpr bool IsInline = sizeof(F) <= InlineSize && alignof(F) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible_v<F>;
+
+public:
+	JobFunction_t()												= default;
+
+	template <typename F>
+		requires std::invocable<std::decay_t<F>&> && (!std::same_as<std::decay_t<F>, JobFunction_t>)
+	JobFunction_t(F&& function)
+	{
+		using Callable_t = std::decay_t<F>;
+
+		if constexpr (IsInline<Callable_t>)
+		{
+			new (Storage) Callable_t(std::forward<F>(function));
+
+			Invoke = [](void* storage) { (*(Callable_t*)storage)(); };
+			Relocate = [](void* destination, void* source)
+				{
+					if (destination)
+						new (destination) Callable_t(std::move(*(Callable_t*)source));
+
+					((Callable_t*)source)->~Callable_t();
+				};
+		}
+		else
+		{
+			// Only the pointer is kept in place
+			*(Callable_t**)Storage = new Callable_t(std::forward<F>(function));
+
+			Invoke = [](void* storage) { (**(Callable_t**)storage)(); };
+			Relocate = [](void* destination, void* source)
+				{
+					if (destination)
+						*(Callable_t**)destination = *(Callable_t**)source;
+					else
+						delete *(Callable_t**)source;
+				};
+		}
+	}
+
+	JobFunction_t(const JobFunction_t&)							= delete;
+	JobFunction_t& operator=(const JobFunction_t&)				= delete;
+
+	JobFunction_t(JobFunction_t&& other) noexcept				{ *this = std::move(other); }
+
+	JobFunction_t& operator=(JobFunction_t&& other) noexcept
+	{
+		if (this != &other)
+		{
+			Reset();
+
+			if (other.Relocate)
+				other.Relocate(Storage, other.Storage);
+
+			Invoke = other.Invoke;
+			Relocate = other.Relocate;
+			other.Invoke = nullptr;
+			other.Relocate = nullptr;
+		}
+
+		return *this;
+	}
+
+	~JobFunction_t()											{ Reset(); }
+
+	void Reset()
+	{
+		if (Relocate)
+			Relocate(nullptr, Storage);
+
+		Invoke = nullptr;
+		Relocate = nullptr;
+	}
+
+	explicit operator bool() const								{ return Invoke != nullptr; }
+	void operator()()											{ Invoke(Storage); }
+};
+
+/*
+ * A unit of work
+ */
+struct Job_t
+{
+	JobFunction_t Function										= {};
+
+	// Decremented once Function has run
+	JobCounter_t* Counter										= nullptr;
+
+	// Only the main thread may run this one; for WebGPU calls that have to stay on the device thread
+	bool IsMainThreadOnly										= false;
+};
+
+/*
+ * Number of unfinished jobs in a group. Jobs can be made to wait for a counter, and waiting on one
+ * from a thread keeps that thread busy with other jobs until it drops to zero.
+ */
+struct JobCounter_t
+{
+private:
+	friend struct JobScheduler_t;
+
+	std::atomic<uint32_t> Count									= 0;
+
+	// Jobs that depend on this counter, released once it hits zero; the first few without allocating
+	static constexpr uint32_t InlineContinuationCapacity		= 2;
+
+	std::mutex Mutex											= {};
+	Job_t InlineContinuations[InlineContinuationCapacity]		= {};
+	uint32_t InlineContinuationCount							= 0;
+	std::vector<Job_t> Continuations							= {};
+
+public:
+	bool IsDone()												{ return Count.load(std::memory_order_acquire) == 0; }
+};
+
+/*
+ * Work-stealing job scheduler.
+ *
+ * Every thread, the main thread included, owns a deque: it pushes and pops its own jobs at the back,
+ * so recently spawned (and still cached) work runs first, while idle threads steal from the front of
+ * the others. Main-thread-only jobs go to a separate queue that the main thread drains whenever it
+ * waits or calls ExecuteMainThreadJobs.
+ */
+namespace Jobs
+{
+	// Starts workerCount worker threads, or one per remaining core when zero
+	void Init(uint32_t workerCount = 0);
+	void Shutdown();
+
+	// Worker threads, not counting the main thread
+	uint32_t GetWorkerCount();
+
+	// 0 on the main thread, 1..GetWorkerCount() on workers; for per-thread data
+	uint32_t GetThreadIndex();
+	bool IsMainThread();
+
+	// Make the calling thread the one main-thread-only jobs run on; defaults to the one that called Init
+	void SetMainThread();
+
+	// Queue a job, optionally held back until dependency is done
+	void Run(JobFunction_t function, JobCounter_t* counter = nullptr, JobCounter_t* dependency = nullptr);
+	void RunOnMainThread(JobFunction_t function, JobCounter_t* counter = nullptr, JobCounter_t* dependency = nullptr);
+
+	// Run other jobs until the counter drops to zero; the counter can be destroyed as soon as this returns
+	void Wait(JobCounter_t& counter);
+
+	// Run whatever main-thread-only jobs are queued; call once a frame
+	void ExecuteMainThreadJobs();
+
+	// function(first, last) by reference, so the call doesn't have to copy the callable anywhere
+	using RangeFunc_t = void (*)(const void* function, uint32_t first, uint32_t last);
+	void ParallelFor(uint32_t count, uint32_t grainSize, const void* function, RangeFunc_t invoke);
+
+	// Split [0, count) into ranges of at most grainSize and run function(first, last) over them, returning once all are done
+	template <typename F>
+	void ParallelFor(uint32_t count, uint32_t grainSize, const F& function)
+	{
+		ParallelFor(count, grainSize, &function, [](const void* callable, uint32_t first, uint32_t last) { (*(const F*)callable)(first, last); });
+	}
+}
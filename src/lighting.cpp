@@ -0,0 +1,599 @@
+#include "lighting.hpp"
+#include "frames.hpp"
+#include "resources.hpp"
+
+#include <cmath>
+#include <string>
+
+//
+// Shared between the culling pass and every shader that shades with lights
+//
+static const char* LightTypesSource = R"(
+	const LIGHT_TYPE_POINT: u32 = 0u;
+	const LIGHT_TYPE_SPOT: u32 = 1u;
+
+	struct Light {
+		position: vec3f,
+		range: f32,
+		color: vec3f,
+		intensity: f32,
+		direction: vec3f,
+		spotCosOuter: f32,
+		spotCosInner: f32,
+		lightType: u32,
+		shadowIndex: i32,
+		padding: f32
+	};
+
+	struct ClusterUniforms {
+		viewMatrix: mat4x4f,
+		gridSize: vec3u,
+		lightCount: u32,
+		screenSize: vec2f,
+		zNear: f32,
+		zFar: f32,
+		tanHalfFov: vec2f,
+		sliceScale: f32,
+		sliceBias: f32,
+		maxLightsPerCluster: u32
+	};
+)";
+
+static const char* LightBindingsSource = R"(
+	@group(2) @binding(0) var<uniform> uClusters: ClusterUniforms;
+	@group(2) @binding(1) var<storage, read> lights: array<Light>;
+	@group(2) @binding(2) var<storage, read> clusterLightCounts: array<u32>;
+	@group(2) @binding(3) var<storage, read> clusterLightIndices: array<u32>;
+
+	struct ShadowInfo {
+		viewProjMatrix: mat4x4f,
+		atlasRect: vec4f
+	};
+
+	@group(2) @binding(4) var shadowAtlas: texture_depth_2d;
+	@group(2) @binding(5) var shadowSampler: sampler_comparison;
+	@group(2) @binding(6) var<storage, read> shadowInfos: array<ShadowInfo>;
+
+	@group(2) @binding(7) var environmentCube: texture_cube<f32>;
+	@group(2) @binding(8) var<uniform> environmentSh: array<vec4f, 9>;
+	@group(2) @binding(9) var brdfLut: texture_2d<f32>;
+	@group(2) @binding(10) var environmentSampler: sampler;
+
+	fn GetClusterIndex(fragCoord: vec2f, viewDepth: f32) -> u32
+	{
+		let grid = uClusters.gridSize;
+
+		let tile = vec2u(clamp(fragCoord / uClusters.screenSize, vec2f(0.0), vec2f(0.9999)) * vec2f(grid.xy));
+		let slice = u32(clamp(log(viewDepth) * uClusters.sliceScale + uClusters.sliceBias, 0.0, f32(grid.z - 1u)));
+
+		return tile.x + tile.y * grid.x + slice * grid.x * grid.y;
+	}
+
+	// Direction towards the light in xyz, attenuation in w
+	fn GetLightIncidence(light: Light, worldPos: vec3f) -> vec4f
+	{
+		let toLight: vec3f = light.position - worldPos;
+		let lightDistance: f32 = length(toLight);
+		let L: vec3f = toLight / max(lightDistance, 0.0001);
+
+		// Reaches exactly zero at the range, so culling by bounding sphere never cuts a light off visibly
+		let window: f32 = saturate(1.0 - pow(lightDistance / light.range, 4.0));
+		var attenuation: f32 = window * window * light.intensity;
+
+		if (light.lightType == LIGHT_TYPE_SPOT)
+		{
+			attenuation *= smoothstep(light.spotCosOuter, light.spotCosInner, dot(-L, light.direction));
+		}
+
+		return vec4f(L, attenuation);
+	}
+
+	// 1 when lit, 0 when fully in shadow
+	fn GetShadowFactor(light: Light, worldPos: vec3f, normal: vec3f) -> f32
+	{
+		if (light.shadowIndex < 0)
+		{
+			return 1.0;
+		}
+
+		let shadow: ShadowInfo = shadowInfos[light.shadowIndex];
+
+		// Offset along the normal, the caster depth bias alone doesn't cover grazing angles
+		let clip: vec4f = shadow.viewProjMatrix * vec4f(worldPos + normal * 0.02, 1.0);
+		let ndc: vec3f = clip.xyz / clip.w;
+
+		if (clip.w <= 0.0 || any(abs(ndc.xy) > vec2f(1.0)))
+		{
+			return 1.0;
+		}
+
+		// Keep the filter taps inside the tile
+		let halfTexel: f32 = 0.5 / f32(textureDimensions(shadowAtlas).x);
+		let tileUv: vec2f = ndc.xy * vec2f(0.5, -0.5) + 0.5;
+		let atlasUv: vec2f = clamp(shadow.atlasRect.xy + tileUv * shadow.atlasRect.zw,
+			shadow.atlasRect.xy + halfTexel, shadow.atlasRect.xy + shadow.atlasRect.zw - halfTexel);
+
+		return textureSampleCompareLevel(shadowAtlas, shadowSampler, atlasUv, ndc.z);
+	}
+
+	// Everything shading needs to know about a point, filled from material textures or from the G-buffer
+	struct Surface {
+		position: vec3f,
+		normal: vec3f,
+		baseColor: vec3f,
+		emissive: vec3f,
+		ao: f32,
+		metalness: f32,
+		roughness: f32
+	};
+
+	// Cosine-convolved irradiance, already divided by pi
+	fn GetEnvironmentIrradiance(n: vec3f) -> vec3f
+	{
+		let irradiance: vec3f = environmentSh[0].rgb * 0.282095
+			+ environmentSh[1].rgb * 0.488603 * n.y
+			+ environmentSh[2].rgb * 0.488603 * n.z
+			+ environmentSh[3].rgb * 0.488603 * n.x
+			+ environmentSh[4].rgb * 1.092548 * n.x * n.y
+			+ environmentSh[5].rgb * 1.092548 * n.y * n.z
+			+ environmentSh[6].rgb * 0.315392 * (3.0 * n.z * n.z - 1.0)
+			+ environmentSh[7].rgb * 1.092548 * n.x * n.z
+			+ environmentSh[8].rgb * 0.546274 * (n.x * n.x - n.y * n.y);
+
+		return max(irradiance, vec3f(0.0));
+	}
+
+	// Diffuse and split-sum specular from the environment
+	fn GetEnvironmentLighting(surface: Surface, V: vec3f) -> vec3f
+	{
+		let NdotV: f32 = clamp(dot(surface.normal, V), 0.0, 1.0);
+		let F0: vec3f = mix(vec3f(0.04), surface.baseColor, surface.metalness);
+
+		let R: vec3f = reflect(-V, surface.normal);
+		let lod: f32 = surface.roughness * f32(textureNumLevels(environmentCube) - 1u);
+		let prefiltered: vec3f = textureSampleLevel(environmentCube, environmentSampler, R, lod).rgb;
+		let brdf: vec2f = textureSampleLevel(brdfLut, environmentSampler, vec2f(NdotV, surface.roughness), 0.0).rg;
+
+		let specular: vec3f = prefiltered * (F0 * brdf.x + brdf.y);
+		let diffuse: vec3f = surface.baseColor * (1.0 - surface.metalness) * GetEnvironmentIrradiance(surface.normal);
+
+		return diffuse + specular;
+	}
+
+	fn ShadeSurface(surface: Surface, fragCoord: vec2f, cameraPosition: vec3f) -> vec3f
+	{
+		let V: vec3f = normalize(cameraPosition - surface.position);
+		let shininess: f32 = pow(2.0, (1.0 - surface.roughness) * 10.0);
+
+		//
+		// Only the lights assigned to this fragment's cluster
+		//
+		let viewDepth: f32 = -(uClusters.viewMatrix * vec4f(surface.position, 1.0)).z;
+		let cluster: u32 = GetClusterIndex(fragCoord, viewDepth);
+		let lightCount: u32 = min(clusterLightCounts[cluster], uClusters.maxLightsPerCluster);
+
+		var diffuse: vec3f = vec3f(0.0);
+		var specularColor: vec3f = vec3f(0.0);
+
+		for (var i = 0u; i < lightCount; i++)
+		{
+			let light: Light = lights[clusterLightIndices[cluster * uClusters.maxLightsPerCluster + i]];
+			let incidence: vec4f = GetLightIncidence(light, surface.position);
+			let radiance: vec3f = light.color * incidence.w * GetShadowFactor(light, surface.position, surface.normal);
+
+			let L: vec3f = incidence.xyz;
+			let H: vec3f = normalize(L + V);
+
+			diffuse += radiance * max(dot(surface.normal, L), 0.0);
+
+			// Specular highlights (Blinn-Phong model)
+			specularColor += radiance * pow(max(dot(surface.normal, H), 0.0), shininess);
+		}
+
+		var shadedColor: vec3f = surface.baseColor * diffuse + GetEnvironmentLighting(surface, V);
+		shadedColor += surface.emissive;
+		shadedColor *= surface.ao;
+		shadedColor += specularColor;
+
+		return shadedColor;
+	}
+)";
+
+static const char* LightCullingSource = R"(
+	@group(0) @binding(0) var<uniform> uClusters: ClusterUniforms;
+	@group(0) @binding(1) var<storage, read> lights: array<Light>;
+	@group(0) @binding(2) var<storage, read_write> clusterLightCounts: array<u32>;
+	@group(0) @binding(3) var<storage, read_write> clusterLightIndices: array<u32>;
+
+	const CULL_GROUP_SIZE: u32 = 64u;
+
+	// View-space bounding spheres of the batch of lights being tested
+	var<workgroup> sharedLights: array<vec4f, CULL_GROUP_SIZE>;
+
+	fn GetSliceDepth(slice: u32) -> f32
+	{
+		return uClusters.zNear * pow(uClusters.zFar / uClusters.zNear, f32(slice) / f32(uClusters.gridSize.z));
+	}
+
+	@compute @workgroup_size(CULL_GROUP_SIZE)
+	fn cs_cull(@builtin(global_invocation_id) id: vec3u, @builtin(local_invocation_index) localIndex: u32)
+	{
+		let grid = uClusters.gridSize;
+		let cluster = id.x;
+		let isValid = cluster < grid.x * grid.y * grid.z;
+
+		//
+		// View-space bounds of the froxel; tile rows go top to bottom like framebuffer coordinates
+		//
+		let x = cluster % grid.x;
+		let y = (cluster / grid.x) % grid.y;
+		let z = cluster / (grid.x * grid.y);
+
+		let ndcMin = vec2f(f32(x) / f32(grid.x) * 2.0 - 1.0, 1.0 - f32(y + 1u) / f32(grid.y) * 2.0);
+		let ndcMax = vec2f(f32(x + 1u) / f32(grid.x) * 2.0 - 1.0, 1.0 - f32(y) / f32(grid.y) * 2.0);
+
+		let nearDepth = GetSliceDepth(z);
+		let farDepth = GetSliceDepth(z + 1u);
+
+		let nearMin = ndcMin * uClusters.tanHalfFov * nearDepth;
+		let nearMax = ndcMax * uClusters.tanHalfFov * nearDepth;
+		let farMin = ndcMin * uClusters.tanHalfFov * farDepth;
+		let farMax = ndcMax * uClusters.tanHalfFov * farDepth;
+
+		let aabbMin = vec3f(min(min(nearMin, nearMax), min(farMin, farMax)), -farDepth);
+		let aabbMax = vec3f(max(max(nearMin, nearMax), max(farMin, farMax)), -nearDepth);
+
+		//
+		// Every thread tests the same lights, so each batch gets transformed once and shared
+		//
+		var count = 0u;
+
+		for (var base = 0u; base < uClusters.lightCount; base += CULL_GROUP_SIZE)
+		{
+			let lightIndex = base + localIndex;
+
+			if (lightIndex < uClusters.lightCount)
+			{
+				let light = lights[lightIndex];
+				sharedLights[localIndex] = vec4f((uClusters.viewMatrix * vec4f(light.position, 1.0)).xyz, light.range);
+			}
+
+			workgroupBarrier();
+
+			let batchSize = min(CULL_GROUP_SIZE, uClusters.lightCount - base);
+
+			for (var i = 0u; i < batchSize; i++)
+			{
+				// Spot lights are tested by the sphere bounding their whole range
+				let sphere = sharedLights[i];
+				let delta = clamp(sphere.xyz, aabbMin, aabbMax) - sphere.xyz;
+
+				if (isValid && count < uClusters.maxLightsPerCluster && dot(delta, delta) <= sphere.w * sphere.w)
+				{
+					clusterLightIndices[cluster * uClusters.maxLightsPerCluster + count] = base + i;
+					count++;
+				}
+			}
+
+			workgroupBarrier();
+		}
+
+		if (isValid)
+		{
+			clusterLightCounts[cluster] = count;
+		}
+	}
+)";
+
+static GraphicsBuffer_t MakeBuffer(GraphicsDevice_t* gpu, const char* label, size_t size, WGPUBufferUsageFlags usage)
+{
+	GraphicsBuffer_t buffer;
+
+	WGPUBufferDescriptor bufferDesc = {
+		.nextInChain = nullptr,
+		.label = label,
+		.usage = usage,
+		.size = size,
+		.mappedAtCreation = false
+	};
+
+	buffer.DataBuffer = Resources::Track(wgpuDeviceCreateBuffer(gpu->Device, &bufferDesc), label, MemoryCategory_t::Uniform, size);
+	buffer.DataSize = size;
+	buffer.Count = 1;
+
+	return buffer;
+}
+
+const char* Lighting_t::GetShaderSource()
+{
+	static std::string source = std::string(LightTypesSource) + LightBindingsSource;
+
+	return source.c_str();
+}
+
+void Lighting_t::Init(GraphicsDevice_t* gpu)
+{
+	Gpu = gpu;
+
+	Shadows.Init(gpu);
+	Environment.Init(gpu);
+
+	//
+	// Shading layout: everything is read-only outside of the culling pass
+	//
+	std::vector<WGPUBindGroupLayoutEntry> bindingLayoutEntries(11);
+
+	for (uint32_t i = 0; i < bindingLayoutEntries.size(); ++i)
+	{
+		WGPUBindGroupLayoutEntry& bindingLayout = bindingLayoutEntries[i];
+		SetDefaultBindGroupLayoutEntry(bindingLayout);
+		bindingLayout.binding = i;
+		bindingLayout.visibility = WGPUShaderStage_Fragment;
+	}
+
+	bindingLayoutEntries[0].buffer.type = WGPUBufferBindingType_Uniform;
+	bindingLayoutEntries[0].buffer.minBindingSize = sizeof(ClusterUniforms_t);
+	bindingLayoutEntries[1].buffer.type = WGPUBufferBindingType_ReadOnlyStorage;
+	bindingLayoutEntries[2].buffer.type = WGPUBufferBindingType_ReadOnlyStorage;
+	bindingLayoutEntries[3].buffer.type = WGPUBufferBindingType_ReadOnlyStorage;
+
+	// Shadows
+	bindingLayoutEntries[4].texture.sampleType = WGPUTextureSampleType_Depth;
+	bindingLayoutEntries[4].texture.viewDimension = WGPUTextureViewDimension_2D;
+	bindingLayoutEntries[5].sampler.type = WGPUSamplerBindingType_Comparison;
+	bindingLayoutEntries[6].buffer.type = WGPUBufferBindingType_ReadOnlyStorage;
+
+	// Environment
+	bindingLayoutEntries[7].texture.sampleType = WGPUTextureSampleType_Float;
+	bindingLayoutEntries[7].texture.viewDimension = WGPUTextureViewDimension_Cube;
+	bindingLayoutEntries[8].buffer.type = WGPUBufferBindingType_Uniform;
+	bindingLayoutEntries[8].buffer.minBindingSize = EnvironmentLighting_t::ShCoefficientCount * sizeof(glm::vec4);
+	bindingLayoutEntries[9].texture.sampleType = WGPUTextureSampleType_Float;
+	bindingLayoutEntries[9].texture.viewDimension = WGPUTextureViewDimension_2D;
+	bindingLayoutEntries[10].sampler.type = WGPUSamplerBindingType_Filtering;
+
+	WGPUBindGroupLayoutDescriptor bindGroupLayoutDesc = {
+		.nextInChain = nullptr,
+		.label = "Lighting bind group layout",
+		.entryCount = bindingLayoutEntries.size(),
+		.entries = bindingLayoutEntries.data()
+	};
+
+	gpu->LightingBindGroupLayout = Resources::Track(wgpuDeviceCreateBindGroupLayout(gpu->Device, &bindGroupLayoutDesc), bindGroupLayoutDesc.label);
+
+	//
+	// Culling layout: the first four bindings, cluster lists are written
+	//
+	bindingLayoutEntries.resize(4);
+
+	for (auto& bindingLayout : bindingLayoutEntries)
+	{
+		bindingLayout.visibility = WGPUShaderStage_Compute;
+
+		if (bindingLayout.binding >= 2)
+			bindingLayout.buffer.type = WGPUBufferBindingType_Storage;
+	}
+
+	bindGroupLayoutDesc.label = "Light culling bind group layout";
+	bindGroupLayoutDesc.entryCount = bindingLayoutEntries.size();
+
+	CullBindGroupLayout = Resources::Track(wgpuDeviceCreateBindGroupLayout(gpu->Device, &bindGroupLayoutDesc), bindGroupLayoutDesc.label);
+
+	CreateCullPipeline();
+
+	//
+	// Buffers
+	//
+	UniformBuffer = MakeBuffer(gpu, "Cluster uniform buffer", sizeof(ClusterUniforms_t), WGPUBufferUsage_CopyDst | WGPUBufferUsage_Uniform);
+	ClusterLightCountBuffer = MakeBuffer(gpu, "Cluster light count buffer", ClusterCount * sizeof(uint32_t), WGPUBufferUsage_Storage);
+	ClusterLightIndexBuffer = MakeBuffer(gpu, "Cluster light index buffer", ClusterCount * MaxLightsPerCluster * sizeof(uint32_t), WGPUBufferUsage_Storage);
+
+	ReserveLights(64);
+}
+
+void Lighting_t::CreateCullPipeline()
+{
+	std::string source = std::string(LightTypesSource) + LightCullingSource;
+
+	WGPUShaderModule shaderModule = Graphics::MakeShaderModule(Gpu, source.c_str());
+
+	WGPUPipelineLayoutDescriptor layoutDesc = {
+		.nextInChain = nullptr,
+		.bindGroupLayoutCount = 1,
+		.bindGroupLayouts = &CullBindGroupLayout
+	};
+
+	WGPUPipelineLayout layout = wgpuDeviceCreatePipelineLayout(Gpu->Device, &layoutDesc);
+
+	WGPUComputePipelineDescriptor pipelineDesc = {
+		.nextInChain = nullptr,
+		.label = "Light culling pipeline",
+		.layout = layout,
+		.compute = {
+			.nextInChain = nullptr,
+			.module = shaderModule,
+			.entryPoint = "cs_cull",
+			.constantCount = 0,
+			.constants = nullptr
+		}
+	};
+
+	CullPipeline = Resources::Track(wgpuDeviceCreateComputePipeline(Gpu->Device, &pipelineDesc), pipelineDesc.label);
+
+	wgpuPipelineLayoutRelease(layout);
+	wgpuShaderModuleRelease(shaderModule);
+}
+
+void Lighting_t::CreateBindGroups()
+{
+	// Frames in flight may still use the old ones
+	Resources::Release(BindGroup);
+	Resources::Release(CullBindGroup);
+
+	WGPUBindGroupEntry bindings[] = {
+		{ .nextInChain = nullptr, .binding = 0, .buffer = UniformBuffer.DataBuffer, .offset = 0, .size = sizeof(ClusterUniforms_t) },
+		{ .nextInChain = nullptr, .binding = 1, .buffer = LightBuffer.DataBuffer, .offset = 0, .size = LightBuffer.DataSize },
+		{ .nextInChain = nullptr, .binding = 2, .buffer = ClusterLightCountBuffer.DataBuffer, .offset = 0, .size = ClusterLightCountBuffer.DataSize },
+		{ .nextInChain = nullptr, .binding = 3, .buffer = ClusterLightIndexBuffer.DataBuffer, .offset = 0, .size = ClusterLightIndexBuffer.DataSize },
+		{ .nextInChain = nullptr, .binding = 4, .textureView = Shadows.GetSampledView() },
+		{ .nextInChain = nullptr, .binding = 5, .sampler = Shadows.GetSampler() },
+		{ .nextInChain = nullptr, .binding = 6, .buffer = Shadows.GetShadowInfoBuffer().DataBuffer, .offset = 0, .size = Shadows.GetShadowInfoBuffer().DataSize },
+		{ .nextInChain = nullptr, .binding = 7, .textureView = Environment.GetPrefilteredView() },
+		{ .nextInChain = nullptr, .binding = 8, .buffer = Environment.GetShBuffer().DataBuffer, .offset = 0, .size = Environment.GetShBuffer().DataSize },
+		{ .nextInChain = nullptr, .binding = 9, .textureView = Environment.GetBrdfLutView() },
+		{ .nextInChain = nullptr, .binding = 10, .sampler = Environment.GetSampler() }
+	};
+
+	WGPUBindGroupDescriptor bindGroupDesc = {
+		.nextInChain = nullptr,
+		.label = "Lighting bind group",
+		.layout = Gpu->LightingBindGroupLayout,
+		.entryCount = 11,
+		.entries = bindings
+	};
+
+	BindGroup = Resources::Track(wgpuDeviceCreateBindGroup(Gpu->Device, &bindGroupDesc), bindGroupDesc.label);
+	BoundShadowAtlasView = Shadows.GetSampledView();
+
+	bindGroupDesc.label = "Light culling bind group";
+	bindGroupDesc.layout = CullBindGroupLayout;
+	bindGroupDesc.entryCount = 4;
+
+	CullBindGroup = Resources::Track(wgpuDeviceCreateBindGroup(Gpu->Device, &bindGroupDesc), bindGroupDesc.label);
+}
+
+void Lighting_t::ReserveLights(size_t count)
+{
+	if (count <= LightCapacity)
+		return;
+
+	// Grow geometrically, a new buffer means new bind groups and re-recorded bundles
+	size_t newCapacity = LightCapacity > 0 ? LightCapacity : 64;
+
+	while (newCapacity < count)
+		newCapacity *= 2;
+
+	if (LightBuffer.DataBuffer)
+		LightBuffer.Destroy();
+
+	LightBuffer = MakeBuffer(Gpu, "Light buffer", newCapacity * sizeof(GpuLight_t), WGPUBufferUsage_CopyDst | WGPUBufferUsage_Storage);
+	LightCapacity = newCapacity;
+
+	CreateBindGroups();
+}
+
+size_t Lighting_t::AddLight(const Light_t& light)
+{
+	Lights.push_back(light);
+
+	return Lights.size() - 1;
+}
+
+void Lighting_t::Update(Camera_t& camera, uint32_t width, uint32_t height)
+{
+	ReserveLights(Lights.size());
+
+	//
+	// Lights
+	//
+	GpuLights.resize(Lights.size());
+
+	for (size_t i = 0; i < Lights.size(); ++i)
+	{
+		const Light_t& light = Lights[i];
+		GpuLight_t& gpuLight = GpuLights[i];
+
+		gpuLight.Position = light.Position;
+		gpuLight.Range = light.Range;
+		gpuLight.Color = light.Color;
+		gpuLight.Intensity = light.Intensity;
+		gpuLight.Direction = glm::normalize(light.Direction);
+		gpuLight.SpotCosOuter = cosf(glm::radians(light.OuterConeAngle));
+		gpuLight.SpotCosInner = cosf(glm::radians(light.InnerConeAngle));
+		gpuLight.Type = (uint32_t)light.Type;
+	}
+
+	// Fills in each light's shadow index
+	Shadows.Update(Lights, GpuLights, camera);
+
+	// The sampled atlas switches when dynamic casters come and go
+	if (Shadows.GetSampledView() != BoundShadowAtlasView)
+		CreateBindGroups();
+
+	if (!GpuLights.empty())
+		Gpu->Frames->WriteBuffer(LightBuffer.DataBuffer, 0, GpuLights.data(), GpuLights.size() * sizeof(GpuLight_t));
+
+	//
+	// Cluster parameters, depth slices are spaced exponentially between the near and far planes
+	//
+	float tanHalfFovY = tanf(glm::radians(camera.FieldOfView) * 0.5f);
+	float depthRangeLog = logf(camera.ZFar / camera.ZNear);
+
+	ClusterUniforms_t uniforms = {};
+	uniforms.ViewMatrix = camera.GetViewMatrix();
+	uniforms.GridSize = glm::uvec3(ClusterCountX, ClusterCountY, ClusterCountZ);
+	uniforms.LightCount = (uint32_t)Lights.size();
+	uniforms.ScreenSize = glm::vec2((float)width, (float)height);
+	uniforms.ZNear = camera.ZNear;
+	uniforms.ZFar = camera.ZFar;
+	uniforms.TanHalfFov = glm::vec2(tanHalfFovY * camera.Aspect, tanHalfFovY);
+	uniforms.SliceScale = ClusterCountZ / depthRangeLog;
+	uniforms.SliceBias = -ClusterCountZ * logf(camera.ZNear) / depthRangeLog;
+	uniforms.MaxLightsPerCluster = MaxLightsPerCluster;
+
+	Gpu->Frames->WriteBuffer(UniformBuffer.DataBuffer, 0, &uniforms, sizeof(ClusterUniforms_t));
+}
+
+LightingResources_t Lighting_t::AddPasses(FrameGraph_t& graph)
+{
+	LightingResources_t resources = {};
+
+	resources.ShadowAtlas = Shadows.AddPasses(graph);
+
+	resources.ClusterLightCounts = graph.ImportBuffer("Cluster light counts", ClusterLightCountBuffer.DataBuffer, {
+		.Size = ClusterLightCountBuffer.DataSize,
+		.Usage = WGPUBufferUsage_Storage
+	});
+
+	resources.ClusterLightIndices = graph.ImportBuffer("Cluster light indices", ClusterLightIndexBuffer.DataBuffer, {
+		.Size = ClusterLightIndexBuffer.DataSize,
+		.Usage = WGPUBufferUsage_Storage
+	});
+
+	graph.AddPass("Light culling", FrameGraphPassType_t::Compute, [this](FrameGraphContext_t& context)
+		{
+			uint32_t groupCount = (ClusterCount + 63) / 64;
+
+			wgpuComputePassEncoderSetPipeline(context.ComputePass, CullPipeline);
+			wgpuComputePassEncoderSetBindGroup(context.ComputePass, 0, CullBindGroup, 0, nullptr);
+			wgpuComputePassEncoderDispatchWorkgroups(context.ComputePass, groupCount, 1, 1);
+		})
+		.Write(resources.ClusterLightCounts)
+		.Write(resources.ClusterLightIndices);
+
+	return resources;
+}
+
+void Lighting_t::Destroy()
+{
+	Shadows.Destroy();
+	Environment.Destroy();
+
+	Resources::Release(BindGroup);
+	Resources::Release(CullBindGroup);
+	Resources::Release(CullPipeline);
+	Resources::Release(CullBindGroupLayout);
+
+	if (Gpu)
+		Resources::Release(Gpu->LightingBindGroupLayout);
+
+	UniformBuffer.Destroy();
+	LightBuffer.Destroy();
+	ClusterLightCountBuffer.Destroy();
+	ClusterLightIndexBuffer.Destroy();
+
+	Lights.clear();
+	GpuLights.clear();
+	LightCapacity = 0;
+	BoundShadowAtlasView = nullptr;
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include "gpu.hpp"
+#include "framegraph.hpp"
+#include "environment.hpp"
+#include "shadows.hpp"
+
+#include <webgpu/webgpu.h>
+
+#include <vector>
+
+enum class LightType_t : uint32_t
+{
+	Point = 0,
+	Spot
+};
+
+/*
+ * A dynamic light, as set up by the application
+ */
+struct Light_t
+{
+	LightType_t Type											= LightType_t::Point;
+
+	glm::vec3 Position											= {};
+	glm::vec3 Color												= glm::vec3(1.0f);
+	float Intensity												= 1.0f;
+
+	// Light falls off to exactly zero at this distance
+	float Range													= 10.0f;
+
+	// Spot lights only, angles in degrees
+	glm::vec3 Direction											= glm::vec3(0.0f, 0.0f, -1.0f);
+	float InnerConeAngle										= 20.0f;
+	float OuterConeAngle										= 30.0f;
+
+	// Spot lights only, point lights are never shadowed
+	bool CastsShadows											= false;
+};
+
+/*
+ * Light layout in the storage buffer, must match `Light` in the WGSL source
+ */
+struct GpuLight_t
+{
+	glm::vec3 Position											= {};
+	float Range													= 0.0f;
+	glm::vec3 Color												= {};
+	float Intensity												= 0.0f;
+	glm::vec3 Direction											= {};
+	float SpotCosOuter											= -1.0f;
+	float SpotCosInner											= -1.0f;
+	uint32_t Type												= 0;
+	int32_t ShadowIndex											= -1;
+	float Padding												= 0.0f;
+};
+
+static_assert(sizeof(GpuLight_t) == 64, "GpuLight_t must match the WGSL layout");
+
+/*
+ * Must match `ClusterUniforms` in the WGSL source
+ */
+struct ClusterUniforms_t
+{
+	glm::mat4 ViewMatrix										= {};
+	glm::uvec3 GridSize											= {};
+	uint32_t LightCount											= 0;
+	glm::vec2 ScreenSize										= {};
+	float ZNear													= 0.0f;
+	float ZFar													= 0.0f;
+	glm::vec2 TanHalfFov										= {};
+	float SliceScale											= 0.0f;
+	float SliceBias												= 0.0f;
+	uint32_t MaxLightsPerCluster								= 0;
+	uint32_t Padding[3]											= {};
+};
+
+static_assert(sizeof(ClusterUniforms_t) == 128, "ClusterUniforms_t must match the WGSL layout");
+
+/*
+ * Frame graph handles for the light culling outputs, read by every pass that shades with lights
+ */
+struct LightingResources_t
+{
+	FrameGraphResource_t ClusterLightCounts						= {};
+	FrameGraphResource_t ClusterLightIndices					= {};
+	FrameGraphResource_t ShadowAtlas							= {};
+};
+
+/*
+ * Clustered forward lighting.
+ *
+ * The view frustum is split into a grid of froxels, tiled in screen space and exponentially in depth.
+ * Every frame a compute pass tests each light's bounding sphere against each froxel and writes a
+ * fixed-size list of light indices per froxel; the fragment shader then only loops over the lights
+ * of the froxel it falls into.
+ */
+struct Lighting_t
+{
+private:
+	GraphicsDevice_t* Gpu										= nullptr;
+
+	std::vector<Light_t> Lights									= {};
+	std::vector<GpuLight_t> GpuLights							= {};
+
+	GraphicsBuffer_t UniformBuffer								= {};
+	GraphicsBuffer_t LightBuffer								= {};
+	GraphicsBuffer_t ClusterLightCountBuffer					= {};
+	GraphicsBuffer_t ClusterLightIndexBuffer					= {};
+
+	// Number of lights LightBuffer has room for
+	size_t LightCapacity										= 0;
+
+	ShadowAtlas_t Shadows										= {};
+	EnvironmentLighting_t Environment							= {};
+
+	// The atlas view BindGroup was created with
+	WGPUTextureView BoundShadowAtlasView						= nullptr;
+
+	WGPUBindGroupLayout CullBindGroupLayout						= nullptr;
+	WGPUComputePipeline CullPipeline							= nullptr;
+	WGPUBindGroup CullBindGroup									= nullptr;
+	WGPUBindGroup BindGroup										= nullptr;
+
+	void CreateCullPipeline();
+	void CreateBindGroups();
+	void ReserveLights(size_t count);
+
+public:
+	static constexpr uint32_t ClusterCountX						= 16;
+	static constexpr uint32_t ClusterCountY						= 9;
+	static constexpr uint32_t ClusterCountZ						= 24;
+	static constexpr uint32_t ClusterCount						= ClusterCountX * ClusterCountY * ClusterCountZ;
+
+	// Lights beyond this in a single froxel get dropped
+	static constexpr uint32_t MaxLightsPerCluster				= 128;
+
+	// WGSL declarations and helpers for the lighting bind group, prepended to every shader that shades with lights
+	static const char* GetShaderSource();
+
+	// Creates gpu->LightingBindGroupLayout, so it must run before any pipeline that uses it
+	void Init(GraphicsDevice_t* gpu);
+
+	size_t AddLight(const Light_t& light);
+	Light_t& GetLight(size_t index)								{ return Lights[index]; }
+	size_t GetLightCount()										{ return Lights.size(); }
+	void ClearLights()											{ Lights.clear(); }
+
+	// Upload lights and cluster parameters for this frame
+	void Update(Camera_t& camera, uint32_t width, uint32_t height);
+
+	ShadowAtlas_t& GetShadows()									{ return Shadows; }
+
+	// Rebakes (or loads from the cache) the image-based lighting; the bind group keeps its views
+	void SetEnvironment(const char* hdrPath)					{ Environment.Load(hdrPath); }
+
+	// Add the shadow and light culling passes; the returned resources must be read by the shading passes
+	LightingResources_t AddPasses(FrameGraph_t& graph);
+
+	// Group 2 of every lit pipeline
+	WGPUBindGroup GetBindGroup()								{ return BindGroup; }
+
+	void Destroy();
+};
@@ -11,6 +11,8 @@ int main(int argc, const char **argv)
     CWindow window;
     window.SetTitle("Hackweek WebGPU test");
     window.SetFrameFunc(Graphics::OnRender);
+    window.SetFrameWaitFunc(Graphics::WaitForNextFrame);
+    window.SetThreadingMode(ThreadingMode_t::RenderThread);
 
     //
     // Set up gpu
@@ -0,0 +1,82 @@
+#include "pacing.hpp"
+#include "frames.hpp"
+
+#include <algorithm>
+#include <thread>
+
+void FramePacer_t::SetSettings(const PresentSettings_t& settings)
+{
+	Settings = settings;
+	Settings.MaxFrameRate = std::max(Settings.MaxFrameRate, 0.0f);
+	Settings.FramesInFlight = std::clamp(Settings.FramesInFlight, 1u, FramesInFlight_t::MaxCount);
+
+	// The old measurements belong to a different present mode
+	HasPresented = false;
+	PresentInterval = 0.0;
+}
+
+void FramePacer_t::WaitUntil(Clock_t::time_point deadline)
+{
+	Clock_t::time_point sleepUntil = deadline - std::chrono::duration_cast<Clock_t::duration>(std::chrono::duration<double>(SpinThreshold));
+
+	if (Clock_t::now() < sleepUntil)
+		std::this_thread::sleep_until(sleepUntil);
+
+	while (Clock_t::now() < deadline)
+		std::this_thread::yield();
+}
+
+void FramePacer_t::WaitForFrameStart(float gpuFrameTime)
+{
+	Clock_t::time_point start = Clock_t::now();
+
+	if (HasPresented)
+	{
+		double interval = PresentInterval;
+
+		//
+		// Limiter, measured from the last frame's start so the rate holds regardless of where in the frame time went
+		//
+		if (Settings.MaxFrameRate > 0.0f)
+		{
+			double minInterval = 1.0 / Settings.MaxFrameRate;
+			start = std::max(start, FrameStart + std::chrono::duration_cast<Clock_t::duration>(std::chrono::duration<double>(minInterval)));
+
+			interval = std::max(interval, minInterval);
+		}
+
+		//
+		// Low latency: the next present is predicted one interval after the last, and the frame needs its
+		// CPU and GPU time before that
+		//
+		if (Settings.IsLowLatency && interval > 0.0)
+		{
+			double frameTime = CpuFrameTime + gpuFrameTime / 1000.0 + LatencyMargin;
+			double delay = interval - frameTime;
+
+			if (delay > 0.0)
+				start = std::max(start, LastPresent + std::chrono::duration_cast<Clock_t::duration>(std::chrono::duration<double>(delay)));
+		}
+	}
+
+	WaitUntil(start);
+
+	FrameStart = Clock_t::now();
+}
+
+void FramePacer_t::OnPresented()
+{
+	Clock_t::time_point now = Clock_t::now();
+
+	double cpuFrameTime = std::chrono::duration<double>(now - FrameStart).count();
+	CpuFrameTime = CpuFrameTime > 0.0 ? CpuFrameTime + (cpuFrameTime - CpuFrameTime) * SmoothingFactor : cpuFrameTime;
+
+	if (HasPresented)
+	{
+		double presentInterval = std::chrono::duration<double>(now - LastPresent).count();
+		PresentInterval = PresentInterval > 0.0 ? PresentInterval + (presentInterval - PresentInterval) * SmoothingFactor : presentInterval;
+	}
+
+	LastPresent = now;
+	HasPresented = true;
+}
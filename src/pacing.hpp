@@ -0,0 +1,77 @@
+#pragma once
+
+#include <webgpu/webgpu.h>
+
+#include <chrono>
+#include <cstdint>
+
+/*
+ * How frames get presented and paced
+ */
+struct PresentSettings_t
+{
+	// Fifo waits for vblank; Mailbox and Immediate don't, where the surface supports them
+	WGPUPresentMode PresentMode									= WGPUPresentMode_Fifo;
+
+	// Frames per second the CPU is held to, 0 for no limit; Fifo is already held to the refresh rate
+	float MaxFrameRate											= 0.0f;
+
+	// 1 to FramesInFlight_t::MaxCount; more frames in flight trade latency for throughput
+	uint32_t FramesInFlight										= 2;
+
+	// Start frames as late as still makes the predicted present, and keep a single frame in flight
+	bool IsLowLatency											= false;
+};
+
+/*
+ * CPU side frame pacing.
+ *
+ * The limiter sleeps until shortly before the deadline and spins the rest of the way, since OS sleeps
+ * overshoot by about a millisecond. In low-latency mode the pacer predicts when the next present will
+ * land from the measured present interval, and holds the frame back by whatever the frame won't need
+ * of that interval: starting any earlier would only make input older by the time it's on screen.
+ */
+struct FramePacer_t
+{
+public:
+	// Sleep until this close to a deadline, in seconds, and spin from there
+	static constexpr double SpinThreshold						= 0.002;
+
+	// Slack kept before the predicted present in low-latency mode, in seconds
+	static constexpr double LatencyMargin						= 0.002;
+
+	// Weight of a new measurement in the running averages
+	static constexpr double SmoothingFactor						= 0.1;
+
+private:
+	using Clock_t = std::chrono::steady_clock;
+
+	PresentSettings_t Settings									= {};
+
+	Clock_t::time_point FrameStart								= {};
+	Clock_t::time_point LastPresent								= {};
+	bool HasPresented											= false;
+
+	// Running averages, in seconds
+	double PresentInterval										= 0.0;
+	double CpuFrameTime											= 0.0;
+
+	void WaitUntil(Clock_t::time_point deadline);
+
+public:
+	void SetSettings(const PresentSettings_t& settings);
+	const PresentSettings_t& GetSettings()						{ return Settings; }
+
+	// Frames in flight the settings call for right now
+	uint32_t GetFramesInFlight()								{ return Settings.IsLowLatency ? 1 : Settings.FramesInFlight; }
+
+	// Blocks until the next frame should start; gpuFrameTime is the last measured one, in milliseconds
+	void WaitForFrameStart(float gpuFrameTime);
+
+	// Right after the present call returns
+	void OnPresented();
+
+	// In milliseconds
+	float GetPresentInterval()									{ return (float)(PresentInterval * 1000.0); }
+	float GetCpuFrameTime()										{ return (float)(CpuFrameTime * 1000.0); }
+};
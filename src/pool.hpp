@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/*
+ * Reference to an object in a Pool_t.
+ *
+ * The generation changes every time a slot gets reused, so a handle to a destroyed object stays
+ * invalid instead of quietly pointing at whatever took its place.
+ */
+template <typename T>
+struct Handle_t
+{
+	uint32_t Index												= UINT32_MAX;
+	uint32_t Generation											= 0;
+
+	bool IsNull() const											{ return Index == UINT32_MAX; }
+
+	bool operator==(const Handle_t& other) const				= default;
+};
+
+/*
+ * Typed object pool.
+ *
+ * Objects are packed into one array, so going over all of them touches nothing else, and a table of
+ * slots maps handles onto that array. Create, Destroy and Get are all O(1): Destroy moves the last
+ * object into the hole it leaves. That also means pointers into the pool only hold until the next
+ * Create or Destroy; anything that keeps a reference for longer keeps the handle.
+ */
+template <typename T>
+struct Pool_t
+{
+private:
+	struct Slot_t
+	{
+		uint32_t DenseIndex										= 0;
+		uint32_t Generation										= 0;
+	};
+
+	std::vector<T> Objects										= {};
+
+	// Slot of each object, for fixing up the slot of the object that fills a hole
+	std::vector<uint32_t> ObjectSlots							= {};
+
+	std::vector<Slot_t> Slots									= {};
+	std::vector<uint32_t> FreeSlots								= {};
+
+public:
+	template <typename... Args>
+	Handle_t<T> Create(Args&&... args)
+	{
+		uint32_t slotIndex = 0;
+
+		if (!FreeSlots.empty())
+		{
+			slotIndex = FreeSlots.back();
+			FreeSlots.pop_back();
+		}
+		else
+		{
+			slotIndex = (uint32_t)Slots.size();
+			Slots.push_back({});
+		}
+
+		Slot_t& slot = Slots[slotIndex];
+		slot.DenseIndex = (uint32_t)Objects.size();
+
+		Objects.emplace_back(std::forward<Args>(args)...);
+		ObjectSlots.push_back(slotIndex);
+
+		return { .Index = slotIndex, .Generation = slot.Generation };
+	}
+
+	// Stale and null handles are ignored
+	void Destroy(Handle_t<T> handle)
+	{
+		if (!IsValid(handle))
+			return;
+
+		Slot_t& slot = Slots[handle.Index];
+		uint32_t lastIndex = (uint32_t)Objects.size() - 1;
+
+		if (slot.DenseIndex != lastIndex)
+		{
+			Objects[slot.DenseIndex] = std::move(Objects[lastIndex]);
+			ObjectSlots[slot.DenseIndex] = ObjectSlots[lastIndex];
+			Slots[ObjectSlots[lastIndex]].DenseIndex = slot.DenseIndex;
+		}
+
+		Objects.pop_back();
+		ObjectSlots.pop_back();
+
+		// Every handle to the old object goes stale
+		slot.Generation++;
+		FreeSlots.push_back(handle.Index);
+	}
+
+	bool IsValid(Handle_t<T> handle) const
+	{
+		return handle.Index < Slots.size() && Slots[handle.Index].Generation == handle.Generation;
+	}
+
+	// Null for stale handles; only valid until the next Create or Destroy
+	T* Get(Handle_t<T> handle)
+	{
+		return IsValid(handle) ? &Objects[Slots[handle.Index].DenseIndex] : nullptr;
+	}
+
+	uint32_t GetCount() const									{ return (uint32_t)Objects.size(); }
+
+	// Every live object, packed, in no particular order
+	typename std::vector<T>::iterator begin()					{ return Objects.begin(); }
+	typename std::vector<T>::iterator end()						{ return Objects.end(); }
+};
@@ -0,0 +1,334 @@
+#include "profiler.hpp"
+#include "arena.hpp"
+#include "frames.hpp"
+#include "resources.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+void GpuProfiler_t::Init(GraphicsDevice_t* gpu)
+{
+	Gpu = gpu;
+
+	for (Readback_t& readback : Readbacks)
+		readback.Owner = this;
+
+	if (!gpu->HasTimestampQuery)
+		return;
+
+	WGPUQuerySetDescriptor querySetDesc = {
+		.nextInChain = nullptr,
+		.label = "Profiler timestamps",
+		.type = WGPUQueryType_Timestamp,
+		.count = MaxScopes * 2
+	};
+
+	QuerySet = Resources::Track(wgpuDeviceCreateQuerySet(gpu->Device, &querySetDesc), querySetDesc.label);
+
+	WGPUBufferDescriptor resolveBufferDesc = {
+		.nextInChain = nullptr,
+		.label = "Profiler resolve buffer",
+		.usage = WGPUBufferUsage_QueryResolve | WGPUBufferUsage_CopySrc,
+		.size = MaxScopes * 2 * sizeof(uint64_t),
+		.mappedAtCreation = false
+	};
+
+	ResolveBuffer = Resources::Track(wgpuDeviceCreateBuffer(gpu->Device, &resolveBufferDesc), resolveBufferDesc.label, MemoryCategory_t::Other, resolveBufferDesc.size);
+
+	WGPUBufferDescriptor readbackBufferDesc = {
+		.nextInChain = nullptr,
+		.label = "Profiler readback buffer",
+		.usage = WGPUBufferUsage_MapRead | WGPUBufferUsage_CopyDst,
+		.size = MaxScopes * 2 * sizeof(uint64_t),
+		.mappedAtCreation = false
+	};
+
+	for (Readback_t& readback : Readbacks)
+		readback.Buffer = Resources::Track(wgpuDeviceCreateBuffer(gpu->Device, &readbackBufferDesc), readbackBufferDesc.label, MemoryCategory_t::Staging, readbackBufferDesc.size);
+}
+
+uint32_t GpuProfiler_t::GetTimingIndex(const char* name)
+{
+	// Only a few dozen names, and only looked up while measuring
+	for (uint32_t i = 0; i < Timings.size(); ++i)
+	{
+		if (Timings[i].Name == name || strcmp(Timings[i].Name, name) == 0)
+			return i;
+	}
+
+	Timings.push_back({ .Name = name });
+	return (uint32_t)Timings.size() - 1;
+}
+
+uint32_t GpuProfiler_t::AddScope(const char* name)
+{
+	if (!Current || Current->ScopeCount == MaxScopes)
+		return UINT32_MAX;
+
+	uint32_t scope = Current->ScopeCount++;
+	Current->TimingIndices[scope] = GetTimingIndex(name);
+
+	return scope * 2;
+}
+
+uint32_t GpuProfiler_t::PushScope(const char* name)
+{
+	// Too deep still counts, so the matching pop lines up
+	uint32_t query = OpenScopeCount < MaxScopeDepth ? AddScope(name) : UINT32_MAX;
+
+	if (OpenScopeCount < MaxScopeDepth)
+		OpenScopes[OpenScopeCount] = query;
+
+	OpenScopeCount++;
+	return query;
+}
+
+uint32_t GpuProfiler_t::PopScope()
+{
+	if (OpenScopeCount == 0)
+		return UINT32_MAX;
+
+	OpenScopeCount--;
+	return OpenScopeCount < MaxScopeDepth ? OpenScopes[OpenScopeCount] : UINT32_MAX;
+}
+
+void GpuProfiler_t::BeginFrame(WGPUCommandEncoder encoder)
+{
+	OpenScopeCount = 0;
+
+	if (!QuerySet)
+		return;
+
+	for (Readback_t& readback : Readbacks)
+	{
+		if (readback.IsBusy)
+			continue;
+
+		Current = &readback;
+		break;
+	}
+
+	if (!Current)
+		return;
+
+	Current->FrameIndex = Gpu->Frames->GetFrameIndex();
+	Current->ScopeCount = 0;
+
+	BeginScope(encoder, "Frame");
+}
+
+void GpuProfiler_t::EndFrame(WGPUCommandEncoder encoder)
+{
+	if (!Current)
+		return;
+
+	// Scopes left open never get their end timestamp; they resolve to zero and get skipped
+	while (OpenScopeCount > 1)
+		PopScope();
+
+	EndScope(encoder);
+
+	uint32_t queryCount = Current->ScopeCount * 2;
+
+	wgpuCommandEncoderResolveQuerySet(encoder, QuerySet, 0, queryCount, ResolveBuffer, 0);
+	wgpuCommandEncoderCopyBufferToBuffer(encoder, ResolveBuffer, 0, Current->Buffer, 0, queryCount * sizeof(uint64_t));
+
+	Current->IsBusy = true;
+	PendingReadback = Current;
+	Current = nullptr;
+}
+
+void GpuProfiler_t::OnSubmitted()
+{
+	if (!PendingReadback)
+		return;
+
+	uint64_t size = PendingReadback->ScopeCount * 2 * sizeof(uint64_t);
+
+	wgpuBufferMapAsync(PendingReadback->Buffer, WGPUMapMode_Read, 0, size, OnReadbackMapped, PendingReadback);
+	PendingReadback = nullptr;
+}
+
+bool GpuProfiler_t::GetPassTimestampWrites(const char* name, WGPURenderPassTimestampWrites& timestampWrites)
+{
+	uint32_t query = AddScope(name);
+
+	if (query == UINT32_MAX)
+		return false;
+
+	timestampWrites = {
+		.querySet = QuerySet,
+		.beginningOfPassWriteIndex = query,
+		.endOfPassWriteIndex = query + 1
+	};
+
+	return true;
+}
+
+bool GpuProfiler_t::GetPassTimestampWrites(const char* name, WGPUComputePassTimestampWrites& timestampWrites)
+{
+	uint32_t query = AddScope(name);
+
+	if (query == UINT32_MAX)
+		return false;
+
+	timestampWrites = {
+		.querySet = QuerySet,
+		.beginningOfPassWriteIndex = query,
+		.endOfPassWriteIndex = query + 1
+	};
+
+	return true;
+}
+
+void GpuProfiler_t::BeginScope(WGPUCommandEncoder encoder, const char* name)
+{
+	uint32_t query = PushScope(name);
+
+	if (query != UINT32_MAX)
+		wgpuCommandEncoderWriteTimestamp(encoder, QuerySet, query);
+}
+
+void GpuProfiler_t::EndScope(WGPUCommandEncoder encoder)
+{
+	uint32_t query = PopScope();
+
+	if (query != UINT32_MAX)
+		wgpuCommandEncoderWriteTimestamp(encoder, QuerySet, query + 1);
+}
+
+void GpuProfiler_t::BeginScope(WGPURenderPassEncoder renderPass, const char* name)
+{
+	if (!Gpu->HasTimestampQueryInsidePasses)
+		return;
+
+	uint32_t query = PushScope(name);
+
+	if (query != UINT32_MAX)
+		wgpuRenderPassEncoderWriteTimestamp(renderPass, QuerySet, query);
+}
+
+void GpuProfiler_t::EndScope(WGPURenderPassEncoder renderPass)
+{
+	if (!Gpu->HasTimestampQueryInsidePasses)
+		return;
+
+	uint32_t query = PopScope();
+
+	if (query != UINT32_MAX)
+		wgpuRenderPassEncoderWriteTimestamp(renderPass, QuerySet, query + 1);
+}
+
+void GpuProfiler_t::BeginScope(WGPUComputePassEncoder computePass, const char* name)
+{
+	if (!Gpu->HasTimestampQueryInsidePasses)
+		return;
+
+	uint32_t query = PushScope(name);
+
+	if (query != UINT32_MAX)
+		wgpuComputePassEncoderWriteTimestamp(computePass, QuerySet, query);
+}
+
+void GpuProfiler_t::EndScope(WGPUComputePassEncoder computePass)
+{
+	if (!Gpu->HasTimestampQueryInsidePasses)
+		return;
+
+	uint32_t query = PopScope();
+
+	if (query != UINT32_MAX)
+		wgpuComputePassEncoderWriteTimestamp(computePass, QuerySet, query + 1);
+}
+
+void GpuProfiler_t::OnReadback(Readback_t& readback, const uint64_t* timestamps)
+{
+	LinearArena_t& arena = FrameArena::Get();
+	ArenaScope_t scope(arena);
+
+	// Scopes that share a name add up, so total the frame first; negative for names it didn't have
+	ArenaVector_t<float> totals(Timings.size(), -1.0f, arena);
+
+	for (uint32_t i = 0; i < readback.ScopeCount; ++i)
+	{
+		float& total = totals[readback.TimingIndices[i]];
+		total = std::max(total, 0.0f);
+
+		uint64_t begin = timestamps[i * 2];
+		uint64_t end = timestamps[i * 2 + 1];
+
+		// Timestamps are in nanoseconds; a reset, a disjoint pair or a scope left open just gets skipped
+		if (end > begin)
+			total += (float)((end - begin) / 1.0e6);
+	}
+
+	for (uint32_t i = 0; i < Timings.size(); ++i)
+	{
+		if (totals[i] < 0.0f)
+			continue;
+
+		GpuTiming_t& timing = Timings[i];
+
+		timing.LastMilliseconds = totals[i];
+		timing.Milliseconds = timing.SampleCount == 0 ? totals[i] : timing.Milliseconds + (totals[i] - timing.Milliseconds) * SmoothingFactor;
+		timing.FrameIndex = readback.FrameIndex;
+		timing.SampleCount++;
+	}
+}
+
+void GpuProfiler_t::OnReadbackMapped(WGPUBufferMapAsyncStatus status, void* userData)
+{
+	Readback_t* readback = (Readback_t*)userData;
+
+	if (status == WGPUBufferMapAsyncStatus_Success)
+	{
+		uint64_t size = readback->ScopeCount * 2 * sizeof(uint64_t);
+		const uint64_t* timestamps = (const uint64_t*)wgpuBufferGetConstMappedRange(readback->Buffer, 0, size);
+
+		if (timestamps)
+			readback->Owner->OnReadback(*readback, timestamps);
+
+		wgpuBufferUnmap(readback->Buffer);
+	}
+
+	readback->IsBusy = false;
+}
+
+const GpuTiming_t* GpuProfiler_t::GetTiming(const char* name)
+{
+	for (const GpuTiming_t& timing : Timings)
+	{
+		if (strcmp(timing.Name, name) == 0)
+			return &timing;
+	}
+
+	return nullptr;
+}
+
+float GpuProfiler_t::GetMilliseconds(const char* name)
+{
+	const GpuTiming_t* timing = GetTiming(name);
+	return timing ? timing->Milliseconds : 0.0f;
+}
+
+void GpuProfiler_t::Destroy()
+{
+	// Copied into but never submitted, so it won't come back
+	if (PendingReadback)
+		PendingReadback->IsBusy = false;
+
+	for (Readback_t& readback : Readbacks)
+	{
+		Gpu->Frames->WaitUntil([&readback]() { return !readback.IsBusy; });
+		Resources::Release(readback.Buffer);
+	}
+
+	Resources::Release(ResolveBuffer);
+	Resources::Release(QuerySet);
+
+	Timings.clear();
+
+	Current = nullptr;
+	PendingReadback = nullptr;
+	OpenScopeCount = 0;
+}
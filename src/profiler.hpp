@@ -0,0 +1,138 @@
+#pragma once
+
+#include "gpu.hpp"
+
+#include <webgpu/webgpu.h>
+
+#include <span>
+#include <vector>
+
+/*
+ * GPU time of one named scope
+ */
+struct GpuTiming_t
+{
+	const char* Name											= nullptr;
+
+	// Exponential moving average, and the most recent frame on its own
+	float Milliseconds											= 0.0f;
+	float LastMilliseconds										= 0.0f;
+
+	// Frame the most recent measurement came from, and how many there have been
+	uint64_t FrameIndex											= 0;
+	uint32_t SampleCount										= 0;
+};
+
+/*
+ * GPU profiler, on timestamp queries.
+ *
+ * The frame graph gives every pass a scope. Render and compute passes use their timestampWrites, and
+ * transfer passes get timestamps written on the command encoder around them. The whole frame is one
+ * more scope. Where the device has Chromium's timestamps-inside-passes feature, passes can also open
+ * named scopes of their own; elsewhere those are no-ops.
+ *
+ * At the end of the frame all of its queries are resolved and copied into one of a ring of readback
+ * buffers. The buffer is mapped once the frame is submitted and comes back a few frames later, without
+ * anyone waiting on it. Scopes that share a name within a frame add up, and every name keeps a moving
+ * average. When all readback buffers are still on their way back, the frame goes unmeasured.
+ */
+struct GpuProfiler_t
+{
+public:
+	// Per frame; every scope takes two queries
+	static constexpr uint32_t MaxScopes							= 256;
+
+	// Frames of timestamps that can be on their way back at once
+	static constexpr uint32_t ReadbackCount						= 4;
+
+	// Nested scopes open at once
+	static constexpr uint32_t MaxScopeDepth						= 16;
+
+	// Weight of a new measurement in the moving average
+	static constexpr float SmoothingFactor						= 0.1f;
+
+private:
+	/*
+	 * One frame's worth of timestamps on their way back to the CPU
+	 */
+	struct Readback_t
+	{
+		GpuProfiler_t* Owner									= nullptr;
+		WGPUBuffer Buffer										= nullptr;
+
+		uint64_t FrameIndex										= 0;
+		uint32_t ScopeCount										= 0;
+
+		// Timing each scope counts towards
+		uint32_t TimingIndices[MaxScopes]						= {};
+
+		bool IsBusy												= false;
+	};
+
+	GraphicsDevice_t* Gpu										= nullptr;
+
+	WGPUQuerySet QuerySet										= nullptr;
+	WGPUBuffer ResolveBuffer									= nullptr;
+	Readback_t Readbacks[ReadbackCount]							= {};
+
+	// Readback this frame's scopes go into; null while the frame isn't measured
+	Readback_t* Current											= nullptr;
+
+	// Readback copied into this frame, mapped once the frame is submitted
+	Readback_t* PendingReadback									= nullptr;
+
+	// Scopes opened with BeginScope, innermost last; UINT32_MAX for ones that didn't fit
+	uint32_t OpenScopes[MaxScopeDepth]							= {};
+	uint32_t OpenScopeCount										= 0;
+
+	// Every name measured so far, in the order they first showed up
+	std::vector<GpuTiming_t> Timings							= {};
+
+	uint32_t GetTimingIndex(const char* name);
+
+	// Query of the scope's begin timestamp, end is the one after; UINT32_MAX when not measuring
+	uint32_t AddScope(const char* name);
+
+	uint32_t PushScope(const char* name);
+	uint32_t PopScope();
+
+	void OnReadback(Readback_t& readback, const uint64_t* timestamps);
+	static void OnReadbackMapped(WGPUBufferMapAsyncStatus status, void* userData);
+
+public:
+	void Init(GraphicsDevice_t* gpu);
+
+	// False without timestamp support, every call is a no-op then
+	bool IsEnabled()											{ return QuerySet != nullptr; }
+
+	// Bracket everything the frame records
+	void BeginFrame(WGPUCommandEncoder encoder);
+	void EndFrame(WGPUCommandEncoder encoder);
+
+	// Buffers can only be mapped once the copy into them has been submitted
+	void OnSubmitted();
+
+	// Timestamps for a whole pass; false, leaving timestampWrites alone, when the frame isn't measured
+	bool GetPassTimestampWrites(const char* name, WGPURenderPassTimestampWrites& timestampWrites);
+	bool GetPassTimestampWrites(const char* name, WGPUComputePassTimestampWrites& timestampWrites);
+
+	// Around commands recorded straight into the encoder, outside any pass
+	void BeginScope(WGPUCommandEncoder encoder, const char* name);
+	void EndScope(WGPUCommandEncoder encoder);
+
+	// Inside a pass; no-ops without timestamps inside passes
+	void BeginScope(WGPURenderPassEncoder renderPass, const char* name);
+	void EndScope(WGPURenderPassEncoder renderPass);
+	void BeginScope(WGPUComputePassEncoder computePass, const char* name);
+	void EndScope(WGPUComputePassEncoder computePass);
+
+	std::span<const GpuTiming_t> GetTimings()					{ return Timings; }
+
+	// Null for a name that hasn't been measured
+	const GpuTiming_t* GetTiming(const char* name);
+
+	// Smoothed; 0 for a name that hasn't been measured
+	float GetMilliseconds(const char* name);
+
+	void Destroy();
+};
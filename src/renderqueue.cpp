@@ -0,0 +1,323 @@
+#include "renderqueue.hpp"
+#include "jobs.hpp"
+
+#include <algorithm>
+#include <type_traits>
+
+uint64_t RenderQueue_t::MakeSortKey(DrawPass_t pass, uint16_t pipelineId, uint16_t materialId, float depth)
+{
+	const uint32_t maxDepth = 0xFFFFFF;
+
+	uint32_t depthBucket = (uint32_t)(std::clamp(depth, 0.0f, 1.0f) * maxDepth);
+
+	// Transparent draws have to blend back-to-front
+	if (pass == DrawPass_t::Transparent)
+		depthBucket = maxDepth - depthBucket;
+
+	return ((uint64_t)pass << 56)
+		| ((uint64_t)pipelineId << 40)
+		| ((uint64_t)materialId << 24)
+		| (uint64_t)depthBucket;
+}
+
+uint16_t RenderQueue_t::GetPipelineId(WGPURenderPipeline pipeline)
+{
+	auto it = PipelineIds.find(pipeline);
+
+	if (it != PipelineIds.end())
+		return it->second;
+
+	uint16_t pipelineId = (uint16_t)PipelineIds.size();
+	PipelineIds[pipeline] = pipelineId;
+
+	return pipelineId;
+}
+
+void RenderQueue_t::Clear()
+{
+	static_assert(std::is_trivially_destructible_v<DrawPacket_t>, "Packets are dropped with the frame arena without being destroyed");
+
+	// Last frame's storage went with the arena reset, start out with room for as many draws again
+	size_t lastCount = Packets.size();
+
+	Packets = ArenaVector_t<DrawPacket_t>();
+	Packets.reserve(lastCount);
+
+	SortScratch = ArenaVector_t<DrawPacket_t>();
+}
+
+void RenderQueue_t::Push(DrawPass_t pass, Mesh_t* mesh, Material_t* material, WGPURenderPipeline pipeline, float depth)
+{
+	// Depth-only draws don't touch the material, and transparent ones sort on depth alone to blend in order
+	uint16_t materialId = pass == DrawPass_t::DepthPrepass || pass == DrawPass_t::Transparent ? 0 : (uint16_t)material->Id;
+
+	DrawPacket_t packet = {
+		.SortKey = MakeSortKey(pass, GetPipelineId(pipeline), materialId, depth),
+		.Mesh = mesh,
+		.Material = material,
+		.Pipeline = pipeline
+	};
+
+	Packets.push_back(packet);
+}
+
+void RenderQueue_t::Sort()
+{
+	size_t count = Packets.size();
+
+	if (count < 2)
+		return;
+
+	SortScratch.resize(count);
+
+	// Build the histograms for all eight digits in a single pass
+	uint32_t histograms[8][256] = {};
+
+	for (auto& packet : Packets)
+	{
+		for (int digit = 0; digit < 8; ++digit)
+		{
+			histograms[digit][(packet.SortKey >> (digit * 8)) & 0xFF]++;
+		}
+	}
+
+	DrawPacket_t* source = Packets.data();
+	DrawPacket_t* destination = SortScratch.data();
+
+	// LSD radix sort, 8 bits at a time
+	for (int digit = 0; digit < 8; ++digit)
+	{
+		uint32_t* histogram = histograms[digit];
+		int shift = digit * 8;
+
+		// Every key shares this digit (common for the pass and pipeline bits), so the pass would be a no-op
+		if (histogram[(source[0].SortKey >> shift) & 0xFF] == count)
+			continue;
+
+		uint32_t offset = 0;
+
+		for (int bucket = 0; bucket < 256; ++bucket)
+		{
+			uint32_t bucketCount = histogram[bucket];
+			histogram[bucket] = offset;
+			offset += bucketCount;
+		}
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			destination[histogram[(source[i].SortKey >> shift) & 0xFF]++] = source[i];
+		}
+
+		std::swap(source, destination);
+	}
+
+	// An odd number of passes leaves the result in the scratch buffer
+	if (source != Packets.data())
+		Packets.swap(SortScratch);
+}
+
+void RenderQueue_t::SetSharedBindGroup(uint32_t group, WGPUBindGroup bindGroup)
+{
+	SharedBindGroups[group] = bindGroup;
+}
+
+void RenderQueue_t::Record(WGPURenderBundleEncoder bundleEncoder, DrawPass_t pass, size_t first, size_t last)
+{
+	bool isDepthOnly = pass == DrawPass_t::DepthPrepass;
+
+	// Visibility draws fetch their own vertices through the geometry bind group, de-indexed
+	bool isVertexPulling = pass == DrawPass_t::Visibility;
+
+	WGPURenderPipeline currentPipeline = nullptr;
+	WGPUBindGroup currentMaterial = nullptr;
+	WGPUBuffer currentVertexBuffer = nullptr;
+	WGPUBuffer currentIndexBuffer = nullptr;
+
+	if (!isDepthOnly && !isVertexPulling)
+	{
+		for (uint32_t group = 0; group < MaxBindGroups; ++group)
+		{
+			if (SharedBindGroups[group])
+				wgpuRenderBundleEncoderSetBindGroup(bundleEncoder, group, SharedBindGroups[group], 0, nullptr);
+		}
+	}
+
+	for (size_t i = first; i < last; ++i)
+	{
+		DrawPacket_t& packet = Packets[i];
+		Mesh_t& mesh = *packet.Mesh;
+
+		// Depth-only draws read a position-only stream
+		WGPUBuffer vertexBuffer = isDepthOnly ? mesh.PositionBuffer.DataBuffer : mesh.VertexBuffer.DataBuffer;
+
+		// Draws are sorted by state, so skip anything that's already bound
+		if (packet.Pipeline != currentPipeline)
+		{
+			wgpuRenderBundleEncoderSetPipeline(bundleEncoder, packet.Pipeline);
+			currentPipeline = packet.Pipeline;
+		}
+
+		uint32_t objectOffset = mesh.GetObjectOffset();
+
+		if (isVertexPulling)
+		{
+			wgpuRenderBundleEncoderSetBindGroup(bundleEncoder, 0, mesh.ObjectBindGroup, 1, &objectOffset);
+			wgpuRenderBundleEncoderSetBindGroup(bundleEncoder, 1, mesh.GeometryBindGroup, 0, nullptr);
+			wgpuRenderBundleEncoderDraw(bundleEncoder, mesh.IndexBuffer.Count, 1, 0, 0);
+			continue;
+		}
+
+		if (!isDepthOnly && packet.Material->BindGroup != currentMaterial)
+		{
+			wgpuRenderBundleEncoderSetBindGroup(bundleEncoder, 1, packet.Material->BindGroup, 0, nullptr);
+			currentMaterial = packet.Material->BindGroup;
+		}
+
+		if (vertexBuffer != currentVertexBuffer)
+		{
+			wgpuRenderBundleEncoderSetVertexBuffer(bundleEncoder, 0, vertexBuffer, 0, WGPU_WHOLE_SIZE);
+			currentVertexBuffer = vertexBuffer;
+		}
+
+		if (mesh.IndexBuffer.DataBuffer != currentIndexBuffer)
+		{
+			wgpuRenderBundleEncoderSetIndexBuffer(bundleEncoder, mesh.IndexBuffer.DataBuffer, WGPUIndexFormat_Uint32, 0, WGPU_WHOLE_SIZE);
+			currentIndexBuffer = mesh.IndexBuffer.DataBuffer;
+		}
+
+		// Per-object data always changes
+		wgpuRenderBundleEncoderSetBindGroup(bundleEncoder, 0, mesh.ObjectBindGroup, 1, &objectOffset);
+
+		wgpuRenderBundleEncoderDrawIndexed(bundleEncoder, mesh.IndexBuffer.Count, 1, 0, 0, 0);
+	}
+}
+
+void RenderQueue_t::GetPassRange(DrawPass_t pass, size_t& first, size_t& last)
+{
+	// Packets are sorted by pass first, so each pass is one contiguous range
+	auto passBegin = std::lower_bound(Packets.begin(), Packets.end(), (uint64_t)pass << 56,
+		[](const DrawPacket_t& packet, uint64_t key) { return packet.SortKey < key; });
+
+	auto passEnd = std::lower_bound(passBegin, Packets.end(), ((uint64_t)pass + 1) << 56,
+		[](const DrawPacket_t& packet, uint64_t key) { return packet.SortKey < key; });
+
+	first = passBegin - Packets.begin();
+	last = passEnd - Packets.begin();
+}
+
+bool RenderQueue_t::HasDraws(DrawPass_t pass)
+{
+	size_t first, last;
+	GetPassRange(pass, first, last);
+
+	return first != last;
+}
+
+std::span<const DrawPacket_t> RenderQueue_t::GetDraws(DrawPass_t pass)
+{
+	size_t first, last;
+	GetPassRange(pass, first, last);
+
+	return std::span<const DrawPacket_t>(Packets.data() + first, last - first);
+}
+
+void RenderQueue_t::Execute(GraphicsDevice_t* gpu, WGPURenderPassEncoder renderPass, DrawPass_t pass)
+{
+	size_t first, last;
+	GetPassRange(pass, first, last);
+
+	if (first == last)
+		return;
+
+	std::vector<RenderBundle_t>& bundles = Bundles[(size_t)pass];
+	size_t bundleCount = (last - first + DrawsPerBundle - 1) / DrawsPerBundle;
+
+	for (size_t i = bundleCount; i < bundles.size(); ++i)
+		bundles[i].Destroy();
+
+	bundles.resize(bundleCount);
+
+	uint64_t sharedSignature = HashSeed;
+
+	for (WGPUBindGroup bindGroup : SharedBindGroups)
+	{
+		sharedSignature = HashCombine(sharedSignature, (uint64_t)bindGroup);
+	}
+
+	auto recordBundles = [this, gpu, pass, first, last, sharedSignature, &bundles](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t bundleIndex = begin; bundleIndex < end; ++bundleIndex)
+			{
+				size_t bundleFirst = first + bundleIndex * DrawsPerBundle;
+				size_t bundleLast = std::min(bundleFirst + DrawsPerBundle, last);
+
+				// A bundle stays valid for as long as the same draws come out of the sort in the same order
+				uint64_t signature = sharedSignature;
+
+				for (size_t i = bundleFirst; i < bundleLast; ++i)
+				{
+					signature = HashCombine(signature, (uint64_t)Packets[i].Mesh);
+					signature = HashCombine(signature, (uint64_t)Packets[i].Pipeline);
+					signature = HashCombine(signature, (uint64_t)Packets[i].Material->BindGroup.Get());
+					signature = Packets[i].Mesh->GetSignature(signature);
+				}
+
+				RenderBundle_t& bundle = bundles[bundleIndex];
+
+				if (bundle.IsValid(signature))
+					continue;
+
+				bundle.Destroy();
+
+				WGPURenderBundleEncoder bundleEncoder = Graphics::MakeRenderBundleEncoder(gpu, pass, "Render queue bundle encoder");
+
+				Record(bundleEncoder, pass, bundleFirst, bundleLast);
+
+				WGPURenderBundleDescriptor bundleDesc = {
+					.nextInChain = nullptr,
+					.label = "Render queue bundle"
+				};
+
+				bundle.Bundle = wgpuRenderBundleEncoderFinish(bundleEncoder, &bundleDesc);
+				bundle.Signature = signature;
+
+				wgpuRenderBundleEncoderRelease(bundleEncoder);
+			}
+		};
+
+	// Without implicit device synchronization, bundles can only be recorded from the device thread
+	if (gpu->IsMultithreaded)
+		Jobs::ParallelFor((uint32_t)bundleCount, 1, recordBundles);
+	else
+		recordBundles(0, (uint32_t)bundleCount);
+
+	ExecuteScratch.clear();
+
+	for (RenderBundle_t& bundle : bundles)
+	{
+		ExecuteScratch.push_back(bundle.Bundle);
+	}
+
+	wgpuRenderPassEncoderExecuteBundles(renderPass, ExecuteScratch.size(), ExecuteScratch.data());
+}
+
+void RenderQueue_t::Destroy()
+{
+	for (auto& passBundles : Bundles)
+	{
+		for (auto& bundle : passBundles)
+		{
+			bundle.Destroy();
+		}
+
+		passBundles.clear();
+	}
+
+	Packets.clear();
+	PipelineIds.clear();
+
+	for (auto& bindGroup : SharedBindGroups)
+	{
+		bindGroup = nullptr;
+	}
+}
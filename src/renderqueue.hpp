@@ -0,0 +1,90 @@
+#pragma once
+
+#include "arena.hpp"
+#include "gpu.hpp"
+
+#include <webgpu/webgpu.h>
+
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * A single draw, plus the key it gets sorted by
+ */
+struct DrawPacket_t
+{
+	uint64_t SortKey											= 0;
+	Mesh_t* Mesh												= nullptr;
+	Material_t* Material										= nullptr;
+	WGPURenderPipeline Pipeline									= nullptr;
+};
+
+/*
+ * Collects draws every frame, sorts them by state and records them with as few state changes as possible.
+ *
+ * Sort key layout, most significant first:
+ *   [63..56] pass
+ *   [55..40] pipeline
+ *   [39..24] material
+ *   [23..0]  depth bucket (front-to-back, or back-to-front for transparent draws)
+ *
+ * Each pass is recorded as a run of render bundles of DrawsPerBundle draws, recorded in parallel on
+ * the job system and executed in order. Bundle boundaries only depend on the draw count, so the
+ * recorded commands are the same however many threads there are, and a change only re-records the
+ * bundles it falls in.
+ */
+struct RenderQueue_t
+{
+private:
+	// Frame arena, so gathering draws never touches the heap; replaced by Clear every frame
+	ArenaVector_t<DrawPacket_t> Packets							= {};
+	ArenaVector_t<DrawPacket_t> SortScratch						= {};
+
+	// Pipelines don't carry an ID, so hand out small ones as we see them
+	std::unordered_map<WGPURenderPipeline, uint16_t> PipelineIds = {};
+
+	// Recorded draws for each pass, reused while their part of the sorted draw list stays the same
+	std::vector<RenderBundle_t> Bundles[(size_t)DrawPass_t::Count] = {};
+
+	// Handles of the bundles a pass executes, in order
+	std::vector<WGPURenderBundle> ExecuteScratch				= {};
+
+	// WebGPU's default maxBindGroups
+	static constexpr uint32_t MaxBindGroups						= 4;
+
+	// Per-frame bind groups (lighting, ...) that every shaded draw uses, indexed by group
+	WGPUBindGroup SharedBindGroups[MaxBindGroups]				= {};
+
+	uint16_t GetPipelineId(WGPURenderPipeline pipeline);
+	void GetPassRange(DrawPass_t pass, size_t& first, size_t& last);
+	void Record(WGPURenderBundleEncoder bundleEncoder, DrawPass_t pass, size_t first, size_t last);
+
+public:
+	// Fixed, so the split doesn't depend on the thread count
+	static constexpr size_t DrawsPerBundle						= 256;
+
+	static uint64_t MakeSortKey(DrawPass_t pass, uint16_t pipelineId, uint16_t materialId, float depth);
+
+	// Drop last frame's draws; after the frame arena's reset, before the first push
+	void Clear();
+
+	// Queue a draw; depth is the normalised (0..1) view depth of the mesh. Mesh and material are
+	// looked up in their pools every frame, the pointers only have to last until the queue is cleared
+	void Push(DrawPass_t pass, Mesh_t* mesh, Material_t* material, WGPURenderPipeline pipeline, float depth);
+
+	// Bound at the start of every shaded bundle (not depth-only or visibility ones); groups 0 and 1 belong to the draws
+	void SetSharedBindGroup(uint32_t group, WGPUBindGroup bindGroup);
+
+	// Radix sort all queued draws by key
+	void Sort();
+
+	// Only valid after sorting
+	bool HasDraws(DrawPass_t pass);
+	std::span<const DrawPacket_t> GetDraws(DrawPass_t pass);
+
+	// Replay every draw in a pass, re-recording only the bundles whose draws changed
+	void Execute(GraphicsDevice_t* gpu, WGPURenderPassEncoder renderPass, DrawPass_t pass);
+
+	void Destroy();
+};
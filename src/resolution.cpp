@@ -0,0 +1,252 @@
+#include "resolution.hpp"
+#include "frames.hpp"
+#include "profiler.hpp"
+#include "resources.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+static const char* UpscaleShaderSource = R"(
+	@group(0) @binding(0) var sourceTexture: texture_2d<f32>;
+	@group(0) @binding(1) var sourceSampler: sampler;
+
+	struct VertexOutput {
+		@builtin(position) position: vec4f,
+		@location(0) uv: vec2f
+	};
+
+	@vertex
+	fn vs_upscale(@builtin(vertex_index) vertexIndex: u32) -> VertexOutput
+	{
+		let uv = vec2f(f32((vertexIndex << 1u) & 2u), f32(vertexIndex & 2u));
+
+		var out: VertexOutput;
+		out.position = vec4f(uv * vec2f(2.0, -2.0) + vec2f(-1.0, 1.0), 0.0, 1.0);
+		out.uv = uv;
+
+		return out;
+	}
+
+	@fragment
+	fn fs_upscale(in: VertexOutput) -> @location(0) vec4f
+	{
+		return textureSampleLevel(sourceTexture, sourceSampler, in.uv, 0.0);
+	}
+)";
+
+void DynamicResolution_t::Init(GraphicsDevice_t* gpu, WGPUTextureFormat outputFormat)
+{
+	Gpu = gpu;
+
+	CreateUpscalePipeline(outputFormat);
+
+	SetSettings(Settings);
+}
+
+void DynamicResolution_t::CreateUpscalePipeline(WGPUTextureFormat outputFormat)
+{
+	WGPUShaderModule shaderModule = Graphics::MakeShaderModule(Gpu, UpscaleShaderSource);
+
+	WGPUBindGroupLayoutEntry bindingLayouts[2] = {};
+
+	SetDefaultBindGroupLayoutEntry(bindingLayouts[0]);
+	bindingLayouts[0].binding = 0;
+	bindingLayouts[0].visibility = WGPUShaderStage_Fragment;
+	bindingLayouts[0].texture.sampleType = WGPUTextureSampleType_Float;
+	bindingLayouts[0].texture.viewDimension = WGPUTextureViewDimension_2D;
+
+	SetDefaultBindGroupLayoutEntry(bindingLayouts[1]);
+	bindingLayouts[1].binding = 1;
+	bindingLayouts[1].visibility = WGPUShaderStage_Fragment;
+	bindingLayouts[1].sampler.type = WGPUSamplerBindingType_Filtering;
+
+	WGPUBindGroupLayoutDescriptor bindGroupLayoutDesc = {
+		.nextInChain = nullptr,
+		.label = "Upscale bind group layout",
+		.entryCount = 2,
+		.entries = bindingLayouts
+	};
+
+	UpscaleBindGroupLayout = Resources::Track(wgpuDeviceCreateBindGroupLayout(Gpu->Device, &bindGroupLayoutDesc), bindGroupLayoutDesc.label);
+
+	WGPUPipelineLayoutDescriptor layoutDesc = {
+		.nextInChain = nullptr,
+		.bindGroupLayoutCount = 1,
+		.bindGroupLayouts = &UpscaleBindGroupLayout
+	};
+
+	WGPUPipelineLayout layout = wgpuDeviceCreatePipelineLayout(Gpu->Device, &layoutDesc);
+
+	WGPUColorTargetState colorTarget = {
+		.format = outputFormat,
+		.blend = nullptr,
+		.writeMask = WGPUColorWriteMask_All
+	};
+
+	WGPUFragmentState fragmentState = {
+		.module = shaderModule,
+		.entryPoint = "fs_upscale",
+		.constantCount = 0,
+		.constants = nullptr,
+		.targetCount = 1,
+		.targets = &colorTarget
+	};
+
+	WGPURenderPipelineDescriptor pipelineDesc = {
+		.nextInChain = nullptr,
+		.label = "Upscale pipeline",
+		.layout = layout,
+		.vertex = {
+			.module = shaderModule,
+			.entryPoint = "vs_upscale",
+			.constantCount = 0,
+			.constants = nullptr,
+			.bufferCount = 0,
+			.buffers = nullptr
+		},
+
+		.primitive = {
+			.topology = WGPUPrimitiveTopology_TriangleList,
+			.stripIndexFormat = WGPUIndexFormat_Undefined,
+			.frontFace = WGPUFrontFace_CCW,
+			.cullMode = WGPUCullMode_None
+		},
+
+		.depthStencil = nullptr,
+		.multisample = {
+			.count = 1,
+			.mask = ~0u,
+			.alphaToCoverageEnabled = false
+		},
+		.fragment = &fragmentState
+	};
+
+	UpscalePipeline = Resources::Track(wgpuDeviceCreateRenderPipeline(Gpu->Device, &pipelineDesc), pipelineDesc.label);
+
+	WGPUSamplerDescriptor samplerDesc = {
+		.nextInChain = nullptr,
+		.label = "Upscale sampler",
+		.addressModeU = WGPUAddressMode_ClampToEdge,
+		.addressModeV = WGPUAddressMode_ClampToEdge,
+		.addressModeW = WGPUAddressMode_ClampToEdge,
+		.magFilter = WGPUFilterMode_Linear,
+		.minFilter = WGPUFilterMode_Linear,
+		.mipmapFilter = WGPUMipmapFilterMode_Nearest,
+		.lodMinClamp = 0.0f,
+		.lodMaxClamp = 1.0f,
+		.compare = WGPUCompareFunction_Undefined,
+		.maxAnisotropy = 1
+	};
+
+	UpscaleSampler = Resources::Track(wgpuDeviceCreateSampler(Gpu->Device, &samplerDesc), samplerDesc.label);
+
+	wgpuPipelineLayoutRelease(layout);
+	wgpuShaderModuleRelease(shaderModule);
+}
+
+void DynamicResolution_t::SetSettings(const DynamicResolutionSettings_t& settings)
+{
+	Settings = settings;
+	Settings.MinScale = std::clamp(Settings.MinScale, ScaleStep, 1.0f);
+	Settings.MaxScale = std::clamp(Settings.MaxScale, Settings.MinScale, 1.0f);
+
+	TargetScale = std::clamp(TargetScale, Settings.MinScale, Settings.MaxScale);
+
+	if (!Settings.IsEnabled)
+		TargetScale = Settings.MaxScale;
+
+	Scale = TargetScale;
+}
+
+void DynamicResolution_t::GetRenderSize(uint32_t outputWidth, uint32_t outputHeight, uint32_t& width, uint32_t& height)
+{
+	uint64_t frameIndex = Gpu->Frames->GetFrameIndex();
+	ScaleHistory[frameIndex % ScaleHistoryCount] = { .FrameIndex = frameIndex, .Scale = Scale };
+
+	width = std::max(1u, (uint32_t)std::lround(outputWidth * Scale));
+	height = std::max(1u, (uint32_t)std::lround(outputHeight * Scale));
+}
+
+void DynamicResolution_t::OnFrameTime(float frameTime, float frameScale)
+{
+	LastFrameTime = frameTime;
+
+	if (!Settings.IsEnabled || frameTime <= 0.0f)
+		return;
+
+	// Pixel count goes with the square of the scale; relative to what the frame was measured at, since
+	// scaling the current target would apply the same correction again for every frame still in flight
+	float desiredScale = frameScale * std::sqrt(Settings.TargetFrameTime / frameTime);
+
+	// Rather lose a few pixels than a frame: shrink at once, grow back slowly
+	if (desiredScale < TargetScale)
+		TargetScale = desiredScale;
+	else
+		TargetScale += (desiredScale - TargetScale) * IncreaseRate;
+
+	TargetScale = std::clamp(TargetScale, Settings.MinScale, Settings.MaxScale);
+
+	// Only move the rendered scale once the target is a full step away, so render targets don't churn
+	float steppedScale = std::floor(TargetScale / ScaleStep + 1.0e-3f) * ScaleStep;
+
+	if (TargetScale < Scale)
+		Scale = std::max(Settings.MinScale, steppedScale);
+	else if (steppedScale > Scale)
+		Scale = std::min(Settings.MaxScale, steppedScale);
+}
+
+void DynamicResolution_t::BeginFrame()
+{
+	// The profiler's scope around everything a frame records; only its most recent frame is kept
+	const GpuTiming_t* timing = Gpu->Profiler->GetTiming("Frame");
+
+	if (!timing || timing->FrameIndex < NextMeasuredFrame)
+		return;
+
+	NextMeasuredFrame = timing->FrameIndex + 1;
+
+	// Came back so late its scale has been overwritten already
+	const FrameScale_t& frameScale = ScaleHistory[timing->FrameIndex % ScaleHistoryCount];
+
+	if (frameScale.FrameIndex != timing->FrameIndex)
+		return;
+
+	OnFrameTime(timing->LastMilliseconds, frameScale.Scale);
+}
+
+void DynamicResolution_t::AddUpscalePass(FrameGraph_t& graph, FrameGraphResource_t source, FrameGraphResource_t output)
+{
+	graph.AddPass("Upscale", FrameGraphPassType_t::Render, [this, source](FrameGraphContext_t& context)
+		{
+			WGPUBindGroupEntry bindings[2] = {};
+			bindings[0].binding = 0;
+			bindings[0].textureView = context.GetTextureView(source);
+			bindings[1].binding = 1;
+			bindings[1].sampler = UpscaleSampler;
+
+			WGPUBindGroupDescriptor bindGroupDesc = {
+				.nextInChain = nullptr,
+				.label = "Upscale bind group",
+				.layout = UpscaleBindGroupLayout,
+				.entryCount = 2,
+				.entries = bindings
+			};
+
+			WGPUBindGroup bindGroup = wgpuDeviceCreateBindGroup(context.Gpu->Device, &bindGroupDesc);
+
+			wgpuRenderPassEncoderSetPipeline(context.RenderPass, UpscalePipeline);
+			wgpuRenderPassEncoderSetBindGroup(context.RenderPass, 0, bindGroup, 0, nullptr);
+			wgpuRenderPassEncoderDraw(context.RenderPass, 3, 1, 0, 0);
+
+			wgpuBindGroupRelease(bindGroup);
+		})
+		.Read(source)
+		.WriteColor(output, WGPULoadOp_Clear, { 0.0, 0.0, 0.0, 1.0 });
+}
+
+void DynamicResolution_t::Destroy()
+{
+	Resources::Release(UpscaleSampler);
+	Resources::Release(UpscalePipeline);
+	Resources::Release(UpscaleBindGroupLayout);
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "gpu.hpp"
+#include "framegraph.hpp"
+
+#include <webgpu/webgpu.h>
+
+/*
+ * Bounds and target for the dynamic resolution controller
+ */
+struct DynamicResolutionSettings_t
+{
+	// Disabled renders at MaxScale, always
+	bool IsEnabled												= true;
+
+	// Fraction of the output size, per axis
+	float MinScale												= 0.5f;
+	float MaxScale												= 1.0f;
+
+	// GPU milliseconds to aim for; kept under the frame budget so a spike has somewhere to go
+	float TargetFrameTime										= 14.0f;
+};
+
+/*
+ * Dynamic resolution scaling.
+ *
+ * The scene renders into an intermediate target whose size follows a feedback controller on the GPU
+ * frame time. That's the profiler's whole-frame scope, which comes back a few frames late. GPU
+ * time roughly follows the pixel count, so the controller asks for sqrt(target / measured) of the
+ * scale the measured frame rendered at, not the current one, so a few frames of latency don't make it
+ * overshoot: drops are applied straight away, recovery is eased in. The applied scale moves in
+ * fixed steps so the frame graph can keep reusing the same pooled targets while the load is steady.
+ */
+struct DynamicResolution_t
+{
+public:
+	// Frames back the scale of a measured frame is remembered; later measurements get dropped
+	static constexpr uint32_t ScaleHistoryCount					= 16;
+
+	static constexpr float ScaleStep							= 0.05f;
+	static constexpr float IncreaseRate							= 0.1f;
+
+private:
+	/*
+	 * Scale a frame rendered at; the controller has usually moved on by the time its time comes back
+	 */
+	struct FrameScale_t
+	{
+		uint64_t FrameIndex										= UINT64_MAX;
+		float Scale												= 1.0f;
+	};
+
+	GraphicsDevice_t* Gpu										= nullptr;
+
+	DynamicResolutionSettings_t Settings						= {};
+
+	// What the controller wants, and what gets rendered
+	float TargetScale											= 1.0f;
+	float Scale													= 1.0f;
+
+	// Indexed by frame index modulo the count
+	FrameScale_t ScaleHistory[ScaleHistoryCount]				= {};
+
+	// Frames before this one have been measured already, or never will be
+	uint64_t NextMeasuredFrame									= 0;
+
+	float LastFrameTime											= 0.0f;
+
+	WGPUBindGroupLayout UpscaleBindGroupLayout					= nullptr;
+	WGPURenderPipeline UpscalePipeline							= nullptr;
+	WGPUSampler UpscaleSampler									= nullptr;
+
+	void CreateUpscalePipeline(WGPUTextureFormat outputFormat);
+
+	void OnFrameTime(float frameTime, float frameScale);
+
+public:
+	void Init(GraphicsDevice_t* gpu, WGPUTextureFormat outputFormat);
+
+	void SetSettings(const DynamicResolutionSettings_t& settings);
+
+	// Size the scene should render at this frame
+	void GetRenderSize(uint32_t outputWidth, uint32_t outputHeight, uint32_t& width, uint32_t& height);
+
+	float GetScale()											{ return Scale; }
+	float GetLastFrameTime()									{ return LastFrameTime; }
+
+	// Feeds the controller the profiler's latest frame time, if a new one came back; does nothing
+	// without timestamp support
+	void BeginFrame();
+
+	// Bilinear upscale of source into output
+	void AddUpscalePass(FrameGraph_t& graph, FrameGraphResource_t source, FrameGraphResource_t output);
+
+	void Destroy();
+};
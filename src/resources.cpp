@@ -0,0 +1,339 @@
+#include "resources.hpp"
+#include "arena.hpp"
+#include "frames.hpp"
+#include "gpu.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Registry state
+ */
+struct ResourceRegistry_t
+{
+	struct Entry_t
+	{
+		ResourceType_t Type										= ResourceType_t::Buffer;
+		std::string Label										= {};
+		uint32_t RefCount										= 0;
+
+		MemoryCategory_t Category								= MemoryCategory_t::Other;
+		uint64_t Size											= 0;
+	};
+
+	struct PendingRelease_t
+	{
+		void* Handle											= nullptr;
+		ResourceType_t Type										= ResourceType_t::Buffer;
+
+		// Free once the GPU has completed more frames than this
+		uint64_t FrameIndex										= 0;
+	};
+
+	GraphicsDevice_t* Gpu										= nullptr;
+
+	// Loading and bundle recording can create objects off the device thread
+	std::mutex Mutex											= {};
+
+	std::unordered_map<void*, Entry_t> Entries					= {};
+	std::vector<PendingRelease_t> PendingReleases				= {};
+
+	// Bytes held by live objects
+	uint64_t MemoryUsage[(size_t)MemoryCategory_t::Count]		= {};
+
+	static void Free(void* handle, ResourceType_t type);
+};
+
+static ResourceRegistry_t Registry;
+
+static const char* ResourceTypeNames[] = {
+	"Buffer",
+	"Texture",
+	"TextureView",
+	"Sampler",
+	"BindGroup",
+	"BindGroupLayout",
+	"PipelineLayout",
+	"RenderPipeline",
+	"ComputePipeline",
+	"ShaderModule",
+	"QuerySet"
+};
+
+static_assert(sizeof(ResourceTypeNames) / sizeof(ResourceTypeNames[0]) == (size_t)ResourceType_t::Count, "Every resource type needs a name");
+
+static const char* MemoryCategoryNames[] = {
+	"Geometry",
+	"Texture",
+	"RenderTarget",
+	"Uniform",
+	"Staging",
+	"Other"
+};
+
+static_assert(sizeof(MemoryCategoryNames) / sizeof(MemoryCategoryNames[0]) == (size_t)MemoryCategory_t::Count, "Every memory category needs a name");
+
+static uint32_t GetBytesPerTexel(WGPUTextureFormat format)
+{
+	switch (format)
+	{
+	case WGPUTextureFormat_R8Unorm:
+	case WGPUTextureFormat_Stencil8:
+		return 1;
+	case WGPUTextureFormat_RG8Unorm:
+	case WGPUTextureFormat_R16Float:
+	case WGPUTextureFormat_Depth16Unorm:
+		return 2;
+	case WGPUTextureFormat_RGBA16Float:
+	case WGPUTextureFormat_RG32Float:
+	case WGPUTextureFormat_RG32Uint:
+		return 8;
+	case WGPUTextureFormat_RGBA32Float:
+	case WGPUTextureFormat_RGBA32Uint:
+		return 16;
+	default:
+		// RGBA8, BGRA8, RGB10A2, R32 and packed depth formats
+		return 4;
+	}
+}
+
+void ResourceRegistry_t::Free(void* handle, ResourceType_t type)
+{
+	switch (type)
+	{
+	case ResourceType_t::Buffer:
+		wgpuBufferDestroy((WGPUBuffer)handle);
+		wgpuBufferRelease((WGPUBuffer)handle);
+		break;
+	case ResourceType_t::Texture:
+		wgpuTextureDestroy((WGPUTexture)handle);
+		wgpuTextureRelease((WGPUTexture)handle);
+		break;
+	case ResourceType_t::TextureView:
+		wgpuTextureViewRelease((WGPUTextureView)handle);
+		break;
+	case ResourceType_t::Sampler:
+		wgpuSamplerRelease((WGPUSampler)handle);
+		break;
+	case ResourceType_t::BindGroup:
+		wgpuBindGroupRelease((WGPUBindGroup)handle);
+		break;
+	case ResourceType_t::BindGroupLayout:
+		wgpuBindGroupLayoutRelease((WGPUBindGroupLayout)handle);
+		break;
+	case ResourceType_t::PipelineLayout:
+		wgpuPipelineLayoutRelease((WGPUPipelineLayout)handle);
+		break;
+	case ResourceType_t::RenderPipeline:
+		wgpuRenderPipelineRelease((WGPURenderPipeline)handle);
+		break;
+	case ResourceType_t::ComputePipeline:
+		wgpuComputePipelineRelease((WGPUComputePipeline)handle);
+		break;
+	case ResourceType_t::ShaderModule:
+		wgpuShaderModuleRelease((WGPUShaderModule)handle);
+		break;
+	case ResourceType_t::QuerySet:
+		wgpuQuerySetDestroy((WGPUQuerySet)handle);
+		wgpuQuerySetRelease((WGPUQuerySet)handle);
+		break;
+	case ResourceType_t::Count:
+		assert(false);
+		break;
+	}
+}
+
+void Resources::Init(GraphicsDevice_t* gpu)
+{
+	Registry.Gpu = gpu;
+}
+
+void Resources::Shutdown()
+{
+	std::vector<ResourceRegistry_t::PendingRelease_t> pendingReleases = {};
+
+	{
+		std::lock_guard<std::mutex> lock(Registry.Mutex);
+		pendingReleases.swap(Registry.PendingReleases);
+	}
+
+	for (const ResourceRegistry_t::PendingRelease_t& pending : pendingReleases)
+		ResourceRegistry_t::Free(pending.Handle, pending.Type);
+
+	ReportLeaks();
+
+	// Owners that only go away after this free their objects right away
+	Registry.Gpu = nullptr;
+}
+
+void Resources::TrackHandle(void* handle, ResourceType_t type, const char* label, MemoryCategory_t category, uint64_t size)
+{
+	if (!handle)
+		return;
+
+	std::lock_guard<std::mutex> lock(Registry.Mutex);
+
+	ResourceRegistry_t::Entry_t& entry = Registry.Entries[handle];
+	assert(entry.RefCount == 0 && "Object is already tracked");
+
+	entry.Type = type;
+	entry.Label = label ? label : "";
+	entry.RefCount = 1;
+	entry.Category = category;
+	entry.Size = size;
+
+	Registry.MemoryUsage[(size_t)category] += size;
+}
+
+void Resources::AddRefHandle(void* handle)
+{
+	std::lock_guard<std::mutex> lock(Registry.Mutex);
+
+	auto it = Registry.Entries.find(handle);
+	assert(it != Registry.Entries.end() && "Only tracked objects can be shared");
+
+	it->second.RefCount++;
+}
+
+void Resources::ReleaseHandle(void* handle, ResourceType_t type)
+{
+	std::lock_guard<std::mutex> lock(Registry.Mutex);
+
+	auto it = Registry.Entries.find(handle);
+
+	if (it != Registry.Entries.end())
+	{
+		assert(it->second.Type == type);
+
+		if (--it->second.RefCount > 0)
+			return;
+
+		// Counted as gone right away, so a budget sees what it freed before the GPU lets go of it
+		Registry.MemoryUsage[(size_t)it->second.Category] -= it->second.Size;
+		Registry.Entries.erase(it);
+	}
+
+	if (!Registry.Gpu)
+	{
+		ResourceRegistry_t::Free(handle, type);
+		return;
+	}
+
+	// Outside a frame this is the next frame's index, which covers everything submitted so far as well
+	uint64_t frameIndex = Registry.Gpu->Frames ? Registry.Gpu->Frames->GetFrameIndex() : 0;
+
+	Registry.PendingReleases.push_back({ .Handle = handle, .Type = type, .FrameIndex = frameIndex });
+}
+
+void Resources::Collect()
+{
+	uint64_t completedFrames = Registry.Gpu->Frames->GetCompletedFrameCount();
+
+	ArenaVector_t<ResourceRegistry_t::PendingRelease_t> readyReleases = {};
+
+	{
+		std::lock_guard<std::mutex> lock(Registry.Mutex);
+
+		std::erase_if(Registry.PendingReleases, [&](const ResourceRegistry_t::PendingRelease_t& pending)
+			{
+				if (pending.FrameIndex >= completedFrames)
+					return false;
+
+				readyReleases.push_back(pending);
+				return true;
+			});
+	}
+
+	for (const ResourceRegistry_t::PendingRelease_t& pending : readyReleases)
+		ResourceRegistry_t::Free(pending.Handle, pending.Type);
+}
+
+uint32_t Resources::GetLiveCount()
+{
+	std::lock_guard<std::mutex> lock(Registry.Mutex);
+	return (uint32_t)Registry.Entries.size();
+}
+
+uint32_t Resources::GetPendingCount()
+{
+	std::lock_guard<std::mutex> lock(Registry.Mutex);
+	return (uint32_t)Registry.PendingReleases.size();
+}
+
+uint64_t Resources::GetTextureSize(const WGPUTextureDescriptor& desc)
+{
+	uint64_t size = 0;
+
+	for (uint32_t mip = 0; mip < desc.mipLevelCount; ++mip)
+	{
+		uint64_t width = std::max(desc.size.width >> mip, 1u);
+		uint64_t height = std::max(desc.size.height >> mip, 1u);
+		uint64_t depth = desc.dimension == WGPUTextureDimension_3D ? std::max(desc.size.depthOrArrayLayers >> mip, 1u) : desc.size.depthOrArrayLayers;
+
+		size += width * height * depth;
+	}
+
+	return size * GetBytesPerTexel(desc.format) * desc.sampleCount;
+}
+
+uint64_t Resources::GetMemoryUsage(MemoryCategory_t category)
+{
+	std::lock_guard<std::mutex> lock(Registry.Mutex);
+	return Registry.MemoryUsage[(size_t)category];
+}
+
+uint64_t Resources::GetTotalMemoryUsage()
+{
+	std::lock_guard<std::mutex> lock(Registry.Mutex);
+
+	uint64_t total = 0;
+
+	for (uint64_t usage : Registry.MemoryUsage)
+		total += usage;
+
+	return total;
+}
+
+void Resources::ReportMemoryUsage()
+{
+	std::lock_guard<std::mutex> lock(Registry.Mutex);
+
+	uint64_t total = 0;
+
+	for (size_t category = 0; category < (size_t)MemoryCategory_t::Count; ++category)
+	{
+		std::cout << "  " << MemoryCategoryNames[category] << ": " << Registry.MemoryUsage[category] / 1024 << " KB" << std::endl;
+		total += Registry.MemoryUsage[category];
+	}
+
+	std::cout << "  Total: " << total / 1024 << " KB" << std::endl;
+}
+
+void Resources::ReportLeaks()
+{
+	std::lock_guard<std::mutex> lock(Registry.Mutex);
+
+	if (Registry.Entries.empty())
+		return;
+
+	uint32_t counts[(size_t)ResourceType_t::Count] = {};
+
+	for (const auto& [handle, entry] : Registry.Entries)
+		counts[(size_t)entry.Type]++;
+
+	std::cout << "GPU resource leaks: " << Registry.Entries.size() << " objects never released" << std::endl;
+
+	for (size_t type = 0; type < (size_t)ResourceType_t::Count; ++type)
+	{
+		if (counts[type] > 0)
+			std::cout << "  " << ResourceTypeNames[type] << ": " << counts[type] << std::endl;
+	}
+
+	for (const auto& [handle, entry] : Registry.Entries)
+		std::cout << "  " << ResourceTypeNames[(size_t)entry.Type] << " '" << entry.Label << "' " << handle << ", " << entry.RefCount << " reference(s)" << std::endl;
+}
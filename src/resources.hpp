@@ -0,0 +1,177 @@
+#pragma once
+
+#include <webgpu/webgpu.h>
+
+#include <cstdint>
+
+struct GraphicsDevice_t;
+
+enum class ResourceType_t : uint8_t
+{
+	Buffer,
+	Texture,
+	TextureView,
+	Sampler,
+	BindGroup,
+	BindGroupLayout,
+	PipelineLayout,
+	RenderPipeline,
+	ComputePipeline,
+	ShaderModule,
+	QuerySet,
+
+	Count
+};
+
+/*
+ * What GPU memory is spent on
+ */
+enum class MemoryCategory_t : uint8_t
+{
+	Geometry,		// Vertex and index buffers
+	Texture,		// Sampled textures loaded from content
+	RenderTarget,	// Attachments and transient frame graph resources
+	Uniform,		// Uniform and storage data
+	Staging,		// Upload and readback buffers
+	Other,
+
+	Count
+};
+
+/*
+ * Maps a WebGPU handle type to its ResourceType_t
+ */
+template <typename T>
+struct ResourceTraits_t;
+
+template <> struct ResourceTraits_t<WGPUBuffer>					{ static constexpr ResourceType_t Type = ResourceType_t::Buffer; };
+template <> struct ResourceTraits_t<WGPUTexture>				{ static constexpr ResourceType_t Type = ResourceType_t::Texture; };
+template <> struct ResourceTraits_t<WGPUTextureView>			{ static constexpr ResourceType_t Type = ResourceType_t::TextureView; };
+template <> struct ResourceTraits_t<WGPUSampler>				{ static constexpr ResourceType_t Type = ResourceType_t::Sampler; };
+template <> struct ResourceTraits_t<WGPUBindGroup>				{ static constexpr ResourceType_t Type = ResourceType_t::BindGroup; };
+template <> struct ResourceTraits_t<WGPUBindGroupLayout>		{ static constexpr ResourceType_t Type = ResourceType_t::BindGroupLayout; };
+template <> struct ResourceTraits_t<WGPUPipelineLayout>			{ static constexpr ResourceType_t Type = ResourceType_t::PipelineLayout; };
+template <> struct ResourceTraits_t<WGPURenderPipeline>			{ static constexpr ResourceType_t Type = ResourceType_t::RenderPipeline; };
+template <> struct ResourceTraits_t<WGPUComputePipeline>		{ static constexpr ResourceType_t Type = ResourceType_t::ComputePipeline; };
+template <> struct ResourceTraits_t<WGPUShaderModule>			{ static constexpr ResourceType_t Type = ResourceType_t::ShaderModule; };
+template <> struct ResourceTraits_t<WGPUQuerySet>				{ static constexpr ResourceType_t Type = ResourceType_t::QuerySet; };
+
+/*
+ * Registry of GPU objects.
+ *
+ * Tracked objects carry a reference count and a label. Dropping the last reference doesn't free the
+ * object right away: it waits in a queue until every frame that was submitted (or being built) at
+ * that point has finished on the GPU, and Collect frees it after that. Buffers and textures are
+ * destroyed as well as released, so their memory goes back immediately rather than whenever the
+ * last WebGPU reference disappears.
+ *
+ * Objects tracked with a size count towards the memory usage of their category, until their last
+ * reference is dropped.
+ *
+ * Whatever is still tracked at shutdown was never released, and gets reported as a leak.
+ */
+namespace Resources
+{
+	void Init(GraphicsDevice_t* gpu);
+
+	// Frees everything still queued, so the GPU must be idle; then reports leaks
+	void Shutdown();
+
+	void TrackHandle(void* handle, ResourceType_t type, const char* label, MemoryCategory_t category, uint64_t size);
+	void AddRefHandle(void* handle);
+	void ReleaseHandle(void* handle, ResourceType_t type);
+
+	// Start tracking a new object with one reference; returns it, so creation calls can be wrapped
+	template <typename T>
+	T Track(T handle, const char* label, MemoryCategory_t category = MemoryCategory_t::Other, uint64_t size = 0)
+	{
+		TrackHandle((void*)handle, ResourceTraits_t<T>::Type, label, category, size);
+		return handle;
+	}
+
+	// Memory a texture takes with its whole mip chain, going by the size of its format
+	uint64_t GetTextureSize(const WGPUTextureDescriptor& desc);
+
+	template <typename T>
+	void AddRef(T handle)
+	{
+		AddRefHandle((void*)handle);
+	}
+
+	// Drop a reference and clear the handle; untracked objects count as having one. Null is fine
+	template <typename T>
+	void Release(T& handle)
+	{
+		if (handle)
+			ReleaseHandle((void*)handle, ResourceTraits_t<T>::Type);
+
+		handle = nullptr;
+	}
+
+	// Free queued objects the GPU is done with; once a frame
+	void Collect();
+
+	uint32_t GetLiveCount();
+	uint32_t GetPendingCount();
+
+	uint64_t GetMemoryUsage(MemoryCategory_t category);
+	uint64_t GetTotalMemoryUsage();
+
+	// Print memory usage per category
+	void ReportMemoryUsage();
+
+	// Print everything still tracked, with labels and reference counts
+	void ReportLeaks();
+}
+
+/*
+ * Owning reference to a WebGPU object, handed back to the registry when it goes away.
+ *
+ * Move-only, so whoever holds one owns the object; it converts to the raw handle for WebGPU calls,
+ * which only borrow it.
+ */
+template <typename T>
+struct GpuObject_t
+{
+private:
+	T Handle													= nullptr;
+
+public:
+	GpuObject_t()												= default;
+	explicit GpuObject_t(T handle) : Handle(handle)				{}
+
+	GpuObject_t(const GpuObject_t&)								= delete;
+	GpuObject_t& operator=(const GpuObject_t&)					= delete;
+
+	GpuObject_t(GpuObject_t&& other) noexcept : Handle(other.Handle)
+	{
+		other.Handle = nullptr;
+	}
+
+	GpuObject_t& operator=(GpuObject_t&& other) noexcept
+	{
+		if (this != &other)
+		{
+			Reset();
+			Handle = other.Handle;
+			other.Handle = nullptr;
+		}
+
+		return *this;
+	}
+
+	// Takes over handle, releasing whatever was held before
+	GpuObject_t& operator=(T handle)
+	{
+		Reset();
+		Handle = handle;
+		return *this;
+	}
+
+	~GpuObject_t()												{ Reset(); }
+
+	void Reset()												{ Resources::Release(Handle); }
+
+	T Get() const												{ return Handle; }
+	operator T() const											{ return Handle; }
+};
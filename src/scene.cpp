@@ -0,0 +1,344 @@
+#include "scene.hpp"
+#include "jobs.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SCENE_USE_SSE 1
+#include <xmmintrin.h>
+#endif
+
+glm::mat4 NodeTransform_t::ToMatrix() const
+{
+	glm::mat4 scaleMatrix = glm::scale(glm::mat4(1.0f), Scale);
+	glm::mat4 rotationMatrix = glm::mat4_cast(Rotation);
+	glm::mat4 translationMatrix = glm::translate(glm::mat4(1.0f), Position);
+
+	return translationMatrix * rotationMatrix * scaleMatrix;
+}
+
+NodeTransform_t NodeTransform_t::FromMatrix(const glm::mat4& matrix)
+{
+	NodeTransform_t transform = {};
+	transform.Position = glm::vec3(matrix[3]);
+	transform.Scale = glm::vec3(glm::length(glm::vec3(matrix[0])), glm::length(glm::vec3(matrix[1])), glm::length(glm::vec3(matrix[2])));
+
+	glm::mat3 rotationMatrix = glm::mat3(
+		glm::vec3(matrix[0]) / transform.Scale.x,
+		glm::vec3(matrix[1]) / transform.Scale.y,
+		glm::vec3(matrix[2]) / transform.Scale.z);
+
+	// Mirrored matrices keep their mirror in the scale
+	if (glm::determinant(rotationMatrix) < 0.0f)
+	{
+		transform.Scale.x = -transform.Scale.x;
+		rotationMatrix[0] = -rotationMatrix[0];
+	}
+
+	transform.Rotation = glm::quat_cast(rotationMatrix);
+
+	return transform;
+}
+
+uint32_t SceneGraph_t::AddNode(int32_t parent, const NodeTransform_t& transform, const std::string& name)
+{
+	uint32_t node = GetNodeCount();
+	assert(parent < (int32_t)node);
+
+	Parents.push_back(parent);
+	Names.push_back(name);
+
+	// Start a new batch, padded with identity transforms so whole batches can always be composed
+	if (node % BatchSize == 0)
+	{
+		uint32_t paddedCount = node + BatchSize;
+
+		for (FloatArray_t* component : { &PositionX, &PositionY, &PositionZ, &RotationX, &RotationY, &RotationZ })
+			component->resize(paddedCount, 0.0f);
+
+		for (FloatArray_t* component : { &RotationW, &ScaleX, &ScaleY, &ScaleZ })
+			component->resize(paddedCount, 1.0f);
+
+		LocalMatrices.resize(paddedCount, glm::mat4(1.0f));
+		LocalNormalMatrices.resize(paddedCount, glm::mat4(1.0f));
+		IsDirty.resize(paddedCount, 0);
+	}
+
+	WorldMatrices.push_back(glm::mat4(1.0f));
+	WorldNormalMatrices.push_back(glm::mat4(1.0f));
+	HasChanged.push_back(0);
+	Outputs.emplace_back();
+
+	uint32_t level = parent != NoParent ? NodeLevels[parent] + 1 : 0;
+
+	if (level == Levels.size())
+		Levels.emplace_back();
+
+	Levels[level].push_back(node);
+	NodeLevels.push_back(level);
+
+	SetLocalTransform(node, transform);
+
+	return node;
+}
+
+void SceneGraph_t::AddWorldOutput(uint32_t node, glm::mat4* worldMatrix, glm::mat4* worldNormalMatrix)
+{
+	Outputs[node].push_back({ .WorldMatrix = worldMatrix, .WorldNormalMatrix = worldNormalMatrix });
+
+	// Filled in by the next update, even if nothing moves before then
+	IsDirty[node] = 1;
+	FirstDirty = std::min(FirstDirty, node);
+}
+
+int32_t SceneGraph_t::FindNode(const std::string& name)
+{
+	auto it = std::find(Names.begin(), Names.end(), name);
+	return it != Names.end() ? (int32_t)(it - Names.begin()) : NoParent;
+}
+
+NodeTransform_t SceneGraph_t::GetLocalTransform(uint32_t node)
+{
+	NodeTransform_t transform = {};
+	transform.Position = glm::vec3(PositionX[node], PositionY[node], PositionZ[node]);
+	transform.Rotation = glm::quat(RotationW[node], RotationX[node], RotationY[node], RotationZ[node]);
+	transform.Scale = glm::vec3(ScaleX[node], ScaleY[node], ScaleZ[node]);
+
+	return transform;
+}
+
+void SceneGraph_t::SetLocalTransform(uint32_t node, const NodeTransform_t& transform)
+{
+	PositionX[node] = transform.Position.x;
+	PositionY[node] = transform.Position.y;
+	PositionZ[node] = transform.Position.z;
+	RotationX[node] = transform.Rotation.x;
+	RotationY[node] = transform.Rotation.y;
+	RotationZ[node] = transform.Rotation.z;
+	RotationW[node] = transform.Rotation.w;
+	ScaleX[node] = transform.Scale.x;
+	ScaleY[node] = transform.Scale.y;
+	ScaleZ[node] = transform.Scale.z;
+
+	IsDirty[node] = 1;
+
+	FirstDirty = std::min(FirstDirty, node);
+}
+
+//
+// Local matrix T * R * S and normal matrix R * S^-1 of BatchSize nodes, written out column by column:
+//
+//   R = | 1 - 2(yy + zz)   2(xy - wz)       2(xz + wy)     |
+//       | 2(xy + wz)       1 - 2(xx + zz)   2(yz - wx)     |
+//       | 2(xz - wy)       2(yz + wx)       1 - 2(xx + yy) |
+//
+#if SCENE_USE_SSE
+
+void SceneGraph_t::ComposeBatch(uint32_t first)
+{
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 two = _mm_set1_ps(2.0f);
+	const __m128 zero = _mm_setzero_ps();
+
+	__m128 x = _mm_load_ps(&RotationX[first]);
+	__m128 y = _mm_load_ps(&RotationY[first]);
+	__m128 z = _mm_load_ps(&RotationZ[first]);
+	__m128 w = _mm_load_ps(&RotationW[first]);
+
+	__m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+	__m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+	__m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+
+	// rotation[column][row], one node per lane
+	__m128 rotation[3][3] = {
+		{ _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), _mm_mul_ps(two, _mm_add_ps(xy, wz)), _mm_mul_ps(two, _mm_sub_ps(xz, wy)) },
+		{ _mm_mul_ps(two, _mm_sub_ps(xy, wz)), _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), _mm_mul_ps(two, _mm_add_ps(yz, wx)) },
+		{ _mm_mul_ps(two, _mm_add_ps(xz, wy)), _mm_mul_ps(two, _mm_sub_ps(yz, wx)), _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))) }
+	};
+
+	__m128 scale[3] = { _mm_load_ps(&ScaleX[first]), _mm_load_ps(&ScaleY[first]), _mm_load_ps(&ScaleZ[first]) };
+	__m128 position[3] = { _mm_load_ps(&PositionX[first]), _mm_load_ps(&PositionY[first]), _mm_load_ps(&PositionZ[first]) };
+
+	for (int column = 0; column < 4; ++column)
+	{
+		__m128 local[4];
+		__m128 normal[4];
+
+		if (column < 3)
+		{
+			__m128 inverseScale = _mm_div_ps(one, scale[column]);
+
+			for (int row = 0; row < 3; ++row)
+			{
+				local[row] = _mm_mul_ps(rotation[column][row], scale[column]);
+				normal[row] = _mm_mul_ps(rotation[column][row], inverseScale);
+			}
+
+			local[3] = zero;
+			normal[3] = zero;
+		}
+		else
+		{
+			for (int row = 0; row < 3; ++row)
+			{
+				local[row] = position[row];
+				normal[row] = zero;
+			}
+
+			local[3] = one;
+			normal[3] = one;
+		}
+
+		// Lanes to nodes: afterwards register i holds this column of node first + i
+		_MM_TRANSPOSE4_PS(local[0], local[1], local[2], local[3]);
+		_MM_TRANSPOSE4_PS(normal[0], normal[1], normal[2], normal[3]);
+
+		for (uint32_t lane = 0; lane < BatchSize; ++lane)
+		{
+			_mm_storeu_ps(&LocalMatrices[first + lane][column][0], local[lane]);
+			_mm_storeu_ps(&LocalNormalMatrices[first + lane][column][0], normal[lane]);
+		}
+	}
+}
+
+#else
+
+void SceneGraph_t::ComposeBatch(uint32_t first)
+{
+	for (uint32_t node = first; node < first + BatchSize; ++node)
+	{
+		float x = RotationX[node], y = RotationY[node], z = RotationZ[node], w = RotationW[node];
+
+		glm::vec3 rotation[3] = {
+			{ 1.0f - 2.0f * (y * y + z * z), 2.0f * (x * y + w * z), 2.0f * (x * z - w * y) },
+			{ 2.0f * (x * y - w * z), 1.0f - 2.0f * (x * x + z * z), 2.0f * (y * z + w * x) },
+			{ 2.0f * (x * z + w * y), 2.0f * (y * z - w * x), 1.0f - 2.0f * (x * x + y * y) }
+		};
+
+		glm::vec3 scale = glm::vec3(ScaleX[node], ScaleY[node], ScaleZ[node]);
+
+		glm::mat4& local = LocalMatrices[node];
+		glm::mat4& normal = LocalNormalMatrices[node];
+
+		for (int column = 0; column < 3; ++column)
+		{
+			local[column] = glm::vec4(rotation[column] * scale[column], 0.0f);
+			normal[column] = glm::vec4(rotation[column] / scale[column], 0.0f);
+		}
+
+		local[3] = glm::vec4(PositionX[node], PositionY[node], PositionZ[node], 1.0f);
+		normal[3] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	}
+}
+
+#endif
+
+void SceneGraph_t::PropagateNode(uint32_t node)
+{
+	int32_t parent = Parents[node];
+	bool hasParentChanged = parent != NoParent && HasChanged[parent];
+
+	if (!IsDirty[node] && !hasParentChanged)
+		return;
+
+	// The inverse transpose distributes over the product just like the matrices themselves
+	if (parent != NoParent)
+	{
+		WorldMatrices[node] = WorldMatrices[parent] * LocalMatrices[node];
+		WorldNormalMatrices[node] = WorldNormalMatrices[parent] * LocalNormalMatrices[node];
+	}
+	else
+	{
+		WorldMatrices[node] = LocalMatrices[node];
+		WorldNormalMatrices[node] = LocalNormalMatrices[node];
+	}
+
+	for (const WorldOutput_t& output : Outputs[node])
+	{
+		*output.WorldMatrix = WorldMatrices[node];
+		*output.WorldNormalMatrix = WorldNormalMatrices[node];
+	}
+
+	IsDirty[node] = 0;
+	HasChanged[node] = 1;
+}
+
+void SceneGraph_t::Update()
+{
+	// Whoever cared about the last update's changes has seen them by now
+	if (HasChanges)
+	{
+		std::fill(HasChanged.begin(), HasChanged.end(), 0);
+		HasChanges = false;
+	}
+
+	if (FirstDirty == UINT32_MAX)
+		return;
+
+	//
+	// Local matrices, a batch at a time; the flags of a batch are checked together
+	//
+	static_assert(BatchSize == sizeof(uint32_t), "Dirty flags of a batch are read as one word");
+
+	uint32_t firstBatch = FirstDirty / BatchSize;
+	uint32_t batchCount = (GetNodeCount() + BatchSize - 1) / BatchSize - firstBatch;
+
+	// Batches are independent, so large scenes spread them over the workers
+	Jobs::ParallelFor(batchCount, ComposeGrainSize, [this, firstBatch](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t batch = firstBatch + begin; batch < firstBatch + end; ++batch)
+			{
+				uint32_t first = batch * BatchSize;
+
+				uint32_t batchFlags;
+				memcpy(&batchFlags, &IsDirty[first], sizeof(batchFlags));
+
+				if (batchFlags != 0)
+					ComposeBatch(first);
+			}
+		});
+
+	//
+	// World matrices, a level at a time: a level's parents are all final once the level above is done.
+	// Nodes before the first dirty one can't have moved, nor can their parents, so each level starts there
+	//
+	for (const std::vector<uint32_t>& level : Levels)
+	{
+		uint32_t first = (uint32_t)(std::lower_bound(level.begin(), level.end(), FirstDirty) - level.begin());
+
+		Jobs::ParallelFor((uint32_t)level.size() - first, PropagateGrainSize, [this, &level, first](uint32_t begin, uint32_t end)
+			{
+				for (uint32_t i = first + begin; i < first + end; ++i)
+					PropagateNode(level[i]);
+			});
+	}
+
+	FirstDirty = UINT32_MAX;
+	HasChanges = true;
+}
+
+void SceneGraph_t::Clear()
+{
+	Parents.clear();
+	Names.clear();
+
+	for (FloatArray_t* component : { &PositionX, &PositionY, &PositionZ, &RotationX, &RotationY, &RotationZ, &RotationW, &ScaleX, &ScaleY, &ScaleZ })
+		component->clear();
+
+	LocalMatrices.clear();
+	LocalNormalMatrices.clear();
+	WorldMatrices.clear();
+	WorldNormalMatrices.clear();
+	Levels.clear();
+	NodeLevels.clear();
+	Outputs.clear();
+	IsDirty.clear();
+	HasChanged.clear();
+
+	FirstDirty = UINT32_MAX;
+	HasChanges = false;
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <string>
+#include <vector>
+
+/*
+ * Local transform of a scene node, relative to its parent
+ */
+struct NodeTransform_t
+{
+	glm::vec3 Position											= glm::vec3(0.0f);
+	glm::quat Rotation											= glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+	glm::vec3 Scale												= glm::vec3(1.0f);
+
+	glm::mat4 ToMatrix() const;
+
+	// Shear is dropped
+	static NodeTransform_t FromMatrix(const glm::mat4& matrix);
+};
+
+/*
+ * std::allocator with a minimum alignment, for arrays that get loaded a SIMD register at a time
+ */
+template <typename T, size_t Alignment>
+struct AlignedAllocator_t
+{
+	using value_type = T;
+
+	template <typename U>
+	struct rebind { using other = AlignedAllocator_t<U, Alignment>; };
+
+	AlignedAllocator_t() = default;
+
+	template <typename U>
+	AlignedAllocator_t(const AlignedAllocator_t<U, Alignment>&) {}
+
+	T* allocate(size_t count)									{ return (T*)::operator new(count * sizeof(T), std::align_val_t(Alignment)); }
+	void deallocate(T* pointer, size_t)							{ ::operator delete(pointer, std::align_val_t(Alignment)); }
+
+	template <typename U>
+	bool operator==(const AlignedAllocator_t<U, Alignment>&) const { return true; }
+};
+
+/*
+ * Flattened node hierarchy.
+ *
+ * Nodes are stored in topological order - a parent always comes before its children - so world
+ * matrices can be resolved in one forward pass. Changing a local transform only flags the node;
+ * Update then recomputes the flagged nodes and whatever lies below them, starting from the first
+ * flagged node, and does nothing at all while the scene stays still.
+ *
+ * Local transforms are kept as separate float arrays, one per component, padded to whole batches of
+ * BatchSize nodes. A batch with any flagged node gets its local and normal matrices built in one go,
+ * each SIMD lane handling one node.
+ *
+ * World matrices are then resolved a hierarchy level at a time. Nodes on one level only read their
+ * parents on the level above, which are final by then, so every level is spread over the workers.
+ * Consumers that keep their own copy of a node's world matrices (per-object GPU uniforms) register it
+ * as an output, and the update writes straight into it instead of them copying afterwards.
+ */
+struct SceneGraph_t
+{
+public:
+	static constexpr int32_t NoParent							= -1;
+
+	// Nodes per SIMD batch; one SSE register of floats
+	static constexpr uint32_t BatchSize							= 4;
+
+	// Batches per job when composing in parallel
+	static constexpr uint32_t ComposeGrainSize					= 1024;
+
+	// Nodes per job when resolving a level of world matrices in parallel
+	static constexpr uint32_t PropagateGrainSize				= 1024;
+
+private:
+	/*
+	 * Copy of a node's world matrices kept outside the graph
+	 */
+	struct WorldOutput_t
+	{
+		glm::mat4* WorldMatrix									= nullptr;
+		glm::mat4* WorldNormalMatrix							= nullptr;
+	};
+
+	using FloatArray_t = std::vector<float, AlignedAllocator_t<float, BatchSize * sizeof(float)>>;
+
+	std::vector<int32_t> Parents								= {};
+	std::vector<std::string> Names								= {};
+
+	// Local transforms, component by component
+	FloatArray_t PositionX										= {};
+	FloatArray_t PositionY										= {};
+	FloatArray_t PositionZ										= {};
+	FloatArray_t RotationX										= {};
+	FloatArray_t RotationY										= {};
+	FloatArray_t RotationZ										= {};
+	FloatArray_t RotationW										= {};
+	FloatArray_t ScaleX											= {};
+	FloatArray_t ScaleY											= {};
+	FloatArray_t ScaleZ											= {};
+
+	// Normal matrices are the inverse transpose of the upper 3x3, kept as mat4 to match the GPU layout
+	std::vector<glm::mat4> LocalMatrices						= {};
+	std::vector<glm::mat4> LocalNormalMatrices					= {};
+	std::vector<glm::mat4> WorldMatrices						= {};
+	std::vector<glm::mat4> WorldNormalMatrices					= {};
+
+	// Nodes of every hierarchy level, roots first, each level in ascending order
+	std::vector<std::vector<uint32_t>> Levels					= {};
+	std::vector<uint32_t> NodeLevels							= {};
+
+	std::vector<std::vector<WorldOutput_t>> Outputs				= {};
+
+	// Local transform changed since the last update
+	std::vector<uint8_t> IsDirty								= {};
+
+	// World matrix changed during the last update
+	std::vector<uint8_t> HasChanged								= {};
+
+	// Lowest dirty node, nothing before it needs looking at
+	uint32_t FirstDirty											= UINT32_MAX;
+
+	bool HasChanges												= false;
+
+	void ComposeBatch(uint32_t first);
+
+	// New world matrices for the node if it or its parent moved
+	void PropagateNode(uint32_t node);
+
+public:
+	// The parent must already be in the graph, which keeps the order topological
+	uint32_t AddNode(int32_t parent, const NodeTransform_t& transform, const std::string& name);
+
+	uint32_t GetNodeCount()										{ return (uint32_t)Parents.size(); }
+	int32_t GetParent(uint32_t node)							{ return Parents[node]; }
+	const std::string& GetName(uint32_t node)					{ return Names[node]; }
+
+	// First node with that name, or NoParent
+	int32_t FindNode(const std::string& name);
+
+	NodeTransform_t GetLocalTransform(uint32_t node);
+	void SetLocalTransform(uint32_t node, const NodeTransform_t& transform);
+
+	// Only up to date after Update
+	const glm::mat4& GetWorldMatrix(uint32_t node)				{ return WorldMatrices[node]; }
+	const glm::mat4& GetWorldNormalMatrix(uint32_t node)		{ return WorldNormalMatrices[node]; }
+	bool HasWorldChanged(uint32_t node)							{ return HasChanged[node] != 0; }
+
+	// Also write the node's world matrices here from the next update on; the pointers must stay valid while the graph exists
+	void AddWorldOutput(uint32_t node, glm::mat4* worldMatrix, glm::mat4* worldNormalMatrix);
+
+	// Resolve world matrices of everything that moved since the last call
+	void Update();
+
+	void Clear();
+};
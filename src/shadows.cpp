@@ -0,0 +1,803 @@
+#include "shadows.hpp"
+#include "frames.hpp"
+#include "lighting.hpp"
+#include "resources.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// Spot light shadows are rendered from the light's position out to its range
+static constexpr float ShadowNearPlane = 0.05f;
+
+// Dynamic uniform offsets must be aligned to minUniformBufferOffsetAlignment
+static constexpr uint32_t ShadowViewStride = 256;
+
+static const char* CasterShaderSource = R"(
+	// Only the start of the object uniforms; the camera binding goes unused
+	struct UniformBuffer {
+		modelMatrix: mat4x4f
+	};
+
+	@group(0) @binding(0) var<uniform> uConstants: UniformBuffer;
+	@group(1) @binding(0) var<uniform> uShadowViewProj: mat4x4f;
+
+	@vertex
+	fn vs_caster(@location(0) position: vec3f) -> @builtin(position) vec4f
+	{
+		return uShadowViewProj * uConstants.modelMatrix * vec4f(position, 1.0);
+	}
+
+	// Triangle on the far plane covering the viewport, resets a single tile
+	@vertex
+	fn vs_clear(@builtin(vertex_index) vertexIndex: u32) -> @builtin(position) vec4f
+	{
+		let uv = vec2f(f32((vertexIndex << 1u) & 2u), f32(vertexIndex & 2u));
+		return vec4f(uv * 2.0 - 1.0, 1.0, 1.0);
+	}
+)";
+
+static const char* CompositeShaderSource = R"(
+	@group(0) @binding(0) var staticAtlas: texture_depth_2d;
+
+	@vertex
+	fn vs_composite(@builtin(vertex_index) vertexIndex: u32) -> @builtin(position) vec4f
+	{
+		let uv = vec2f(f32((vertexIndex << 1u) & 2u), f32(vertexIndex & 2u));
+		return vec4f(uv * 2.0 - 1.0, 1.0, 1.0);
+	}
+
+	// Both atlases share a layout, so the fragment position addresses the same texel in the static one
+	@fragment
+	fn fs_composite(@builtin(position) fragCoord: vec4f) -> @builtin(frag_depth) f32
+	{
+		return textureLoad(staticAtlas, vec2i(fragCoord.xy), 0);
+	}
+)";
+
+static inline uint32_t PackTile(uint32_t x, uint32_t y)
+{
+	return (x << 16) | y;
+}
+
+static inline uint64_t HashFloats(uint64_t hash, const float* values, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		uint32_t bits;
+		memcpy(&bits, &values[i], sizeof(bits));
+		hash = HashCombine(hash, bits);
+	}
+
+	return hash;
+}
+
+static WGPUTexture MakeAtlasTexture(GraphicsDevice_t* gpu, const char* label, WGPUTextureView& view)
+{
+	WGPUTextureDescriptor textureDesc = {
+		.nextInChain = nullptr,
+		.label = label,
+		.usage = WGPUTextureUsage_RenderAttachment | WGPUTextureUsage_TextureBinding,
+		.dimension = WGPUTextureDimension_2D,
+		.size = { ShadowAtlas_t::AtlasSize, ShadowAtlas_t::AtlasSize, 1 },
+		.format = ShadowAtlas_t::AtlasFormat,
+
+		.mipLevelCount = 1,
+		.sampleCount = 1,
+		.viewFormatCount = 0,
+		.viewFormats = nullptr
+	};
+
+	WGPUTexture texture = Resources::Track(wgpuDeviceCreateTexture(gpu->Device, &textureDesc), label, MemoryCategory_t::RenderTarget, Resources::GetTextureSize(textureDesc));
+
+	WGPUTextureViewDescriptor textureViewDesc = {
+		.nextInChain = nullptr,
+		.label = label,
+		.format = textureDesc.format,
+		.dimension = WGPUTextureViewDimension_2D,
+		.baseMipLevel = 0,
+		.mipLevelCount = 1,
+		.baseArrayLayer = 0,
+		.arrayLayerCount = 1,
+		.aspect = WGPUTextureAspect_All
+	};
+
+	view = Resources::Track(wgpuTextureCreateView(texture, &textureViewDesc), label);
+
+	return texture;
+}
+
+void ShadowAtlas_t::Init(GraphicsDevice_t* gpu)
+{
+	Gpu = gpu;
+
+	//
+	// Atlases
+	//
+	StaticAtlas = MakeAtlasTexture(gpu, "Static shadow atlas", StaticAtlasView);
+	DynamicAtlas = MakeAtlasTexture(gpu, "Dynamic shadow atlas", DynamicAtlasView);
+
+	WGPUSamplerDescriptor samplerDesc = {
+		.nextInChain = nullptr,
+		.label = "Shadow comparison sampler",
+		.addressModeU = WGPUAddressMode_ClampToEdge,
+		.addressModeV = WGPUAddressMode_ClampToEdge,
+		.addressModeW = WGPUAddressMode_ClampToEdge,
+		.magFilter = WGPUFilterMode_Linear,
+		.minFilter = WGPUFilterMode_Linear,
+		.mipmapFilter = WGPUMipmapFilterMode_Nearest,
+		.lodMinClamp = 0.0f,
+		.lodMaxClamp = 1.0f,
+		.compare = WGPUCompareFunction_LessEqual,
+		.maxAnisotropy = 1
+	};
+
+	ComparisonSampler = Resources::Track(wgpuDeviceCreateSampler(gpu->Device, &samplerDesc), samplerDesc.label);
+
+	//
+	// Buffers
+	//
+	WGPUBufferDescriptor shadowViewBufferDesc = {
+		.nextInChain = nullptr,
+		.label = "Shadow view buffer",
+		.usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Uniform,
+		.size = MaxShadowedLights * ShadowViewStride,
+		.mappedAtCreation = false
+	};
+
+	ShadowViewBuffer.DataBuffer = Resources::Track(wgpuDeviceCreateBuffer(gpu->Device, &shadowViewBufferDesc), shadowViewBufferDesc.label, MemoryCategory_t::Uniform, shadowViewBufferDesc.size);
+	ShadowViewBuffer.DataSize = shadowViewBufferDesc.size;
+	ShadowViewBuffer.Count = MaxShadowedLights;
+
+	WGPUBufferDescriptor shadowInfoBufferDesc = {
+		.nextInChain = nullptr,
+		.label = "Shadow info buffer",
+		.usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Storage,
+		.size = MaxShadowedLights * sizeof(GpuShadowInfo_t),
+		.mappedAtCreation = false
+	};
+
+	ShadowInfoBuffer.DataBuffer = Resources::Track(wgpuDeviceCreateBuffer(gpu->Device, &shadowInfoBufferDesc), shadowInfoBufferDesc.label, MemoryCategory_t::Uniform, shadowInfoBufferDesc.size);
+	ShadowInfoBuffer.DataSize = shadowInfoBufferDesc.size;
+	ShadowInfoBuffer.Count = MaxShadowedLights;
+
+	//
+	// Layouts & bind groups
+	//
+	WGPUBindGroupLayoutEntry shadowViewBindingLayout = {};
+	SetDefaultBindGroupLayoutEntry(shadowViewBindingLayout);
+	shadowViewBindingLayout.binding = 0;
+	shadowViewBindingLayout.visibility = WGPUShaderStage_Vertex;
+	shadowViewBindingLayout.buffer.type = WGPUBufferBindingType_Uniform;
+	shadowViewBindingLayout.buffer.hasDynamicOffset = true;
+	shadowViewBindingLayout.buffer.minBindingSize = sizeof(glm::mat4);
+
+	WGPUBindGroupLayoutDescriptor shadowViewBindGroupLayoutDesc = {
+		.nextInChain = nullptr,
+		.label = "Shadow view bind group layout",
+		.entryCount = 1,
+		.entries = &shadowViewBindingLayout
+	};
+
+	ShadowViewBindGroupLayout = Resources::Track(wgpuDeviceCreateBindGroupLayout(gpu->Device, &shadowViewBindGroupLayoutDesc), shadowViewBindGroupLayoutDesc.label);
+
+	WGPUBindGroupLayoutEntry compositeBindingLayout = {};
+	SetDefaultBindGroupLayoutEntry(compositeBindingLayout);
+	compositeBindingLayout.binding = 0;
+	compositeBindingLayout.visibility = WGPUShaderStage_Fragment;
+	compositeBindingLayout.texture.sampleType = WGPUTextureSampleType_Depth;
+	compositeBindingLayout.texture.viewDimension = WGPUTextureViewDimension_2D;
+
+	WGPUBindGroupLayoutDescriptor compositeBindGroupLayoutDesc = {
+		.nextInChain = nullptr,
+		.label = "Shadow composite bind group layout",
+		.entryCount = 1,
+		.entries = &compositeBindingLayout
+	};
+
+	CompositeBindGroupLayout = Resources::Track(wgpuDeviceCreateBindGroupLayout(gpu->Device, &compositeBindGroupLayoutDesc), compositeBindGroupLayoutDesc.label);
+
+	WGPUBindGroupEntry shadowViewBinding = {
+		.nextInChain = nullptr,
+		.binding = 0,
+		.buffer = ShadowViewBuffer.DataBuffer,
+		.offset = 0,
+		.size = sizeof(glm::mat4)
+	};
+
+	WGPUBindGroupDescriptor shadowViewBindGroupDesc = {
+		.nextInChain = nullptr,
+		.label = "Shadow view bind group",
+		.layout = ShadowViewBindGroupLayout,
+		.entryCount = 1,
+		.entries = &shadowViewBinding
+	};
+
+	ShadowViewBindGroup = Resources::Track(wgpuDeviceCreateBindGroup(gpu->Device, &shadowViewBindGroupDesc), shadowViewBindGroupDesc.label);
+
+	WGPUBindGroupEntry compositeBinding = {
+		.nextInChain = nullptr,
+		.binding = 0,
+		.textureView = StaticAtlasView
+	};
+
+	WGPUBindGroupDescriptor compositeBindGroupDesc = {
+		.nextInChain = nullptr,
+		.label = "Shadow composite bind group",
+		.layout = CompositeBindGroupLayout,
+		.entryCount = 1,
+		.entries = &compositeBinding
+	};
+
+	CompositeBindGroup = Resources::Track(wgpuDeviceCreateBindGroup(gpu->Device, &compositeBindGroupDesc), compositeBindGroupDesc.label);
+
+	CreatePipelines();
+
+	// The whole atlas starts out as one free root tile
+	for (auto& freeTiles : FreeTiles)
+		freeTiles.clear();
+
+	FreeTiles[0].push_back(PackTile(0, 0));
+}
+
+void ShadowAtlas_t::CreatePipelines()
+{
+	WGPUShaderModule casterShaderModule = Graphics::MakeShaderModule(Gpu, CasterShaderSource);
+	WGPUShaderModule compositeShaderModule = Graphics::MakeShaderModule(Gpu, CompositeShaderSource);
+
+	WGPUVertexAttribute positionAttribute = {
+		.format = WGPUVertexFormat_Float32x3,
+		.offset = 0,
+		.shaderLocation = 0
+	};
+
+	WGPUVertexBufferLayout positionBufferLayout = {
+		.arrayStride = sizeof(glm::vec3),
+		.stepMode = WGPUVertexStepMode_Vertex,
+		.attributeCount = 1,
+		.attributes = &positionAttribute
+	};
+
+	WGPUDepthStencilState depthStencilState = {};
+	SetDefaultDepthStencilState(depthStencilState);
+	depthStencilState.format = AtlasFormat;
+	depthStencilState.stencilReadMask = 0;
+	depthStencilState.stencilWriteMask = 0;
+
+	//
+	// Casters: depth only, biased against acne
+	//
+	WGPUBindGroupLayout casterBindGroupLayouts[] = { Gpu->ObjectBindGroupLayout, ShadowViewBindGroupLayout };
+
+	WGPUPipelineLayoutDescriptor casterLayoutDesc = {
+		.nextInChain = nullptr,
+		.bindGroupLayoutCount = 2,
+		.bindGroupLayouts = casterBindGroupLayouts
+	};
+
+	WGPUPipelineLayout casterLayout = wgpuDeviceCreatePipelineLayout(Gpu->Device, &casterLayoutDesc);
+
+	depthStencilState.depthCompare = WGPUCompareFunction_Less;
+	depthStencilState.depthWriteEnabled = true;
+	depthStencilState.depthBias = 2;
+	depthStencilState.depthBiasSlopeScale = 2.0f;
+
+	WGPURenderPipelineDescriptor pipelineDesc = {
+		.nextInChain = nullptr,
+		.label = "Shadow caster pipeline",
+		.layout = casterLayout,
+		.vertex = {
+			.module = casterShaderModule,
+			.entryPoint = "vs_caster",
+			.constantCount = 0,
+			.constants = nullptr,
+			.bufferCount = 1,
+			.buffers = &positionBufferLayout
+		},
+
+		.primitive = {
+			.topology = WGPUPrimitiveTopology_TriangleList,
+			.stripIndexFormat = WGPUIndexFormat_Undefined,
+			.frontFace = WGPUFrontFace_CCW,
+			.cullMode = WGPUCullMode_None
+		},
+
+		.depthStencil = &depthStencilState,
+		.multisample = {
+			.count = 1,
+			.mask = ~0u,
+			.alphaToCoverageEnabled = false
+		},
+		.fragment = nullptr
+	};
+
+	CasterPipeline = Resources::Track(wgpuDeviceCreateRenderPipeline(Gpu->Device, &pipelineDesc), pipelineDesc.label);
+
+	//
+	// Tile clear: no bindings, writes the far plane everywhere in the viewport
+	//
+	WGPUPipelineLayoutDescriptor emptyLayoutDesc = {
+		.nextInChain = nullptr,
+		.bindGroupLayoutCount = 0,
+		.bindGroupLayouts = nullptr
+	};
+
+	WGPUPipelineLayout emptyLayout = wgpuDeviceCreatePipelineLayout(Gpu->Device, &emptyLayoutDesc);
+
+	depthStencilState.depthCompare = WGPUCompareFunction_Always;
+	depthStencilState.depthBias = 0;
+	depthStencilState.depthBiasSlopeScale = 0.0f;
+
+	pipelineDesc.label = "Shadow tile clear pipeline";
+	pipelineDesc.layout = emptyLayout;
+	pipelineDesc.vertex.entryPoint = "vs_clear";
+	pipelineDesc.vertex.bufferCount = 0;
+	pipelineDesc.vertex.buffers = nullptr;
+
+	ClearPipeline = Resources::Track(wgpuDeviceCreateRenderPipeline(Gpu->Device, &pipelineDesc), pipelineDesc.label);
+
+	//
+	// Composite: copies a tile's cached static depth into the dynamic atlas
+	//
+	WGPUPipelineLayoutDescriptor compositeLayoutDesc = {
+		.nextInChain = nullptr,
+		.bindGroupLayoutCount = 1,
+		.bindGroupLayouts = &CompositeBindGroupLayout
+	};
+
+	WGPUPipelineLayout compositeLayout = wgpuDeviceCreatePipelineLayout(Gpu->Device, &compositeLayoutDesc);
+
+	WGPUFragmentState fragmentState = {
+		.module = compositeShaderModule,
+		.entryPoint = "fs_composite",
+		.constantCount = 0,
+		.constants = nullptr,
+		.targetCount = 0,
+		.targets = nullptr
+	};
+
+	pipelineDesc.label = "Shadow composite pipeline";
+	pipelineDesc.layout = compositeLayout;
+	pipelineDesc.vertex.module = compositeShaderModule;
+	pipelineDesc.vertex.entryPoint = "vs_composite";
+	pipelineDesc.fragment = &fragmentState;
+
+	CompositePipeline = Resources::Track(wgpuDeviceCreateRenderPipeline(Gpu->Device, &pipelineDesc), pipelineDesc.label);
+
+	// The pipelines hold their own references
+	wgpuPipelineLayoutRelease(casterLayout);
+	wgpuPipelineLayoutRelease(emptyLayout);
+	wgpuPipelineLayoutRelease(compositeLayout);
+	wgpuShaderModuleRelease(casterShaderModule);
+	wgpuShaderModuleRelease(compositeShaderModule);
+}
+
+bool ShadowAtlas_t::AllocateTile(uint32_t level, uint32_t& x, uint32_t& y)
+{
+	if (!FreeTiles[level].empty())
+	{
+		uint32_t tile = FreeTiles[level].back();
+		FreeTiles[level].pop_back();
+
+		x = tile >> 16;
+		y = tile & 0xFFFF;
+
+		return true;
+	}
+
+	if (level == 0)
+		return false;
+
+	// Split a tile from the level above into four, keep one
+	uint32_t parentX, parentY;
+
+	if (!AllocateTile(level - 1, parentX, parentY))
+		return false;
+
+	uint32_t size = AtlasSize >> level;
+
+	FreeTiles[level].push_back(PackTile(parentX + size, parentY));
+	FreeTiles[level].push_back(PackTile(parentX, parentY + size));
+	FreeTiles[level].push_back(PackTile(parentX + size, parentY + size));
+
+	x = parentX;
+	y = parentY;
+
+	return true;
+}
+
+void ShadowAtlas_t::FreeTile(uint32_t level, uint32_t x, uint32_t y)
+{
+	if (level == 0)
+	{
+		FreeTiles[0].push_back(PackTile(x, y));
+		return;
+	}
+
+	// Merge back into the parent once all four siblings are free
+	uint32_t parentSize = AtlasSize >> (level - 1);
+	uint32_t size = AtlasSize >> level;
+	uint32_t parentX = x - x % parentSize;
+	uint32_t parentY = y - y % parentSize;
+
+	std::vector<uint32_t>& freeTiles = FreeTiles[level];
+
+	uint32_t siblings[] = {
+		PackTile(parentX, parentY),
+		PackTile(parentX + size, parentY),
+		PackTile(parentX, parentY + size),
+		PackTile(parentX + size, parentY + size)
+	};
+
+	uint32_t self = PackTile(x, y);
+	size_t freeSiblingCount = 0;
+
+	for (uint32_t sibling : siblings)
+	{
+		if (sibling != self && std::find(freeTiles.begin(), freeTiles.end(), sibling) != freeTiles.end())
+			++freeSiblingCount;
+	}
+
+	if (freeSiblingCount < 3)
+	{
+		freeTiles.push_back(self);
+		return;
+	}
+
+	for (uint32_t sibling : siblings)
+	{
+		if (sibling != self)
+			freeTiles.erase(std::find(freeTiles.begin(), freeTiles.end(), sibling));
+	}
+
+	FreeTile(level - 1, parentX, parentY);
+}
+
+void ShadowAtlas_t::ReleaseTile(ShadowTile_t& tile)
+{
+	if (tile.IsAllocated)
+		FreeTile(tile.Level, tile.X, tile.Y);
+
+	tile.IsAllocated = false;
+	tile.IsStaticValid = false;
+	tile.ShadowIndex = -1;
+}
+
+void ShadowAtlas_t::ClearCasters()
+{
+	// The lists live in the frame arena; last frame's storage is gone
+	StaticCasters = ArenaVector_t<Mesh_t*>();
+	DynamicCasters = ArenaVector_t<Mesh_t*>();
+}
+
+void ShadowAtlas_t::AddCaster(Mesh_t* mesh, bool isStatic)
+{
+	if (isStatic)
+		StaticCasters.push_back(mesh);
+	else
+		DynamicCasters.push_back(mesh);
+}
+
+bool ShadowAtlas_t::IsCasterInRange(Mesh_t* caster, glm::vec4 lightSphere)
+{
+	glm::vec3 center;
+	float radius;
+	caster->GetWorldBoundingSphere(center, radius);
+
+	float reach = radius + lightSphere.w;
+	glm::vec3 delta = center - glm::vec3(lightSphere);
+
+	return glm::dot(delta, delta) <= reach * reach;
+}
+
+void ShadowAtlas_t::Update(const std::vector<Light_t>& lights, std::vector<GpuLight_t>& gpuLights, Camera_t& camera)
+{
+	// Lights were cleared or re-added, everything gets a fresh tile
+	if (Tiles.size() > lights.size())
+	{
+		for (auto& tile : Tiles)
+			ReleaseTile(tile);
+
+		Tiles.clear();
+	}
+
+	Tiles.resize(lights.size());
+
+	//
+	// Screen importance: fraction of the screen height covered by the light's range
+	//
+	glm::vec3 cameraPosition = camera.Transform.GetPosition();
+	float tanHalfFov = tanf(glm::radians(camera.FieldOfView) * 0.5f);
+
+	ShadowedLights.clear();
+
+	for (uint32_t i = 0; i < lights.size(); ++i)
+	{
+		const Light_t& light = lights[i];
+		ShadowTile_t& tile = Tiles[i];
+
+		tile.ShadowIndex = -1;
+		gpuLights[i].ShadowIndex = -1;
+
+		if (!light.CastsShadows || light.Type != LightType_t::Spot)
+		{
+			ReleaseTile(tile);
+			continue;
+		}
+
+		float distance = glm::length(light.Position - cameraPosition);
+
+		tile.Importance = distance > light.Range ? light.Range / (distance * tanHalfFov) : 1.0f;
+		tile.Importance = std::clamp(tile.Importance, 0.0f, 1.0f);
+		tile.LightSphere = glm::vec4(light.Position, light.Range);
+
+		ShadowedLights.push_back(i);
+	}
+
+	std::stable_sort(ShadowedLights.begin(), ShadowedLights.end(),
+		[&](uint32_t a, uint32_t b) { return Tiles[a].Importance > Tiles[b].Importance; });
+
+	if (ShadowedLights.size() > MaxShadowedLights)
+	{
+		for (size_t i = MaxShadowedLights; i < ShadowedLights.size(); ++i)
+			ReleaseTile(Tiles[ShadowedLights[i]]);
+
+		ShadowedLights.resize(MaxShadowedLights);
+	}
+
+	//
+	// Tile sizes halve as importance halves. Tiles only get reallocated once the ideal level is well away
+	// from the current one, since a new tile throws away the cached static depth
+	//
+	for (uint32_t lightIndex : ShadowedLights)
+	{
+		ShadowTile_t& tile = Tiles[lightIndex];
+
+		float idealLevel = MinLevel + log2f(1.0f / std::max(tile.Importance, 1e-4f));
+		idealLevel = std::clamp(idealLevel, (float)MinLevel, (float)MaxLevel);
+
+		if (tile.IsAllocated && fabsf(idealLevel - (float)tile.Level) < 0.75f)
+			continue;
+
+		ReleaseTile(tile);
+
+		for (uint32_t level = (uint32_t)roundf(idealLevel); level <= MaxLevel; ++level)
+		{
+			if (AllocateTile(level, tile.X, tile.Y))
+			{
+				tile.Level = level;
+				tile.IsAllocated = true;
+				break;
+			}
+		}
+	}
+
+	//
+	// Find stale static depth. Tiles that were never rendered go first since they can't be used at all yet,
+	// then the most important stale ones, up to the per-frame budget
+	//
+	StaticUpdates.clear();
+
+	ArenaVector_t<uint64_t> signatures(lights.size(), 0);
+	ArenaVector_t<glm::mat4> viewProjMatrices(lights.size());
+
+	for (uint32_t lightIndex : ShadowedLights)
+	{
+		const Light_t& light = lights[lightIndex];
+		ShadowTile_t& tile = Tiles[lightIndex];
+
+		if (!tile.IsAllocated)
+			continue;
+
+		glm::vec3 direction = glm::normalize(light.Direction);
+		glm::vec3 up = fabsf(direction.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+
+		glm::mat4 view = glm::lookAt(light.Position, light.Position + direction, up);
+		glm::mat4 projection = glm::perspectiveRH_ZO(glm::radians(light.OuterConeAngle * 2.0f), 1.0f, ShadowNearPlane, light.Range);
+
+		viewProjMatrices[lightIndex] = projection * view;
+
+		uint64_t signature = HashSeed;
+		signature = HashFloats(signature, &viewProjMatrices[lightIndex][0][0], 16);
+		signature = HashCombine(signature, PackTile(tile.X, tile.Y));
+		signature = HashCombine(signature, tile.Level);
+
+		for (Mesh_t* caster : StaticCasters)
+		{
+			if (!IsCasterInRange(caster, tile.LightSphere))
+				continue;
+
+			glm::mat4 modelMatrix = caster->GetModelMatrix();
+
+			signature = HashCombine(signature, (uint64_t)caster);
+			signature = HashFloats(signature, &modelMatrix[0][0], 16);
+		}
+
+		signatures[lightIndex] = signature;
+	}
+
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		for (uint32_t lightIndex : ShadowedLights)
+		{
+			ShadowTile_t& tile = Tiles[lightIndex];
+
+			if (StaticUpdates.size() >= MaxStaticUpdatesPerFrame)
+				break;
+
+			if (!tile.IsAllocated)
+				continue;
+
+			bool isMissing = !tile.IsStaticValid;
+			bool isStale = tile.IsStaticValid && tile.StaticSignature != signatures[lightIndex];
+
+			if ((pass == 0 && isMissing) || (pass == 1 && isStale))
+			{
+				tile.StaticSignature = signatures[lightIndex];
+				tile.IsStaticValid = true;
+				tile.ViewProjMatrix = viewProjMatrices[lightIndex];
+
+				StaticUpdates.push_back(lightIndex);
+			}
+		}
+	}
+
+	//
+	// Every tile with valid static depth gets sampled this frame. Stale tiles keep the matrix their
+	// cached depth was rendered with until their refresh comes around
+	//
+	ShadowInfos.clear();
+
+	ArenaVector_t<uint8_t> shadowViews(MaxShadowedLights * ShadowViewStride, 0);
+
+	for (uint32_t lightIndex : ShadowedLights)
+	{
+		ShadowTile_t& tile = Tiles[lightIndex];
+
+		if (!tile.IsAllocated || !tile.IsStaticValid)
+			continue;
+
+		float tileSize = (float)(AtlasSize >> tile.Level) / AtlasSize;
+
+		GpuShadowInfo_t shadowInfo = {};
+		shadowInfo.ViewProjMatrix = tile.ViewProjMatrix;
+		shadowInfo.AtlasRect = glm::vec4((float)tile.X / AtlasSize, (float)tile.Y / AtlasSize, tileSize, tileSize);
+
+		tile.ShadowIndex = (int32_t)ShadowInfos.size();
+		gpuLights[lightIndex].ShadowIndex = tile.ShadowIndex;
+
+		memcpy(&shadowViews[tile.ShadowIndex * ShadowViewStride], &tile.ViewProjMatrix, sizeof(glm::mat4));
+
+		ShadowInfos.push_back(shadowInfo);
+	}
+
+	if (!ShadowInfos.empty())
+	{
+		Gpu->Frames->WriteBuffer(ShadowInfoBuffer.DataBuffer, 0, ShadowInfos.data(), ShadowInfos.size() * sizeof(GpuShadowInfo_t));
+		Gpu->Frames->WriteBuffer(ShadowViewBuffer.DataBuffer, 0, shadowViews.data(), ShadowInfos.size() * ShadowViewStride);
+	}
+}
+
+void ShadowAtlas_t::SetTileViewport(WGPURenderPassEncoder renderPass, const ShadowTile_t& tile)
+{
+	uint32_t size = AtlasSize >> tile.Level;
+
+	wgpuRenderPassEncoderSetViewport(renderPass, (float)tile.X, (float)tile.Y, (float)size, (float)size, 0.0f, 1.0f);
+	wgpuRenderPassEncoderSetScissorRect(renderPass, tile.X, tile.Y, size, size);
+}
+
+void ShadowAtlas_t::DrawCasters(WGPURenderPassEncoder renderPass, const ArenaVector_t<Mesh_t*>& casters, const ShadowTile_t& tile)
+{
+	uint32_t shadowViewOffset = tile.ShadowIndex * ShadowViewStride;
+
+	wgpuRenderPassEncoderSetPipeline(renderPass, CasterPipeline);
+	wgpuRenderPassEncoderSetBindGroup(renderPass, 1, ShadowViewBindGroup, 1, &shadowViewOffset);
+
+	for (Mesh_t* caster : casters)
+	{
+		if (!IsCasterInRange(caster, tile.LightSphere))
+			continue;
+
+		uint32_t objectOffset = caster->GetObjectOffset();
+
+		wgpuRenderPassEncoderSetBindGroup(renderPass, 0, caster->ObjectBindGroup, 1, &objectOffset);
+		wgpuRenderPassEncoderSetVertexBuffer(renderPass, 0, caster->PositionBuffer.DataBuffer, 0, WGPU_WHOLE_SIZE);
+		wgpuRenderPassEncoderSetIndexBuffer(renderPass, caster->IndexBuffer.DataBuffer, WGPUIndexFormat_Uint32, 0, WGPU_WHOLE_SIZE);
+		wgpuRenderPassEncoderDrawIndexed(renderPass, caster->IndexBuffer.Count, 1, 0, 0, 0);
+	}
+}
+
+FrameGraphResource_t ShadowAtlas_t::AddPasses(FrameGraph_t& graph)
+{
+	FrameGraphTextureDesc_t atlasDesc = {
+		.Width = AtlasSize,
+		.Height = AtlasSize,
+		.Format = AtlasFormat,
+		.Usage = WGPUTextureUsage_RenderAttachment | WGPUTextureUsage_TextureBinding
+	};
+
+	FrameGraphResource_t staticAtlas = graph.ImportTexture("Static shadow atlas", StaticAtlas, StaticAtlasView, atlasDesc);
+
+	//
+	// Refresh stale cached tiles, everything else in the atlas is kept
+	//
+	if (!StaticUpdates.empty())
+	{
+		graph.AddPass("Static shadows", FrameGraphPassType_t::Render, [this](FrameGraphContext_t& context)
+			{
+				for (uint32_t lightIndex : StaticUpdates)
+				{
+					const ShadowTile_t& tile = Tiles[lightIndex];
+
+					SetTileViewport(context.RenderPass, tile);
+
+					wgpuRenderPassEncoderSetPipeline(context.RenderPass, ClearPipeline);
+					wgpuRenderPassEncoderDraw(context.RenderPass, 3, 1, 0, 0);
+
+					DrawCasters(context.RenderPass, StaticCasters, tile);
+				}
+			})
+			.WriteDepth(staticAtlas, WGPULoadOp_Load);
+	}
+
+	if (DynamicCasters.empty())
+		return staticAtlas;
+
+	//
+	// Cached static depth plus this frame's dynamic casters
+	//
+	FrameGraphResource_t dynamicAtlas = graph.ImportTexture("Dynamic shadow atlas", DynamicAtlas, DynamicAtlasView, atlasDesc);
+
+	graph.AddPass("Dynamic shadows", FrameGraphPassType_t::Render, [this](FrameGraphContext_t& context)
+		{
+			for (uint32_t lightIndex : ShadowedLights)
+			{
+				const ShadowTile_t& tile = Tiles[lightIndex];
+
+				if (tile.ShadowIndex < 0)
+					continue;
+
+				SetTileViewport(context.RenderPass, tile);
+
+				// Scopes add up over all tiles
+				context.BeginScope("Shadow composite");
+				wgpuRenderPassEncoderSetPipeline(context.RenderPass, CompositePipeline);
+				wgpuRenderPassEncoderSetBindGroup(context.RenderPass, 0, CompositeBindGroup, 0, nullptr);
+				wgpuRenderPassEncoderDraw(context.RenderPass, 3, 1, 0, 0);
+				context.EndScope();
+
+				context.BeginScope("Dynamic shadow casters");
+				DrawCasters(context.RenderPass, DynamicCasters, tile);
+				context.EndScope();
+			}
+		})
+		.Read(staticAtlas)
+		.WriteDepth(dynamicAtlas, WGPULoadOp_Clear, 1.0f);
+
+	return dynamicAtlas;
+}
+
+void ShadowAtlas_t::Destroy()
+{
+	Resources::Release(ShadowViewBindGroup);
+	Resources::Release(CompositeBindGroup);
+	Resources::Release(ShadowViewBindGroupLayout);
+	Resources::Release(CompositeBindGroupLayout);
+	Resources::Release(CasterPipeline);
+	Resources::Release(ClearPipeline);
+	Resources::Release(CompositePipeline);
+	Resources::Release(ComparisonSampler);
+	Resources::Release(StaticAtlasView);
+	Resources::Release(DynamicAtlasView);
+	Resources::Release(StaticAtlas);
+	Resources::Release(DynamicAtlas);
+
+	ShadowViewBuffer.Destroy();
+	ShadowInfoBuffer.Destroy();
+
+	Tiles.clear();
+	ShadowedLights.clear();
+	StaticUpdates.clear();
+	ShadowInfos.clear();
+	ClearCasters();
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include "gpu.hpp"
+#include "framegraph.hpp"
+
+#include <webgpu/webgpu.h>
+
+#include <vector>
+
+struct Light_t;
+struct GpuLight_t;
+
+/*
+ * Must match `ShadowInfo` in the WGSL source
+ */
+struct GpuShadowInfo_t
+{
+	glm::mat4 ViewProjMatrix									= {};
+
+	// Tile offset and size in atlas UVs
+	glm::vec4 AtlasRect											= {};
+};
+
+static_assert(sizeof(GpuShadowInfo_t) == 80, "GpuShadowInfo_t must match the WGSL layout");
+
+/*
+ * Where a light's shadow map lives in the atlas, and whether its cached static depth is still good
+ */
+struct ShadowTile_t
+{
+	bool IsAllocated											= false;
+	uint32_t Level												= 0;
+	uint32_t X													= 0;
+	uint32_t Y													= 0;
+
+	// Hash of the light and the static casters in its range when the static depth was rendered
+	uint64_t StaticSignature									= 0;
+	bool IsStaticValid											= false;
+
+	// Light position and range, casters outside of it are skipped
+	glm::vec4 LightSphere										= {};
+
+	glm::mat4 ViewProjMatrix									= {};
+	float Importance											= 0.0f;
+
+	// Index into this frame's shadow infos, -1 if the light doesn't get a shadow this frame
+	int32_t ShadowIndex											= -1;
+};
+
+/*
+ * Shadow maps for spot lights, packed into one depth atlas.
+ *
+ * Tiles are handed out by a quadtree buddy allocator, sized by how much of the screen the light covers.
+ * Static casters are rendered into a persistent atlas that's only refreshed for a tile when its light or
+ * a static caster in range changes (a few tiles per frame at most). Every frame the cached depth of each
+ * tile gets copied into a second atlas and dynamic casters are drawn on top; with no dynamic casters the
+ * static atlas is sampled directly and steady-state shadows cost nothing but the lookups.
+ */
+struct ShadowAtlas_t
+{
+public:
+	static constexpr uint32_t AtlasSize							= 4096;
+	static constexpr uint32_t LevelCount						= 6;
+
+	// Level 1 (2048) is the largest tile handed out, level 5 (128) the smallest
+	static constexpr uint32_t MinLevel							= 1;
+	static constexpr uint32_t MaxLevel							= LevelCount - 1;
+
+	static constexpr uint32_t MaxShadowedLights					= 32;
+	static constexpr uint32_t MaxStaticUpdatesPerFrame			= 4;
+
+	static constexpr WGPUTextureFormat AtlasFormat				= WGPUTextureFormat_Depth32Float;
+
+private:
+	GraphicsDevice_t* Gpu										= nullptr;
+
+	WGPUTexture StaticAtlas										= nullptr;
+	WGPUTextureView StaticAtlasView								= nullptr;
+	WGPUTexture DynamicAtlas									= nullptr;
+	WGPUTextureView DynamicAtlasView							= nullptr;
+	WGPUSampler ComparisonSampler								= nullptr;
+
+	// Light view-projection per tile, bound with a dynamic offset
+	GraphicsBuffer_t ShadowViewBuffer							= {};
+	GraphicsBuffer_t ShadowInfoBuffer							= {};
+
+	WGPUBindGroupLayout ShadowViewBindGroupLayout				= nullptr;
+	WGPUBindGroupLayout CompositeBindGroupLayout				= nullptr;
+	WGPUBindGroup ShadowViewBindGroup							= nullptr;
+	WGPUBindGroup CompositeBindGroup							= nullptr;
+
+	WGPURenderPipeline CasterPipeline							= nullptr;
+	WGPURenderPipeline ClearPipeline							= nullptr;
+	WGPURenderPipeline CompositePipeline						= nullptr;
+
+	// Indexed by light
+	std::vector<ShadowTile_t> Tiles								= {};
+
+	// Free tiles per quadtree level, as pixel offsets packed into 32 bits
+	std::vector<uint32_t> FreeTiles[LevelCount]				= {};
+
+	// Gathered every frame, in the frame arena
+	ArenaVector_t<Mesh_t*> StaticCasters						= {};
+	ArenaVector_t<Mesh_t*> DynamicCasters						= {};
+
+	// Light indices, this frame
+	std::vector<uint32_t> ShadowedLights						= {};
+	std::vector<uint32_t> StaticUpdates							= {};
+
+	std::vector<GpuShadowInfo_t> ShadowInfos					= {};
+
+	void CreatePipelines();
+
+	bool AllocateTile(uint32_t level, uint32_t& x, uint32_t& y);
+	void FreeTile(uint32_t level, uint32_t x, uint32_t y);
+	void ReleaseTile(ShadowTile_t& tile);
+
+	static bool IsCasterInRange(Mesh_t* caster, glm::vec4 lightSphere);
+
+	void DrawCasters(WGPURenderPassEncoder renderPass, const ArenaVector_t<Mesh_t*>& casters, const ShadowTile_t& tile);
+	void SetTileViewport(WGPURenderPassEncoder renderPass, const ShadowTile_t& tile);
+
+public:
+	void Init(GraphicsDevice_t* gpu);
+
+	// Casters are gathered every frame, like draws
+	void ClearCasters();
+	void AddCaster(Mesh_t* mesh, bool isStatic);
+
+	// Assign tiles, work out which cached tiles are stale, and fill in ShadowIndex for every light
+	void Update(const std::vector<Light_t>& lights, std::vector<GpuLight_t>& gpuLights, Camera_t& camera);
+
+	// Add the shadow passes; returns the atlas the shading passes should sample
+	FrameGraphResource_t AddPasses(FrameGraph_t& graph);
+
+	// Whichever atlas holds the final shadows this frame; changes only when dynamic casters come and go
+	WGPUTextureView GetSampledView()							{ return DynamicCasters.empty() ? StaticAtlasView : DynamicAtlasView; }
+	WGPUSampler GetSampler()									{ return ComparisonSampler; }
+	GraphicsBuffer_t& GetShadowInfoBuffer()						{ return ShadowInfoBuffer; }
+
+	void Destroy();
+};
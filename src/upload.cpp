@@ -0,0 +1,247 @@
+#include "upload.hpp"
+#include "frames.hpp"
+#include "resources.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+static uint64_t AlignUp(uint64_t value, uint64_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+void UploadManager_t::CreateChunkBuffer(Chunk_t& chunk)
+{
+	Resources::Release(chunk.Buffer);
+
+	WGPUBufferDescriptor chunkDesc = {
+		.nextInChain = nullptr,
+		.label = "Upload staging chunk",
+		.usage = WGPUBufferUsage_MapWrite | WGPUBufferUsage_CopySrc,
+		.size = ChunkSize,
+		.mappedAtCreation = true
+	};
+
+	chunk.Buffer = Resources::Track(wgpuDeviceCreateBuffer(Gpu->Device, &chunkDesc), chunkDesc.label, MemoryCategory_t::Staging, ChunkSize);
+	chunk.Data = (uint8_t*)wgpuBufferGetMappedRange(chunk.Buffer, 0, ChunkSize);
+	chunk.Used = 0;
+	chunk.State = ChunkState_t::Free;
+}
+
+UploadManager_t::Chunk_t* UploadManager_t::AcquireChunk()
+{
+	for (;;)
+	{
+		for (std::unique_ptr<Chunk_t>& chunk : Chunks)
+		{
+			if (chunk->State != ChunkState_t::Free)
+				continue;
+
+			// Its map failed, start over with a new buffer
+			if (!chunk->Data)
+				CreateChunkBuffer(*chunk);
+
+			return chunk.get();
+		}
+
+		if (Chunks.size() < MaxChunkCount)
+		{
+			std::unique_ptr<Chunk_t> chunk = std::make_unique<Chunk_t>();
+			CreateChunkBuffer(*chunk);
+
+			Chunks.push_back(std::move(chunk));
+			return Chunks.back().get();
+		}
+
+		// Out of staging memory: send off what's there and wait for the GPU to hand a chunk back
+		Flush();
+
+		Gpu->Frames->WaitUntil([this]()
+			{
+				return std::any_of(Chunks.begin(), Chunks.end(), [](const std::unique_ptr<Chunk_t>& chunk) { return chunk->State == ChunkState_t::Free; });
+			});
+	}
+}
+
+uint64_t UploadManager_t::Allocate(uint64_t size, uint64_t granularity, Chunk_t*& chunk, uint64_t& offset)
+{
+	assert(granularity > 0 && granularity <= ChunkSize);
+
+	for (;;)
+	{
+		if (Current)
+		{
+			uint64_t start = AlignUp(Current->Used, OffsetAlignment);
+			uint64_t available = start < ChunkSize ? (ChunkSize - start) / granularity * granularity : 0;
+
+			if (available > 0)
+			{
+				uint64_t allocated = std::min(size, available);
+
+				Current->Used = start + allocated;
+				Current->State = ChunkState_t::Filling;
+
+				chunk = Current;
+				offset = start;
+				return allocated;
+			}
+		}
+
+		Current = AcquireChunk();
+	}
+}
+
+WGPUCommandEncoder UploadManager_t::GetEncoder()
+{
+	if (!Encoder)
+	{
+		WGPUCommandEncoderDescriptor encoderDesc = {
+			.nextInChain = nullptr,
+			.label = "Upload encoder"
+		};
+
+		Encoder = wgpuDeviceCreateCommandEncoder(Gpu->Device, &encoderDesc);
+	}
+
+	return Encoder;
+}
+
+void UploadManager_t::UploadBuffer(WGPUBuffer destination, uint64_t offset, const void* data, uint64_t size)
+{
+	assert(offset % 4 == 0 && size % 4 == 0);
+
+	const uint8_t* source = (const uint8_t*)data;
+
+	while (size > 0)
+	{
+		Chunk_t* chunk;
+		uint64_t stagingOffset;
+		uint64_t copySize = Allocate(size, 4, chunk, stagingOffset);
+
+		memcpy(chunk->Data + stagingOffset, source, copySize);
+		wgpuCommandEncoderCopyBufferToBuffer(GetEncoder(), chunk->Buffer, stagingOffset, destination, offset, copySize);
+
+		source += copySize;
+		offset += copySize;
+		size -= copySize;
+	}
+}
+
+void UploadManager_t::UploadTexture(const WGPUImageCopyTexture& destination, const void* data, uint32_t bytesPerRow, uint32_t rowsPerImage, const WGPUExtent3D& size)
+{
+	uint32_t rowPitch = (uint32_t)AlignUp(bytesPerRow, RowPitchAlignment);
+	assert(rowPitch <= ChunkSize && "A single texture row doesn't fit a staging chunk");
+
+	const uint8_t* source = (const uint8_t*)data;
+
+	//
+	// Layer by layer, as many rows at a time as the current chunk has room for
+	//
+	for (uint32_t layer = 0; layer < size.depthOrArrayLayers; ++layer)
+	{
+		const uint8_t* layerSource = source + (size_t)layer * rowsPerImage * bytesPerRow;
+		uint32_t row = 0;
+
+		while (row < size.height)
+		{
+			Chunk_t* chunk;
+			uint64_t stagingOffset;
+			uint32_t rowCount = (uint32_t)(Allocate((uint64_t)(size.height - row) * rowPitch, rowPitch, chunk, stagingOffset) / rowPitch);
+
+			for (uint32_t i = 0; i < rowCount; ++i)
+				memcpy(chunk->Data + stagingOffset + (size_t)i * rowPitch, layerSource + (size_t)(row + i) * bytesPerRow, bytesPerRow);
+
+			WGPUImageCopyBuffer copySource = {
+				.nextInChain = nullptr,
+				.layout = {
+					.nextInChain = nullptr,
+					.offset = stagingOffset,
+					.bytesPerRow = rowPitch,
+					.rowsPerImage = rowCount
+				},
+				.buffer = chunk->Buffer
+			};
+
+			WGPUImageCopyTexture copyDestination = destination;
+			copyDestination.origin.y += row;
+			copyDestination.origin.z += layer;
+
+			WGPUExtent3D copySize = { size.width, rowCount, 1 };
+
+			wgpuCommandEncoderCopyBufferToTexture(GetEncoder(), &copySource, &copyDestination, &copySize);
+
+			row += rowCount;
+		}
+	}
+}
+
+void UploadManager_t::OnChunkMapped(WGPUBufferMapAsyncStatus status, void* userData)
+{
+	Chunk_t* chunk = (Chunk_t*)userData;
+
+	// A failed map leaves the data null, and the chunk gets a new buffer the next time it's picked
+	if (status == WGPUBufferMapAsyncStatus_Success)
+		chunk->Data = (uint8_t*)wgpuBufferGetMappedRange(chunk->Buffer, 0, ChunkSize);
+
+	chunk->Used = 0;
+	chunk->State = ChunkState_t::Free;
+}
+
+void UploadManager_t::Flush()
+{
+	if (!Encoder)
+		return;
+
+	//
+	// Staging memory has to be unmapped before the GPU may read it
+	//
+	std::vector<Chunk_t*> batch = {};
+
+	for (std::unique_ptr<Chunk_t>& chunk : Chunks)
+	{
+		if (chunk->State != ChunkState_t::Filling)
+			continue;
+
+		wgpuBufferUnmap(chunk->Buffer);
+		chunk->Data = nullptr;
+		chunk->State = ChunkState_t::InFlight;
+
+		batch.push_back(chunk.get());
+	}
+
+	WGPUCommandBufferDescriptor cmdBufferDescriptor = {
+		.nextInChain = nullptr,
+		.label = "Upload command buffer"
+	};
+	WGPUCommandBuffer commands = wgpuCommandEncoderFinish(Encoder, &cmdBufferDescriptor);
+
+	wgpuQueueSubmit(Gpu->Queue, 1, &commands);
+
+	wgpuCommandBufferRelease(commands);
+	wgpuCommandEncoderRelease(Encoder);
+	Encoder = nullptr;
+	Current = nullptr;
+
+	// These only complete once the copies above are done
+	for (Chunk_t* chunk : batch)
+		wgpuBufferMapAsync(chunk->Buffer, WGPUMapMode_Write, 0, ChunkSize, OnChunkMapped, chunk);
+}
+
+void UploadManager_t::Destroy()
+{
+	Flush();
+
+	// Wait for the map callbacks, they point at the chunks
+	auto isInFlight = [](const std::unique_ptr<Chunk_t>& chunk) { return chunk->State == ChunkState_t::InFlight; };
+
+	Gpu->Frames->WaitUntil([this, isInFlight]() { return std::none_of(Chunks.begin(), Chunks.end(), isInFlight); });
+
+	for (std::unique_ptr<Chunk_t>& chunk : Chunks)
+	{
+		Resources::Release(chunk->Buffer);
+	}
+
+	Chunks.clear();
+	Current = nullptr;
+}
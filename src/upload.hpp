@@ -0,0 +1,81 @@
+#pragma once
+
+#include "gpu.hpp"
+
+#include <webgpu/webgpu.h>
+
+#include <memory>
+#include <vector>
+
+/*
+ * Buffer and texture uploads through a ring of staging buffers.
+ *
+ * Data gets copied into mapped staging chunks and the copies into place are recorded into one command
+ * encoder, submitted in a single batch by Flush. Right after that every chunk of the batch is mapped
+ * again; WebGPU only completes that map once the GPU is done copying out of it, so the map callback
+ * is what hands a chunk back to the ring. Uploads larger than a chunk are split over several, which
+ * keeps staging memory at MaxChunkCount chunks no matter how much gets uploaded.
+ *
+ * Texture rows are padded to the 256 byte bytesPerRow alignment buffer to texture copies require.
+ */
+struct UploadManager_t
+{
+public:
+	static constexpr uint64_t ChunkSize							= 4 * 1024 * 1024;
+
+	// Running out flushes and waits for the GPU to give a chunk back
+	static constexpr uint32_t MaxChunkCount						= 16;
+
+	// Staging offsets start here; covers the texel block alignment of texture copies as well
+	static constexpr uint64_t OffsetAlignment					= 256;
+	static constexpr uint32_t RowPitchAlignment					= 256;
+
+private:
+	enum class ChunkState_t
+	{
+		Free,		// Mapped and empty
+		Filling,	// Mapped, part of the batch that hasn't been flushed yet
+		InFlight	// Unmapped for the GPU, coming back through MapAsync
+	};
+
+	struct Chunk_t
+	{
+		WGPUBuffer Buffer										= nullptr;
+		uint8_t* Data											= nullptr;
+		uint64_t Used											= 0;
+		ChunkState_t State										= ChunkState_t::Free;
+	};
+
+	GraphicsDevice_t* Gpu										= nullptr;
+
+	// Chunks hand their address to MapAsync, so they can't move
+	std::vector<std::unique_ptr<Chunk_t>> Chunks				= {};
+	Chunk_t* Current											= nullptr;
+
+	// Copies of the current batch
+	WGPUCommandEncoder Encoder									= nullptr;
+
+	void CreateChunkBuffer(Chunk_t& chunk);
+	Chunk_t* AcquireChunk();
+
+	// Room for up to size bytes in whole multiples of granularity; returns how much it got
+	uint64_t Allocate(uint64_t size, uint64_t granularity, Chunk_t*& chunk, uint64_t& offset);
+
+	WGPUCommandEncoder GetEncoder();
+
+	static void OnChunkMapped(WGPUBufferMapAsyncStatus status, void* userData);
+
+public:
+	void Init(GraphicsDevice_t* gpu)							{ Gpu = gpu; }
+
+	// Offset and size must be multiples of 4
+	void UploadBuffer(WGPUBuffer destination, uint64_t offset, const void* data, uint64_t size);
+
+	// Same layout rules as wgpuQueueWriteTexture; rows of data are tightly packed at bytesPerRow
+	void UploadTexture(const WGPUImageCopyTexture& destination, const void* data, uint32_t bytesPerRow, uint32_t rowsPerImage, const WGPUExtent3D& size);
+
+	// Submit the batch; anything submitted after this sees the uploads
+	void Flush();
+
+	void Destroy();
+};
@@ -0,0 +1,598 @@
+#include "visibility.hpp"
+#include "lighting.hpp"
+#include "renderqueue.hpp"
+#include "resources.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <string>
+
+static_assert(sizeof(Vertex_t) == 11 * sizeof(float), "Vertex_t must match VertexStride in the WGSL source");
+
+// Shared by both shaders, TriangleBits gets prepended from the C++ side
+static const char* VisibilityCommonSource = R"(
+	struct UniformBuffer {
+		modelMatrix: mat4x4f,
+		normalMatrix: mat4x4f,
+		instanceId: u32
+	};
+
+	struct CameraUniforms {
+		viewProjMatrix: mat4x4f,
+		cameraPosition: vec3f
+	};
+
+	const TriangleMask: u32 = (1u << TriangleBits) - 1u;
+
+	// Vertex_t as floats: position (3), uv (2), normal (3), tangent (3)
+	const VertexStride: u32 = 11u;
+
+	@group(0) @binding(0) var<uniform> uConstants: UniformBuffer;
+	@group(0) @binding(1) var<uniform> uCamera: CameraUniforms;
+)";
+
+static const char* GeometryShaderSource = R"(
+	@group(1) @binding(0) var<storage, read> indices: array<u32>;
+	@group(1) @binding(1) var<storage, read> vertices: array<f32>;
+
+	struct VisibilityOutput {
+		@builtin(position) position: vec4f,
+		@location(0) @interpolate(flat) triangleId: u32
+	};
+
+	// Drawn without an index buffer so that vertex_index / 3 is the triangle ID
+	@vertex
+	fn vs_visibility(@builtin(vertex_index) vertexIndex: u32) -> VisibilityOutput
+	{
+		let base: u32 = indices[vertexIndex] * VertexStride;
+		let position: vec3f = vec3f(vertices[base], vertices[base + 1u], vertices[base + 2u]);
+
+		var out: VisibilityOutput;
+		out.position = uCamera.viewProjMatrix * uConstants.modelMatrix * vec4f(position, 1.0);
+		out.triangleId = vertexIndex / 3u;
+
+		return out;
+	}
+
+	@fragment
+	fn fs_visibility(in: VisibilityOutput) -> @location(0) u32
+	{
+		return ((uConstants.instanceId + 1u) << TriangleBits) | (in.triangleId & TriangleMask);
+	}
+)";
+
+static const char* ResolveShaderSource = R"(
+	@group(1) @binding(0) var mainSampler: sampler;
+	@group(1) @binding(1) var colorTexture: texture_2d<f32>;
+	@group(1) @binding(2) var aoTexture: texture_2d<f32>;
+	@group(1) @binding(3) var emissiveTexture: texture_2d<f32>;
+	@group(1) @binding(4) var metalRoughnessTexture: texture_2d<f32>;
+	@group(1) @binding(5) var normalTexture: texture_2d<f32>;
+
+	@group(3) @binding(0) var visibilityBuffer: texture_2d<u32>;
+	@group(3) @binding(1) var<storage, read> indices: array<u32>;
+	@group(3) @binding(2) var<storage, read> vertices: array<f32>;
+
+	struct Vertex {
+		position: vec3f,
+		uv: vec2f,
+		normal: vec3f,
+		tangent: vec3f
+	};
+
+	fn LoadVertex(index: u32) -> Vertex
+	{
+		let base: u32 = index * VertexStride;
+
+		var vertex: Vertex;
+		vertex.position = vec3f(vertices[base], vertices[base + 1u], vertices[base + 2u]);
+		vertex.uv = vec2f(vertices[base + 3u], vertices[base + 4u]);
+		vertex.normal = vec3f(vertices[base + 5u], vertices[base + 6u], vertices[base + 7u]);
+		vertex.tangent = vec3f(vertices[base + 8u], vertices[base + 9u], vertices[base + 10u]);
+
+		return vertex;
+	}
+
+	// Perspective-correct barycentrics at a pixel, plus how they change one pixel right and one pixel down
+	struct Barycentrics {
+		lambda: vec3f,
+		ddx: vec3f,
+		ddy: vec3f
+	};
+
+	fn ComputeBarycentrics(c0: vec4f, c1: vec4f, c2: vec4f, ndc: vec2f, screenSize: vec2f) -> Barycentrics
+	{
+		let invW: vec3f = 1.0 / vec3f(c0.w, c1.w, c2.w);
+
+		let ndc0: vec2f = c0.xy * invW.x;
+		let ndc1: vec2f = c1.xy * invW.y;
+		let ndc2: vec2f = c2.xy * invW.z;
+
+		let invDet: f32 = 1.0 / determinant(mat2x2f(ndc2 - ndc1, ndc0 - ndc1));
+
+		// Gradients of lambda / w per NDC unit
+		var ddx: vec3f = vec3f(ndc1.y - ndc2.y, ndc2.y - ndc0.y, ndc0.y - ndc1.y) * invDet * invW;
+		var ddy: vec3f = vec3f(ndc2.x - ndc1.x, ndc0.x - ndc2.x, ndc1.x - ndc0.x) * invDet * invW;
+		var ddxSum: f32 = dot(ddx, vec3f(1.0));
+		var ddySum: f32 = dot(ddy, vec3f(1.0));
+
+		let delta: vec2f = ndc - ndc0;
+		let interpInvW: f32 = invW.x + delta.x * ddxSum + delta.y * ddySum;
+		let interpW: f32 = 1.0 / interpInvW;
+
+		var out: Barycentrics;
+		out.lambda = vec3f(
+			interpW * (invW.x + delta.x * ddx.x + delta.y * ddy.x),
+			interpW * (delta.x * ddx.y + delta.y * ddy.y),
+			interpW * (delta.x * ddx.z + delta.y * ddy.z));
+
+		// One pixel in NDC, y flipped
+		let pixelSize: vec2f = vec2f(2.0, -2.0) / screenSize;
+		ddx *= pixelSize.x;
+		ddy *= pixelSize.y;
+		ddxSum *= pixelSize.x;
+		ddySum *= pixelSize.y;
+
+		let interpWDdx: f32 = 1.0 / (interpInvW + ddxSum);
+		let interpWDdy: f32 = 1.0 / (interpInvW + ddySum);
+
+		out.ddx = interpWDdx * (out.lambda * interpInvW + ddx) - out.lambda;
+		out.ddy = interpWDdy * (out.lambda * interpInvW + ddy) - out.lambda;
+
+		return out;
+	}
+
+	fn Interpolate2(b: vec3f, a0: vec2f, a1: vec2f, a2: vec2f) -> vec2f
+	{
+		return a0 * b.x + a1 * b.y + a2 * b.z;
+	}
+
+	fn Interpolate3(b: vec3f, a0: vec3f, a1: vec3f, a2: vec3f) -> vec3f
+	{
+		return a0 * b.x + a1 * b.y + a2 * b.z;
+	}
+
+	@vertex
+	fn vs_resolve(@builtin(vertex_index) vertexIndex: u32) -> @builtin(position) vec4f
+	{
+		let uv = vec2f(f32((vertexIndex << 1u) & 2u), f32(vertexIndex & 2u));
+		return vec4f(uv * 2.0 - 1.0, 0.0, 1.0);
+	}
+
+	@fragment
+	fn fs_resolve(@builtin(position) fragCoord: vec4f) -> @location(0) vec4f
+	{
+		let visibility: u32 = textureLoad(visibilityBuffer, vec2i(fragCoord.xy), 0).r;
+
+		// Another mesh (or nothing) covers this pixel
+		if ((visibility >> TriangleBits) != uConstants.instanceId + 1u)
+		{
+			discard;
+		}
+
+		let triangleId: u32 = visibility & TriangleMask;
+
+		let v0: Vertex = LoadVertex(indices[triangleId * 3u]);
+		let v1: Vertex = LoadVertex(indices[triangleId * 3u + 1u]);
+		let v2: Vertex = LoadVertex(indices[triangleId * 3u + 2u]);
+
+		let modelViewProj: mat4x4f = uCamera.viewProjMatrix * uConstants.modelMatrix;
+		let c0: vec4f = modelViewProj * vec4f(v0.position, 1.0);
+		let c1: vec4f = modelViewProj * vec4f(v1.position, 1.0);
+		let c2: vec4f = modelViewProj * vec4f(v2.position, 1.0);
+
+		let screenSize: vec2f = vec2f(textureDimensions(visibilityBuffer));
+		let ndc: vec2f = (fragCoord.xy / screenSize) * vec2f(2.0, -2.0) + vec2f(-1.0, 1.0);
+
+		let b: Barycentrics = ComputeBarycentrics(c0, c1, c2, ndc, screenSize);
+
+		// Neighbouring pixels can belong to other triangles, so sample with analytic gradients
+		let uv: vec2f = Interpolate2(b.lambda, v0.uv, v1.uv, v2.uv);
+		let uvDdx: vec2f = Interpolate2(b.ddx, v0.uv, v1.uv, v2.uv);
+		let uvDdy: vec2f = Interpolate2(b.ddy, v0.uv, v1.uv, v2.uv);
+
+		let normalMap: vec3f = textureSampleGrad(normalTexture, mainSampler, uv, uvDdx, uvDdy).rgb;
+		let tangentNormal: vec3f = normalMap * 2.0 - 1.0;
+
+		let N = normalize((uConstants.normalMatrix * vec4f(Interpolate3(b.lambda, v0.normal, v1.normal, v2.normal), 0.0)).xyz);
+		let T = normalize((uConstants.modelMatrix * vec4f(Interpolate3(b.lambda, v0.tangent, v1.tangent, v2.tangent), 0.0)).xyz);
+		let B = normalize(cross(N, T));
+		let TBN = mat3x3f(T, B, N);
+
+		let textureColor: vec4f = textureSampleGrad(colorTexture, mainSampler, uv, uvDdx, uvDdy);
+		let emissiveColor: vec4f = textureSampleGrad(emissiveTexture, mainSampler, uv, uvDdx, uvDdy);
+		let aoColor: vec4f = textureSampleGrad(aoTexture, mainSampler, uv, uvDdx, uvDdy);
+		let metalRoughness: vec4f = textureSampleGrad(metalRoughnessTexture, mainSampler, uv, uvDdx, uvDdy);
+
+		let position: vec3f = Interpolate3(b.lambda, v0.position, v1.position, v2.position);
+
+		var surface: Surface;
+		surface.position = (uConstants.modelMatrix * vec4f(position, 1.0)).xyz;
+		surface.normal = normalize(TBN * tangentNormal);
+		surface.baseColor = textureColor.rgb;
+		surface.emissive = emissiveColor.rgb;
+		surface.ao = aoColor.r;
+		surface.metalness = metalRoughness.b;
+		surface.roughness = metalRoughness.g;
+
+		return vec4f(ShadeSurface(surface, fragCoord.xy, uCamera.cameraPosition), 1.0);
+	}
+)";
+
+static std::string GetCommonSource()
+{
+	return "const TriangleBits: u32 = " + std::to_string(VisibilityRenderer_t::TriangleBits) + "u;\n" + VisibilityCommonSource;
+}
+
+void VisibilityRenderer_t::Init(GraphicsDevice_t* gpu, WGPUTextureFormat outputFormat, WGPUTextureFormat depthFormat)
+{
+	Gpu = gpu;
+
+	//
+	// Mesh geometry layout: indices and vertices, read by the vertex stage
+	//
+	WGPUBindGroupLayoutEntry geometryBindingLayouts[2] = {};
+
+	for (uint32_t i = 0; i < 2; ++i)
+	{
+		WGPUBindGroupLayoutEntry& bindingLayout = geometryBindingLayouts[i];
+		SetDefaultBindGroupLayoutEntry(bindingLayout);
+		bindingLayout.binding = i;
+		bindingLayout.visibility = WGPUShaderStage_Vertex;
+		bindingLayout.buffer.type = WGPUBufferBindingType_ReadOnlyStorage;
+	}
+
+	WGPUBindGroupLayoutDescriptor geometryBindGroupLayoutDesc = {
+		.nextInChain = nullptr,
+		.label = "Mesh geometry bind group layout",
+		.entryCount = 2,
+		.entries = geometryBindingLayouts
+	};
+
+	gpu->MeshGeometryBindGroupLayout = Resources::Track(wgpuDeviceCreateBindGroupLayout(gpu->Device, &geometryBindGroupLayoutDesc), geometryBindGroupLayoutDesc.label);
+
+	//
+	// Resolve layout: the visibility buffer plus the same geometry, read by the fragment stage
+	//
+	WGPUBindGroupLayoutEntry resolveBindingLayouts[3] = {};
+
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		WGPUBindGroupLayoutEntry& bindingLayout = resolveBindingLayouts[i];
+		SetDefaultBindGroupLayoutEntry(bindingLayout);
+		bindingLayout.binding = i;
+		bindingLayout.visibility = WGPUShaderStage_Fragment;
+
+		if (i == 0)
+		{
+			bindingLayout.texture.sampleType = WGPUTextureSampleType_Uint;
+			bindingLayout.texture.viewDimension = WGPUTextureViewDimension_2D;
+		}
+		else
+		{
+			bindingLayout.buffer.type = WGPUBufferBindingType_ReadOnlyStorage;
+		}
+	}
+
+	WGPUBindGroupLayoutDescriptor resolveBindGroupLayoutDesc = {
+		.nextInChain = nullptr,
+		.label = "Visibility resolve bind group layout",
+		.entryCount = 3,
+		.entries = resolveBindingLayouts
+	};
+
+	ResolveBindGroupLayout = Resources::Track(wgpuDeviceCreateBindGroupLayout(gpu->Device, &resolveBindGroupLayoutDesc), resolveBindGroupLayoutDesc.label);
+
+	CreateGeometryPipeline(depthFormat);
+	CreateResolvePipeline(outputFormat);
+}
+
+void VisibilityRenderer_t::CreateGeometryPipeline(WGPUTextureFormat depthFormat)
+{
+	std::string source = GetCommonSource() + GeometryShaderSource;
+
+	WGPUShaderModule shaderModule = Graphics::MakeShaderModule(Gpu, source.c_str());
+
+	WGPUBindGroupLayout bindGroupLayouts[] = { Gpu->ObjectBindGroupLayout, Gpu->MeshGeometryBindGroupLayout };
+
+	WGPUPipelineLayoutDescriptor layoutDesc = {
+		.nextInChain = nullptr,
+		.bindGroupLayoutCount = 2,
+		.bindGroupLayouts = bindGroupLayouts
+	};
+
+	WGPUPipelineLayout layout = wgpuDeviceCreatePipelineLayout(Gpu->Device, &layoutDesc);
+
+	WGPUColorTargetState colorTarget = {
+		.format = VisibilityFormat,
+		.blend = nullptr,
+		.writeMask = WGPUColorWriteMask_All
+	};
+
+	WGPUFragmentState fragmentState = {
+		.module = shaderModule,
+		.entryPoint = "fs_visibility",
+		.constantCount = 0,
+		.constants = nullptr,
+		.targetCount = 1,
+		.targets = &colorTarget
+	};
+
+	WGPUDepthStencilState depthStencilState = {};
+	SetDefaultDepthStencilState(depthStencilState);
+	depthStencilState.depthCompare = WGPUCompareFunction_Less;
+	depthStencilState.depthWriteEnabled = true;
+	depthStencilState.format = depthFormat;
+	depthStencilState.stencilReadMask = 0;
+	depthStencilState.stencilWriteMask = 0;
+
+	WGPURenderPipelineDescriptor pipelineDesc = {
+		.nextInChain = nullptr,
+		.label = "Visibility pipeline",
+		.layout = layout,
+		.vertex = {
+			.module = shaderModule,
+			.entryPoint = "vs_visibility",
+			.constantCount = 0,
+			.constants = nullptr,
+			.bufferCount = 0,
+			.buffers = nullptr
+		},
+
+		.primitive = {
+			.topology = WGPUPrimitiveTopology_TriangleList,
+			.stripIndexFormat = WGPUIndexFormat_Undefined,
+			.frontFace = WGPUFrontFace_CCW,
+			.cullMode = WGPUCullMode_None
+		},
+
+		.depthStencil = &depthStencilState,
+		.multisample = {
+			.count = 1,
+			.mask = ~0u,
+			.alphaToCoverageEnabled = false
+		},
+		.fragment = &fragmentState
+	};
+
+	GeometryPipeline = Resources::Track(wgpuDeviceCreateRenderPipeline(Gpu->Device, &pipelineDesc), pipelineDesc.label);
+
+	wgpuPipelineLayoutRelease(layout);
+	wgpuShaderModuleRelease(shaderModule);
+}
+
+void VisibilityRenderer_t::CreateResolvePipeline(WGPUTextureFormat outputFormat)
+{
+	std::string source = std::string(Lighting_t::GetShaderSource()) + GetCommonSource() + ResolveShaderSource;
+
+	WGPUShaderModule shaderModule = Graphics::MakeShaderModule(Gpu, source.c_str());
+
+	WGPUBindGroupLayout bindGroupLayouts[] = {
+		Gpu->ObjectBindGroupLayout,
+		Gpu->MaterialBindGroupLayout,
+		Gpu->LightingBindGroupLayout,
+		ResolveBindGroupLayout
+	};
+
+	WGPUPipelineLayoutDescriptor layoutDesc = {
+		.nextInChain = nullptr,
+		.bindGroupLayoutCount = 4,
+		.bindGroupLayouts = bindGroupLayouts
+	};
+
+	WGPUPipelineLayout layout = wgpuDeviceCreatePipelineLayout(Gpu->Device, &layoutDesc);
+
+	WGPUColorTargetState colorTarget = {
+		.format = outputFormat,
+		.blend = nullptr,
+		.writeMask = WGPUColorWriteMask_All
+	};
+
+	WGPUFragmentState fragmentState = {
+		.module = shaderModule,
+		.entryPoint = "fs_resolve",
+		.constantCount = 0,
+		.constants = nullptr,
+		.targetCount = 1,
+		.targets = &colorTarget
+	};
+
+	WGPURenderPipelineDescriptor pipelineDesc = {
+		.nextInChain = nullptr,
+		.label = "Visibility resolve pipeline",
+		.layout = layout,
+		.vertex = {
+			.module = shaderModule,
+			.entryPoint = "vs_resolve",
+			.constantCount = 0,
+			.constants = nullptr,
+			.bufferCount = 0,
+			.buffers = nullptr
+		},
+
+		.primitive = {
+			.topology = WGPUPrimitiveTopology_TriangleList,
+			.stripIndexFormat = WGPUIndexFormat_Undefined,
+			.frontFace = WGPUFrontFace_CCW,
+			.cullMode = WGPUCullMode_None
+		},
+
+		.depthStencil = nullptr,
+		.multisample = {
+			.count = 1,
+			.mask = ~0u,
+			.alphaToCoverageEnabled = false
+		},
+		.fragment = &fragmentState
+	};
+
+	ResolvePipeline = Resources::Track(wgpuDeviceCreateRenderPipeline(Gpu->Device, &pipelineDesc), pipelineDesc.label);
+
+	wgpuPipelineLayoutRelease(layout);
+	wgpuShaderModuleRelease(shaderModule);
+}
+
+bool VisibilityRenderer_t::GetScissorRect(Mesh_t& mesh, const glm::mat4& viewProjMatrix, uint32_t width, uint32_t height,
+	uint32_t& x, uint32_t& y, uint32_t& rectWidth, uint32_t& rectHeight)
+{
+	glm::mat4 modelViewProjMatrix = viewProjMatrix * mesh.GetModelMatrix();
+
+	float minX = FLT_MAX, minY = FLT_MAX;
+	float maxX = -FLT_MAX, maxY = -FLT_MAX;
+
+	for (uint32_t i = 0; i < 8; ++i)
+	{
+		glm::vec3 corner = glm::vec3(
+			(i & 1) ? mesh.BoundsMax.x : mesh.BoundsMin.x,
+			(i & 2) ? mesh.BoundsMax.y : mesh.BoundsMin.y,
+			(i & 4) ? mesh.BoundsMax.z : mesh.BoundsMin.z);
+
+		glm::vec4 clip = modelViewProjMatrix * glm::vec4(corner, 1.0f);
+
+		// A corner behind the camera flips when projected, so just cover the whole screen
+		if (clip.w <= 0.0f)
+		{
+			x = 0;
+			y = 0;
+			rectWidth = width;
+			rectHeight = height;
+			return true;
+		}
+
+		minX = std::min(minX, clip.x / clip.w);
+		minY = std::min(minY, clip.y / clip.w);
+		maxX = std::max(maxX, clip.x / clip.w);
+		maxY = std::max(maxY, clip.y / clip.w);
+	}
+
+	// NDC to pixels, y down
+	float left = std::clamp(std::floor((minX * 0.5f + 0.5f) * width), 0.0f, (float)width);
+	float right = std::clamp(std::ceil((maxX * 0.5f + 0.5f) * width), 0.0f, (float)width);
+	float top = std::clamp(std::floor((0.5f - maxY * 0.5f) * height), 0.0f, (float)height);
+	float bottom = std::clamp(std::ceil((0.5f - minY * 0.5f) * height), 0.0f, (float)height);
+
+	if (right <= left || bottom <= top)
+		return false;
+
+	x = (uint32_t)left;
+	y = (uint32_t)top;
+	rectWidth = (uint32_t)(right - left);
+	rectHeight = (uint32_t)(bottom - top);
+
+	return true;
+}
+
+void VisibilityRenderer_t::AddPasses(FrameGraph_t& graph, RenderQueue_t& queue, Camera_t& camera, Lighting_t& lighting, const LightingResources_t& lightingResources,
+	FrameGraphResource_t output, FrameGraphResource_t depth)
+{
+	const FrameGraphTextureDesc_t& depthDesc = graph.GetTextureDesc(depth);
+
+	FrameGraphResource_t visibilityBuffer = graph.CreateTexture("Visibility buffer", {
+		.Width = depthDesc.Width,
+		.Height = depthDesc.Height,
+		.Format = VisibilityFormat,
+		.Usage = WGPUTextureUsage_RenderAttachment | WGPUTextureUsage_TextureBinding
+	});
+
+	//
+	// Visibility
+	//
+	graph.AddPass("Visibility pass", FrameGraphPassType_t::Render, [&queue](FrameGraphContext_t& context)
+		{
+			queue.Execute(context.Gpu, context.RenderPass, DrawPass_t::Visibility);
+		})
+		.WriteColor(visibilityBuffer, WGPULoadOp_Clear, { 0.0, 0.0, 0.0, 0.0 })
+		.WriteDepth(depth, WGPULoadOp_Clear, 1.0f);
+
+	//
+	// Resolve
+	//
+	glm::mat4 viewProjMatrix = camera.GetViewProjMatrix();
+	uint32_t width = depthDesc.Width;
+	uint32_t height = depthDesc.Height;
+
+	graph.AddPass("Visibility resolve", FrameGraphPassType_t::Render,
+		[this, &queue, &lighting, visibilityBuffer, viewProjMatrix, width, height](FrameGraphContext_t& context)
+		{
+			WGPUTextureView visibilityView = context.GetTextureView(visibilityBuffer);
+
+			wgpuRenderPassEncoderSetPipeline(context.RenderPass, ResolvePipeline);
+			wgpuRenderPassEncoderSetBindGroup(context.RenderPass, 2, lighting.GetBindGroup(), 0, nullptr);
+
+			for (const DrawPacket_t& packet : queue.GetDraws(DrawPass_t::Visibility))
+			{
+				Mesh_t& mesh = *packet.Mesh;
+
+				// Anything that doesn't fit was queued as an Opaque draw instead
+				assert(CanDraw(mesh));
+
+				uint32_t x, y, rectWidth, rectHeight;
+
+				if (!GetScissorRect(mesh, viewProjMatrix, width, height, x, y, rectWidth, rectHeight))
+					continue;
+
+				WGPUBindGroupEntry resolveBindings[3] = {};
+				resolveBindings[0].binding = 0;
+				resolveBindings[0].textureView = visibilityView;
+				resolveBindings[1].binding = 1;
+				resolveBindings[1].buffer = mesh.IndexBuffer.DataBuffer;
+				resolveBindings[1].size = mesh.IndexBuffer.Count * sizeof(unsigned int);
+				resolveBindings[2].binding = 2;
+				resolveBindings[2].buffer = mesh.VertexBuffer.DataBuffer;
+				resolveBindings[2].size = mesh.VertexBuffer.Count * sizeof(Vertex_t);
+
+				WGPUBindGroupDescriptor resolveBindGroupDesc = {
+					.nextInChain = nullptr,
+					.label = "Visibility resolve bind group",
+					.layout = ResolveBindGroupLayout,
+					.entryCount = 3,
+					.entries = resolveBindings
+				};
+
+				WGPUBindGroup resolveBindGroup = wgpuDeviceCreateBindGroup(context.Gpu->Device, &resolveBindGroupDesc);
+
+				uint32_t objectOffset = mesh.GetObjectOffset();
+
+				wgpuRenderPassEncoderSetScissorRect(context.RenderPass, x, y, rectWidth, rectHeight);
+				wgpuRenderPassEncoderSetBindGroup(context.RenderPass, 0, mesh.ObjectBindGroup, 1, &objectOffset);
+				wgpuRenderPassEncoderSetBindGroup(context.RenderPass, 1, packet.Material->BindGroup, 0, nullptr);
+				wgpuRenderPassEncoderSetBindGroup(context.RenderPass, 3, resolveBindGroup, 0, nullptr);
+				wgpuRenderPassEncoderDraw(context.RenderPass, 3, 1, 0, 0);
+
+				wgpuBindGroupRelease(resolveBindGroup);
+			}
+		})
+		.Read(visibilityBuffer)
+		.Read(lightingResources.ClusterLightCounts)
+		.Read(lightingResources.ClusterLightIndices)
+		.Read(lightingResources.ShadowAtlas)
+		.WriteColor(output, WGPULoadOp_Clear, { 0.0, 0.0, 0.0, 1.0 });
+
+	//
+	// Fallback: meshes the visibility buffer can't encode, depth tested against what the visibility pass wrote
+	//
+	if (queue.HasDraws(DrawPass_t::Opaque))
+	{
+		graph.AddPass("Visibility fallback pass", FrameGraphPassType_t::Render, [&queue](FrameGraphContext_t& context)
+			{
+				queue.Execute(context.Gpu, context.RenderPass, DrawPass_t::Opaque);
+			})
+			.Read(lightingResources.ClusterLightCounts)
+			.Read(lightingResources.ClusterLightIndices)
+			.Read(lightingResources.ShadowAtlas)
+			.WriteColor(output, WGPULoadOp_Load)
+			.WriteDepth(depth, WGPULoadOp_Load);
+	}
+}
+
+void VisibilityRenderer_t::Destroy()
+{
+	Resources::Release(ResolvePipeline);
+	Resources::Release(GeometryPipeline);
+	Resources::Release(ResolveBindGroupLayout);
+
+	if (Gpu)
+		Resources::Release(Gpu->MeshGeometryBindGroupLayout);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "gpu.hpp"
+#include "framegraph.hpp"
+
+#include <webgpu/webgpu.h>
+
+struct Lighting_t;
+struct LightingResources_t;
+
+/*
+ * Visibility buffer rendering: the geometry pass writes nothing but a 32-bit ID per pixel,
+ *   [31..23] instance ID + 1 (0 means nothing was drawn)
+ *   [22..0]  triangle ID
+ * and the resolve pass fetches that triangle's vertices back out of the mesh buffers, rebuilds
+ * perspective-correct barycentrics and UV derivatives analytically, and runs the material and the
+ * lights exactly once per pixel.
+ *
+ * There's no bindless in WebGPU, so the resolve is one full-screen draw per mesh, scissored to the mesh's
+ * screen bounds; pixels that belong to another mesh are rejected after a single texel load.
+ */
+struct VisibilityRenderer_t
+{
+public:
+	static constexpr WGPUTextureFormat VisibilityFormat			= WGPUTextureFormat_R32Uint;
+
+	static constexpr uint32_t TriangleBits						= 23;
+	static constexpr uint32_t MaxTriangles						= 1u << TriangleBits;
+	static constexpr uint32_t MaxInstances						= (1u << (32 - TriangleBits)) - 1;
+
+private:
+	GraphicsDevice_t* Gpu										= nullptr;
+
+	WGPUBindGroupLayout ResolveBindGroupLayout					= nullptr;
+	WGPURenderPipeline GeometryPipeline							= nullptr;
+	WGPURenderPipeline ResolvePipeline							= nullptr;
+
+	void CreateGeometryPipeline(WGPUTextureFormat depthFormat);
+	void CreateResolvePipeline(WGPUTextureFormat outputFormat);
+
+	// Pixel rect covered by the mesh's bounds, false if it's entirely off screen
+	static bool GetScissorRect(Mesh_t& mesh, const glm::mat4& viewProjMatrix, uint32_t width, uint32_t height,
+		uint32_t& x, uint32_t& y, uint32_t& rectWidth, uint32_t& rectHeight);
+
+public:
+	// Creates gpu->MeshGeometryBindGroupLayout, so it must run before any mesh is created
+	void Init(GraphicsDevice_t* gpu, WGPUTextureFormat outputFormat, WGPUTextureFormat depthFormat);
+
+	// Pipeline for the queue's Visibility draws
+	WGPURenderPipeline GetGeometryPipeline()					{ return GeometryPipeline; }
+
+	// Whether the mesh's instance and triangle IDs fit the visibility buffer; the rest have to be shaded forward
+	static bool CanDraw(const Mesh_t& mesh)						{ return mesh.InstanceId < MaxInstances && (uint32_t)mesh.IndexBuffer.Count / 3 <= MaxTriangles; }
+
+	// Visibility pass for the queue's Visibility draws, then the resolve into output, then the queue's
+	// Opaque draws forward on top
+	void AddPasses(FrameGraph_t& graph, RenderQueue_t& queue, Camera_t& camera, Lighting_t& lighting, const LightingResources_t& lightingResources,
+		FrameGraphResource_t output, FrameGraphResource_t depth);
+
+	void Destroy();
+};
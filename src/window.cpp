@@ -1,17 +1,33 @@
 #include "window.hpp"
+#include "jobs.hpp"
 
 #include <GLFW/glfw3.h>
 #include <iostream>
 #include <glfw3webgpu.h>
 #include <cassert>
+#include <thread>
 
 CWindow::CWindow()
 {
 	glfwInit();
 
-	// Non-resizable window
-	glfwWindowHint(GLFW_RESIZABLE, 0);
+	glfwWindowHint(GLFW_RESIZABLE, 1);
 	Window = glfwCreateWindow(Width, Height, Title.c_str(), nullptr, nullptr);
+
+	// Sizes are in pixels from here on, which is what the swap chain wants
+	glfwGetFramebufferSize(Window, &Width, &Height);
+
+	glfwSetWindowUserPointer(Window, this);
+	glfwSetFramebufferSizeCallback(Window, OnFramebufferResized);
+}
+
+void CWindow::OnFramebufferResized(GLFWwindow* window, int width, int height)
+{
+	CWindow* owner = (CWindow*)glfwGetWindowUserPointer(window);
+
+	// Only the event thread touches the size; the renderer sees it through the frame state and follows at its own pace
+	owner->Width = width;
+	owner->Height = height;
 }
 
 bool CWindow::ShouldWindowClose()
@@ -19,19 +35,92 @@ bool CWindow::ShouldWindowClose()
 	return glfwWindowShouldClose(Window);
 }
 
+void CWindow::PublishFrameState()
+{
+	FrameState_t& state = FrameStates.GetWriteSlot();
+	state.Index = NextFrameStateIndex++;
+	state.Time = glfwGetTime();
+
+	double cursorX, cursorY;
+	glfwGetCursorPos(Window, &cursorX, &cursorY);
+	state.CursorPosition = glm::vec2(cursorX, cursorY);
+
+	state.MouseButtons = 0;
+
+	for (int button = 0; button <= GLFW_MOUSE_BUTTON_LAST; ++button)
+	{
+		if (glfwGetMouseButton(Window, button) == GLFW_PRESS)
+			state.MouseButtons |= 1u << button;
+	}
+
+	state.WindowSize = glm::ivec2(Width, Height);
+
+	FrameStates.Publish();
+}
+
 void CWindow::Run()
+{
+	assert(FrameFunc != nullptr);
+
+	if (ThreadingMode == ThreadingMode_t::RenderThread)
+		RunWithRenderThread();
+	else
+		RunSingleThreaded();
+}
+
+void CWindow::RunSingleThreaded()
 {
 	while (!ShouldWindowClose())
 	{
+		if (FrameWaitFunc)
+			FrameWaitFunc(GraphicsDevice);
+
 		glfwPollEvents();
+		PublishFrameState();
 
 		//
 		// Render
 		//
-		assert(FrameFunc != nullptr);
+		FrameFunc(GraphicsDevice, FrameStates.Acquire());
+	}
+}
+
+void CWindow::RunWithRenderThread()
+{
+	std::atomic<bool> isRunning = true;
 
-		FrameFunc(GraphicsDevice);
+	// Make sure the first frame has something to read
+	PublishFrameState();
+
+	std::thread renderThread([this, &isRunning]()
+		{
+			// The render thread owns the device now, so it's the one that runs device-bound jobs
+			Jobs::SetMainThread();
+
+			while (isRunning.load(std::memory_order_acquire))
+			{
+				if (FrameWaitFunc)
+					FrameWaitFunc(GraphicsDevice);
+
+				FrameFunc(GraphicsDevice, FrameStates.Acquire());
+			}
+		});
+
+	//
+	// Events; GLFW only allows this on the main thread. A slow frame no longer holds up input, and the
+	// frame always picks up the latest state without waiting for us
+	//
+	while (!ShouldWindowClose())
+	{
+		glfwWaitEventsTimeout(EventPollInterval);
+		PublishFrameState();
 	}
+
+	isRunning.store(false, std::memory_order_release);
+	renderThread.join();
+
+	// Teardown happens back here
+	Jobs::SetMainThread();
 }
 
 WGPUSurface CWindow::CreateSurface(WGPUInstance instance)
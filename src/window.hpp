@@ -3,11 +3,83 @@
 #include <glm/glm.hpp>
 
 #include <webgpu/webgpu.h>
+
+#include <atomic>
+#include <cstdint>
 #include <string>
 
 struct GraphicsDevice_t;
 struct GLFWwindow;
 
+enum class ThreadingMode_t
+{
+	SingleThreaded,	// Events and frames take turns on the main thread
+	RenderThread	// The main thread only handles events, frames run on a thread of their own
+};
+
+/*
+ * Input and window state as of one event poll, handed from the event thread to the frame
+ */
+struct FrameState_t
+{
+	// Increments with every poll
+	uint64_t Index												= 0;
+
+	// Seconds since the window was created
+	double Time													= 0.0;
+
+	glm::vec2 CursorPosition									= {};
+
+	// Bit per GLFW mouse button
+	uint32_t MouseButtons										= 0;
+
+	// Framebuffer size in pixels, zero while minimized
+	glm::ivec2 WindowSize										= {};
+};
+
+/*
+ * Lock-free single producer, single consumer handoff of the latest value.
+ *
+ * Three slots: the writer fills its own, then swaps it with the shared one; the reader swaps the shared
+ * slot with its own whenever something new was published. Neither side ever waits, and the reader
+ * always sees the most recent complete value.
+ */
+template <typename T>
+struct TripleBuffer_t
+{
+private:
+	// The low bits of Shared index the shared slot; this bit says the reader hasn't picked it up yet
+	static constexpr uint8_t FreshBit							= 4;
+
+	T Slots[3]													= {};
+
+	std::atomic<uint8_t> Shared									= 1;
+	uint8_t WriteIndex											= 0;
+	uint8_t ReadIndex											= 2;
+
+public:
+	// Must be filled in completely, it holds an older value
+	T& GetWriteSlot()											{ return Slots[WriteIndex]; }
+
+	void Publish()
+	{
+		uint8_t previous = Shared.exchange(WriteIndex | FreshBit, std::memory_order_acq_rel);
+		WriteIndex = previous & 3;
+	}
+
+	// The newest published value, or the same one as last time if nothing new came in
+	const T& Acquire()
+	{
+		if (Shared.load(std::memory_order_relaxed) & FreshBit)
+		{
+			uint8_t previous = Shared.exchange(ReadIndex, std::memory_order_acq_rel);
+			ReadIndex = previous & 3;
+		}
+
+		return Slots[ReadIndex];
+	}
+};
+
 /*
  * Creates and manages a window.
  */
@@ -25,10 +97,22 @@ private:
 	//
 	GraphicsDevice_t* GraphicsDevice							= nullptr;
 
+	ThreadingMode_t ThreadingMode								= ThreadingMode_t::SingleThreaded;
+
+	// Written by the event thread, read by whichever thread runs frames
+	TripleBuffer_t<FrameState_t> FrameStates					= {};
+	uint64_t NextFrameStateIndex								= 0;
+
+	// How long the event thread waits for events before publishing anyway, in seconds
+	static constexpr double EventPollInterval					= 0.001;
+
 	//
 	// Events
 	//
-	void (*FrameFunc)(GraphicsDevice_t*)						= nullptr;
+	void (*FrameFunc)(GraphicsDevice_t*, const FrameState_t&)	= nullptr;
+
+	// Optional; blocks until the next frame should start, called before its input is sampled
+	void (*FrameWaitFunc)(GraphicsDevice_t*)					= nullptr;
 
 	//
 	// GLFW
@@ -40,6 +124,15 @@ private:
 	// Should this window close?
 	bool ShouldWindowClose();
 
+	// Snapshot input and window state for the next frame
+	void PublishFrameState();
+
+	// Zero while minimized
+	static void OnFramebufferResized(GLFWwindow* window, int width, int height);
+
+	void RunSingleThreaded();
+	void RunWithRenderThread();
+
 public:
 	// Retrieve the window size
 	glm::ivec2 GetSize()										{ return glm::ivec2{ Width, Height }; }
@@ -57,7 +150,11 @@ public:
 	std::string GetTitle()										{ return Title; };
 
 	// Set a function that runs every frame
-	void SetFrameFunc(void (*func)(GraphicsDevice_t*))			{ FrameFunc = func; }
+	void SetFrameFunc(void (*func)(GraphicsDevice_t*, const FrameState_t&)) { FrameFunc = func; }
+	void SetFrameWaitFunc(void (*func)(GraphicsDevice_t*))		{ FrameWaitFunc = func; }
+
+	// Must be set before Run
+	void SetThreadingMode(ThreadingMode_t mode)					{ ThreadingMode = mode; }
 
 	// Run the application
 	void Run();